@@ -43,15 +43,11 @@ class PkAssemblyHandlers(ctx: ActorContext[TopLevelActorMessage], cswCtx: CswCon
   private val refFrameKey: Key[Choice] = KeyType.ChoiceKey.make("Refframe", "ICRS", "FK5", "AzEl")
 
   /**
-   * This helps in initializing TPK JNI Wrapper in separate thread, so that
+   * Initializes the TPK JNI Wrapper, which starts its own threads and returns, so that
    * New Target and Offset requests can be passed on to it
    */
   private def initiateTpkEndpoint(): Unit = {
-    new Thread(new Runnable() {
-      override def run(): Unit = {
-        tpkc.init()
-      }
-    }).start()
+    tpkc.init()
   }
 
   override def initialize(): Unit = {
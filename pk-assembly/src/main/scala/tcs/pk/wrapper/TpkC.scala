@@ -5,14 +5,26 @@ import TpkC._
 
 object TpkC {
 
-  // Matches C++ version in tpk-jni used to return coordinate positions
-  class CoordPair(runtime: Runtime) extends Struct(runtime) {
-    var a = new Double
-    var b = new Double
-  }
+  // Sizes in bytes of the C structs that are returned in direct memory (see TpkC.h in tpk-jni)
+  val CoordPairSize: Int  = 2 * 8
+  val PkDemandSize: Int   = 10 * 8
+  val PkVtDemandSize: Int = 5 * 8
+  val PkWeatherSize: Int  = 3 * 8
+
+  // The PkRefSys values used by the added virtual telescope commands
+  val PkIcrs: Int = 0
+  val PkFk5: Int  = 1
+  val PkAzEl: Int = 2
+
+  // PkVisibility: rise, set, transit, maxEl, numIntervals, reserved and the start and end of 8 intervals
+  val PkVisibleIntervals: Int = 8
+  val PkVisibilitySize: Int   = 4 * 8 + 2 * 4 + PkVisibleIntervals * 2 * 8
 
   /**
-   * Matching interface for the extern "C" API defined in TpkC.cpp in the tpk-jni subproject
+   * Matching interface for the extern "C" API defined in TpkC.cpp in the tpk-jni subproject.
+   *
+   * Results are returned in native memory given by a Pointer (see CoordBuffer and DemandBuffer), which
+   * JNR passes as an address without copying or allocating anything per call.
    */
   trait TpkExternC {
     def tpkc_ctor(): Pointer
@@ -20,6 +32,9 @@ object TpkC {
     def tpkc_init(self: Pointer): Unit
     def tpkc_shutdown(self: Pointer): Unit
 
+    // Sets an item of the real-time configuration used by the next tpkc_init
+    def tpkc_configure(self: Pointer, key: String, value: String): Boolean
+
     def tpkc_newICRSTarget(self: Pointer, ra: Double, dec: Double): Boolean
     def tpkc_newFK5Target(self: Pointer, ra: Double, dec: Double): Boolean
     def tpkc_newAzElTarget(self: Pointer, az: Double, el: Double): Boolean
@@ -28,11 +43,123 @@ object TpkC {
     def tpkc_setFK5Offset(self: Pointer, raO: Double, decO: Double): Unit
     def tpkc_setAzElOffset(self: Pointer, azO: Double, elO: Double): Unit
 
-//    // Return the current position in the current ref sys (RA, Dec for ICRS, FK5, ...)
-//    def tpkc_currentPosition(self: Pointer, @Out @Transient raDec: CoordPair): Unit
-//
-//    // Convert az,el to ra,dec
-//    def tpkc_azElToRaDec(self: Pointer, az: Double, el: Double, @Out @Transient raDec: CoordPair): Unit
+    // Writes the current position in the current ref sys (RA, Dec for ICRS, FK5, ...) to a CoordPair
+    def tpkc_currentPosition(self: Pointer, raDec: Pointer): Unit
+
+    // Convert az,el to ra,dec and ra,dec to az,el, writing the result to a CoordPair
+    def tpkc_azElToRaDec(self: Pointer, az: Double, el: Double, raDec: Pointer): Unit
+    def tpkc_raDecToAzEl(self: Pointer, ra: Double, dec: Double, azEl: Pointer): Unit
+
+    // Convert arrays of n coordinates
+    def tpkc_azElToRaDecBatch(self: Pointer, az: Pointer, el: Pointer, ra: Pointer, dec: Pointer, n: Int): Unit
+    def tpkc_raDecToAzElBatch(self: Pointer, ra: Pointer, dec: Pointer, az: Pointer, el: Pointer, n: Int): Unit
+
+    // Copies up to max of the latest PkDemand structs, oldest first, and returns the number copied
+    def tpkc_demandHistory(self: Pointer, demands: Pointer, max: Int): Int
+
+    // Adds a named virtual telescope (before tpkc_init) and returns its index, or -1
+    def tpkc_addVt(self: Pointer, name: String): Int
+
+    // Targets (deg), offsets (arcsec) and the latest PkVtDemand of an added virtual telescope
+    def tpkc_newVtTarget(self: Pointer, vt: Int, refSys: Int, a: Double, b: Double): Boolean
+    def tpkc_setVtOffset(self: Pointer, vt: Int, refSys: Int, a: Double, b: Double): Boolean
+    def tpkc_vtDemand(self: Pointer, vt: Int, demand: Pointer): Boolean
+
+    // Writes the PkVisibility of n ICRS targets between startUtc and endUtc (s since 1970) above minEl
+    def tpkc_visibility(
+        self: Pointer,
+        ra: Pointer,
+        dec: Pointer,
+        n: Int,
+        startUtc: Double,
+        endUtc: Double,
+        minEl: Double,
+        visibility: Pointer
+    ): Unit
+
+    // Sets the weather (deg C, hPa, humidity 0 to 1) and gets the PkWeather last applied to the site
+    def tpkc_setWeather(self: Pointer, temperature: Double, pressure: Double, humidity: Double): Boolean
+    def tpkc_weather(self: Pointer, weather: Pointer): Boolean
+
+    // Loads a pointing model file and returns its number, or -1, and the number of the model in use
+    def tpkc_loadPointingModel(self: Pointer, path: String): Int
+    def tpkc_pointingModel(self: Pointer): Int
+  }
+
+  /**
+   * Native memory for batch conversions of up to capacity coordinate pairs: two input and two output
+   * arrays of doubles, allocated once and reused for every call
+   */
+  class CoordBuffer(runtime: Runtime, val capacity: Int) {
+    private val arraySize = capacity.toLong * 8
+    val memory: Pointer   = Memory.allocateDirect(runtime, 4 * capacity * 8)
+    val inA: Pointer      = memory.slice(0, arraySize)
+    val inB: Pointer      = memory.slice(arraySize, arraySize)
+    val outA: Pointer     = memory.slice(2 * arraySize, arraySize)
+    val outB: Pointer     = memory.slice(3 * arraySize, arraySize)
+
+    def setIn(i: Int, a: Double, b: Double): Unit = {
+      inA.putDouble(i * 8L, a)
+      inB.putDouble(i * 8L, b)
+    }
+    def resultA(i: Int): Double = outA.getDouble(i * 8L)
+    def resultB(i: Int): Double = outB.getDouble(i * 8L)
+  }
+
+  /**
+   * Native memory for up to capacity demands from the demand history, allocated once and reused.
+   * The accessors read the fields of demand i (0 is the oldest) in place.
+   */
+  class DemandBuffer(runtime: Runtime, val capacity: Int) {
+    val memory: Pointer = Memory.allocateDirect(runtime, capacity * PkDemandSize)
+
+    // The number of demands read by the last call to TpkC.demandHistory()
+    var size: Int = 0
+
+    private def field(i: Int, n: Int): Double = memory.getDouble(i.toLong * PkDemandSize + n * 8)
+
+    def time(i: Int): Double         = field(i, 0)
+    def mcsAz(i: Int): Double        = field(i, 1)
+    def mcsEl(i: Int): Double        = field(i, 2)
+    def ra(i: Int): Double           = field(i, 3)
+    def dec(i: Int): Double          = field(i, 4)
+    def siderealTime(i: Int): Double = field(i, 5)
+    def base(i: Int): Double         = field(i, 6)
+    def cap(i: Int): Double          = field(i, 7)
+    def m3Rotation(i: Int): Double   = field(i, 8)
+    def m3Tilt(i: Int): Double       = field(i, 9)
+  }
+
+  /**
+   * Native memory for the visibility of up to capacity targets: their ra and dec (in deg) and the
+   * PkVisibility results, allocated once and reused. Times are UTC in seconds since 1970, NaN if the
+   * event is not in the time window.
+   */
+  class VisibilityBuffer(runtime: Runtime, val capacity: Int) {
+    val ra: Pointer      = Memory.allocateDirect(runtime, capacity * 8)
+    val dec: Pointer     = Memory.allocateDirect(runtime, capacity * 8)
+    val results: Pointer = Memory.allocateDirect(runtime, capacity * PkVisibilitySize)
+
+    def setTarget(i: Int, raDeg: Double, decDeg: Double): Unit = {
+      ra.putDouble(i * 8L, raDeg)
+      dec.putDouble(i * 8L, decDeg)
+    }
+
+    private def offset(i: Int): Long = i.toLong * PkVisibilitySize
+
+    def rise(i: Int): Double      = results.getDouble(offset(i))
+    def set(i: Int): Double       = results.getDouble(offset(i) + 8)
+    def transit(i: Int): Double   = results.getDouble(offset(i) + 16)
+    def maxEl(i: Int): Double     = results.getDouble(offset(i) + 24)
+    def numIntervals(i: Int): Int = results.getInt(offset(i) + 32)
+
+    // The (start, end) of the observable intervals of target i (at most PkVisibleIntervals)
+    def intervals(i: Int): Seq[(Double, Double)] = {
+      val base = offset(i) + 40
+      (0 until math.min(numIntervals(i), PkVisibleIntervals)).map { k =>
+        (results.getDouble(base + k * 16), results.getDouble(base + k * 16 + 8))
+      }
+    }
   }
 
   /**
@@ -46,7 +173,16 @@ object TpkC {
   }
 }
 
-class TpkC(val tpkExternC: TpkExternC, val self: Pointer, runtime: Runtime) {
+class TpkC(val tpkExternC: TpkExternC, val self: Pointer, val runtime: Runtime) {
+  // A CoordPair in native memory for each calling thread, for the single coordinate results
+  private val coordPair = ThreadLocal.withInitial[Pointer](() => Memory.allocateDirect(runtime, CoordPairSize))
+
+  // A PkVtDemand in native memory for each calling thread
+  private val vtDemandStruct = ThreadLocal.withInitial[Pointer](() => Memory.allocateDirect(runtime, PkVtDemandSize))
+
+  // A PkWeather in native memory for each calling thread
+  private val weatherStruct = ThreadLocal.withInitial[Pointer](() => Memory.allocateDirect(runtime, PkWeatherSize))
+
   def init(): Unit = {
     tpkExternC.tpkc_init(self)
   }
@@ -54,6 +190,12 @@ class TpkC(val tpkExternC: TpkExternC, val self: Pointer, runtime: Runtime) {
     tpkExternC.tpkc_shutdown(self)
   }
 
+  // Sets an item of the real-time configuration (policy, deadlineBudget, lockMemory, prefaultStack,
+  // cpuAffinity) used by the next init(). Returns false if the key or value is not valid.
+  def configure(key: String, value: String): Boolean = {
+    tpkExternC.tpkc_configure(self, key, value)
+  }
+
   def newICRSTarget(ra: Double, dec: Double): Boolean = {
     tpkExternC.tpkc_newICRSTarget(self, ra, dec)
   }
@@ -74,18 +216,106 @@ class TpkC(val tpkExternC: TpkExternC, val self: Pointer, runtime: Runtime) {
     tpkExternC.tpkc_setAzElOffset(self, azO, elO)
   }
 
-//  // The mount's current ra,dec position  (if using ICRS, FK5) as a pair (ra, dec) in deg
-//  def currentPosition(): (Double, Double) = {
-//    val raDec = new CoordPair(runtime)
-//    tpkExternC.tpkc_currentPosition(self, raDec)
-//    (raDec.a.get(), raDec.b.get())
-//  }
-//
-//  // Converts the given az,el coords (in deg) to ra,dec and returns a pair (ra, dec) in deg
-//  def azElToRaDec(az: Double, el: Double): (Double, Double) = {
-//    val raDec = new CoordPair(runtime)
-//    tpkExternC.tpkc_azElToRaDec(self, az, el, raDec)
-//    (raDec.a.get(), raDec.b.get())
-//  }
+  // The mount's current ra,dec position  (if using ICRS, FK5) as a pair (ra, dec) in deg
+  def currentPosition(): (Double, Double) = {
+    val raDec = coordPair.get()
+    tpkExternC.tpkc_currentPosition(self, raDec)
+    (raDec.getDouble(0), raDec.getDouble(8))
+  }
+
+  // Converts the given az,el coords (in deg) to ra,dec and returns a pair (ra, dec) in deg
+  def azElToRaDec(az: Double, el: Double): (Double, Double) = {
+    val raDec = coordPair.get()
+    tpkExternC.tpkc_azElToRaDec(self, az, el, raDec)
+    (raDec.getDouble(0), raDec.getDouble(8))
+  }
+
+  // Converts the given ra,dec coords (in deg) to az,el and returns a pair (az, el) in deg
+  def raDecToAzEl(ra: Double, dec: Double): (Double, Double) = {
+    val azEl = coordPair.get()
+    tpkExternC.tpkc_raDecToAzEl(self, ra, dec, azEl)
+    (azEl.getDouble(0), azEl.getDouble(8))
+  }
+
+  // Allocates native memory for batch conversions of up to capacity coordinates
+  def coordBuffer(capacity: Int): CoordBuffer = new CoordBuffer(runtime, capacity)
+
+  // Converts the first n az,el pairs (in deg) in the buffer's inputs to ra,dec in its outputs
+  def azElToRaDec(buf: CoordBuffer, n: Int): Unit = {
+    require(n <= buf.capacity)
+    tpkExternC.tpkc_azElToRaDecBatch(self, buf.inA, buf.inB, buf.outA, buf.outB, n)
+  }
+
+  // Converts the first n ra,dec pairs (in deg) in the buffer's inputs to az,el in its outputs
+  def raDecToAzEl(buf: CoordBuffer, n: Int): Unit = {
+    require(n <= buf.capacity)
+    tpkExternC.tpkc_raDecToAzElBatch(self, buf.inA, buf.inB, buf.outA, buf.outB, n)
+  }
+
+  // Allocates native memory for up to capacity demands
+  def demandBuffer(capacity: Int): DemandBuffer = new DemandBuffer(runtime, capacity)
+
+  // Reads the latest demands (as many as fit) into the buffer and returns the number read
+  def demandHistory(buf: DemandBuffer): Int = {
+    buf.size = tpkExternC.tpkc_demandHistory(self, buf.memory, buf.capacity)
+    buf.size
+  }
+
+  // Adds a named virtual telescope (before init()) and returns its index, or -1 if it could not be added
+  def addVt(name: String): Int = {
+    tpkExternC.tpkc_addVt(self, name)
+  }
+
+  // Sets the target (a, b in deg, refSys PkIcrs, PkFk5 or PkAzEl) of an added virtual telescope and
+  // returns true if it is above the horizon
+  def newVtTarget(vt: Int, refSys: Int, a: Double, b: Double): Boolean = {
+    tpkExternC.tpkc_newVtTarget(self, vt, refSys, a, b)
+  }
+
+  // Sets the offset (a, b in arcsec) of an added virtual telescope
+  def setVtOffset(vt: Int, refSys: Int, a: Double, b: Double): Boolean = {
+    tpkExternC.tpkc_setVtOffset(self, vt, refSys, a, b)
+  }
 
+  // The demands (az, el, ra, dec in deg) of an added virtual telescope on the last tick, if it is tracking
+  def vtDemand(vt: Int): Option[(Double, Double, Double, Double)] = {
+    val d = vtDemandStruct.get()
+    if (tpkExternC.tpkc_vtDemand(self, vt, d))
+      Some((d.getDouble(8), d.getDouble(16), d.getDouble(24), d.getDouble(32)))
+    else None
+  }
+
+  // Allocates native memory for the visibility of up to capacity targets
+  def visibilityBuffer(capacity: Int): VisibilityBuffer = new VisibilityBuffer(runtime, capacity)
+
+  // Calculates the visibility of the first n targets in the buffer between startUtc and endUtc
+  // (s since 1970) above minEl (deg)
+  def visibility(buf: VisibilityBuffer, n: Int, startUtc: Double, endUtc: Double, minEl: Double): Unit = {
+    require(n <= buf.capacity)
+    tpkExternC.tpkc_visibility(self, buf.ra, buf.dec, n, startUtc, endUtc, minEl, buf.results)
+  }
+
+  // Sets the weather at the site (temperature in deg C, pressure in hPa, relative humidity from 0 to 1),
+  // returns false if it comes from elsewhere (TPK_WEATHER) or is not plausible
+  def setWeather(temperature: Double, pressure: Double, humidity: Double): Boolean = {
+    tpkExternC.tpkc_setWeather(self, temperature, pressure, humidity)
+  }
+
+  // The weather (temperature, pressure, humidity) last applied to the site, if any
+  def weather(): Option[(Double, Double, Double)] = {
+    val w = weatherStruct.get()
+    if (tpkExternC.tpkc_weather(self, w)) Some((w.getDouble(0), w.getDouble(8), w.getDouble(16)))
+    else None
+  }
+
+  // Loads a TPOINT pointing model file while tracking and returns its number, or None if it is not valid
+  def loadPointingModel(path: String): Option[Int] = {
+    val n = tpkExternC.tpkc_loadPointingModel(self, path)
+    if (n >= 0) Some(n) else None
+  }
+
+  // The number of the pointing model the fast loop is using (0 for the one installed by init)
+  def pointingModel(): Int = {
+    tpkExternC.tpkc_pointingModel(self)
+  }
 }
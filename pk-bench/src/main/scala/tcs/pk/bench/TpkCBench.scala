@@ -0,0 +1,113 @@
+package tcs.pk.bench
+
+import java.util.concurrent.TimeUnit
+
+import jnr.ffi.{LibraryLoader, Pointer, Runtime, Struct}
+import jnr.ffi.annotations.{In, Out, Transient}
+import org.openjdk.jmh.annotations._
+import org.openjdk.jmh.infra.Blackhole
+import tcs.pk.wrapper.TpkC
+import tcs.pk.wrapper.TpkC.{CoordBuffer, DemandBuffer}
+
+object TpkCBench {
+  // A CoordPair marshalled by JNR as a Struct, as in the original (commented out) wrapper
+  class CoordPair(runtime: Runtime) extends Struct(runtime) {
+    val a = new Double
+    val b = new Double
+  }
+
+  // The same entry points declared with JNR marshalled structs and Java arrays, for comparison
+  trait MarshalledExternC {
+    def tpkc_azElToRaDec(self: Pointer, az: Double, el: Double, @Out @Transient raDec: CoordPair): Unit
+    def tpkc_azElToRaDecBatch(
+        self: Pointer,
+        @In az: Array[Double],
+        @In el: Array[Double],
+        @Out ra: Array[Double],
+        @Out dec: Array[Double],
+        n: Int
+    ): Unit
+  }
+}
+
+/**
+ * Time per call of the TpkC native interface through JNR: results in direct (native) memory reused
+ * across calls, compared with marshalled structs and Java arrays. Needs libtpk-jni on the library path.
+ * The native side alone is measured by tpk-jni/bench/CallOverheadBench.
+ */
+@State(Scope.Benchmark)
+@BenchmarkMode(Array(Mode.AverageTime))
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 5, time = 1)
+@Measurement(iterations = 10, time = 1)
+@Fork(1)
+class TpkCBench {
+  import TpkCBench._
+
+  @Param(Array("16", "256"))
+  var n: Int = 0
+
+  private var tpkc: TpkC                     = null
+  private var marshalled: MarshalledExternC  = null
+  private var coordPair: CoordPair           = null
+  private var coords: CoordBuffer            = null
+  private var az, el, ra, dec: Array[Double] = null
+  private var demands: DemandBuffer          = null
+
+  @Setup
+  def setup(): Unit = {
+    tpkc = TpkC.getInstance()
+    tpkc.init()
+    tpkc.newICRSTarget(185.0, 11.0)
+    marshalled = LibraryLoader.create(classOf[MarshalledExternC]).load("tpk-jni")
+    coordPair = new CoordPair(tpkc.runtime)
+    coords = tpkc.coordBuffer(n)
+    az = Array.fill(n)(180.0)
+    el = Array.fill(n)(45.0)
+    ra = new Array[Double](n)
+    dec = new Array[Double](n)
+    for (i <- 0 until n) coords.setIn(i, az(i), el(i))
+    demands = tpkc.demandBuffer(n)
+    // Let the fast loop fill the demand history
+    Thread.sleep(3000)
+  }
+
+  @TearDown
+  def tearDown(): Unit = {
+    tpkc.shutdown()
+  }
+
+  @Benchmark
+  def currentPosition(bh: Blackhole): Unit = {
+    bh.consume(tpkc.currentPosition())
+  }
+
+  @Benchmark
+  def azElToRaDecDirect(bh: Blackhole): Unit = {
+    bh.consume(tpkc.azElToRaDec(180.0, 45.0))
+  }
+
+  @Benchmark
+  def azElToRaDecStruct(bh: Blackhole): Unit = {
+    marshalled.tpkc_azElToRaDec(tpkc.self, 180.0, 45.0, coordPair)
+    bh.consume(coordPair.a.get())
+  }
+
+  @Benchmark
+  def azElToRaDecBatchDirect(bh: Blackhole): Unit = {
+    tpkc.azElToRaDec(coords, n)
+    bh.consume(coords.resultA(n - 1))
+  }
+
+  @Benchmark
+  def azElToRaDecBatchArrays(bh: Blackhole): Unit = {
+    marshalled.tpkc_azElToRaDecBatch(tpkc.self, az, el, ra, dec, n)
+    bh.consume(ra(n - 1))
+  }
+
+  @Benchmark
+  def demandHistory(bh: Blackhole): Unit = {
+    bh.consume(tpkc.demandHistory(demands))
+    bh.consume(demands.ra(0))
+  }
+}
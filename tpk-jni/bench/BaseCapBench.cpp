@@ -0,0 +1,44 @@
+//
+// Throughput of the scalar and batch (vectorized) base/cap calculations over a sky grid
+//
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <BaseCap.h>
+
+static const int numRepeats = 20;
+
+// Returns the throughput (positions per second) of f over the grid
+template<typename F>
+static double throughput(size_t n, F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < numRepeats; r++) f();
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+    return static_cast<double>(n) * numRepeats / t.count();
+}
+
+int main() {
+    // A 0.1 deg az,el grid over the part of the sky the enclosure can reach
+    std::vector<double> az, el;
+    for (double e = 25.0; e < 90.0; e += 0.1) {
+        for (double a = 0.0; a < 360.0; a += 0.1) {
+            el.push_back(e);
+            az.push_back(a);
+        }
+    }
+    size_t n = az.size();
+    std::vector<double> base(n), cap(n);
+
+    double scalar = throughput(n, [&]() {
+        BaseCap::calculateBatchScalar(az.data(), el.data(), base.data(), cap.data(), n);
+    });
+    double batch = throughput(n, [&]() {
+        BaseCap::calculateBatch(az.data(), el.data(), base.data(), cap.data(), n);
+    });
+
+    printf("%zu positions, AVX2 %s\n", n, BaseCap::haveAvx2() ? "available" : "not available");
+    printf("scalar  %8.2f M positions/s\n", scalar / 1e6);
+    printf("batch   %8.2f M positions/s  (x%.1f)\n", batch / 1e6, batch / scalar);
+    return 0;
+}
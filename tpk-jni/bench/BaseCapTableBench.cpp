@@ -0,0 +1,89 @@
+//
+// Accuracy and speed of the base/cap lookup tables (BaseCapTable) compared with the exact calculation,
+// for a range of resolutions and both interpolations. Accuracy is measured against the exact calculation
+// over a fine elevation grid and against the BaseCapTests table data.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <BaseCap.h>
+#include "BaseCapTestData.h"
+
+static const int numRepeats = 20;
+
+// A fine grid of positions over the reachable part of the sky
+static std::vector<double> gridAz, gridEl;
+
+// Returns the time per position in ns of calculate() over the grid
+template<typename Calculate>
+static double nsPerPosition(Calculate calculate) {
+    double sum = 0.0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < numRepeats; r++) {
+        for (size_t i = 0; i < gridAz.size(); i++) {
+            double baseDeg, capDeg;
+            calculate(gridAz[i], gridEl[i], baseDeg, capDeg);
+            sum += baseDeg + capDeg;
+        }
+    }
+    std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - t0;
+    if (std::isnan(sum)) printf("(NaN in results)\n");
+    return t.count() / (numRepeats * gridAz.size());
+}
+
+static void report(const BaseCapTable &lookupTable, double exactNs) {
+    // Maximum error against the exact calculation
+    double maxBaseErr = 0.0, maxCapErr = 0.0;
+    for (size_t i = 0; i < gridAz.size(); i++) {
+        double base, cap, exactBase, exactCap;
+        lookupTable.calculate(gridAz[i], gridEl[i], base, cap);
+        BaseCap::calculate(gridAz[i], gridEl[i], exactBase, exactCap);
+        // (base wraps at 360 deg)
+        maxBaseErr = std::max(maxBaseErr, fabs(remainder(base - exactBase, 360.0)));
+        maxCapErr = std::max(maxCapErr, fabs(cap - exactCap));
+    }
+
+    // Maximum error against the (rounded) table data, for az = 0
+    double maxTableErr = 0.0;
+    for (int row = 0; row < numRows; row++) {
+        double base, cap;
+        lookupTable.calculate(0.0, table[row][0], base, cap);
+        maxTableErr = std::max(maxTableErr, std::max(fabs(base - table[row][1]), fabs(cap - table[row][2])));
+    }
+
+    double ns = nsPerPosition([&](double az, double el, double &base, double &cap) {
+        lookupTable.calculate(az, el, base, cap);
+    });
+    printf("%-7s %8.4f  %7zu  %12.3e  %12.3e  %10.3f  %7.1f ns  (x%.1f)\n",
+           lookupTable.interpolation() == BaseCapTable::LINEAR ? "linear" : "cubic", lookupTable.resolution(),
+           static_cast<size_t>(65.0 / lookupTable.resolution() + 1.5) * 2 * sizeof(double),
+           maxBaseErr, maxCapErr, maxTableErr, ns, exactNs / ns);
+}
+
+int main() {
+    for (double el = 25.0; el <= 90.0; el += 0.001) {
+        gridEl.push_back(el);
+        gridAz.push_back(fmod(el * 37.0, 360.0));
+    }
+
+    double exactNs = nsPerPosition(BaseCap::calculate);
+    double exactTableErr = 0.0;
+    for (int row = 0; row < numRows; row++) {
+        double base, cap;
+        BaseCap::calculate(0.0, table[row][0], base, cap);
+        exactTableErr = std::max(exactTableErr, std::max(fabs(base - table[row][1]), fabs(cap - table[row][2])));
+    }
+    printf("exact: %.1f ns per position (%zu positions), table err %.3f\n\n", exactNs, gridAz.size(),
+           exactTableErr);
+    printf("interp  res(deg)  bytes    max base err  max cap err   table err   time\n");
+
+    double resolutions[] = {1.0, 0.5, 0.1, 0.05, 0.01};
+    for (double res : resolutions) {
+        report(BaseCapTable(res, BaseCapTable::LINEAR), exactNs);
+        report(BaseCapTable(res, BaseCapTable::CUBIC), exactNs);
+    }
+    return 0;
+}
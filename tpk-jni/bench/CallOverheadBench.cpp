@@ -0,0 +1,79 @@
+//
+// Time per call of the extern "C" entry points used by the Scala wrapper (through JNR), to separate
+// the native cost of a call from the JVM's marshalling cost. Like JMH, each benchmark is warmed up
+// and then timed over several iterations, and the mean and standard deviation are reported.
+//
+// Starts the kernel with the fake system clock and a target, so that there is a demand history.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <TpkC.h>
+
+extern "C" {
+TpkC *tpkc_ctor();
+void tpkc_init(TpkC *self);
+void tpkc_shutdown(TpkC *self);
+bool tpkc_newICRSTarget(TpkC *self, double ra, double dec);
+void tpkc_currentPosition(TpkC *self, CoordPair *raDec);
+void tpkc_azElToRaDec(TpkC *self, double az, double el, CoordPair *raDec);
+void tpkc_azElToRaDecBatch(TpkC *self, const double *az, const double *el, double *ra, double *dec, int n);
+int tpkc_demandHistory(TpkC *self, PkDemand *demands, int max);
+}
+
+static const int warmupIterations = 5;
+static const int iterations = 10;
+static const int callsPerIteration = 20000;
+
+// Prints the mean and standard deviation of the time per op (ns) of f, which does opsPerCall ops
+template<typename F>
+static void bench(const char *name, int opsPerCall, F f) {
+    double t[iterations];
+    for (int i = -warmupIterations; i < iterations; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int c = 0; c < callsPerIteration; c++) f();
+        std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - t0;
+        if (i >= 0) t[i] = d.count() / callsPerIteration / opsPerCall;
+    }
+    double mean = 0.0, var = 0.0;
+    for (double x : t) mean += x / iterations;
+    for (double x : t) var += (x - mean) * (x - mean) / (iterations - 1);
+    printf("%-32s %10.1f ± %6.1f ns/op\n", name, mean, sqrt(var));
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    setenv("TPK_BATCH_THREADS", "1", 1);
+    TpkC *self = tpkc_ctor();
+    tpkc_init(self);
+    tpkc_newICRSTarget(self, 185.0, 11.0);
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    CoordPair p;
+    bench("currentPosition", 1, [&]() { tpkc_currentPosition(self, &p); });
+    bench("azElToRaDec", 1, [&]() { tpkc_azElToRaDec(self, 180.0, 45.0, &p); });
+
+    for (int n : {16, 256}) {
+        std::vector<double> az(n, 180.0), el(n, 45.0), ra(n), dec(n);
+        char name[64];
+        snprintf(name, sizeof name, "azElToRaDecBatch (%d points)", n);
+        bench(name, n, [&]() { tpkc_azElToRaDecBatch(self, az.data(), el.data(), ra.data(), dec.data(), n); });
+    }
+
+    for (int n : {1, 10, 100}) {
+        std::vector<PkDemand> demands(n);
+        char name[64];
+        snprintf(name, sizeof name, "demandHistory (%d demands)", n);
+        int got = 0;
+        bench(name, 1, [&]() { got = tpkc_demandHistory(self, demands.data(), n); });
+        if (got != n) printf("    (only %d demands in the history)\n", got);
+    }
+
+    tpkc_shutdown(self);
+    delete self;
+    return 0;
+}
@@ -0,0 +1,113 @@
+//
+// Compares building a demand event from scratch for every publish (as TpkC::publishMcsDemand used to)
+// with patching a preallocated DemandEvent. Measures the time per event and the number of heap
+// allocations per event. Nothing is published, so no event service is needed.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <DemandEvents.h>
+
+static const int numIterations = 100000;
+
+// --- Count heap allocations (glibc only: interposes malloc and friends) ---
+
+static std::atomic<long> numAllocs(0);
+
+#ifdef __GLIBC__
+extern "C" {
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+    numAllocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    numAllocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    numAllocs++;
+    return __libc_realloc(p, size);
+}
+}
+#endif
+
+// Convert degrees to microarcseconds
+static double deg2Mas(double d) { return d * 60.0 * 60.0 * 1000.0 * 1000.0; }
+
+const char *prefix = "TCS.PointingKernelAssembly";
+
+// The way the MountDemandPosition event used to be made for every publish
+static void makeMcsDemandFromScratch(double az, double el, double ra, double dec, double st) {
+    const char *trackIdAr[] = {"trackid-0"};
+    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
+    CswParameter trackIdParam = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+
+    CswAltAzCoord posValues[1];
+    posValues[0] = cswMakeAltAzCoord("BASE", lround(deg2Mas(el)), lround(deg2Mas(az)));
+    CswArrayValue arrayValues = {.values = posValues, .numValues = 1};
+    CswParameter coordParam = cswMakeParameter("pos", AltAzCoordKey, arrayValues, csw_unit_NoUnits);
+
+    CswEqCoord posRaDecValues[1];
+    posRaDecValues[0] = cswMakeEqCoord("BASE", lround(deg2Mas(ra)), lround(deg2Mas(dec)),
+                                       ICRS, "none", 0.0f, 0.0f);
+    CswArrayValue posRaDecArrayValues = {.values = posRaDecValues, .numValues = 1};
+    CswParameter posRaDecCoordParam = cswMakeParameter("posRaDec", EqCoordKey, posRaDecArrayValues, csw_unit_NoUnits);
+
+    CswUtcTime timeAr[] = {cswUtcTime()};
+    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
+    CswParameter timeParam = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+
+    double siderealTimeAr[] = {st};
+    CswArrayValue siderealTimeValues = {.values = siderealTimeAr, .numValues = 1};
+    CswParameter siderealTimeParam = cswMakeParameter("siderealTime", DoubleKey, siderealTimeValues, csw_unit_hour);
+
+    CswParameter params[] = {trackIdParam, coordParam, posRaDecCoordParam, timeParam, siderealTimeParam};
+    CswParamSet paramSet = {.params = params, .numParams = 5};
+    CswEvent event = cswMakeEvent(SystemEvent, prefix, "MountDemandPosition", paramSet);
+    cswFreeEvent(event);
+}
+
+// Runs f numIterations times and prints the median and 99th percentile time and the allocations per call
+template<typename F>
+static void bench(const char *name, F f) {
+    std::vector<double> ns;
+    ns.reserve(numIterations);
+    long allocs0 = numAllocs;
+    for (int i = 0; i < numIterations; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        f(i);
+        std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - t0;
+        ns.push_back(t.count());
+    }
+    long allocs = numAllocs - allocs0;
+    std::sort(ns.begin(), ns.end());
+    printf("%-24s median %7.0f ns   p99 %7.0f ns   allocations/event %.2f\n", name,
+           ns[ns.size() / 2], ns[ns.size() * 99 / 100], static_cast<double>(allocs) / numIterations);
+}
+
+int main() {
+    printf("MountDemandPosition event, %d iterations\n", numIterations);
+    bench("built for each publish", [](int i) {
+        makeMcsDemandFromScratch(180.0 + i * 1e-6, 45.0, 10.0, 20.0, 1.5);
+    });
+
+    McsDemandEvent mcsDemand(prefix);
+    bench("preallocated", [&](int i) {
+        mcsDemand.set(180.0 + i * 1e-6, 45.0, 10.0, 20.0, cswUtcTime(), 1.5);
+    });
+#ifndef __GLIBC__
+    printf("(allocations are only counted with glibc)\n");
+#endif
+    return 0;
+}
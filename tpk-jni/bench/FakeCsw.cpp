@@ -0,0 +1,24 @@
+#include <atomic>
+#include "csw/csw.h"
+#include "FakeCsw.h"
+
+static std::atomic<long> publishedEvents(0);
+static int context;
+
+long fakeCswPublishedEvents() {
+    return publishedEvents.load(std::memory_order_relaxed);
+}
+
+extern "C" {
+CswEventServiceContext cswEventPublisherInit() {
+    return &context;
+}
+
+void cswEventPublisherClose(CswEventServiceContext) {
+}
+
+int cswEventPublish(CswEventServiceContext, CswEvent) {
+    publishedEvents.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// A stand-in for the CSW event service, built as the fake-csw library for the benchmarks. It is linked
+// ahead of the CSW library, so that its publisher functions are the ones tpk-jni calls too: they count
+// the events instead of sending them. The events themselves are still built by the CSW library.
+
+// The number of events published so far
+long fakeCswPublishedEvents();
@@ -0,0 +1,71 @@
+//
+// Whether loading pointing models while tracking disturbs the fast loop. Runs the loops in real time
+// twice, without loading and then loading a new model twice a second, and compares the jitter and
+// execution time of the fast loop and the execution time of the medium loop, which installs the models.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <TpkC.h>
+
+static const int seconds = 20;
+static const char *modelFile = "/tmp/PointingModelSwapBench.dat";
+
+// A model with the usual terms for an alt-az telescope
+static void writeModel() {
+    FILE *f = fopen(modelFile, "w");
+    fputs("PointingModelSwapBench\n"
+          "S   T  01  2022 01 01  59580.5  2.0  615.0  0.25\n"
+          "     IA       -12.3456     1.2345\n"
+          "     IE        45.678      0.9876\n"
+          "     NPAE       1.5        0.5\n"
+          "     CA        -8.2        0.7\n"
+          "     AN         2.1        0.3\n"
+          "     AW        -1.7        0.3\n"
+          "     TF         3.0        0.1\n"
+          "     TX         0.4        0.1\n"
+          "END\n", f);
+    fclose(f);
+}
+
+static void run(const char *name, bool load) {
+    TpkC tpkc;
+    tpkc.init();
+    tpkc.newICRSTarget(185.0, 11.0);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    double loadUs = 0.0;
+    int loads = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (std::chrono::steady_clock::now() < end) {
+        if (load) {
+            auto t0 = std::chrono::steady_clock::now();
+            tpkc.loadPointingModel(modelFile);
+            loadUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+            loads++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+
+    ScanStats stats[3];
+    tpkc.loopStats(stats, 3);
+    const ScanStats &fast = stats[2];
+    printf("%-8s %6d %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %7ld %9.2f\n", name, loads, fast.jitter.p50Us,
+           fast.jitter.p99Us, fast.jitter.maxUs, fast.execution.p99Us, fast.execution.maxUs,
+           stats[1].execution.p99Us, fast.missedTicks, loads ? loadUs / loads : 0.0);
+    tpkc.shutdown();
+}
+
+int main() {
+    writeModel();
+    printf("%d s per row, times in us (jitter and execution time of the fast loop, execution time of the medium "
+           "loop)\n", seconds);
+    printf("%-8s %6s %9s %9s %9s %9s %9s %9s %7s %9s\n", "", "loads", "jit p50", "jit 99%", "jit max", "exec 99%",
+           "exec max", "med 99%", "missed", "load");
+    run("steady", false);
+    run("loading", true);
+    remove(modelFile);
+    return 0;
+}
@@ -0,0 +1,65 @@
+//
+// Time to plan a slew of the mount, enclosure and M3 (Slew::plan()) from rest and during a slew,
+// and to evaluate the offsets of all axes on a tick, as the fast loop does
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <Slew.h>
+
+static const int numSlews = 100000;
+static const double startTai = 59580.5;
+
+// Prints the median, 99th percentile and maximum of the times (ns)
+static void report(const char *name, std::vector<double> &ns) {
+    std::sort(ns.begin(), ns.end());
+    printf("%-28s median %7.0f ns  99%% %7.0f ns  max %7.0f ns\n", name, ns[ns.size() / 2],
+           ns[ns.size() * 99 / 100], ns.back());
+}
+
+int main() {
+    SlewLimits limits[Slew::NUM_AXES] = {{2.5, 1.0, 2.0}, {2.5, 1.0, 2.0}, {2.0, 0.5, 1.0}, {2.0, 0.5, 1.0},
+                                         {5.0, 5.0, 20.0}, {5.0, 5.0, 20.0}};
+    Slew slew(limits);
+
+    // Random slews of up to 180 deg on every axis
+    unsigned int seed = 1;
+    std::vector<double> offsets(numSlews * Slew::NUM_AXES);
+    for (double &o : offsets) o = (2.0 * rand_r(&seed) / RAND_MAX - 1.0) * 180.0;
+
+    std::vector<double> fromRest(numSlews), duringSlew(numSlews), tick(numSlews);
+    double sum = 0.0, duration = 0.0;
+    for (int i = 0; i < numSlews; i++) {
+        // A slew from rest (the previous one is long over)
+        double tai = startTai + i;
+        auto t0 = std::chrono::steady_clock::now();
+        slew.plan(tai, &offsets[i * Slew::NUM_AXES]);
+        auto t1 = std::chrono::steady_clock::now();
+        fromRest[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        duration += (slew.endTai() - tai) * 86400.0;
+
+        // The offsets on a tick during it
+        tai += 2.0 / 86400.0;
+        t0 = std::chrono::steady_clock::now();
+        for (int axis = 0; axis < Slew::NUM_AXES; axis++) sum += slew.offset(axis, tai);
+        t1 = std::chrono::steady_clock::now();
+        tick[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+
+        // A new slew that replaces it while it is accelerating
+        t0 = std::chrono::steady_clock::now();
+        slew.plan(tai, &offsets[((i + 1) % numSlews) * Slew::NUM_AXES]);
+        t1 = std::chrono::steady_clock::now();
+        duringSlew[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    }
+    if (std::isnan(sum)) printf("(NaN in results)\n");
+
+    printf("%d slews of %d axes, %.1f s long on average\n", numSlews, Slew::NUM_AXES, duration / numSlews);
+    report("plan from rest", fromRest);
+    report("plan during a slew", duringSlew);
+    report("offsets of all axes", tick);
+    return 0;
+}
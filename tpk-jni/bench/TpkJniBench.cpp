@@ -0,0 +1,241 @@
+//
+// Google Benchmark suite for the hot paths of tpk-jni, for tracking regressions across releases. The
+// results are written to tpk-jni-bench.json (or to the file given with --benchmark_out).
+//
+// The kernel runs in virtual time (TPK_VIRTUAL_TIME, on the virtual FakeSystemClock) and the batch
+// calls on one thread, so every run computes the same demands from the same start time. The fast loop
+// benchmarks run whole ticks of the scan loops and report the execution time of FastScan::scan, as
+// timed by its scan task. The CSW event service is replaced by the fake-csw library (see FakeCsw.h),
+// so nothing is sent, and the demand event benchmarks only measure building the events.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <DemandPublisher.h>
+#include <TpkC.h>
+#include "FakeCsw.h"
+
+#ifndef TPK_JNI_VERSION
+#define TPK_JNI_VERSION "unknown"
+#endif
+
+static const char *prefix = "TCS.PointingKernelAssembly";
+
+// The kernel used by the benchmarks that need one, tracking a target
+static TpkC *tpkc;
+
+// Az, el (deg) spread over the sky above the enclosure limit
+static void skyGrid(std::vector<double> &az, std::vector<double> &el, int n) {
+    az.resize(static_cast<size_t>(n));
+    el.resize(static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        az[i] = fmod(i * 137.508, 360.0);
+        el[i] = 26.0 + fmod(i * 7.31, 63.0);
+    }
+}
+
+// --- Enclosure base and cap ---
+
+static void BM_BaseCap(benchmark::State &state) {
+    std::vector<double> az, el;
+    skyGrid(az, el, 1024);
+    size_t i = 0;
+    for (auto _ : state) {
+        double base, cap;
+        TpkC::calculateBaseAndCap(az[i], el[i], base, cap);
+        benchmark::DoNotOptimize(base);
+        benchmark::DoNotOptimize(cap);
+        i = (i + 1) & 1023;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BaseCap);
+
+static void BM_BaseCapBatch(benchmark::State &state) {
+    int n = static_cast<int>(state.range(0));
+    std::vector<double> az, el, base(static_cast<size_t>(n)), cap(static_cast<size_t>(n));
+    skyGrid(az, el, n);
+    for (auto _ : state) {
+        TpkC::calculateBaseAndCap(az.data(), el.data(), base.data(), cap.data(), n);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_BaseCapBatch)->Arg(16)->Arg(256)->Arg(4096);
+
+// --- RA/Dec to Az/El ---
+
+static void BM_RaDecToAzEl(benchmark::State &state) {
+    CoordPair p{};
+    int i = 0;
+    for (auto _ : state) {
+        tpkc->raDecToAzEl(185.0 + (i++ & 63) * 0.01, 11.0, &p);
+        benchmark::DoNotOptimize(p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RaDecToAzEl);
+
+static void BM_RaDecToAzElBatch(benchmark::State &state) {
+    int n = static_cast<int>(state.range(0));
+    std::vector<double> ra(static_cast<size_t>(n)), dec(static_cast<size_t>(n));
+    std::vector<double> az(static_cast<size_t>(n)), el(static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        ra[i] = fmod(i * 137.508, 360.0);
+        dec[i] = -30.0 + fmod(i * 7.31, 90.0);
+    }
+    for (auto _ : state) {
+        tpkc->raDecToAzEl(ra.data(), dec.data(), az.data(), el.data(), n);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_RaDecToAzElBatch)->Arg(16)->Arg(256)->Arg(4096);
+
+// --- One tick of the fast loop ---
+
+// The total execution time (s) and the number of executions of FastScan::scan so far
+static void fastLoopTotals(double &seconds, long &runs) {
+    ScanStats stats[3];
+    tpkc->loopStats(stats, 3);
+    seconds = stats[2].execution.meanUs * stats[2].execution.count * 1e-6;
+    runs = stats[2].execution.count;
+}
+
+// Runs the scan loops for one tick of the fast loop and sets the time of the iteration to the
+// execution time of FastScan::scan
+static void timeFastTick(benchmark::State &state) {
+    double s0, s1;
+    long r0, r1;
+    fastLoopTotals(s0, r0);
+    tpkc->runFor(0.01);
+    fastLoopTotals(s1, r1);
+    state.SetIterationTime(r1 > r0 ? (s1 - s0) / static_cast<double>(r1 - r0) : 0.0);
+}
+
+// Tracking a target: the time keeper, the mount and enclosure, base and cap, and queuing the demands
+static void BM_FastScanTick(benchmark::State &state) {
+    tpkc->newICRSTarget(185.0, 11.0);
+    tpkc->runFor(1.0);
+    for (auto _ : state) timeFastTick(state);
+}
+BENCHMARK(BM_FastScanTick)->UseManualTime();
+
+// A tick that applies a new target, alternating between two
+static void BM_TargetSwitch(benchmark::State &state) {
+    tpkc->runFor(0.1);
+    int i = 0;
+    for (auto _ : state) {
+        tpkc->newICRSTarget(i++ % 2 ? 185.0 : 186.0, 11.0);
+        timeFastTick(state);
+    }
+}
+BENCHMARK(BM_TargetSwitch)->UseManualTime();
+
+// A tick that applies a new offset, alternating between two
+static void BM_OffsetSwitch(benchmark::State &state) {
+    tpkc->newICRSTarget(185.0, 11.0);
+    tpkc->runFor(0.1);
+    int i = 0;
+    for (auto _ : state) {
+        tpkc->setICRSOffset(i++ % 2 ? 10.0 : -10.0, 5.0);
+        timeFastTick(state);
+    }
+}
+BENCHMARK(BM_OffsetSwitch)->UseManualTime();
+
+// The time for a command thread to post a new target (not timed in the fast loop)
+static void BM_NewTargetCommand(benchmark::State &state) {
+    int i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(tpkc->newICRSTarget(i++ % 2 ? 185.0 : 186.0, 11.0));
+}
+BENCHMARK(BM_NewTargetCommand);
+
+// --- Building the demand events for a tick (without publishing them) ---
+
+static void BM_BuildMcsDemandEvent(benchmark::State &state) {
+    McsDemandEvent mcs(prefix);
+    CswUtcTime time = cswUtcTime();
+    double el = 45.0;
+    for (auto _ : state) {
+        mcs.set(180.0, el += 1e-9, 10.0, 20.0, time, 1.5);
+        benchmark::DoNotOptimize(mcs.event());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BuildMcsDemandEvent);
+
+static void BM_BuildEcsDemandEvent(benchmark::State &state) {
+    EcsDemandEvent ecs(prefix);
+    CswUtcTime time = cswUtcTime();
+    double cap = 60.0;
+    for (auto _ : state) {
+        ecs.set(30.0, cap += 1e-9, time);
+        benchmark::DoNotOptimize(ecs.event());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BuildEcsDemandEvent);
+
+static void BM_BuildM3DemandEvent(benchmark::State &state) {
+    M3DemandEvent m3(prefix);
+    CswUtcTime time = cswUtcTime();
+    double tilt = 45.0;
+    for (auto _ : state) {
+        m3.set(90.0, tilt += 1e-9, time);
+        benchmark::DoNotOptimize(m3.event());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BuildM3DemandEvent);
+
+int main(int argc, char **argv) {
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    setenv("TPK_BATCH_THREADS", "1", 1);
+    unsetenv("TPK_PREDICT");
+    unsetenv("TPK_RECORD_DIR");
+
+    // Write JSON results unless told where to write them
+    std::vector<char *> args(argv, argv + argc);
+    bool out = false;
+    for (int i = 1; i < argc; i++) out |= strncmp(argv[i], "--benchmark_out=", 16) == 0;
+    char outArg[] = "--benchmark_out=tpk-jni-bench.json";
+    char formatArg[] = "--benchmark_out_format=json";
+    if (!out) {
+        args.push_back(outArg);
+        args.push_back(formatArg);
+    }
+    int n = static_cast<int>(args.size());
+    benchmark::Initialize(&n, args.data());
+    if (benchmark::ReportUnrecognizedArguments(n, args.data())) return 1;
+    benchmark::AddCustomContext("tpk_jni_version", TPK_JNI_VERSION);
+    benchmark::AddCustomContext("tpk_clock", "virtual FakeSystemClock from MJD 59580.5");
+
+    tpkc = new TpkC();
+    tpkc->init();
+    tpkc->newICRSTarget(185.0, 11.0);
+    tpkc->runFor(1.0);
+
+    // The kernel must be publishing to the fake event service, not to a real one
+    for (int i = 0; i < 100 && fakeCswPublishedEvents() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (fakeCswPublishedEvents() == 0) {
+        fprintf(stderr, "tpk-jni-bench: the demands were not published to the fake event service "
+                        "(is fake-csw linked ahead of csw?)\n");
+        tpkc->shutdown();
+        delete tpkc;
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    tpkc->shutdown();
+    delete tpkc;
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,78 @@
+//
+// Points per second converting RA/Dec to Az/El (and back) one point per call and in batches
+//
+// Starts the kernel with the fake system clock, so that the conversions are for a fixed time.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <TpkC.h>
+
+static const int numPoints = 100000;
+
+// Returns the throughput (points per second) of f
+template<typename F>
+static double throughput(F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+    return numPoints / t.count();
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    TpkC tpkc;
+    tpkc.init();
+
+    // Random points spread over the sky
+    std::vector<double> ra(numPoints), dec(numPoints), az(numPoints), el(numPoints);
+    std::vector<double> ra2(numPoints), dec2(numPoints);
+    unsigned int seed = 1;
+    for (int i = 0; i < numPoints; i++) {
+        ra[i] = rand_r(&seed) * 360.0 / RAND_MAX;
+        dec[i] = asin(2.0 * rand_r(&seed) / RAND_MAX - 1.0) * 180.0 / M_PI;
+    }
+
+    double single = throughput([&]() {
+        for (int i = 0; i < numPoints; i++) {
+            CoordPair azEl;
+            tpkc.raDecToAzEl(ra[i], dec[i], &azEl);
+            az[i] = azEl.a;
+            el[i] = azEl.b;
+        }
+    });
+    printf("%d points, %u CPUs\n", numPoints, std::thread::hardware_concurrency());
+    printf("raDecToAzEl one at a time  %10.0f points/s\n", single);
+
+    unsigned threads[] = {1, 2, 4, std::thread::hardware_concurrency()};
+    for (unsigned t : threads) {
+        if (t == 0) continue;
+        setenv("TPK_BATCH_THREADS", std::to_string(t).c_str(), 1);
+        double batch = throughput([&]() {
+            tpkc.raDecToAzEl(ra.data(), dec.data(), az.data(), el.data(), numPoints);
+        });
+        double back = throughput([&]() {
+            tpkc.azElToRaDec(az.data(), el.data(), ra2.data(), dec2.data(), numPoints);
+        });
+        printf("batch, %2u threads: raDecToAzEl %10.0f points/s (x%.1f), azElToRaDec %10.0f points/s\n",
+               t, batch, batch / single, back);
+    }
+
+    // Check the round trip, to be sure the batches did the work
+    double maxErr = 0.0;
+    for (int i = 0; i < numPoints; i++) {
+        double c = sin(dec[i] * M_PI / 180.0) * sin(dec2[i] * M_PI / 180.0) +
+                   cos(dec[i] * M_PI / 180.0) * cos(dec2[i] * M_PI / 180.0) * cos((ra[i] - ra2[i]) * M_PI / 180.0);
+        double err = acos(fmin(1.0, c)) * 180.0 / M_PI * 3600.0;
+        if (err > maxErr) maxErr = err;
+    }
+    printf("max round trip error %g arcsec\n", maxErr);
+
+    tpkc.shutdown();
+    return 0;
+}
@@ -0,0 +1,39 @@
+//
+// How the execution time of the fast loop grows with the number of virtual telescopes added to the mount
+// and enclosure, all tracking. Runs the loops in virtual time, so that nothing else is timed.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <TpkC.h>
+
+static const double seconds = 20.0;
+
+int main() {
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    printf("%d s of ticks per row, execution time of the fast loop in us\n", static_cast<int>(seconds));
+    printf("%4s %9s %9s %9s %9s %12s\n", "vts", "mean", "median", "99%", "max", "median/vt");
+
+    double base = 0.0;
+    for (int n = 0; n <= pkMaxVts; n = n ? n * 2 : 1) {
+        TpkC tpkc;
+        for (int i = 0; i < n; i++) {
+            char name[16];
+            snprintf(name, sizeof(name), "Vt%d", i);
+            tpkc.addVt(name);
+        }
+        tpkc.init();
+        tpkc.newICRSTarget(185.0, 11.0);
+        for (int i = 0; i < n; i++) tpkc.newVtTarget(i, PK_ICRS, 185.0 + 0.01 * i, 11.0);
+        tpkc.runFor(seconds);
+
+        ScanStats stats[3];
+        tpkc.loopStats(stats, 3);
+        const LatencySummary &e = stats[2].execution;
+        if (n == 0) base = e.p50Us;
+        printf("%4d %9.2f %9.2f %9.2f %9.2f %12.2f\n", n, e.meanUs, e.p50Us, e.p99Us, e.maxUs,
+               n ? (e.p50Us - base) / n : 0.0);
+        tpkc.shutdown();
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+//
+// Compares the wakeup latency of the named POSIX semaphores previously used by ScanTask
+// with the process private Wakeup class that replaced them.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <thread>
+#include <vector>
+#include <Wakeup.h>
+
+static const int numIterations = 20000;
+
+typedef std::chrono::steady_clock Clock;
+
+// Prints the median, 99th percentile and maximum of the given one way latencies (ns)
+static void report(const char *name, std::vector<double> &ns) {
+    std::sort(ns.begin(), ns.end());
+    printf("%-16s median %8.0f ns   p99 %8.0f ns   max %8.0f ns\n", name,
+           ns[ns.size() / 2], ns[ns.size() * 99 / 100], ns.back());
+}
+
+// Adapts a named POSIX semaphore to the post/wait interface of Wakeup
+class NamedSemaphore {
+public:
+    explicit NamedSemaphore(const char *name) : name(name) {
+        sem_unlink(name);
+        sem = sem_open(name, O_CREAT, 0777, 0);
+        if (sem == SEM_FAILED) perror("sem_open");
+    }
+
+    ~NamedSemaphore() {
+        sem_close(sem);
+        sem_unlink(name);
+    }
+
+    void post() { sem_post(sem); }
+
+    void wait() { sem_wait(sem); }
+
+private:
+    const char *name;
+    sem_t *sem;
+};
+
+// Measures ping-pong round trips between two threads. Half of each round trip is the one way
+// wakeup latency.
+template<typename Sem>
+static std::vector<double> pingPong(Sem &ping, Sem &pong) {
+    std::vector<double> ns;
+    ns.reserve(numIterations);
+
+    std::thread ponger([&]() {
+        for (int i = 0; i < numIterations; i++) {
+            ping.wait();
+            pong.post();
+        }
+    });
+
+    for (int i = 0; i < numIterations; i++) {
+        auto t0 = Clock::now();
+        ping.post();
+        pong.wait();
+        std::chrono::duration<double, std::nano> rt = Clock::now() - t0;
+        ns.push_back(rt.count() / 2.0);
+    }
+    ponger.join();
+    return ns;
+}
+
+int main() {
+    printf("One way wakeup latency over %d round trips\n", numIterations);
+    {
+        NamedSemaphore ping("/WakeupBenchPing"), pong("/WakeupBenchPong");
+        auto before = pingPong(ping, pong);
+        report("named sem_t", before);
+    }
+    {
+        Wakeup ping, pong;
+        auto after = pingPong(ping, pong);
+        report("Wakeup", after);
+    }
+    return 0;
+}
@@ -0,0 +1,337 @@
+#include "BaseCap.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BASECAP_AVX2
+#include <immintrin.h>
+#endif
+
+// Convert degrees to radians
+#define deg2Rad(d) ((d) * M_PI / 180.0)
+
+// Convert radians to degrees
+#define rad2Deg(d) ((d) * 180.0 / M_PI)
+
+static const double ci = deg2Rad(32.5);
+static const double ciz = deg2Rad(90.0 - 32.5);
+static const double PI2 = M_PI * 2;
+
+
+// From table:
+// cap  =ROUND(DEGREES(ACOS(TAN(RADIANS(el-57.5)) / TAN(RADIANS(32.5)))),1)
+// base =ROUND(DEGREES(ATAN(SIN(RADIANS(cap)/COS(RADIANS(32.5))*(1-COS(RADIANS(cap)))))),1)
+// ???  =ROUND(DEGREES(ACOS(TAN(RADIANS(A2-57.5+1)) / TAN(RADIANS(32.5)))),1)
+
+// Calculates the base and cap values
+void BaseCap::calculate(double azDeg, double elDeg, double &baseDeg, double &capDeg) {
+    double azRad = deg2Rad(azDeg);
+    double elRad = deg2Rad(elDeg);
+
+    if ((elRad > PI2) || (elRad < 0)) {
+        elRad = 0;
+    }
+    if ((azRad > PI2) || (azRad < 0)) {
+        azRad = 0;
+    }
+
+    // Convert Az, El into base & cap coordinates
+    double capRad = acos(tan(elRad - ciz) / tan(ci));
+    // check for division by zero from altitude angle at 90 degrees
+    double azShift = (elRad == M_PI_2) ? 0.0 : atan(sin(capRad / cos(ci) * (1 - cos(capRad))));
+    double baseRad = ((azRad + azShift) > PI2) ? (azRad + azShift) - PI2 : azRad + azShift;
+    baseDeg = rad2Deg(baseRad);
+    capDeg = rad2Deg(capRad);
+}
+
+void BaseCap::calculateBatchScalar(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg,
+                                   size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        calculate(azDeg[i], elDeg[i], baseDeg[i], capDeg[i]);
+    }
+}
+
+#ifdef BASECAP_AVX2
+
+/*
+   AVX2 versions of tan, sin, atan and acos for four doubles at a time.
+
+   These follow the Cephes library (S. L. Moshier) implementations: the argument is reduced by
+   multiples of pi/4 (tan, sin) or split into ranges (atan, asin) and a rational or polynomial
+   approximation is evaluated. Branches are replaced by computing both sides and blending, so they
+   are accurate to a few units in the last place over the whole range and give NaN where the libm
+   functions do.
+*/
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+static const double PIO2 = 1.57079632679489661923;
+static const double PIO4 = 7.85398163397448309616E-1;
+static const double FOPI = 1.27323954473516268615;   // 4/pi
+static const double DP1 = 7.853981554508209228515625E-1;
+static const double DP2 = 7.94662735614792836714E-9;
+static const double DP3 = 3.06161699786838294307E-17;
+static const double MOREBITS = 6.123233995736765886130E-17;
+static const double T3P8 = 2.41421356237309504880;   // tan(3pi/8)
+
+static const double tanP[] = {-1.30936939181383777646E4, 1.15351664838587416140E6, -1.79565251976484877988E7};
+static const double tanQ[] = {1.36812963470692954678E4, -1.32089234440210967447E6, 2.50083801823357915839E7,
+                              -5.38695755929454629881E7};
+
+static const double sinCof[] = {1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+                                -1.98412698295895385996E-4, 8.33333333332211858878E-3, -1.66666666666666307295E-1};
+static const double cosCof[] = {-1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+                                2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2};
+
+static const double atanP[] = {-8.750608600031904122785E-1, -1.615753718733365076637E1, -7.500855792314704667340E1,
+                               -1.228866684490136173410E2, -6.485021904942025371773E1};
+static const double atanQ[] = {2.485846490142306297962E1, 1.650270098316988542046E2, 4.328810604912902668951E2,
+                               4.853903996359136964868E2, 1.945506571482613964425E2};
+
+static const double asinP[] = {4.253011369004428248960E-3, -6.019598008014123785661E-1, 5.444622390564711410273E0,
+                               -1.626247967210700244449E1, 1.956261983317594739197E1, -8.198089802484824371615E0};
+static const double asinQ[] = {-1.474091372988853791896E1, 7.049610280856842141659E1, -1.471791292232726029859E2,
+                               1.395105614657485689735E2, -4.918853881490881290097E1};
+static const double asinR[] = {2.967721961301243206100E-3, -5.634242780008963776856E-1, 6.968710824104713396794E0,
+                               -2.556901049652824852289E1, 2.853665548261061424989E1};
+static const double asinS[] = {-2.194779531642920639778E1, 1.470656354026814941758E2, -3.838770957603691357202E2,
+                               3.424398657913078477438E2};
+
+// Evaluates the polynomial c[0]*x^(n-1) + ... + c[n-1]
+AVX2_TARGET static inline __m256d polevl(__m256d x, const double *c, int n) {
+    __m256d r = _mm256_set1_pd(c[0]);
+    for (int i = 1; i < n; i++) r = _mm256_fmadd_pd(r, x, _mm256_set1_pd(c[i]));
+    return r;
+}
+
+// Evaluates the polynomial x^n + c[0]*x^(n-1) + ... + c[n-1]
+AVX2_TARGET static inline __m256d p1evl(__m256d x, const double *c, int n) {
+    __m256d r = _mm256_add_pd(x, _mm256_set1_pd(c[0]));
+    for (int i = 1; i < n; i++) r = _mm256_fmadd_pd(r, x, _mm256_set1_pd(c[i]));
+    return r;
+}
+
+// Returns x modulo m for non-negative integral x
+AVX2_TARGET static inline __m256d fmodInt(__m256d x, double m) {
+    __m256d vm = _mm256_set1_pd(m);
+    return _mm256_sub_pd(x, _mm256_mul_pd(vm, _mm256_floor_pd(_mm256_div_pd(x, vm))));
+}
+
+AVX2_TARGET static inline __m256d signBit() {
+    return _mm256_set1_pd(-0.0);
+}
+
+// Reduces x (>= 0) to z in [-pi/4, pi/4] and the (even) number of octants y
+AVX2_TARGET static inline __m256d reduce(__m256d x, __m256d &y) {
+    y = _mm256_floor_pd(_mm256_mul_pd(x, _mm256_set1_pd(FOPI)));
+    __m256d odd = _mm256_cmp_pd(fmodInt(y, 2.0), _mm256_set1_pd(1.0), _CMP_EQ_OQ);
+    y = _mm256_add_pd(y, _mm256_and_pd(odd, _mm256_set1_pd(1.0)));
+    __m256d z = _mm256_fnmadd_pd(y, _mm256_set1_pd(DP1), x);
+    z = _mm256_fnmadd_pd(y, _mm256_set1_pd(DP2), z);
+    return _mm256_fnmadd_pd(y, _mm256_set1_pd(DP3), z);
+}
+
+AVX2_TARGET static __m256d tan4(__m256d x) {
+    __m256d sign = _mm256_and_pd(x, signBit());
+    x = _mm256_andnot_pd(signBit(), x);
+    __m256d y;
+    __m256d z = reduce(x, y);
+    __m256d zz = _mm256_mul_pd(z, z);
+    __m256d r = _mm256_div_pd(_mm256_mul_pd(zz, polevl(zz, tanP, 3)), p1evl(zz, tanQ, 4));
+    r = _mm256_fmadd_pd(z, r, z);
+    __m256d cot = _mm256_cmp_pd(fmodInt(y, 4.0), _mm256_set1_pd(2.0), _CMP_EQ_OQ);
+    r = _mm256_blendv_pd(r, _mm256_div_pd(_mm256_set1_pd(-1.0), r), cot);
+    return _mm256_xor_pd(r, sign);
+}
+
+AVX2_TARGET static __m256d sin4(__m256d x) {
+    __m256d sign = _mm256_and_pd(x, signBit());
+    x = _mm256_andnot_pd(signBit(), x);
+    __m256d y;
+    __m256d z = reduce(x, y);
+    __m256d j = fmodInt(y, 8.0);
+    __m256d upper = _mm256_cmp_pd(j, _mm256_set1_pd(3.0), _CMP_GT_OQ);
+    sign = _mm256_xor_pd(sign, _mm256_and_pd(upper, signBit()));
+    j = _mm256_sub_pd(j, _mm256_and_pd(upper, _mm256_set1_pd(4.0)));
+    __m256d zz = _mm256_mul_pd(z, z);
+    __m256d c = _mm256_fmadd_pd(_mm256_mul_pd(zz, zz), polevl(zz, cosCof, 6),
+                                _mm256_fnmadd_pd(_mm256_set1_pd(0.5), zz, _mm256_set1_pd(1.0)));
+    __m256d s = _mm256_fmadd_pd(_mm256_mul_pd(z, zz), polevl(zz, sinCof, 6), z);
+    __m256d useCos = _mm256_cmp_pd(j, _mm256_set1_pd(2.0), _CMP_EQ_OQ);
+    return _mm256_xor_pd(_mm256_blendv_pd(s, c, useCos), sign);
+}
+
+AVX2_TARGET static __m256d atan4(__m256d x) {
+    __m256d sign = _mm256_and_pd(x, signBit());
+    x = _mm256_andnot_pd(signBit(), x);
+    __m256d one = _mm256_set1_pd(1.0);
+    __m256d big = _mm256_cmp_pd(x, _mm256_set1_pd(T3P8), _CMP_GT_OQ);
+    __m256d mid = _mm256_andnot_pd(big, _mm256_cmp_pd(x, _mm256_set1_pd(0.66), _CMP_GT_OQ));
+    __m256d xr = _mm256_blendv_pd(x, _mm256_div_pd(_mm256_sub_pd(x, one), _mm256_add_pd(x, one)), mid);
+    xr = _mm256_blendv_pd(xr, _mm256_div_pd(_mm256_set1_pd(-1.0), x), big);
+    __m256d y = _mm256_or_pd(_mm256_and_pd(big, _mm256_set1_pd(PIO2)), _mm256_and_pd(mid, _mm256_set1_pd(PIO4)));
+    __m256d more = _mm256_or_pd(_mm256_and_pd(big, _mm256_set1_pd(MOREBITS)),
+                                _mm256_and_pd(mid, _mm256_set1_pd(0.5 * MOREBITS)));
+    __m256d z = _mm256_mul_pd(xr, xr);
+    z = _mm256_div_pd(_mm256_mul_pd(z, polevl(z, atanP, 5)), p1evl(z, atanQ, 5));
+    z = _mm256_add_pd(_mm256_fmadd_pd(xr, z, xr), more);
+    return _mm256_xor_pd(_mm256_add_pd(y, z), sign);
+}
+
+// Returns NaN for |x| > 1 (from the square root of a negative number)
+AVX2_TARGET static __m256d asin4(__m256d x) {
+    __m256d sign = _mm256_and_pd(x, signBit());
+    __m256d a = _mm256_andnot_pd(signBit(), x);
+    __m256d pio4 = _mm256_set1_pd(PIO4);
+
+    // |x| > 0.625
+    __m256d zz = _mm256_sub_pd(_mm256_set1_pd(1.0), a);
+    __m256d p = _mm256_div_pd(_mm256_mul_pd(zz, polevl(zz, asinR, 5)), p1evl(zz, asinS, 4));
+    zz = _mm256_sqrt_pd(_mm256_add_pd(zz, zz));
+    __m256d zb = _mm256_sub_pd(pio4, zz);
+    zb = _mm256_sub_pd(zb, _mm256_fmsub_pd(zz, p, _mm256_set1_pd(MOREBITS)));
+    zb = _mm256_add_pd(zb, pio4);
+
+    // |x| <= 0.625
+    __m256d zs = _mm256_mul_pd(a, a);
+    zs = _mm256_div_pd(_mm256_mul_pd(zs, polevl(zs, asinP, 6)), p1evl(zs, asinQ, 5));
+    zs = _mm256_fmadd_pd(a, zs, a);
+
+    __m256d big = _mm256_cmp_pd(a, _mm256_set1_pd(0.625), _CMP_NLE_UQ);
+    return _mm256_xor_pd(_mm256_blendv_pd(zs, zb, big), sign);
+}
+
+AVX2_TARGET static __m256d acos4(__m256d x) {
+    __m256d half = _mm256_set1_pd(0.5);
+    __m256d hi = _mm256_cmp_pd(x, half, _CMP_GT_OQ);
+    __m256d rhi = _mm256_mul_pd(_mm256_set1_pd(2.0), asin4(_mm256_sqrt_pd(_mm256_fnmadd_pd(half, x, half))));
+    __m256d pio4 = _mm256_set1_pd(PIO4);
+    __m256d rlo = _mm256_add_pd(_mm256_add_pd(_mm256_sub_pd(pio4, asin4(x)), _mm256_set1_pd(MOREBITS)), pio4);
+    return _mm256_blendv_pd(rlo, rhi, hi);
+}
+
+AVX2_TARGET static void calculateBatchAvx2(const double *azDeg, const double *elDeg, double *baseDeg,
+                                           double *capDeg, size_t n) {
+    const __m256d pi = _mm256_set1_pd(M_PI);
+    const __m256d d180 = _mm256_set1_pd(180.0);
+    const __m256d pi2 = _mm256_set1_pd(PI2);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d tanCi = _mm256_set1_pd(tan(ci));
+    const __m256d cosCi = _mm256_set1_pd(cos(ci));
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d azRad = _mm256_div_pd(_mm256_mul_pd(_mm256_loadu_pd(azDeg + i), pi), d180);
+        __m256d elRad = _mm256_div_pd(_mm256_mul_pd(_mm256_loadu_pd(elDeg + i), pi), d180);
+
+        // Out of range angles are replaced by zero
+        __m256d badEl = _mm256_or_pd(_mm256_cmp_pd(elRad, pi2, _CMP_GT_OQ), _mm256_cmp_pd(elRad, zero, _CMP_LT_OQ));
+        elRad = _mm256_andnot_pd(badEl, elRad);
+        __m256d badAz = _mm256_or_pd(_mm256_cmp_pd(azRad, pi2, _CMP_GT_OQ), _mm256_cmp_pd(azRad, zero, _CMP_LT_OQ));
+        azRad = _mm256_andnot_pd(badAz, azRad);
+
+        // cos(cap) is just the argument of acos
+        __m256d cosCap = _mm256_div_pd(tan4(_mm256_sub_pd(elRad, _mm256_set1_pd(ciz))), tanCi);
+        __m256d capRad = acos4(cosCap);
+        __m256d arg = _mm256_mul_pd(_mm256_div_pd(capRad, cosCi), _mm256_sub_pd(_mm256_set1_pd(1.0), cosCap));
+        __m256d azShift = atan4(sin4(arg));
+        azShift = _mm256_andnot_pd(_mm256_cmp_pd(elRad, _mm256_set1_pd(M_PI_2), _CMP_EQ_OQ), azShift);
+
+        __m256d baseRad = _mm256_add_pd(azRad, azShift);
+        baseRad = _mm256_sub_pd(baseRad, _mm256_and_pd(_mm256_cmp_pd(baseRad, pi2, _CMP_GT_OQ), pi2));
+
+        _mm256_storeu_pd(baseDeg + i, _mm256_div_pd(_mm256_mul_pd(baseRad, d180), pi));
+        _mm256_storeu_pd(capDeg + i, _mm256_div_pd(_mm256_mul_pd(capRad, d180), pi));
+    }
+
+    // The remaining 0-3 positions
+    BaseCap::calculateBatchScalar(azDeg + i, elDeg + i, baseDeg + i, capDeg + i, n - i);
+}
+
+bool BaseCap::haveAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return avx2;
+}
+
+void BaseCap::calculateBatch(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg, size_t n) {
+    if (haveAvx2()) {
+        calculateBatchAvx2(azDeg, elDeg, baseDeg, capDeg, n);
+    } else {
+        calculateBatchScalar(azDeg, elDeg, baseDeg, capDeg, n);
+    }
+}
+
+#else
+
+bool BaseCap::haveAvx2() {
+    return false;
+}
+
+void BaseCap::calculateBatch(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg, size_t n) {
+    calculateBatchScalar(azDeg, elDeg, baseDeg, capDeg, n);
+}
+
+#endif
+
+// The range of elevations for which the base and cap can be calculated (deg)
+static const double minEl = 90.0 - 2 * 32.5;
+static const double maxEl = 90.0;
+
+/*
+   The spacing is adjusted so that the samples fall exactly on the limits. Cubic interpolation needs
+   the samples either side of the interval and the slope of the cap is infinite at the limits, so the
+   table is only used at least two samples away from them.
+*/
+BaseCapTable::BaseCapTable(double resolutionDeg, Interpolation interpolation) : interp(interpolation) {
+    int n = static_cast<int>(ceil((maxEl - minEl) / (resolutionDeg > 0.0 ? resolutionDeg : 0.1)));
+    if (n < 8) n = 8;
+    res = (maxEl - minEl) / n;
+    elLo = minEl + 2 * res;
+    elHi = maxEl - 2 * res;
+
+    cap.resize(n + 1);
+    shift.resize(n + 1);
+    for (int i = 0; i <= n; i++) {
+        double baseDeg, capDeg;
+        BaseCap::calculate(0.0, i == n ? maxEl : minEl + i * res, baseDeg, capDeg);
+        cap[i] = capDeg;
+        shift[i] = baseDeg;
+    }
+}
+
+double BaseCapTable::interpolate(const double *table, double x) const {
+    int i = static_cast<int>(x);
+    double t = x - i;
+    if (interp == LINEAR) {
+        return table[i] + t * (table[i + 1] - table[i]);
+    }
+    // Catmull-Rom spline through table[i - 1] .. table[i + 2]
+    double p0 = table[i - 1], p1 = table[i], p2 = table[i + 1], p3 = table[i + 2];
+    return p1 + 0.5 * t * (p2 - p0 + t * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 + t * (3.0 * (p1 - p2) + p3 - p0)));
+}
+
+void BaseCapTable::calculate(double azDeg, double elDeg, double &baseDeg, double &capDeg) const {
+    if (!(elDeg >= elLo && elDeg <= elHi && azDeg >= 0.0 && azDeg <= 360.0)) {
+        BaseCap::calculate(azDeg, elDeg, baseDeg, capDeg);
+        return;
+    }
+    double x = (elDeg - minEl) / res;
+    capDeg = interpolate(cap.data(), x);
+    double b = azDeg + interpolate(shift.data(), x);
+    baseDeg = b > 360.0 ? b - 360.0 : b;
+}
+
+BaseCapTable *BaseCapTable::fromEnv() {
+    const char *s = getenv("TPK_BASECAP_TABLE");
+    if (!s) return nullptr;
+    Interpolation interpolation = strcmp(s, "linear") == 0 ? LINEAR : CUBIC;
+    if (interpolation == CUBIC && strcmp(s, "cubic") != 0) {
+        printf("Warning: Unknown TPK_BASECAP_TABLE %s: using cubic\n", s);
+    }
+    const char *r = getenv("TPK_BASECAP_TABLE_RESOLUTION");
+    double resolution = r ? atof(r) : 0.1;
+    return new BaseCapTable(resolution, interpolation);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Conversion of az,el to the base and cap coordinates of the enclosure.
+//
+// calculateBatch() converts arrays of positions (structure of arrays). On x86-64 CPUs with AVX2 it
+// converts four positions at a time with vectorized versions of the transcendental functions,
+// otherwise it falls back to calling calculate() for each position. Positions that cannot be
+// reached by the enclosure give NaN, as with calculate().
+class BaseCap {
+public:
+    // Calculates base and cap (in deg) from the az and el coordinates (in deg)
+    static void calculate(double azDeg, double elDeg, double &baseDeg, double &capDeg);
+
+    // Calculates base[i] and cap[i] (in deg) from az[i] and el[i] (in deg) for i < n
+    static void calculateBatch(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg, size_t n);
+
+    // The scalar version of calculateBatch()
+    static void calculateBatchScalar(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg,
+                                     size_t n);
+
+    // Returns true if calculateBatch() uses the AVX2 version
+    static bool haveAvx2();
+};
+
+// A precomputed, elevation indexed table of the cap and of the azimuth shift (base - az), which depend
+// only on the elevation, with linear or cubic (Catmull-Rom) interpolation.
+//
+// The table covers the elevations the enclosure can reach (25 to 90 deg). Near the limits, where the
+// cap changes infinitely fast, and outside them calculate() falls back to BaseCap::calculate().
+class BaseCapTable {
+public:
+    enum Interpolation {
+        LINEAR, CUBIC
+    };
+
+    // Builds the table with (at most) the given spacing in elevation
+    BaseCapTable(double resolutionDeg, Interpolation interpolation);
+
+    // Calculates base and cap (in deg) from the az and el coordinates (in deg)
+    void calculate(double azDeg, double elDeg, double &baseDeg, double &capDeg) const;
+
+    // Returns a new table configured by the environment variables TPK_BASECAP_TABLE ("linear" or
+    // "cubic") and TPK_BASECAP_TABLE_RESOLUTION (deg, default 0.1), or null if TPK_BASECAP_TABLE is not set
+    static BaseCapTable *fromEnv();
+
+    double resolution() const { return res; }
+
+    Interpolation interpolation() const { return interp; }
+
+private:
+    // Interpolates the given table at fractional index x
+    double interpolate(const double *table, double x) const;
+
+    double res;
+    Interpolation interp;
+    double elLo, elHi;           // range in which the table is used
+    std::vector<double> cap;     // at elevations 25 + i * res deg
+    std::vector<double> shift;
+};
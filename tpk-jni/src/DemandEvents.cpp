@@ -0,0 +1,191 @@
+#include "DemandEvents.h"
+
+#include <cmath>
+#include <cstring>
+
+// Convert degrees to microarcseconds
+static double deg2Mas(double d) { return d * 60.0 * 60.0 * 1000.0 * 1000.0; }
+
+DemandEvent::~DemandEvent() {
+    if (made) cswFreeEvent(cswEvent);
+}
+
+// Note that the parameters and their values are members of the subclass and outlive the event, so it
+// does not matter whether the CSW library copies them or keeps the pointers: values() always returns
+// the array that is actually published.
+void DemandEvent::makeEvent(const char *prefix, const char *eventName, CswParameter *params, int numParams) {
+    CswParamSet paramSet = {.params = params, .numParams = numParams};
+    cswEvent = cswMakeEvent(SystemEvent, prefix, eventName, paramSet);
+    made = true;
+}
+
+McsDemandEvent::McsDemandEvent(const char *prefix, const char *eventName) {
+    // trackID
+    trackIdAr[0] = "trackid-0"; // TODO
+    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
+    params[0] = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+
+    // pos
+    posValues[0] = cswMakeAltAzCoord("BASE", 0, 0);
+    CswArrayValue arrayValues = {.values = posValues, .numValues = 1};
+    params[1] = cswMakeParameter("pos", AltAzCoordKey, arrayValues, csw_unit_NoUnits);
+
+    // posRaDec
+    posRaDecValues[0] = cswMakeEqCoord("BASE", 0, 0, ICRS, "none", 0.0f, 0.0f);
+    CswArrayValue posRaDecArrayValues = {.values = posRaDecValues, .numValues = 1};
+    params[2] = cswMakeParameter("posRaDec", EqCoordKey, posRaDecArrayValues, csw_unit_NoUnits);
+
+    // time
+    timeAr[0] = cswUtcTime();
+    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
+    params[3] = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+
+    // sidereal time in hours
+    siderealTimeAr[0] = 0.0;
+    CswArrayValue siderealTimeValues = {.values = siderealTimeAr, .numValues = 1};
+    params[4] = cswMakeParameter("siderealTime", DoubleKey, siderealTimeValues, csw_unit_hour);
+
+    makeEvent(prefix, eventName, params, 5);
+}
+
+void McsDemandEvent::set(double az, double el, double ra, double dec, CswUtcTime time, double siderealTime) {
+    values<CswAltAzCoord>(1)[0] = cswMakeAltAzCoord("BASE", lround(deg2Mas(el)), lround(deg2Mas(az)));
+    values<CswEqCoord>(2)[0] = cswMakeEqCoord("BASE", lround(deg2Mas(ra)), lround(deg2Mas(dec)),
+                                              ICRS, "none", 0.0f, 0.0f);
+    values<CswUtcTime>(3)[0] = time;
+    values<double>(4)[0] = siderealTime;
+}
+
+EcsDemandEvent::EcsDemandEvent(const char *prefix) {
+    // trackID
+    trackIdAr[0] = "trackid-0"; // TODO
+    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
+    params[0] = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+
+    // BasePosition
+    baseAr[0] = 0.0;
+    CswArrayValue baseValues = {.values = baseAr, .numValues = 1};
+    params[1] = cswMakeParameter("BasePosition", DoubleKey, baseValues, csw_unit_degree);
+
+    // CapPosition
+    capAr[0] = 0.0;
+    CswArrayValue capValues = {.values = capAr, .numValues = 1};
+    params[2] = cswMakeParameter("CapPosition", DoubleKey, capValues, csw_unit_degree);
+
+    // time
+    timeAr[0] = cswUtcTime();
+    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
+    params[3] = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+
+    makeEvent(prefix, "EnclosureDemandPosition", params, 4);
+}
+
+void EcsDemandEvent::set(double base, double cap, CswUtcTime time) {
+    values<double>(1)[0] = base;
+    values<double>(2)[0] = cap;
+    values<CswUtcTime>(3)[0] = time;
+}
+
+M3DemandEvent::M3DemandEvent(const char *prefix) {
+    // trackID
+    trackIdAr[0] = "trackid-0"; // TODO
+    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
+    params[0] = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+
+    // RotationPosition
+    rotationAr[0] = 0.0;
+    CswArrayValue rotationValues = {.values = rotationAr, .numValues = 1};
+    params[1] = cswMakeParameter("RotationPosition", DoubleKey, rotationValues, csw_unit_degree);
+
+    // TiltPosition
+    tiltAr[0] = 0.0;
+    CswArrayValue tiltValues = {.values = tiltAr, .numValues = 1};
+    params[2] = cswMakeParameter("TiltPosition", DoubleKey, tiltValues, csw_unit_degree);
+
+    // time
+    timeAr[0] = cswUtcTime();
+    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
+    params[3] = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+
+    makeEvent(prefix, "M3DemandPosition", params, 4);
+}
+
+void M3DemandEvent::set(double rotation, double tilt, CswUtcTime time) {
+    values<double>(1)[0] = rotation;
+    values<double>(2)[0] = tilt;
+    values<CswUtcTime>(3)[0] = time;
+}
+
+LoopStatsEvent::LoopStatsEvent(const char *prefix, const char *const *loopNames, int numLoops) {
+    n = numLoops < maxLoops ? numLoops : maxLoops;
+    memset(names, 0, sizeof names);
+    for (int i = 0; i < maxLoops; i++) {
+        if (i < n) strncpy(names[i], loopNames[i], sizeof names[i] - 1);
+        loopAr[i] = names[i];
+        runsAr[i] = missedTicksAr[i] = overrunsAr[i] = 0;
+        wakeupP50Ar[i] = wakeupP99Ar[i] = wakeupMaxAr[i] = 0.0;
+        executionP50Ar[i] = executionP99Ar[i] = executionMaxAr[i] = 0.0;
+        jitterP99Ar[i] = jitterMaxAr[i] = 0.0;
+    }
+
+    CswArrayValue loopValues = {.values = loopAr, .numValues = n};
+    params[0] = cswMakeParameter("loop", StringKey, loopValues, csw_unit_NoUnits);
+
+    CswArrayValue runsValues = {.values = runsAr, .numValues = n};
+    params[1] = cswMakeParameter("runs", LongKey, runsValues, csw_unit_NoUnits);
+
+    CswArrayValue missedTicksValues = {.values = missedTicksAr, .numValues = n};
+    params[2] = cswMakeParameter("missedTicks", LongKey, missedTicksValues, csw_unit_NoUnits);
+
+    CswArrayValue overrunsValues = {.values = overrunsAr, .numValues = n};
+    params[3] = cswMakeParameter("overruns", LongKey, overrunsValues, csw_unit_NoUnits);
+
+    CswArrayValue wakeupP50Values = {.values = wakeupP50Ar, .numValues = n};
+    params[4] = cswMakeParameter("wakeupP50", DoubleKey, wakeupP50Values, csw_unit_microsecond);
+
+    CswArrayValue wakeupP99Values = {.values = wakeupP99Ar, .numValues = n};
+    params[5] = cswMakeParameter("wakeupP99", DoubleKey, wakeupP99Values, csw_unit_microsecond);
+
+    CswArrayValue wakeupMaxValues = {.values = wakeupMaxAr, .numValues = n};
+    params[6] = cswMakeParameter("wakeupMax", DoubleKey, wakeupMaxValues, csw_unit_microsecond);
+
+    CswArrayValue executionP50Values = {.values = executionP50Ar, .numValues = n};
+    params[7] = cswMakeParameter("executionP50", DoubleKey, executionP50Values, csw_unit_microsecond);
+
+    CswArrayValue executionP99Values = {.values = executionP99Ar, .numValues = n};
+    params[8] = cswMakeParameter("executionP99", DoubleKey, executionP99Values, csw_unit_microsecond);
+
+    CswArrayValue executionMaxValues = {.values = executionMaxAr, .numValues = n};
+    params[9] = cswMakeParameter("executionMax", DoubleKey, executionMaxValues, csw_unit_microsecond);
+
+    CswArrayValue jitterP99Values = {.values = jitterP99Ar, .numValues = n};
+    params[10] = cswMakeParameter("jitterP99", DoubleKey, jitterP99Values, csw_unit_microsecond);
+
+    CswArrayValue jitterMaxValues = {.values = jitterMaxAr, .numValues = n};
+    params[11] = cswMakeParameter("jitterMax", DoubleKey, jitterMaxValues, csw_unit_microsecond);
+
+    // time
+    timeAr[0] = cswUtcTime();
+    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
+    params[12] = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+
+    makeEvent(prefix, "PkLoopStats", params, 13);
+}
+
+void LoopStatsEvent::set(const ScanStats *stats, CswUtcTime time) {
+    for (int i = 0; i < n; i++) {
+        const ScanStats &s = stats[i];
+        values<long>(1)[i] = s.runs;
+        values<long>(2)[i] = s.missedTicks;
+        values<long>(3)[i] = s.overruns;
+        values<double>(4)[i] = s.wakeup.p50Us;
+        values<double>(5)[i] = s.wakeup.p99Us;
+        values<double>(6)[i] = s.wakeup.maxUs;
+        values<double>(7)[i] = s.execution.p50Us;
+        values<double>(8)[i] = s.execution.p99Us;
+        values<double>(9)[i] = s.execution.maxUs;
+        values<double>(10)[i] = s.jitter.p99Us;
+        values<double>(11)[i] = s.jitter.maxUs;
+    }
+    values<CswUtcTime>(12)[0] = time;
+}
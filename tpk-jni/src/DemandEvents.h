@@ -0,0 +1,118 @@
+#pragma once
+
+#include "csw/csw.h"
+#include "ScanTask.h"
+
+// Base class for the demand events published by the pk assembly at up to 100Hz.
+//
+// The CSW event (parameters, param set and the arrays holding the values) is built once, in the
+// constructor of the subclass, and reused for every publish: set() only overwrites the numeric values
+// in place, so publishing a demand does not allocate or free anything.
+class DemandEvent {
+public:
+    virtual ~DemandEvent();
+
+    // Disable copy: the event points into this object
+    DemandEvent(DemandEvent const &) = delete;
+
+    DemandEvent &operator=(DemandEvent const &) = delete;
+
+    // The event, with the values from the last call to set()
+    const CswEvent &event() const { return cswEvent; }
+
+protected:
+    DemandEvent() = default;
+
+    // Makes the event from the given parameters (called once by the subclass constructor)
+    void makeEvent(const char *prefix, const char *eventName, CswParameter *params, int numParams);
+
+    // Returns the values of the given parameter of the event
+    template<typename T>
+    T *values(int param) { return static_cast<T *>(cswEvent.paramSet.params[param].values.values); }
+
+private:
+    CswEvent cswEvent{};
+    bool made = false;
+};
+
+// TCS.PointingKernelAssembly.MountDemandPosition, or the same parameters in an event of another name for
+// the virtual telescopes added to the mount (the name must outlive the event)
+class McsDemandEvent : public DemandEvent {
+public:
+    explicit McsDemandEvent(const char *prefix, const char *eventName = "MountDemandPosition");
+
+    // az, el, ra, dec are in degrees, siderealTime in hours
+    void set(double az, double el, double ra, double dec, CswUtcTime time, double siderealTime);
+
+private:
+    const char *trackIdAr[1];
+    CswAltAzCoord posValues[1];
+    CswEqCoord posRaDecValues[1];
+    CswUtcTime timeAr[1];
+    double siderealTimeAr[1];
+    CswParameter params[5];
+};
+
+// TCS.PointingKernelAssembly.EnclosureDemandPosition
+class EcsDemandEvent : public DemandEvent {
+public:
+    explicit EcsDemandEvent(const char *prefix);
+
+    // base and cap are in degrees
+    void set(double base, double cap, CswUtcTime time);
+
+private:
+    const char *trackIdAr[1];
+    double baseAr[1];
+    double capAr[1];
+    CswUtcTime timeAr[1];
+    CswParameter params[4];
+};
+
+// TCS.PointingKernelAssembly.M3DemandPosition
+class M3DemandEvent : public DemandEvent {
+public:
+    explicit M3DemandEvent(const char *prefix);
+
+    // rotation and tilt are in degrees
+    void set(double rotation, double tilt, CswUtcTime time);
+
+private:
+    const char *trackIdAr[1];
+    double rotationAr[1];
+    double tiltAr[1];
+    CswUtcTime timeAr[1];
+    CswParameter params[4];
+};
+
+// TCS.PointingKernelAssembly.PkLoopStats: the timing statistics of the scan loops, with one value per
+// loop in each parameter (latencies in microseconds)
+class LoopStatsEvent : public DemandEvent {
+public:
+    static const int maxLoops = 8;
+
+    LoopStatsEvent(const char *prefix, const char *const *loopNames, int numLoops);
+
+    // stats has an entry for each loop, in the same order as the names
+    void set(const ScanStats *stats, CswUtcTime time);
+
+    int numLoops() const { return n; }
+
+private:
+    int n;
+    char names[maxLoops][16];
+    const char *loopAr[maxLoops];
+    long runsAr[maxLoops];
+    long missedTicksAr[maxLoops];
+    long overrunsAr[maxLoops];
+    double wakeupP50Ar[maxLoops];
+    double wakeupP99Ar[maxLoops];
+    double wakeupMaxAr[maxLoops];
+    double executionP50Ar[maxLoops];
+    double executionP99Ar[maxLoops];
+    double executionMaxAr[maxLoops];
+    double jitterP99Ar[maxLoops];
+    double jitterMaxAr[maxLoops];
+    CswUtcTime timeAr[1];
+    CswParameter params[13];
+};
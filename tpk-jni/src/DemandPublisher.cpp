@@ -0,0 +1,171 @@
+#include "DemandPublisher.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Monotonic.h"
+
+static const size_t defaultQueueSize = 256;
+
+DemandPublisher::DemandPublisher(CswEventServiceContext publisher, const char *prefix, PublishPolicy policy,
+                                 size_t queueSize) :
+        publisher(publisher), publishEvent(cswEventPublish), prefix(prefix), policy(policy), queue(queueSize), running(false),
+        mcsDemand(prefix), ecsDemand(prefix), m3Demand(prefix), numVts(0), loopStatsEvent(nullptr), loopStatsRequested(false),
+        queued(0), published(0), events(0), dropped(0), maxDepth(0), lastLatencyNs(0), totalLatencyNs(0), maxLatencyNs(0) {
+}
+
+DemandPublisher::~DemandPublisher() {
+    stop();
+    delete loopStatsEvent;
+    for (int i = 0; i < numVts; i++) delete vtDemands[i];
+}
+
+void DemandPublisher::start() {
+    if (running) return;
+    running = true;
+    thread = std::thread(&DemandPublisher::run, this);
+}
+
+void DemandPublisher::stop() {
+    if (!running) return;
+    running = false;
+    wakeup.post();
+    thread.join();
+}
+
+// Called by the fast loop: must not block. With either policy a full queue drops its oldest demand, so
+// that the publisher thread always finds the latest one when the event service catches up.
+void DemandPublisher::post(const DemandSample &sample) {
+    ++queued;
+    if (!queue.push(sample, true)) ++dropped;
+    long depth = static_cast<long>(queue.size());
+    if (depth > maxDepth) maxDepth = depth;
+    wakeup.post();
+}
+
+// Waits for demands to be queued and publishes them, until stopped. stop() wakes the thread one last
+// time so that whatever is still queued is published before it exits: whether to stop is read before
+// draining, so that demands queued while the previous drain was publishing are not left behind.
+void DemandPublisher::run() {
+    for (;;) {
+        wakeup.wait();
+        bool stopping = !running;
+        drain();
+        if (loopStatsRequested.exchange(false)) publishLoopStats();
+        if (stopping) break;
+    }
+}
+
+// In the coalesce policy everything that is queued is drained and only the latest MCS and M3 demands
+// (and the latest ECS demand, which is not computed on every tick) are published.
+void DemandPublisher::drain() {
+    DemandSample sample{};
+    if (policy == PUBLISH_COALESCE) {
+        DemandSample latestEcs{};
+        bool haveSample = false, haveEcs = false;
+        while (queue.pop(sample)) {
+            if (haveSample) ++dropped;
+            haveSample = true;
+            if (sample.ecs) {
+                latestEcs = sample;
+                haveEcs = true;
+            }
+        }
+        if (haveSample) publish(sample, haveEcs ? &latestEcs : nullptr);
+    } else {
+        while (queue.pop(sample)) {
+            publish(sample, sample.ecs ? &sample : nullptr);
+        }
+    }
+}
+
+// Publishes the MCS and M3 demands of a tick, and the ECS demand if ecs is not null, together with the
+// demands of the added virtual telescopes that are tracking (only those if the tick is vtsOnly). The
+// CSW C API publishes one event per call.
+void DemandPublisher::publish(const DemandSample &sample, const DemandSample *ecs) {
+    int n = 0;
+
+    if (!sample.vtsOnly) {
+        mcsDemand.set(sample.mcsAz, sample.mcsEl, sample.ra, sample.dec, sample.time, sample.siderealTime);
+        publishEvent(publisher, mcsDemand.event());
+        n++;
+        if (ecs) {
+            ecsDemand.set(ecs->base, ecs->cap, ecs->time);
+            publishEvent(publisher, ecsDemand.event());
+            n++;
+        }
+        m3Demand.set(sample.m3Rotation, sample.m3Tilt, sample.time);
+        publishEvent(publisher, m3Demand.event());
+        n++;
+    }
+    int vts = sample.numVts < numVts ? sample.numVts : numVts;
+    for (int i = 0; i < vts; i++) {
+        const VtDemand &vt = sample.vts[i];
+        if (!vt.tracking) continue;
+        vtDemands[i]->set(vt.az, vt.el, vt.ra, vt.dec, sample.time, sample.siderealTime);
+        publishEvent(publisher, vtDemands[i]->event());
+        n++;
+    }
+
+    long long latency = monotonicNs() - sample.queuedNs;
+    ++published;
+    events += n;
+    lastLatencyNs = latency;
+    totalLatencyNs += latency;
+    if (latency > maxLatencyNs) maxLatencyNs = latency;
+}
+
+void DemandPublisher::setLoopStatsSource(const char *const *loopNames, int numLoops, LoopStatsSource source) {
+    delete loopStatsEvent;
+    loopStatsEvent = new LoopStatsEvent(prefix, loopNames, numLoops);
+    loopStatsSource = std::move(source);
+}
+
+void DemandPublisher::setVirtualTelescopes(const char *const *names, int n) {
+    for (int i = 0; i < numVts; i++) delete vtDemands[i];
+    numVts = n < pkMaxVts ? n : pkMaxVts;
+    for (int i = 0; i < numVts; i++) {
+        vtEventNames[i] = std::string(names[i]) + "DemandPosition";
+        vtDemands[i] = new McsDemandEvent(prefix, vtEventNames[i].c_str());
+    }
+}
+
+void DemandPublisher::requestLoopStats() {
+    if (!loopStatsEvent) return;
+    loopStatsRequested = true;
+    wakeup.post();
+}
+
+void DemandPublisher::publishLoopStats() {
+    ScanStats stats[LoopStatsEvent::maxLoops];
+    loopStatsSource(stats);
+    loopStatsEvent->set(stats, cswUtcTime());
+    publishEvent(publisher, loopStatsEvent->event());
+}
+
+void DemandPublisher::stats(PublishStats *s) const {
+    s->queued = queued;
+    s->published = published;
+    s->events = events;
+    s->dropped = dropped;
+    s->depth = static_cast<long>(queue.size());
+    s->maxDepth = maxDepth;
+    s->lastLatencyUs = lastLatencyNs / 1000.0;
+    s->meanLatencyUs = s->published ? totalLatencyNs / 1000.0 / s->published : 0.0;
+    s->maxLatencyUs = maxLatencyNs / 1000.0;
+}
+
+PublishPolicy DemandPublisher::policyFromEnv() {
+    const char *s = getenv("TPK_PUBLISH_POLICY");
+    if (s && strcmp(s, "coalesce") == 0) return PUBLISH_COALESCE;
+    if (s && strcmp(s, "drop-oldest") != 0) {
+        printf("Warning: Unknown TPK_PUBLISH_POLICY %s: using drop-oldest\n", s);
+    }
+    return PUBLISH_DROP_OLDEST;
+}
+
+size_t DemandPublisher::queueSizeFromEnv() {
+    const char *s = getenv("TPK_PUBLISH_QUEUE_SIZE");
+    long n = s ? strtol(s, nullptr, 10) : 0;
+    return n > 0 ? static_cast<size_t>(n) : defaultQueueSize;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include "csw/csw.h"
+#include "DemandEvents.h"
+#include "SpscRing.h"
+#include "Wakeup.h"
+
+// What to do when the publisher thread falls behind the fast loop
+enum PublishPolicy {
+    // When the queue is full drop the oldest queued demands
+    PUBLISH_DROP_OLDEST,
+    // Publish only the latest of the queued demands (older ones are counted as dropped). When the queue is
+    // full the oldest are dropped too, so the latest demand is never the one that is lost.
+    PUBLISH_COALESCE
+};
+
+// The most virtual telescopes that can be added to the mount and enclosure (see TpkC::addVt())
+const int pkMaxVts = 16;
+
+// The demands of a virtual telescope added to the mount and enclosure on one tick
+typedef struct {
+    bool tracking;              // false until the virtual telescope has been given a target
+    double az, el;              // deg
+    double ra, dec;             // deg
+} VtDemand;
+
+// The demands computed by one tick of the fast loop
+typedef struct {
+    CswUtcTime time;
+    double mcsAz, mcsEl;        // deg
+    double ra, dec;             // deg
+    double siderealTime;        // hours
+    bool ecs;                   // true if base and cap are to be published on this tick
+    double base, cap;           // deg
+    double m3Rotation, m3Tilt;  // deg
+    int numVts;                 // the number of added virtual telescopes in vts
+    VtDemand vts[pkMaxVts];
+    bool vtsOnly;               // true if only the virtual telescopes are tracking (no mount target yet)
+    long long queuedNs;         // monotonic time when queued
+} DemandSample;
+
+// Publisher statistics: queued, published and dropped count ticks, events counts the events published.
+// Latencies are from the fast loop queuing a tick until all its events have been published.
+typedef struct {
+    long queued;
+    long published;
+    long events;
+    long dropped;
+    long depth;
+    long maxDepth;
+    double lastLatencyUs;
+    double meanLatencyUs;
+    double maxLatencyUs;
+} PublishStats;
+
+// Fills in the timing statistics of the scan loops (see DemandPublisher::setLoopStatsSource())
+typedef std::function<void(ScanStats *stats)> LoopStatsSource;
+
+// Publishes an event (cswEventPublish, unless replaced with DemandPublisher::setPublishFunction())
+typedef int (*PublishFunction)(CswEventServiceContext publisher, CswEvent event);
+
+// Publishes the demands computed by the fast loop from a separate thread, so that a stall in the CSW
+// event service never holds up the fast loop.
+//
+// The fast loop calls post(), which copies the demands into a bounded lock-free queue and wakes the
+// publisher thread; it never blocks. The publisher thread publishes the MCS, ECS and M3 demand events,
+// which it builds once and reuses, of each tick one after the other with the same timestamp, together with the
+// demand events of any virtual telescopes added to the mount and enclosure that are tracking.
+//
+// The same thread publishes the PkLoopStats event when asked to, so that all the events are published
+// from one thread.
+class DemandPublisher {
+public:
+    DemandPublisher(CswEventServiceContext publisher, const char *prefix, PublishPolicy policy, size_t queueSize);
+
+    ~DemandPublisher();
+
+    // Disable copy
+    DemandPublisher(DemandPublisher const &) = delete;
+
+    DemandPublisher &operator=(DemandPublisher const &) = delete;
+
+    // Starts the publisher thread
+    void start();
+
+    // Stops the publisher thread after it has published what is queued
+    void stop();
+
+    // Queues the demands of one tick for publishing (called by the fast loop)
+    void post(const DemandSample &sample);
+
+    // Returns the statistics so far
+    void stats(PublishStats *stats) const;
+
+    // Sets the names of the scan loops and the function that gets their statistics for the PkLoopStats
+    // event (must be called before start())
+    void setLoopStatsSource(const char *const *loopNames, int numLoops, LoopStatsSource source);
+
+    // Sets the names of the virtual telescopes added to the mount and enclosure, whose demands are
+    // published as the <name>DemandPosition events (must be called before start())
+    void setVirtualTelescopes(const char *const *names, int numVts);
+
+    // Replaces cswEventPublish, for example to test the publisher without an event service (must be
+    // called before start())
+    void setPublishFunction(PublishFunction function) { publishEvent = function; }
+
+    // Asks the publisher thread to publish the PkLoopStats event (does not block)
+    void requestLoopStats();
+
+    // Reads the policy and queue size from the environment variables TPK_PUBLISH_POLICY
+    // ("drop-oldest" or "coalesce") and TPK_PUBLISH_QUEUE_SIZE
+    static PublishPolicy policyFromEnv();
+
+    static size_t queueSizeFromEnv();
+
+private:
+    // The publisher thread
+    void run();
+
+    // Publishes everything that is queued
+    void drain();
+
+    // Publishes the events for one tick
+    void publish(const DemandSample &sample, const DemandSample *ecs);
+
+    // Publishes the PkLoopStats event
+    void publishLoopStats();
+
+    CswEventServiceContext publisher;
+    PublishFunction publishEvent;
+    const char *prefix;
+    PublishPolicy policy;
+    SpscRing<DemandSample> queue;
+    Wakeup wakeup;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    McsDemandEvent mcsDemand;
+    EcsDemandEvent ecsDemand;
+    M3DemandEvent m3Demand;
+
+    // The demand events of the added virtual telescopes, and their names
+    int numVts;
+    std::string vtEventNames[pkMaxVts];
+    McsDemandEvent *vtDemands[pkMaxVts];
+
+    LoopStatsEvent *loopStatsEvent;
+    LoopStatsSource loopStatsSource;
+    std::atomic<bool> loopStatsRequested;
+
+    // Statistics
+    std::atomic<long> queued;
+    std::atomic<long> published;
+    std::atomic<long> events;
+    std::atomic<long> dropped;
+    std::atomic<long> maxDepth;
+    std::atomic<long long> lastLatencyNs;
+    std::atomic<long long> totalLatencyNs;
+    std::atomic<long long> maxLatencyNs;
+};
@@ -19,7 +19,8 @@
     The actual time is unimportant but is, in fact, the current time truncated
     to an integral number of seconds.
 */
-FakeSystemClock::FakeSystemClock(const double &offset) {
+FakeSystemClock::FakeSystemClock(const double &offset, bool isVirtual) :
+        mVirtual(isVirtual), mVirtualNs(0) {
 
     // Convert now to a time_t
     auto t_clock = std::chrono::system_clock::now();
@@ -53,6 +54,11 @@ FakeSystemClock::FakeSystemClock(const double &offset) {
 
 double FakeSystemClock::read(void) {
 
+    // A virtual clock only moves when it is stepped.
+    if (mVirtual) {
+        return mMjdZero + mVirtualNs.load(std::memory_order_acquire) / 86400.0e9;
+    }
+
     // Read the system clock.
     auto now = std::chrono::system_clock::now();
 
@@ -65,3 +71,8 @@ double FakeSystemClock::read(void) {
 
 /*****************************************************************************/
 
+void FakeSystemClock::advance(long long ns) {
+    if (mVirtual) mVirtualNs.fetch_add(ns, std::memory_order_acq_rel);
+}
+
+/*****************************************************************************/
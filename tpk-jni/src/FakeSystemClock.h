@@ -7,6 +7,7 @@
 #ifndef tpkFAKESYSTEMCLOCK_H
 #define tpkFAKESYSTEMCLOCK_H
 
+#include <atomic>
 #include <chrono>
 
 #include "Clock.h"
@@ -17,6 +18,10 @@
     The FakeSystemClock is an implementation of Clock that reads the system
     clock which is a assumed to be some fixed number of seconds offset
     from TAI.
+
+    A virtual clock does not read the system clock at all: it stays at its
+    zero time until it is stepped with advance(), which lets the scan loops
+    run faster than real time and with reproducible results.
 */
 class FakeSystemClock : public tpk::Clock {
 public:
@@ -35,7 +40,8 @@ public:
         which uses a static buffer.
     */
     explicit FakeSystemClock(
-            const double &offset = 0.0  ///< system clock minus TAI (seconds)
+            const double &offset = 0.0, ///< system clock minus TAI (seconds)
+            bool isVirtual = false      ///< stepped by advance() only
     );
 
     /// Read system clock
@@ -47,6 +53,17 @@ public:
     */
     double read(void) override;
 
+    /// Step a virtual clock
+    /**
+        Advances a virtual clock by the given number of nanoseconds (does
+        nothing to a clock that reads the system clock). Can be called
+        while other threads read the clock.
+    */
+    void advance(long long ns);
+
+    /// Is this a virtual clock
+    bool isVirtual() const { return mVirtual; }
+
 protected:
 
     /// Time at which the clock was created
@@ -54,6 +71,10 @@ protected:
 
     /// MJD (TAI) of the zero time.
     double mMjdZero;
+
+    /// Virtual clock: the time since the zero time (ns)
+    bool mVirtual;
+    std::atomic<long long> mVirtualNs;
 };
 
 #endif
@@ -0,0 +1,80 @@
+#include "LatencyHistogram.h"
+
+#include <climits>
+
+LatencyHistogram::LatencyHistogram() : n(0), totalNs(0), minNs(LLONG_MAX), maxNs(0) {
+    for (auto &c : counts) c.store(0, std::memory_order_relaxed);
+}
+
+// Durations below 16 ns have a bucket each. Above that the bucket is given by the position of the
+// highest bit and the 4 bits below it.
+int LatencyHistogram::bucket(uint64_t ns) {
+    if (ns < subBuckets) return static_cast<int>(ns);
+    int power = 63 - __builtin_clzll(ns);
+    if (power >= maxPower) return numBuckets - 1;
+    int sub = static_cast<int>((ns >> (power - 4)) & (subBuckets - 1));
+    return subBuckets + (power - 4) * subBuckets + sub;
+}
+
+long long LatencyHistogram::bucketValue(int bucket) {
+    if (bucket < subBuckets) return bucket;
+    int power = (bucket - subBuckets) / subBuckets + 4;
+    long long width = 1LL << (power - 4);
+    long long lower = static_cast<long long>(subBuckets + bucket % subBuckets) * width;
+    return lower + width / 2;
+}
+
+// There is only one writer, so plain loads and stores are enough (no read-modify-write instructions)
+void LatencyHistogram::record(long long ns) {
+    if (ns < 0) ns = 0;
+    std::atomic<uint64_t> &c = counts[bucket(static_cast<uint64_t>(ns))];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    totalNs.store(totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns < minNs.load(std::memory_order_relaxed)) minNs.store(ns, std::memory_order_relaxed);
+    if (ns > maxNs.load(std::memory_order_relaxed)) maxNs.store(ns, std::memory_order_relaxed);
+    n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+long long LatencyHistogram::percentileNs(double fraction) const {
+    uint64_t total = 0;
+    for (const auto &c : counts) total += c.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+
+    // The rank of the duration wanted (1 based)
+    auto rank = static_cast<uint64_t>(fraction * static_cast<double>(total) + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < numBuckets; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // The last bucket has no upper limit
+            if (i == numBuckets - 1) return maxNs.load(std::memory_order_relaxed);
+
+            // The true value can not be outside the range recorded
+            long long value = bucketValue(i);
+            long long lo = minNs.load(std::memory_order_relaxed);
+            long long hi = maxNs.load(std::memory_order_relaxed);
+            if (value > hi) value = hi;
+            if (value < lo) value = lo;
+            return value;
+        }
+    }
+    return maxNs.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::summary(LatencySummary *s) const {
+    s->count = n.load(std::memory_order_acquire);
+    if (s->count == 0) {
+        *s = LatencySummary{};
+        return;
+    }
+    s->minUs = minNs.load(std::memory_order_relaxed) / 1000.0;
+    s->meanUs = totalNs.load(std::memory_order_relaxed) / 1000.0 / s->count;
+    s->p50Us = percentileNs(0.5) / 1000.0;
+    s->p90Us = percentileNs(0.9) / 1000.0;
+    s->p99Us = percentileNs(0.99) / 1000.0;
+    s->p999Us = percentileNs(0.999) / 1000.0;
+    s->maxUs = maxNs.load(std::memory_order_relaxed) / 1000.0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Summary of a LatencyHistogram, in microseconds
+typedef struct {
+    long count;
+    double minUs;
+    double meanUs;
+    double p50Us;
+    double p90Us;
+    double p99Us;
+    double p999Us;
+    double maxUs;
+} LatencySummary;
+
+// A histogram of durations in ns, with log-linear (HDR style) buckets: each power of two is divided
+// into 16 buckets, so a percentile is within about 3% of the true value, from 1 ns up to about 18
+// minutes (longer durations are counted in the last bucket).
+//
+// record() is wait-free and must only be called by one thread (the thread being timed). Any thread can
+// read the histogram at any time; a reader may see a recording that is in progress partly applied.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    // Disable copy
+    LatencyHistogram(LatencyHistogram const &) = delete;
+
+    LatencyHistogram &operator=(LatencyHistogram const &) = delete;
+
+    // Adds a duration (negative durations are counted as 0)
+    void record(long long ns);
+
+    // The number of durations recorded
+    long count() const { return n.load(std::memory_order_relaxed); }
+
+    // Returns the duration below which the given fraction (0 to 1) of the recorded durations lie
+    long long percentileNs(double fraction) const;
+
+    // Fills in the summary of the durations recorded so far
+    void summary(LatencySummary *s) const;
+
+private:
+    static const int subBuckets = 16;
+    static const int maxPower = 40;
+    static const int numBuckets = subBuckets + (maxPower - 4) * subBuckets;
+
+    static int bucket(uint64_t ns);
+
+    // The middle of a bucket
+    static long long bucketValue(int bucket);
+
+    std::atomic<uint64_t> counts[numBuckets];
+    std::atomic<long> n;
+    std::atomic<long long> totalNs;
+    std::atomic<long long> minNs;
+    std::atomic<long long> maxNs;
+};
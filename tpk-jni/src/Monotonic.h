@@ -0,0 +1,10 @@
+#pragma once
+
+#include <ctime>
+
+// Returns the current value of the monotonic clock in nanoseconds
+inline long long monotonicNs() {
+    struct timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// The number of threads used by parallelFor(): the environment variable TPK_BATCH_THREADS if set,
+// otherwise the number of CPUs
+inline unsigned parallelThreads() {
+    const char *s = getenv("TPK_BATCH_THREADS");
+    long n = s ? strtol(s, nullptr, 10) : 0;
+    if (n > 0) return static_cast<unsigned>(n);
+    unsigned cpus = std::thread::hardware_concurrency();
+    return cpus > 0 ? cpus : 1;
+}
+
+// Calls f(begin, end) for contiguous chunks covering [0, n), in parallel on up to parallelThreads()
+// threads, and returns when all the chunks are done. The calling thread does one of the chunks itself.
+// Each chunk has at least minChunk items, so small batches are done on the calling thread alone
+// without starting any threads.
+//
+// This is for batch calls from command or client threads, not for the scan loops.
+template<typename F>
+void parallelFor(size_t n, size_t minChunk, F f) {
+    if (n == 0) return;
+    size_t chunks = minChunk > 0 ? n / minChunk : n;
+    size_t threads = parallelThreads();
+    if (chunks > threads) chunks = threads;
+    if (chunks <= 1) {
+        f(static_cast<size_t>(0), n);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    size_t begin = 0;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t end = begin + n / chunks + (c < n % chunks ? 1 : 0);
+        if (c == chunks - 1) {
+            f(begin, end);
+        } else {
+            workers.emplace_back(f, begin, end);
+        }
+        begin = end;
+    }
+    for (auto &w : workers) w.join();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <pthread.h>
+#include <unistd.h>
+
+// A mutex with priority inheritance where the platform supports it: a lower priority thread holding it
+// runs at the priority of the highest priority thread waiting for it, so that a real-time thread never
+// waits for threads of priorities in between. Can be used with std::lock_guard.
+class PiMutex {
+public:
+    PiMutex() {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+#if defined(_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT > 0
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+#endif
+        pthread_mutex_init(&mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    ~PiMutex() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Disable copy
+    PiMutex(PiMutex const &) = delete;
+
+    PiMutex &operator=(PiMutex const &) = delete;
+
+    void lock() {
+        pthread_mutex_lock(&mutex);
+    }
+
+    void unlock() {
+        pthread_mutex_unlock(&mutex);
+    }
+
+private:
+    pthread_mutex_t mutex;
+};
@@ -0,0 +1,85 @@
+#include "PointingModelFile.h"
+
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+
+// Returns true if the line holds nothing to parse
+static bool isBlankOrComment(const std::string &line) {
+    size_t i = line.find_first_not_of(" \t\r");
+    return i == std::string::npos || line[i] == '!' || line[i] == '#';
+}
+
+static bool isTermName(const std::string &name) {
+    if (name.empty() || name.size() > 8 || !isupper(static_cast<unsigned char>(name[0]))) return false;
+    for (char c : name) {
+        if (!isupper(static_cast<unsigned char>(c)) && !isdigit(static_cast<unsigned char>(c))) return false;
+    }
+    return true;
+}
+
+bool PointingModelFile::parse(const std::string &text, std::string &error) {
+    modelCaption.clear();
+    modelTerms.clear();
+    std::istringstream in(text);
+    std::string line;
+    int lineNumber = 0;
+    int header = 0;         // the caption and option lines read so far
+    bool end = false;
+    while (!end && std::getline(in, line)) {
+        lineNumber++;
+        if (isBlankOrComment(line)) continue;
+        if (header < 2) {
+            if (header++ == 0) {
+                size_t last = line.find_last_not_of(" \t\r");
+                modelCaption = line.substr(0, last + 1);
+            }
+            continue;
+        }
+
+        std::string fieldText = line;
+        for (size_t i = fieldText.find_first_not_of(" \t"); i < fieldText.size(); i++) {
+            if (fieldText[i] != '&' && fieldText[i] != '=') break;
+            fieldText[i] = ' ';
+        }
+        std::istringstream fields(fieldText);
+        std::string name;
+        fields >> name;
+        if (name == "END") {
+            end = true;
+            continue;
+        }
+        PointingTerm term{name, 0.0};
+        double sigma;
+        if (!isTermName(name) || !(fields >> term.value) || (!(fields >> sigma) && !fields.eof())) {
+            error = "line " + std::to_string(lineNumber) + ": not a term: " + line;
+            return false;
+        }
+        for (const PointingTerm &t : modelTerms) {
+            if (t.name == name) {
+                error = "line " + std::to_string(lineNumber) + ": " + name + " is repeated";
+                return false;
+            }
+        }
+        modelTerms.push_back(term);
+    }
+    if (!end) {
+        error = "no END line";
+        return false;
+    }
+    return true;
+}
+
+bool PointingModelFile::read(const char *path, std::string &error) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        error = "cannot open " + std::string(path);
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+    fclose(f);
+    return parse(text, error);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A term of a pointing model and its coefficient
+struct PointingTerm {
+    std::string name;       // the TPOINT name of the term, for example IA, IE, CA or NPAE
+    double value;           // arcsec
+};
+
+// A pointing model in the format written by TPOINT's OUTMOD command: a caption line, a line of fit
+// options (which is not used here), one line per term with its name, coefficient (arcsec) and
+// optionally its sigma, and a last line END. Blank lines and lines starting with ! or # are ignored, as
+// is a & or = before a term name. The END line is required, so that a file that is still being
+// written is never taken for a complete model.
+class PointingModelFile {
+public:
+    // Parses the model from text and returns true, or returns false with the line and reason in error
+    bool parse(const std::string &text, std::string &error);
+
+    // Reads and parses the model from a file, like parse()
+    bool read(const char *path, std::string &error);
+
+    const std::string &caption() const { return modelCaption; }
+
+    const std::vector<PointingTerm> &terms() const { return modelTerms; }
+
+private:
+    std::string modelCaption;
+    std::vector<PointingTerm> modelTerms;
+};
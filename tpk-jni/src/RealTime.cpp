@@ -0,0 +1,240 @@
+#include "RealTime.h"
+
+#include <alloca.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <strings.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <cstdint>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Stack prefaulted when TPK_PREFAULT_STACK is just switched on
+static const size_t defaultPrefaultStack = 256 * 1024;
+
+static bool parseBool(const char *s, bool *value) {
+    if (!strcmp(s, "1") || !strcasecmp(s, "true") || !strcasecmp(s, "yes") || !strcasecmp(s, "on")) {
+        *value = true;
+    } else if (!strcmp(s, "0") || !strcasecmp(s, "false") || !strcasecmp(s, "no") || !strcasecmp(s, "off")) {
+        *value = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool RealTimeConfig::set(const char *key, const char *value) {
+    if (!key || !value) return false;
+
+    if (!strcmp(key, "policy")) {
+        if (!strcasecmp(value, "other")) policy = RT_OTHER;
+        else if (!strcasecmp(value, "fifo")) policy = RT_FIFO;
+        else if (!strcasecmp(value, "deadline")) policy = RT_DEADLINE;
+        else return false;
+        return true;
+    }
+
+    if (!strcmp(key, "deadlineBudget")) {
+        char *end;
+        double d = strtod(value, &end);
+        if (end == value || *end || d <= 0.0 || d > 1.0) return false;
+        deadlineBudget = d;
+        return true;
+    }
+
+    if (!strcmp(key, "lockMemory")) {
+        return parseBool(value, &lockMemory);
+    }
+
+    if (!strcmp(key, "prefaultStack")) {
+        bool on;
+        if (parseBool(value, &on)) {
+            prefaultStack = on ? defaultPrefaultStack : 0;
+            return true;
+        }
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (end == value || n < 0) return false;
+        if (*end == 'k' || *end == 'K') n *= 1024, end++;
+        else if (*end == 'm' || *end == 'M') n *= 1024 * 1024, end++;
+        if (*end) return false;
+        prefaultStack = static_cast<size_t>(n);
+        return true;
+    }
+
+    if (!strcmp(key, "cpuAffinity")) {
+        // A comma separated list of name=cpu
+        RealTimeConfig c = *this;
+        c.numCpus = 0;
+        const char *p = value;
+        while (*p) {
+            const char *eq = strchr(p, '=');
+            if (!eq || eq == p || eq - p >= 16 || c.numCpus == maxCpus) return false;
+            char *end;
+            long cpu = strtol(eq + 1, &end, 10);
+            if (end == eq + 1 || cpu < 0 || (*end && *end != ',')) return false;
+            auto &entry = c.cpus[c.numCpus++];
+            memset(entry.name, 0, sizeof entry.name);
+            memcpy(entry.name, p, static_cast<size_t>(eq - p));
+            entry.cpu = static_cast<int>(cpu);
+            p = *end ? end + 1 : end;
+        }
+        *this = c;
+        return true;
+    }
+
+    return false;
+}
+
+RealTimeConfig RealTimeConfig::fromEnv() {
+    static const struct {
+        const char *env;
+        const char *key;
+    } vars[] = {
+            {"TPK_RT_POLICY",          "policy"},
+            {"TPK_RT_DEADLINE_BUDGET", "deadlineBudget"},
+            {"TPK_MLOCKALL",           "lockMemory"},
+            {"TPK_PREFAULT_STACK",     "prefaultStack"},
+            {"TPK_CPU_AFFINITY",       "cpuAffinity"},
+    };
+
+    RealTimeConfig config;
+    for (auto &v : vars) {
+        const char *s = getenv(v.env);
+        if (s && !config.set(v.key, s)) {
+            printf("Warning: Ignoring invalid %s: %s\n", v.env, s);
+        }
+    }
+    return config;
+}
+
+int RealTimeConfig::cpuFor(const char *name) const {
+    for (int i = 0; i < numCpus; i++) {
+        if (!strcmp(cpus[i].name, name)) return cpus[i].cpu;
+    }
+    return -1;
+}
+
+const char *rtPolicyName(int policy) {
+    switch (policy) {
+        case RT_FIFO:
+            return "fifo";
+        case RT_DEADLINE:
+            return "deadline";
+        default:
+            return "other";
+    }
+}
+
+bool lockMemory(const RealTimeConfig &config) {
+    if (!config.lockMemory) return false;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        perror("mlockall");
+        return false;
+    }
+    return true;
+}
+
+// Touches the given number of bytes of the stack below the caller, so that they are mapped (and, with
+// mlockall, locked) before the thread has to run in real time
+__attribute__((noinline)) static void prefault(size_t bytes) {
+    volatile char *stack = static_cast<volatile char *>(alloca(bytes));
+    for (size_t i = 0; i < bytes; i += 4096) stack[i] = 0;
+}
+
+#ifdef __linux__
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// The argument of the sched_setattr system call (which glibc does not wrap)
+struct DeadlineAttr {
+    uint32_t size;
+    uint32_t schedPolicy;
+    uint64_t schedFlags;
+    int32_t schedNice;
+    uint32_t schedPriority;
+    uint64_t schedRuntime;
+    uint64_t schedDeadline;
+    uint64_t schedPeriod;
+};
+
+static bool setDeadline(double budget, long long periodNs) {
+    DeadlineAttr attr{};
+    attr.size = sizeof attr;
+    attr.schedPolicy = SCHED_DEADLINE;
+    attr.schedPeriod = static_cast<uint64_t>(periodNs);
+    attr.schedDeadline = attr.schedPeriod;
+    // The kernel does not accept runtimes below 1024 ns
+    attr.schedRuntime = static_cast<uint64_t>(budget * static_cast<double>(periodNs));
+    if (attr.schedRuntime < 1024) attr.schedRuntime = 1024;
+    if (syscall(SYS_sched_setattr, 0, &attr, 0)) {
+        perror("sched_setattr (SCHED_DEADLINE)");
+        return false;
+    }
+    return true;
+}
+#endif
+
+void applyRealTime(const RealTimeConfig &config, const char *name, int fifoPriority, long long periodNs,
+                   ThreadPolicy *applied) {
+    memset(applied, 0, sizeof *applied);
+    strncpy(applied->name, name, sizeof applied->name - 1);
+    applied->policy = RT_OTHER;
+    applied->cpu = -1;
+
+    if (config.prefaultStack) {
+        prefault(config.prefaultStack);
+        applied->stackPrefaulted = true;
+    }
+
+#ifdef __linux__
+    int cpu = config.cpuFor(name);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int ierr = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        if (ierr) {
+            errno = ierr;
+            perror("pthread_setaffinity_np");
+        } else {
+            applied->cpu = cpu;
+        }
+    }
+
+    // SCHED_DEADLINE threads can not be pinned to one CPU (unless it is an exclusive cpuset), so this
+    // usually falls back to SCHED_FIFO when a CPU is given
+    if (config.policy == RT_DEADLINE) {
+        if (setDeadline(config.deadlineBudget, periodNs)) {
+            applied->policy = RT_DEADLINE;
+            return;
+        }
+        printf("Warning: %s: SCHED_DEADLINE not allowed, trying SCHED_FIFO\n", name);
+    }
+#else
+    if (config.numCpus) printf("Warning: %s: CPU affinity is not supported on this system\n", name);
+    if (config.policy == RT_DEADLINE) printf("Warning: %s: SCHED_DEADLINE is not supported, trying SCHED_FIFO\n", name);
+#endif
+
+    if (config.policy != RT_OTHER) {
+        struct sched_param sched{};
+        sched.sched_priority = fifoPriority;
+        int ierr = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
+        if (ierr) {
+            errno = ierr;
+            perror("pthread_setschedparam (SCHED_FIFO)");
+            printf("Warning: %s: running with the normal scheduling policy\n", name);
+        } else {
+            applied->policy = RT_FIFO;
+            applied->priority = fifoPriority;
+        }
+    }
+}
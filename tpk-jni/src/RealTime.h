@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+
+// Scheduling policies for the scan threads
+enum RtPolicy {
+    RT_OTHER,       // the normal time sharing policy
+    RT_FIFO,        // SCHED_FIFO, with the priority given to each thread
+    RT_DEADLINE     // SCHED_DEADLINE, with each thread's period and a share of it as its runtime
+};
+
+// The real-time configuration of the scan threads and the scheduler thread.
+//
+// The configuration is only a request: each thread applies it to itself when it starts and falls back
+// (from SCHED_DEADLINE to SCHED_FIFO to the normal policy) when it is not allowed to, for example when
+// the process does not have CAP_SYS_NICE. ThreadPolicy reports what was actually applied.
+struct RealTimeConfig {
+    static const int maxCpus = 8;
+
+    RtPolicy policy = RT_OTHER;
+
+    // For SCHED_DEADLINE: the share of its period that a thread may run for (0 to 1)
+    double deadlineBudget = 0.5;
+
+    // Lock the process's memory with mlockall(MCL_CURRENT | MCL_FUTURE)
+    bool lockMemory = false;
+
+    // The number of bytes of its stack each thread touches when it starts (0 for none), so that
+    // page faults happen before the thread runs in real time
+    size_t prefaultStack = 0;
+
+    // CPUs that threads are pinned to, by thread name ("SlowScan", "MediumScan", "FastScan" or
+    // "Scheduler"). Threads that are not listed can run on any CPU.
+    struct {
+        char name[16];
+        int cpu;
+    } cpus[maxCpus]{};
+    int numCpus = 0;
+
+    // Reads the configuration from the environment variables TPK_RT_POLICY ("other", "fifo" or
+    // "deadline"), TPK_RT_DEADLINE_BUDGET, TPK_MLOCKALL, TPK_PREFAULT_STACK and TPK_CPU_AFFINITY
+    // (for example "FastScan=3,Scheduler=3,MediumScan=2")
+    static RealTimeConfig fromEnv();
+
+    // Sets one item of the configuration: key is "policy", "deadlineBudget", "lockMemory",
+    // "prefaultStack" or "cpuAffinity", and value is as for the environment variables. Returns false
+    // (leaving the configuration unchanged) if the key or value is not valid.
+    bool set(const char *key, const char *value);
+
+    // The CPU the named thread should be pinned to, or -1
+    int cpuFor(const char *name) const;
+};
+
+// The real-time policy actually applied to a thread
+typedef struct {
+    char name[16];
+    int policy;             // an RtPolicy
+    int priority;           // the SCHED_FIFO priority (0 for other policies)
+    int cpu;                // the CPU the thread is pinned to, or -1
+    bool memoryLocked;      // the process's memory is locked
+    bool stackPrefaulted;
+} ThreadPolicy;
+
+// Applies the configuration to the calling thread. fifoPriority is its SCHED_FIFO priority and periodNs
+// its period (for SCHED_DEADLINE).
+void applyRealTime(const RealTimeConfig &config, const char *name, int fifoPriority, long long periodNs,
+                   ThreadPolicy *applied);
+
+// Locks the process's memory if configured to and returns true if it is locked
+bool lockMemory(const RealTimeConfig &config);
+
+// Returns the name of a policy ("other", "fifo" or "deadline")
+const char *rtPolicyName(int policy);
@@ -0,0 +1,60 @@
+#include "RecordReader.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RecordReader::RecordReader() : map(nullptr), mapSize(0), fileHeader(nullptr), records(nullptr), numRecords(0) {
+}
+
+RecordReader::~RecordReader() {
+    close();
+}
+
+bool RecordReader::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(PkRecordFileHeader)) {
+        printf("Error: %s: not a record file\n", path);
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    auto *h = static_cast<const PkRecordFileHeader *>(p);
+    if (!isRecordFileHeader(*h)) {
+        printf("Error: %s: not a record file (or a different version)\n", path);
+        munmap(p, size);
+        return false;
+    }
+
+    // Records are read in order
+    madvise(p, size, MADV_SEQUENTIAL);
+    map = p;
+    mapSize = size;
+    fileHeader = h;
+    records = reinterpret_cast<const PkTickRecord *>(h + 1);
+    numRecords = (size - sizeof(PkRecordFileHeader)) / sizeof(PkTickRecord);
+    return true;
+}
+
+void RecordReader::close() {
+    if (map) munmap(map, mapSize);
+    map = nullptr;
+    mapSize = 0;
+    fileHeader = nullptr;
+    records = nullptr;
+    numRecords = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include "Recorder.h"
+
+// Read only access to a record file written by Recorder, memory mapped so that the records are read
+// in place and only the pages used are read from disk.
+//
+// A file that is still being written can be opened: it then holds the records written when it was
+// opened (an incomplete last record is ignored).
+class RecordReader {
+public:
+    RecordReader();
+
+    ~RecordReader();
+
+    // Disable copy
+    RecordReader(RecordReader const &) = delete;
+
+    RecordReader &operator=(RecordReader const &) = delete;
+
+    // Maps the file, closing any file already open. Returns false (after printing why) if it could not
+    // be opened or is not a record file.
+    bool open(const char *path);
+
+    void close();
+
+    // The file header (only valid while open)
+    const PkRecordFileHeader &header() const { return *fileHeader; }
+
+    // The number of records
+    size_t size() const { return numRecords; }
+
+    // Record i, for i < size()
+    const PkTickRecord &operator[](size_t i) const { return records[i]; }
+
+    const PkTickRecord *begin() const { return records; }
+
+    const PkTickRecord *end() const { return records + numRecords; }
+
+private:
+    void *map;
+    size_t mapSize;
+    const PkRecordFileHeader *fileHeader;
+    const PkTickRecord *records;
+    size_t numRecords;
+};
@@ -0,0 +1,192 @@
+#include "Recorder.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t defaultFileSize = 64 * 1024 * 1024;
+static const int defaultMaxFiles = 16;
+static const size_t defaultQueueSize = 1024;
+
+static const char recordMagic[8] = {'P', 'K', 'R', 'E', 'C', 0, 0, 0};
+static const uint32_t recordVersion = 1;
+
+bool isRecordFileHeader(const PkRecordFileHeader &header) {
+    return !memcmp(header.magic, recordMagic, sizeof recordMagic) && header.version == recordVersion
+           && header.recordSize == sizeof(PkTickRecord);
+}
+
+static int64_t utcNs() {
+    struct timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+Recorder::Recorder(const char *dir, size_t fileSize, int maxFiles, size_t queueSize) :
+        dir(dir), fileSize(fileSize), maxFiles(maxFiles), queue(queueSize), running(false), file(nullptr),
+        fileBytes(0), recorded(0), dropped(0), written(0), numFiles(0), writeErrors(0) {
+    // Room for the header and at least one record
+    if (this->fileSize < sizeof(PkRecordFileHeader) + sizeof(PkTickRecord)) {
+        this->fileSize = sizeof(PkRecordFileHeader) + sizeof(PkTickRecord);
+    }
+}
+
+Recorder::~Recorder() {
+    stop();
+}
+
+Recorder *Recorder::fromEnv() {
+    const char *dir = getenv("TPK_RECORD_DIR");
+    if (!dir || !*dir) return nullptr;
+
+    size_t fileSize = defaultFileSize;
+    const char *s = getenv("TPK_RECORD_FILE_SIZE");
+    if (s) {
+        char *end;
+        long long n = strtoll(s, &end, 10);
+        if (*end == 'k' || *end == 'K') n *= 1024, end++;
+        else if (*end == 'm' || *end == 'M') n *= 1024 * 1024, end++;
+        else if (*end == 'g' || *end == 'G') n *= 1024LL * 1024 * 1024, end++;
+        if (end == s || *end || n <= 0) {
+            printf("Warning: Ignoring invalid TPK_RECORD_FILE_SIZE: %s\n", s);
+        } else {
+            fileSize = static_cast<size_t>(n);
+        }
+    }
+
+    int maxFiles = defaultMaxFiles;
+    s = getenv("TPK_RECORD_FILES");
+    if (s) {
+        char *end;
+        long n = strtol(s, &end, 10);
+        if (end == s || *end || n < 0) {
+            printf("Warning: Ignoring invalid TPK_RECORD_FILES: %s\n", s);
+        } else {
+            maxFiles = static_cast<int>(n);
+        }
+    }
+    return new Recorder(dir, fileSize, maxFiles, defaultQueueSize);
+}
+
+void Recorder::start() {
+    if (running) return;
+    running = true;
+    thread = std::thread(&Recorder::run, this);
+}
+
+void Recorder::stop() {
+    if (!running) return;
+    running = false;
+    wakeup.post();
+    thread.join();
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+// Called by the fast loop: must not block unless blocking is set
+void Recorder::record(const PkTickRecord &rec) {
+    ++recorded;
+    while (!queue.push(rec, false)) {
+        if (!blocking) {
+            ++dropped;
+            break;
+        }
+        wakeup.post();
+        std::this_thread::yield();
+    }
+    wakeup.post();
+}
+
+// Waits for records to be queued and writes them, until stopped. stop() wakes the thread one last
+// time so that whatever is still queued is written before it exits.
+void Recorder::run() {
+    for (;;) {
+        wakeup.wait();
+        drain();
+        if (!running) break;
+    }
+}
+
+// Writes the queued records and flushes them, so that a crash loses at most what was queued
+void Recorder::drain() {
+    PkTickRecord rec;
+    bool any = false;
+    while (queue.pop(rec)) {
+        if ((!file || fileBytes + sizeof rec > fileSize) && !rotate()) {
+            ++dropped;
+            continue;
+        }
+        if (fwrite(&rec, sizeof rec, 1, file) != 1) {
+            ++writeErrors;
+            ++dropped;
+            continue;
+        }
+        fileBytes += sizeof rec;
+        ++written;
+        any = true;
+    }
+    if (any && fflush(file)) ++writeErrors;
+}
+
+bool Recorder::rotate() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+
+    // Named by the UTC time and a sequence number, so that the names sort in the order written
+    int64_t now = utcNs();
+    time_t secs = static_cast<time_t>(now / 1000000000LL);
+    struct tm tm{};
+    gmtime_r(&secs, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", &tm);
+    char name[64];
+    std::string path;
+    struct stat st{};
+    for (long seq = numFiles; path.empty() || stat(path.c_str(), &st) == 0; seq++) {
+        snprintf(name, sizeof name, "/pk-%s-%04ld.pkrec", stamp, seq);
+        path = dir + name;
+    }
+
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        // Only report the first failure
+        if (writeErrors++ == 0) perror(path.c_str());
+        return false;
+    }
+
+    PkRecordFileHeader header{};
+    memcpy(header.magic, recordMagic, sizeof header.magic);
+    header.version = recordVersion;
+    header.recordSize = sizeof(PkTickRecord);
+    header.createdNs = now;
+    if (fwrite(&header, sizeof header, 1, file) != 1) {
+        ++writeErrors;
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    fileBytes = sizeof header;
+    ++numFiles;
+
+    files.push_back(path);
+    while (maxFiles > 0 && files.size() > static_cast<size_t>(maxFiles)) {
+        unlink(files.front().c_str());
+        files.pop_front();
+    }
+    return true;
+}
+
+void Recorder::stats(RecorderStats *s) const {
+    s->recorded = recorded;
+    s->dropped = dropped;
+    s->written = written;
+    s->files = numFiles;
+    s->writeErrors = writeErrors;
+}
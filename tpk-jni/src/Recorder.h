@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <thread>
+#include "SpscRing.h"
+#include "Wakeup.h"
+
+// One tick of the fast loop as recorded: what the kernel computed and the commands it was tracking.
+// The layout is fixed (it is the record format of the files), so only fixed size types are used.
+typedef struct {
+    double tai;                             // TAI (MJD)
+    int64_t utcNs;                          // UTC, in ns since 1970
+    int64_t monotonicNs;                    // CLOCK_MONOTONIC
+    double siderealTime;                    // hours
+    double mountRoll, mountPitch;           // rad, as returned by the mount virtual telescope
+    double enclosureRoll, enclosurePitch;   // rad
+    double m3Azimuth, m3Elevation;          // rad
+    double ra, dec;                         // deg, the mount position
+    uint64_t targetId, offsetId;            // the ids of the target and offset commands (0 for none)
+    int32_t targetRefSys, offsetRefSys;     // PkRefSys
+    double targetA, targetB;                // rad
+    double offsetA, offsetB;                // rad
+} PkTickRecord;
+
+// The header at the start of each record file
+typedef struct {
+    char magic[8];          // "PKREC\0\0\0"
+    uint32_t version;
+    uint32_t recordSize;    // sizeof(PkTickRecord)
+    int64_t createdNs;      // UTC, in ns since 1970
+    char reserved[40];
+} PkRecordFileHeader;
+
+// Returns true if header is the header of a record file in the current format
+bool isRecordFileHeader(const PkRecordFileHeader &header);
+
+// Recorder statistics: recorded counts the ticks given to record(), dropped those lost because the
+// queue was full and written those written to a file
+typedef struct {
+    long recorded;
+    long dropped;
+    long written;
+    long files;
+    long writeErrors;
+} RecorderStats;
+
+// Records every tick of the fast loop to fixed record binary files, from its own thread.
+//
+// The fast loop calls record(), which copies the record into a bounded lock-free queue and wakes the
+// recorder thread; it never blocks or does any I/O. The recorder thread appends the queued records to
+// the current file, and starts a new file (in the same directory, named by the UTC time it was started)
+// once the current one would grow beyond the maximum size, removing the oldest files it created beyond
+// the maximum number of files.
+class Recorder {
+public:
+    // Records to files in dir, each at most fileSize bytes, keeping at most maxFiles of them (0 for no
+    // limit), with a queue of queueSize records
+    Recorder(const char *dir, size_t fileSize, int maxFiles, size_t queueSize);
+
+    // Stops the thread after it has written what is queued
+    ~Recorder();
+
+    // Disable copy
+    Recorder(Recorder const &) = delete;
+
+    Recorder &operator=(Recorder const &) = delete;
+
+    // Creates a recorder for the directory given by TPK_RECORD_DIR, with TPK_RECORD_FILE_SIZE (bytes,
+    // with an optional k, M or G suffix, default 64M) and TPK_RECORD_FILES (default 16), or returns
+    // nullptr if it is not set
+    static Recorder *fromEnv();
+
+    // Starts the recorder thread
+    void start();
+
+    // Stops the recorder thread after it has written what is queued and closes the file
+    void stop();
+
+    // Queues the record of one tick (called by the fast loop)
+    void record(const PkTickRecord &rec);
+
+    // When blocking, record() waits for room in the queue instead of dropping the record. Only for
+    // when the fast loop is not running in real time (in virtual time).
+    void setBlocking(bool blocking) { this->blocking = blocking; }
+
+    // Returns the statistics so far
+    void stats(RecorderStats *stats) const;
+
+    const char *directory() const { return dir.c_str(); }
+
+private:
+    // The recorder thread
+    void run();
+
+    // Writes everything that is queued
+    void drain();
+
+    // Closes the current file, if any, and opens a new one. Returns false if it could not.
+    bool rotate();
+
+    std::string dir;
+    size_t fileSize;
+    int maxFiles;
+    SpscRing<PkTickRecord> queue;
+    Wakeup wakeup;
+    std::thread thread;
+    std::atomic<bool> running;
+    bool blocking = false;
+
+    // Only used by the recorder thread
+    FILE *file;
+    size_t fileBytes;
+    std::deque<std::string> files;
+
+    std::atomic<long> recorded;
+    std::atomic<long> dropped;
+    std::atomic<long> written;
+    std::atomic<long> numFiles;
+    std::atomic<long> writeErrors;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "Seqlock.h"
+
+// The last N values written by a single writer thread, readable from any thread without locking.
+//
+// Each slot is a Seqlock holding the value and its index in the sequence of values written, so that a
+// reader can tell when a slot it is copying has been overwritten by a newer value: it then drops that
+// value (it is older than all the others it copies). The writer never waits for a reader.
+//
+// T must be trivially copyable.
+template<typename T>
+class SampleHistory {
+public:
+    explicit SampleHistory(size_t capacity) : capacity(capacity > 0 ? capacity : 1), count(0) {
+        slots = new Seqlock<Entry>[this->capacity];
+    }
+
+    ~SampleHistory() {
+        delete[] slots;
+    }
+
+    // Disable copy
+    SampleHistory(SampleHistory const &) = delete;
+
+    SampleHistory &operator=(SampleHistory const &) = delete;
+
+    // Adds a value, replacing the oldest one once full (called by the writer thread only)
+    void add(const T &value) {
+        uint64_t i = count.load(std::memory_order_relaxed);
+        Entry e;
+        e.index = i;
+        e.value = value;
+        slots[i % capacity].store(e);
+        count.store(i + 1, std::memory_order_release);
+    }
+
+    // Copies up to max of the latest values to out, oldest first, and returns the number copied
+    size_t latest(T *out, size_t max) const {
+        uint64_t end = count.load(std::memory_order_acquire);
+        uint64_t n = end < capacity ? end : capacity;
+        if (n > max) n = max;
+        size_t copied = 0;
+        for (uint64_t i = end - n; i < end; i++) {
+            Entry e = slots[i % capacity].load();
+            if (e.index == i) out[copied++] = e.value;
+        }
+        return copied;
+    }
+
+    // The number of values added so far
+    uint64_t added() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        return capacity;
+    }
+
+private:
+    struct Entry {
+        uint64_t index;
+        T value;
+    };
+
+    const size_t capacity;
+    Seqlock<Entry> *slots;
+    std::atomic<uint64_t> count;
+};
@@ -7,40 +7,76 @@
 #include <cerrno>
 #include <pthread.h>
 #include <sched.h>
-#include <semaphore.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <sys/mman.h>
 #include <ctime>
 #include <unistd.h>
+#include <algorithm>
 #include <vector>
+#include "Monotonic.h"
 #include "ScanTask.h"
 
 using std::vector;
 
+// The scheduler tick (1ms)
+static const long TickNs = 1000000L;
+
 // Definitions of static data members.
-bool ScanTask::RealTime = false;
+std::atomic<bool> ScanScheduler::MemoryLocked(false);
+
+ScanScheduler::ScanScheduler() :
+        Policy(), Mode(AbsoluteDeadline), MissedTicks(0), Started(false), Stop(false), TicksToRun(0) {
+    TasksMutex = PTHREAD_MUTEX_INITIALIZER;
+}
+
+ScanScheduler::~ScanScheduler() {
+    stop();
+    pthread_mutex_destroy(&TasksMutex);
+}
+
+void ScanScheduler::configure(const RealTimeConfig &config) {
+    Config = config;
+}
+
+/*
+   This procedure locks the process into memory if the configuration
+   asks for it. The scheduling policy is set by each thread for itself
+   when it starts.
+*/
+void ScanScheduler::makeRealTime() {
+    if (!MemoryLocked && lockMemory(Config)) MemoryLocked = true;
+}
 
-// XXX Note: This value must be null (or properly initialized) on MacOS if not being used for scheduling
-pthread_attr_t ScanTask::Tattr  ;
+void ScanScheduler::add(ScanTask *task) {
+    pthread_mutex_lock(&TasksMutex);
+    Tasks.push_back(task);
+    pthread_mutex_unlock(&TasksMutex);
+}
 
-vector<void *>ScanTask::Tasks;
+void ScanScheduler::remove(ScanTask *task) {
+    pthread_mutex_lock(&TasksMutex);
+    Tasks.erase(std::remove(Tasks.begin(), Tasks.end(), task), Tasks.end());
+    pthread_mutex_unlock(&TasksMutex);
+}
 
 /*
-    The constructor stores the reference to to the semaphore, 
-    initialises the semaphore and the mutexes and creates the 
-    scan thread.
+    The constructor stores the thread name, initialises the mutexes
+    and creates the scan thread, waiting until the thread has applied
+    the real-time configuration of its scheduler. The semaphore is a
+    member (initially zero so that the thread is blocked) and is
+    private to this object, and the task is only woken by the
+    scheduler it is added to.
 */
-ScanTask::ScanTask(const char* name, int waitticks, int prio) :
-        WaitTicks(waitticks), TickCount(0) {
+ScanTask::ScanTask(ScanScheduler &scheduler, const char* name, int waitticks, int prio) :
+        Scheduler(scheduler), WaitTicks(waitticks), Prio(prio), Policy(), TickCount(0), Running(false), Started(false), Stop(false), MissedTicks(0),
+        ReleaseNs(0), LastStartNs(0), Runs(0), Overruns(0) {
 
-// Initialise the semaphore (not shared between processes and 
-// initially zero so that the thread is blocked).
-//    int ierr = sem_init(&Sem, 0, 0);
-    sem_unlink(name);
-    Sem = sem_open(name, O_CREAT, 0777, 0);
-    if (Sem == SEM_FAILED) perror("sem_open");
+// Save the thread name (truncated to the 15 characters allowed by
+// pthread_setname_np).
+    strncpy(Name, name, sizeof Name - 1);
+    Name[sizeof Name - 1] = '\0';
 
 // Initialise the mutex used for waiting for the scan to run.
     WaitMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -49,124 +85,279 @@ ScanTask::ScanTask(const char* name, int waitticks, int prio) :
     ScanStart = PTHREAD_COND_INITIALIZER;
     ScanEnd = PTHREAD_COND_INITIALIZER;
 
-    pthread_t threadId;
-    pthread_attr_t* attr = nullptr;
-
 // Create the scan thread.
-    if (RealTime) {
-        struct sched_param sched{};
-        sched.sched_priority = sched_get_priority_max(SCHED_FIFO) -
-                               prio;
-        if (pthread_attr_setschedparam(&Tattr, &sched))
-            perror("pthread_attr_setschedparam");
-        attr = &Tattr;
-    }
-
-    // XXX Note: Tattr must be null (or properly initialized) on MacOS if not being used for scheduling (above)
-    if (pthread_create(&threadId, attr, startScan, this))
+    if (pthread_create(&Thread, nullptr, startScan, this)) {
         perror("pthread_create (ScanTask)");
+    } else {
+        Started = true;
+        Ready.wait();
+    }
 
-    // Add ourself to the list of scan tasks.
-    Tasks.push_back(this);
+    // Add ourself to the scheduler's list of scan tasks.
+    Scheduler.add(this);
 }
 
 /*
-   This procedure attempts to make the process a real-time process 
-   and lock itself into memory. If it succeeds it set the global 
-   RealTime flag to true.
+    The destructor removes the task from the scheduler's list of scan
+    tasks and stops the scan thread if that has not been done already.
 */
-void ScanTask::makeRealTime() {
-/*
-// Initialise the thread attribute structure.
-    if (pthread_attr_init( &Tattr )) perror("pthread_attr_init");
-
-// Attempt to set ourselves as a real-time process.
-    struct sched_param sched;
-    sched.sched_priority = sched_get_priority_min(SCHED_FIFO);
-    if (sched_setscheduler( getpid(), SCHED_FIFO, &sched )) {
-        perror( "sched_setscheduler" );
-    } else {
-        RealTime = true;
+ScanTask::~ScanTask() {
+    Scheduler.remove(this);
+    stop();
+    pthread_cond_destroy(&ScanStart);
+    pthread_cond_destroy(&ScanEnd);
+    pthread_mutex_destroy(&WaitMutex);
+}
+
+// Sleeps until the monotonic clock reaches the given deadline (ns).
+
+static void sleepUntil(long long deadline) {
+#ifdef __APPLE__
+    // There is no clock_nanosleep on MacOS so sleep for the time
+    // remaining until the deadline instead.
+    long long remaining = deadline - monotonicNs();
+    if (remaining <= 0) return;
+    struct timespec interval{};
+    interval.tv_sec = remaining / 1000000000LL;
+    interval.tv_nsec = remaining % 1000000000LL;
+    while (nanosleep(&interval, &interval) != 0) {
+        if (errno == EINTR) continue;
+        perror("nanosleep");
+        break;
+    }
+#else
+    struct timespec ts{};
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    int ierr;
+    while ((ierr = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)) != 0) {
+        if (ierr == EINTR) continue;
+        errno = ierr;
+        perror("clock_nanosleep");
+        break;
     }
+#endif
+}
+
+// Advances the tick counter by one tick and returns true if the scan
+// is due.
 
-// If we were allowed to set our own scheduling policy then assume 
-// that we can create real-time threads.
-    if ( RealTime ) {
-        if (pthread_attr_setschedpolicy( &Tattr, SCHED_FIFO ))
-                perror("pthread_attr_setschedpolicy");
+bool ScanTask::tick() {
+    bool due = false;
 
-    // Attempt to lock the application into physical memory.
-        if (mlockall( MCL_FUTURE )) perror( "mlockall" );
+    // If the counter has reached zero...
+    if (TickCount == 0) {
+
+        // Reset the counter to the number of ticks to wait.
+        TickCount = WaitTicks;
+        due = true;
     }
-*/
-}
 
-// This is the thread start routine for the scheduler thread.
+    // Decrement the counter
+    --TickCount;
+    return due;
+}
 
-extern "C" [[noreturn]] void *ScanTask::scheduler(void *) {
+/*
+    Releases the scan for execution. "due" is the number of times the
+    scan became due since the scheduler last ran; all but one of them 
+    have been missed. If the previous execution of the scan has not
+    finished the release is counted as missed rather than queued so
+    that the task does not run back to back to catch up. The Running
+    flag stays set from the release until the scan has finished.
+*/
+void ScanTask::release(int due) {
+    if (due > 1) MissedTicks += due - 1;
+    if (Running.exchange(true)) {
+        ++MissedTicks;
+    } else {
+        // Post the semaphore to release the scan.
+        ReleaseNs.store(monotonicNs(), std::memory_order_relaxed);
+        Sem.post();
+    }
+}
 
-// Loop forever.
-    for (;;) {
+// This is the thread start routine for the scheduler thread. It just
+// calls the run method of the scheduler pointed to by its argument.
 
-        // For each scan task...
-        for (auto Task : Tasks) {
-            auto *task = static_cast<ScanTask *>(Task);
+extern "C" void *ScanScheduler::startScheduler(void *scheduler) {
+    (static_cast<ScanScheduler *>(scheduler))->run();
+    return nullptr;
+}
 
-            // If the counter has reached zero...
-            if (task->TickCount == 0) {
+void ScanScheduler::run() {
+
+// Name the thread and run it with the highest possible priority.
+#ifdef __APPLE__
+    pthread_setname_np("Scheduler");
+#else
+    pthread_setname_np(pthread_self(), "Scheduler");
+#endif
+    applyRealTime(Config, "Scheduler", sched_get_priority_max(SCHED_FIFO), TickNs, &Policy);
+    Policy.memoryLocked = MemoryLocked;
+
+// Take a copy of the list of scan tasks, which does not change while
+// the scheduler is running.
+    pthread_mutex_lock(&TasksMutex);
+    vector<ScanTask *> tasks(Tasks);
+    pthread_mutex_unlock(&TasksMutex);
+    Ready.post();
+
+    if (Mode == VirtualTime) {
+        runVirtual(tasks);
+        return;
+    }
 
-                // Reset the counter to the number of ticks to wait.
-                task->TickCount = task->WaitTicks;
+// The deadline of the next tick.
+    long long deadline = monotonicNs();
+
+// Loop until stopped.
+    while (!Stop) {
+
+        // Work out how many ticks have elapsed. In relative mode this is
+        // always one; in absolute mode ticks are missed if we woke up 
+        // more than a tick late.
+        long elapsed = 1;
+        if (Mode == AbsoluteDeadline) {
+            long long late = monotonicNs() - deadline;
+            if (late >= TickNs) {
+                long missed = static_cast<long>(late / TickNs);
+                MissedTicks += missed;
+                elapsed += missed;
+            }
+        }
 
-                // Post the semaphore to release the scan.
-                (void) sem_post(task->Sem);
+        // For each scan task...
+        for (auto task : tasks) {
 
+            // Count the number of times the task became due and release it.
+            int due = 0;
+            for (long i = 0; i < elapsed; i++) {
+                if (task->tick()) ++due;
             }
+            if (due) task->release(due);
+        }
 
-            // Decrement the counter
-            --(task->TickCount);
+        // Wait for the next tick (1ms)
+        if (Mode == AbsoluteDeadline) {
+            deadline += elapsed * TickNs;
+            sleepUntil(deadline);
+        } else {
+            struct timespec interval{};
+            interval.tv_sec = 0;
+            interval.tv_nsec = TickNs;
+            while (nanosleep(&interval, &interval) != 0) {
+                if (errno == EINTR) continue;
+                perror("nanosleep");
+            }
         }
+    }
+}
 
-        // Wait for the one tick (1ms)
-        struct timespec interval{};
-        interval.tv_sec = 0;
-        interval.tv_nsec = 1000000;
-        while (nanosleep(&interval, &interval) != 0) {
-            if (errno == EINTR) continue;
-            perror("nanosleep");
+/*
+    The scheduler loop in virtual time: waits until runTicks asks for
+    ticks and runs them back to back. Each due task is released and
+    waited for in turn, so only one scan runs at a time and always in
+    the same order. The clock is only ever advanced here, between
+    scans, and no other scheduler's tasks or clock are touched.
+*/
+void ScanScheduler::runVirtual(const vector<ScanTask *> &tasks) {
+    for (;;) {
+        RunTicks.wait();
+        if (Stop) break;
+        long n = TicksToRun.exchange(0);
+        for (long i = 0; i < n && !Stop; i++) {
+            if (Advance) Advance(TickNs);
+            for (auto task : tasks) {
+                if (task->tick()) {
+                    task->release(1);
+                    task->Done.wait();
+                }
+            }
         }
+        TicksDone.post();
     }
-//    return nullptr;
+}
+
+void ScanScheduler::setVirtualTime(std::function<void(long long tickNs)> advance) {
+    Mode = VirtualTime;
+    Advance = std::move(advance);
+}
+
+bool ScanScheduler::runTicks(long ticks) {
+    if (Mode != VirtualTime || !Started) return false;
+    TicksToRun = ticks;
+    RunTicks.post();
+    TicksDone.wait();
+    return true;
 }
 
 //   Starts the scheduler thread.
 
-void ScanTask::startScheduler() {
-    pthread_attr_t* attr = nullptr;
+void ScanScheduler::start() {
+    if (Started) return;
 
-   // Create the scheduler thread with the highest possible priority.
-    if (RealTime) {
-        struct sched_param sched{};
-        sched.sched_priority = sched_get_priority_max(SCHED_FIFO);
-        int ierr = pthread_attr_setschedparam(&Tattr, &sched);
-        if (ierr) perror("pthread_attr_setschedparam");
-        attr = &Tattr;
+    // Create the scheduler thread and wait for it to apply the real-time configuration.
+    Stop = false;
+    int ierr = pthread_create(&Thread, nullptr, startScheduler, this);
+    if (ierr) {
+        perror("pthread_create (ScanScheduler)");
+    } else {
+        Started = true;
+        Ready.wait();
     }
-    pthread_t threadId;
-    int ierr = pthread_create(&threadId, attr, scheduler, nullptr);
-    if (ierr) perror("pthread_create (startScheduler)");
 }
 
+//   Stops the scheduler thread and waits for it to exit.
 
-// Start is called by the thread start routine and never returns.
+void ScanScheduler::stop() {
+    if (!Started) return;
+    Stop = true;
+    if (Mode == VirtualTime) RunTicks.post();
+    int ierr = pthread_join(Thread, nullptr);
+    if (ierr) {
+        errno = ierr;
+        perror("pthread_join (ScanScheduler)");
+    }
+    Started = false;
+}
 
-[[noreturn]] void ScanTask::start() {
+void ScanScheduler::setMode(TimingMode mode) {
+    Mode = mode;
+}
+
+long ScanScheduler::missedTicks() const {
+    return MissedTicks;
+}
 
-// Loop forever.
+void ScanScheduler::policy(ThreadPolicy *p) const {
+    *p = Policy;
+}
+
+
+// Start is called by the thread start routine and returns when the
+// task is stopped.
+
+void ScanTask::start() {
+
+// Name the thread so that it can be identified in ps, top and gdb.
+#ifdef __APPLE__
+    pthread_setname_np(Name);
+#else
+    pthread_setname_np(pthread_self(), Name);
+#endif
+
+// Apply the real-time configuration and tell the constructor.
+    applyRealTime(Scheduler.Config, Name, sched_get_priority_max(SCHED_FIFO) - Prio, WaitTicks * TickNs, &Policy);
+    Policy.memoryLocked = ScanScheduler::MemoryLocked;
+    Ready.post();
+
+// Loop until stopped.
     for (;;) {
 
         // Wait for the semaphore to be released.
-        (void) sem_wait(Sem);
+        Sem.wait();
+        if (Stop) break;
 
         // Signal that the scan has started.
         pthread_mutex_lock(&WaitMutex);
@@ -174,9 +365,24 @@ void ScanTask::startScheduler() {
         pthread_cond_signal(&ScanStart);
         pthread_mutex_unlock(&WaitMutex);
 
+        // Time the wakeup and the interval since the previous execution.
+        long long period = WaitTicks * TickNs;
+        long long startNs = monotonicNs();
+        WakeupLatency.record(startNs - ReleaseNs.load(std::memory_order_relaxed));
+        if (LastStartNs) Jitter.record(llabs(startNs - LastStartNs - period));
+        LastStartNs = startNs;
+
         // Call the action routine.
         scan();
 
+        // Time the execution.
+        long long execNs = monotonicNs() - startNs;
+        ExecutionTime.record(execNs);
+        if (execNs > period) ++Overruns;
+        ++Runs;
+        Running = false;
+        if (Scheduler.Mode == ScanScheduler::VirtualTime) Done.post();
+
         // Signal that the scan has ended
         pthread_mutex_lock(&WaitMutex);
         EndFlag = true;
@@ -186,13 +392,27 @@ void ScanTask::startScheduler() {
     }
 }
 
+// Tells the scan thread to exit, wakes it and waits for it.
+
+void ScanTask::stop() {
+    if (!Started) return;
+    Stop = true;
+    Sem.post();
+    int ierr = pthread_join(Thread, nullptr);
+    if (ierr) {
+        errno = ierr;
+        perror("pthread_join (ScanTask)");
+    }
+    Started = false;
+}
+
 // This is a thread start routine which must have C linkage. It just 
 // calls the start method of the Scan object pointed to by its 
 // argument. 
 
 extern "C" void *ScanTask::startScan(void *scanTask) {
     (static_cast<ScanTask *>(scanTask))->start();
-//    return nullptr;
+    return nullptr;
 }
 
 void ScanTask::waitForScan() {
@@ -210,3 +430,21 @@ void ScanTask::waitForScan() {
     while (!EndFlag) pthread_cond_wait(&ScanEnd, &WaitMutex);
     pthread_mutex_unlock(&WaitMutex);
 }
+
+long ScanTask::missedTicks() const {
+    return MissedTicks;
+}
+
+void ScanTask::policy(ThreadPolicy *p) const {
+    *p = Policy;
+}
+
+void ScanTask::stats(ScanStats *s) const {
+    memcpy(s->name, Name, sizeof s->name);
+    s->runs = Runs;
+    s->missedTicks = MissedTicks;
+    s->overruns = Overruns;
+    WakeupLatency.summary(&s->wakeup);
+    ExecutionTime.summary(&s->execution);
+    Jitter.summary(&s->jitter);
+}
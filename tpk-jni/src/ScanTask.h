@@ -7,44 +7,220 @@
 #ifndef SCANTASK_H
 #define SCANTASK_H
 
+#include <atomic>
+#include <functional>
 #include <pthread.h>
-#include <semaphore.h>
 #include <vector>
+#include "LatencyHistogram.h"
+#include "RealTime.h"
+#include "Wakeup.h"
 
-/// Task scheduler
+/// Timing statistics of a scan task
+typedef struct {
+    char name[16];              ///< the name of the scan thread
+    long runs;                  ///< executions of the scan
+    long missedTicks;           ///< executions skipped
+    long overruns;              ///< executions that took longer than the period
+    LatencySummary wakeup;      ///< from the release by the scheduler until the scan thread runs
+    LatencySummary execution;   ///< time spent in the scan method
+    LatencySummary jitter;      ///< difference between the interval from the previous start and the period
+} ScanStats;
+
+class ScanTask;
+
+/// Scan task scheduler
 /**
-   The ScanTask class implements a simple scheduler for threads that 
-   executes periodically. Each ScanTask object creates a thread which 
-   waits for a semaphore to be released, executes its scan method and 
-   then goes back to waiting for the semaphore. The class method 
-   startScheduler creates a thread (running at the highest available 
-   priority) that unlocks the semaphore of each ScanTask object at the
-   appropriate interval. The waitForScan method enables other threads
-   to pause until the ScanTask thread has executed a complete 
-   iteration.
+   The ScanScheduler class wakes a set of ScanTask objects at the
+   appropriate intervals. Each scheduler has its own list of scan
+   tasks, timing mode and real-time configuration, and its own thread
+   (running at the highest available priority), so any number of
+   schedulers, each with its own set of scan tasks, can run at the
+   same time without affecting each other.
+
+   By default the scheduler wakes at absolute CLOCK_MONOTONIC deadlines
+   so that the time spent processing a tick is not added to the tick 
+   period. If the scheduler wakes up late it catches up with the
+   deadlines it has missed and each scan task counts the executions 
+   that were skipped, either because of this or because the previous 
+   execution of the scan had not finished.
+
+   Before creating its scan tasks the methods configure and
+   makeRealTime must be called. Each thread applies the real-time
+   configuration (CPU affinity, scheduling policy and priority, stack
+   prefaulting) to itself when it starts, falling back to what it is
+   allowed to do, and the policy methods report what was applied.
+
+   In virtual time (setVirtualTime) the scheduler does not sleep or
+   read the clock. runTicks makes it run a given number of ticks as
+   fast as the scans allow: at each tick it calls its advance function
+   (which steps the clock the scans read by one tick), then releases
+   its due scan tasks one at a time, in the order they were created,
+   waiting for each scan to finish before releasing the next. The
+   interleaving of the scans is the same as in real time and the
+   result does not depend on how the threads happen to be scheduled.
+
+   Once start has been called it is not safe to create any more
+   ScanTask objects for the scheduler or to delete one. The stop
+   method stops and joins the scheduler thread; after that the
+   ScanTask objects can be deleted (the destructor stops and joins
+   the scan thread) and a new set created and scheduled.
+*/
+
+class ScanScheduler {
+public:
+
+    /// Scheduler timing modes
+    enum TimingMode {
+        RelativeSleep,      ///< sleep for one tick after each tick
+        AbsoluteDeadline,   ///< sleep until the next absolute deadline
+        VirtualTime         ///< run ticks back to back when asked to (see setVirtualTime)
+    };
+
+    /// Constructor
+    ScanScheduler();
+
+    /// Destructor
+    /**
+        Stops the scheduler if it is running. The scan tasks must be
+        deleted first.
+    */
+    ~ScanScheduler();
+
+    // Disable copy
+    ScanScheduler(ScanScheduler const &) = delete;
+
+    ScanScheduler &operator=(ScanScheduler const &) = delete;
+
+    /// Set the real-time configuration of the threads
+    /**
+        Applies to the scheduler thread and to the scan threads of
+        the tasks created after the call.
+    */
+    void configure(const RealTimeConfig &config);
+
+    /// Set the process to be real-time.
+    /**
+        Locks the process into memory if configured to. The lock
+        applies to the whole process and is only taken once.
+    */
+    void makeRealTime();
+
+    /// Start the scheduler
+    void start();
+
+    /// Stop the scheduler
+    /**
+        Waits for the scheduler thread to exit (within one tick). Scan
+        tasks that have been released still run their scan.
+    */
+    void stop();
+
+    /// Set the timing mode
+    /**
+        Must be called before start.
+    */
+    void setMode(TimingMode mode);
+
+    /// Get the timing mode
+    TimingMode mode() const { return Mode; }
+
+    /// Run the scheduler in virtual time
+    /**
+        Sets the VirtualTime mode. advance is called with the tick
+        length (ns) at the start of every tick of this scheduler. Must
+        be called before start.
+    */
+    void setVirtualTime(std::function<void(long long tickNs)> advance);
+
+    /// Run ticks in virtual time
+    /**
+        Runs the given number of scheduler ticks (of 1ms) back to back
+        and returns when the scans released by the last one have
+        finished. Returns false if the scheduler is not running in
+        virtual time.
+    */
+    bool runTicks(long ticks);
+
+    /// Number of scheduler ticks lost because the scheduler woke late
+    long missedTicks() const;
+
+    /// Get the real-time policy applied to the scheduler thread
+    void policy(ThreadPolicy *p) const;
+
+private:
+    friend class ScanTask;
+
+    // The scan tasks of the scheduler, in the order they were created,
+    // and the mutex that protects the list
+    pthread_mutex_t TasksMutex;
+    std::vector<ScanTask *> Tasks;
+
+    RealTimeConfig Config;
+    ThreadPolicy Policy;
+    Wakeup Ready;
+    TimingMode Mode;
+    std::atomic<long> MissedTicks;
+    pthread_t Thread;
+    bool Started;
+    std::atomic<bool> Stop;
+    std::function<void(long long)> Advance;
+    std::atomic<long> TicksToRun;
+    Wakeup RunTicks;
+    Wakeup TicksDone;
+
+    // Set once the process has been locked into memory
+    static std::atomic<bool> MemoryLocked;
+
+    // Add a task to, or remove it from, the list of scan tasks
+    void add(ScanTask *task);
+    void remove(ScanTask *task);
+
+    // The scheduler loop in real time
+    void run();
+
+    // The scheduler loop in virtual time, for the given tasks
+    void runVirtual(const std::vector<ScanTask *> &tasks);
+
+    static void *startScheduler(void *scheduler);
+};
+
+/// Scan task
+/**
+   Each ScanTask object creates a thread which waits to be woken by
+   its scheduler, executes its scan method and then goes back to
+   waiting. The waitForScan method enables other threads to pause
+   until the ScanTask thread has executed a complete iteration.
 
    The work of the thread is done in the virtual method scan which 
    must be implemented by classes derived from ScanTask.
 
-   Before creating any ScanTask objects the class method makeRealTime
-   must be called.
-
-   Once startScheduler has been called it is not safe to create any 
-   more ScanTask objects and deleting one at any time will be a 
-   disaster.
+   Each scan task also keeps lock-free histograms of its wakeup 
+   latency, execution time and period jitter, which can be read at
+   any time with the stats method.
 */
 
 class ScanTask {
 public:
 
     /// Constructor
-    ScanTask(const char* name,  ///< name used for semaphore
+    ScanTask(ScanScheduler &scheduler,  ///< the scheduler that wakes the task
+            const char* name,  ///< name used for the scan thread
             int waitticks,     ///< Number of ticks between executions
             int prio           ///< thread priority
     );
 
-    /// Set the process to be real-time.
-    static void makeRealTime();
+    /// Destructor
+    /**
+        Must not be called while the scheduler is running. The scan
+        thread calls the virtual scan method, so the owner of a 
+        derived object must call stop before deleting it.
+    */
+    virtual ~ScanTask();
+
+    // Disable copy
+    ScanTask(ScanTask const &) = delete;
+
+    ScanTask &operator=(ScanTask const &) = delete;
 
     /// Virtual method executed every waitticks ticks.
     virtual void scan() = 0;
@@ -52,20 +228,41 @@ public:
     /// Start the scan task
     /**
         The tasks scan method does not runn until the scheduler has 
-        been started
+        been started. Returns when the task is stopped.
     */
-    [[noreturn]] void start();
+    void start();
 
-    /// Start the scheduler
-    static void startScheduler();
+    /// Stop the scan task
+    /**
+        Stops the scan thread, waiting for the current execution of
+        the scan (if any) to finish. Must not be called while the
+        scheduler is running.
+    */
+    void stop();
 
     /// Wait for scan to run
     void waitForScan();
 
+    /// Number of executions of the scan that have been skipped
+    long missedTicks() const;
+
+    /// Get the timing statistics (can be called from any thread)
+    void stats(ScanStats *s) const;
+
+    /// Get the real-time policy applied to the scan thread
+    void policy(ThreadPolicy *p) const;
+
 private:
+    friend class ScanScheduler;
+
+    // The scheduler that wakes the task
+    ScanScheduler &Scheduler;
+
+    // The name of the scan thread
+    char Name[16];
 
-    // The semaphore that the scan task waits on
-    sem_t *Sem;
+    // The process private semaphore that the scan task waits on
+    Wakeup Sem;
 
     // Mutex to protect the condition variables
     pthread_mutex_t WaitMutex;
@@ -82,14 +279,47 @@ private:
     // The number of ticks between each run of the scan
     int WaitTicks;
 
+    // The thread priority (relative to the scheduler's), and the real-time
+    // policy applied by the thread, which it posts Ready after setting
+    int Prio;
+    ThreadPolicy Policy;
+    Wakeup Ready;
+
     // The number of ticks since the scan last ran
     int TickCount;
 
-    static std::vector<void *> Tasks;
-    static bool RealTime;
-    static pthread_attr_t Tattr;
+    // Set from the release of the scan until it has finished executing
+    std::atomic<bool> Running;
+
+    // Posted when the scan has finished, in virtual time
+    Wakeup Done;
+
+    // The scan thread, and a flag telling it to exit
+    pthread_t Thread;
+    bool Started;
+    std::atomic<bool> Stop;
+
+    // The number of executions of the scan that have been skipped
+    std::atomic<long> MissedTicks;
+
+    // Timing statistics: the monotonic time of the last release (ns),
+    // the start of the previous execution, and histograms and counters
+    // updated by the scan thread
+    std::atomic<long long> ReleaseNs;
+    long long LastStartNs;
+    LatencyHistogram WakeupLatency;
+    LatencyHistogram ExecutionTime;
+    LatencyHistogram Jitter;
+    std::atomic<long> Runs;
+    std::atomic<long> Overruns;
+
+    // Advance the task's tick counter by one scheduler tick, returning
+    // true if the scan is due.
+    bool tick();
 
-    [[noreturn]] static void *scheduler(void *arg);
+    // Release the scan for execution, or count it as missed if it is
+    // still running.
+    void release(int due);
 
     static void *startScan(void *scanTask);
 };
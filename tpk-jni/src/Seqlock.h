@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// A single value shared between threads using a sequence lock.
+//
+// Readers never block and never see a torn value: load() retries if a store happened while it was
+// copying. Stores must be serialized by the caller (for example by a mutex shared by all writers), but
+// take no lock themselves, so a real-time reader is never held up by a writer.
+//
+// The value is held as an array of relaxed atomic words so that concurrent reads and writes are
+// well defined. T must be trivially copyable.
+template<typename T>
+class Seqlock {
+public:
+    Seqlock() : seq(0) {
+        T value{};
+        store(value);
+    }
+
+    explicit Seqlock(const T &value) : seq(0) {
+        store(value);
+    }
+
+    // Disable copy
+    Seqlock(Seqlock const &) = delete;
+
+    Seqlock &operator=(Seqlock const &) = delete;
+
+    // Publishes a new value (writers must be serialized)
+    void store(const T &value) {
+        uint64_t buf[numWords] = {};
+        memcpy(buf, &value, sizeof(T));
+
+        unsigned long s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < numWords; i++) {
+            words[i].store(buf[i], std::memory_order_relaxed);
+        }
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Returns a consistent copy of the most recently stored value
+    T load() const {
+        uint64_t buf[numWords];
+        unsigned long s1, s2;
+        do {
+            s1 = seq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < numWords; i++) {
+                buf[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s2 = seq.load(std::memory_order_relaxed);
+        } while ((s1 & 1) || s1 != s2);
+
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+    // Returns a number that changes every time a new value is stored
+    unsigned long version() const {
+        return seq.load(std::memory_order_acquire);
+    }
+
+private:
+#if __GNUC__ >= 5 || defined(__clang__)
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock requires a trivially copyable type");
+#endif
+
+    static const size_t numWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<unsigned long> seq;
+    std::atomic<uint64_t> words[numWords];
+};
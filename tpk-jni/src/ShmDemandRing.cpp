@@ -0,0 +1,193 @@
+#include "ShmDemandRing.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ShmDemandRing;
+
+static const uint32_t defaultCapacity = 4096;
+
+// Sets the shared memory object name for name, which may or may not start with '/'
+static bool objectName(const char *name, char *buf, size_t size) {
+    if (!name || !*name) return false;
+    int n = snprintf(buf, size, "%s%s", name[0] == '/' ? "" : "/", name);
+    return n > 0 && static_cast<size_t>(n) < size && !strchr(buf + 1, '/');
+}
+
+ShmDemandWriter::ShmDemandWriter(const char *name, Header *header, size_t size) : header(header), size(size) {
+    snprintf(shmName, sizeof shmName, "%s", name);
+}
+
+ShmDemandWriter *ShmDemandWriter::create(const char *name, uint32_t capacity) {
+    char obj[64];
+    if (!objectName(name, obj, sizeof obj) || capacity == 0) {
+        printf("Warning: Invalid shared memory demand ring %s with %u slots\n", name ? name : "(null)", capacity);
+        return nullptr;
+    }
+
+    // A new object, so that readers of a previous one see it closed rather than a ring starting again
+    shm_unlink(obj);
+    int fd = shm_open(obj, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        return nullptr;
+    }
+    size_t size = sizeFor(capacity);
+    if (ftruncate(fd, static_cast<off_t>(size))) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(obj);
+        return nullptr;
+    }
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(obj);
+        return nullptr;
+    }
+
+    // The object is zero filled: every slot's seq is 0, which no reader expects
+    auto *h = static_cast<Header *>(p);
+    h->capacity = capacity;
+    h->recordSize = sizeof(PkShmDemand);
+    h->version = version;
+    h->written.store(0, std::memory_order_relaxed);
+    h->closed.store(0, std::memory_order_relaxed);
+    h->magic.store(magic, std::memory_order_release);
+    return new ShmDemandWriter(obj, h, size);
+}
+
+ShmDemandWriter *ShmDemandWriter::fromEnv() {
+    const char *name = getenv("TPK_SHM_DEMANDS");
+    if (!name || !*name) return nullptr;
+    uint32_t capacity = defaultCapacity;
+    const char *s = getenv("TPK_SHM_DEMANDS_SIZE");
+    if (s) {
+        char *end;
+        long n = strtol(s, &end, 10);
+        if (end == s || *end || n <= 0 || n > (1L << 24)) {
+            printf("Warning: Ignoring invalid TPK_SHM_DEMANDS_SIZE: %s\n", s);
+        } else {
+            capacity = static_cast<uint32_t>(n);
+        }
+    }
+    return create(name, capacity);
+}
+
+ShmDemandWriter::~ShmDemandWriter() {
+    header->closed.store(1, std::memory_order_release);
+    munmap(header, size);
+    shm_unlink(shmName);
+}
+
+void ShmDemandWriter::write(const PkShmDemand &demand) {
+    uint64_t buf[recordWords] = {};
+    memcpy(buf, &demand, sizeof demand);
+    buf[0] = next;  // seq is the first field
+
+    Slot &slot = slots(header)[next % header->capacity];
+    slot.seq.store(2 * next + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < recordWords; i++) {
+        slot.words[i].store(buf[i], std::memory_order_relaxed);
+    }
+    slot.seq.store(2 * next + 2, std::memory_order_release);
+    header->written.store(++next, std::memory_order_release);
+}
+
+// The reader side of the C API
+
+struct PkShmReader {
+    Header *header;
+    size_t size;
+    uint64_t next;
+    uint64_t lost;
+};
+
+extern "C" {
+
+PkShmReader *pkshm_open(const char *name) {
+    char obj[64];
+    if (!objectName(name, obj, sizeof obj)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    int fd = shm_open(obj, O_RDONLY, 0);
+    if (fd < 0) return nullptr;
+    struct stat st{};
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        close(fd);
+        errno = EINVAL;
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+
+    auto *h = static_cast<Header *>(p);
+    if (h->magic.load(std::memory_order_acquire) != magic || h->version != version
+        || h->recordSize != sizeof(PkShmDemand) || h->capacity == 0 || sizeFor(h->capacity) > size) {
+        munmap(p, size);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    auto *reader = new PkShmReader;
+    reader->header = h;
+    reader->size = size;
+    reader->next = h->written.load(std::memory_order_acquire);
+    reader->lost = 0;
+    return reader;
+}
+
+int pkshm_next(PkShmReader *reader, PkShmDemand *demand) {
+    Header *h = reader->header;
+    for (;;) {
+        uint64_t i = reader->next;
+        const Slot &slot = slots(h)[i % h->capacity];
+        uint64_t expected = 2 * i + 2;
+        uint64_t s1 = slot.seq.load(std::memory_order_acquire);
+        if (s1 < expected) {
+            return h->closed.load(std::memory_order_acquire) ? -1 : 0;
+        }
+        if (s1 == expected) {
+            uint64_t buf[recordWords];
+            for (size_t k = 0; k < recordWords; k++) {
+                buf[k] = slot.words[k].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == expected) {
+                memcpy(demand, buf, sizeof *demand);
+                reader->next = i + 1;
+                return 1;
+            }
+        }
+
+        // Overwritten: skip to the oldest demand still in the ring
+        uint64_t written = h->written.load(std::memory_order_acquire);
+        uint64_t oldest = written > h->capacity ? written - h->capacity : 0;
+        if (oldest <= i) oldest = i + 1;
+        reader->lost += oldest - i;
+        reader->next = oldest;
+    }
+}
+
+uint64_t pkshm_lost(const PkShmReader *reader) {
+    return reader->lost;
+}
+
+void pkshm_close(PkShmReader *reader) {
+    if (!reader) return;
+    munmap(reader->header, reader->size);
+    delete reader;
+}
+
+}
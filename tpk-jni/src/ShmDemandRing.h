@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "ShmDemands.h"
+
+// The layout of the demand ring in shared memory (see ShmDemands.h), shared by the writer and readers.
+//
+// Each slot is a sequence lock holding the index of the demand in it: seq is 2 * index + 1 while the
+// demand is being written and 2 * index + 2 once it is complete. A reader expecting index i copies the
+// slot and then checks that seq was 2 * i + 2 before and after: a lower value means that demand has not
+// been written yet, a higher one that it has been overwritten. The words are relaxed atomics so that
+// concurrent reads and writes are well defined, as in Seqlock.
+namespace ShmDemandRing {
+    const uint32_t magic = 0x504b444d;     // "PKDM"
+    const uint32_t version = 1;
+
+    const size_t recordWords = (sizeof(PkShmDemand) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> words[recordWords];
+    };
+
+    struct alignas(64) Header {
+        std::atomic<uint32_t> magic;    // set last by the writer, once the rest is set
+        uint32_t version;
+        uint32_t capacity;              // number of slots
+        uint32_t recordSize;            // sizeof(PkShmDemand)
+        std::atomic<uint64_t> written;  // the number of demands written
+        std::atomic<uint32_t> closed;   // set by the writer when it is shut down
+    };
+
+    inline size_t sizeFor(uint32_t capacity) {
+        return sizeof(Header) + capacity * sizeof(Slot);
+    }
+
+    inline Slot *slots(Header *h) {
+        return reinterpret_cast<Slot *>(h + 1);
+    }
+}
+
+// Writes the demands to the ring (called by the fast loop only)
+class ShmDemandWriter {
+public:
+    // Creates the named ring (replacing any previous one, so that its readers see it closed) with
+    // room for capacity demands. Returns nullptr, after printing why, if it could not be created.
+    static ShmDemandWriter *create(const char *name, uint32_t capacity);
+
+    // Creates the ring named by TPK_SHM_DEMANDS, with TPK_SHM_DEMANDS_SIZE slots (default 4096), or
+    // returns nullptr if it is not set or the ring could not be created
+    static ShmDemandWriter *fromEnv();
+
+    // Marks the ring closed, unmaps it and removes the name
+    ~ShmDemandWriter();
+
+    // Disable copy
+    ShmDemandWriter(ShmDemandWriter const &) = delete;
+
+    ShmDemandWriter &operator=(ShmDemandWriter const &) = delete;
+
+    // Writes the next demand (its seq is set here) without blocking
+    void write(const PkShmDemand &demand);
+
+    const char *name() const { return shmName; }
+
+    uint32_t capacity() const { return header->capacity; }
+
+private:
+    ShmDemandWriter(const char *name, ShmDemandRing::Header *header, size_t size);
+
+    char shmName[64];
+    ShmDemandRing::Header *header;
+    size_t size;
+    uint64_t next = 0;
+};
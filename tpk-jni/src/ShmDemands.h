@@ -0,0 +1,52 @@
+#pragma once
+
+// C API for following the demands of the pointing kernel through shared memory.
+//
+// When the environment variable TPK_SHM_DEMANDS is set to a name (for example "tpk-demands"), the
+// fast loop also writes the demands of every tick to a ring in the POSIX shared memory object of that
+// name (/dev/shm/tpk-demands on Linux). Consumers on the same host can follow it with this API, without
+// the CSW event service. The writer never waits for a reader: a reader that falls more than the ring
+// size behind skips the overwritten demands, and pkshm_lost() counts them.
+//
+// Readers poll pkshm_next(), which takes no lock and makes no system call.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The demands of one tick of the fast loop
+typedef struct {
+    uint64_t seq;               // the tick's index in the stream (0 for the first tick written)
+    int64_t timeNs;             // UTC, in ns since 1970
+    int64_t monotonicNs;        // CLOCK_MONOTONIC when written, to measure the latency
+    double mcsAz, mcsEl;        // deg
+    double ra, dec;             // deg
+    double siderealTime;        // hours
+    int32_t ecs;                // non-zero if base and cap are new enclosure demands (20Hz)
+    int32_t reserved;
+    double base, cap;           // deg
+    double m3Rotation, m3Tilt;  // deg
+} PkShmDemand;
+
+typedef struct PkShmReader PkShmReader;
+
+// Opens the named ring (as given to TPK_SHM_DEMANDS) and returns a reader positioned after the latest
+// demand written, or NULL (with errno set) if it does not exist or is not a demand ring
+PkShmReader *pkshm_open(const char *name);
+
+// Copies the next demand to demand. Returns 1 if there was one, 0 if there is no new demand yet and
+// -1 if the writer has closed the ring (the pointing kernel was shut down: open it again to follow the
+// next one).
+int pkshm_next(PkShmReader *reader, PkShmDemand *demand);
+
+// The number of demands skipped so far because they were overwritten before they were read
+uint64_t pkshm_lost(const PkShmReader *reader);
+
+// Closes the reader
+void pkshm_close(PkShmReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,169 @@
+#include "Slew.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static const double secondsPerDay = 86400.0;
+
+// The default limits of the mount, enclosure and M3 axes (deg/s, deg/s^2, deg/s^3)
+static const SlewLimits defaultMount = {2.5, 1.0, 2.0};
+static const SlewLimits defaultEnclosure = {2.0, 0.5, 1.0};
+static const SlewLimits defaultM3 = {5.0, 5.0, 20.0};
+
+static double sign(double x) {
+    return x < 0 ? -1.0 : 1.0;
+}
+
+// Brings an angle in deg into (-180, 180]
+static double wrap180(double deg) {
+    double x = remainder(deg, 360.0);
+    return x == -180.0 ? 180.0 : x;
+}
+
+void SlewProfile::add(double duration, double jerk) {
+    if (!(duration > 0) || numPhases == maxPhases) return;
+    Phase &ph = phases[numPhases++];
+    ph.start = total;
+    ph.jerk = jerk;
+    ph.p = p;
+    ph.v = v;
+    ph.a = a;
+    double t = duration;
+    p += v * t + a * t * t / 2 + jerk * t * t * t / 6;
+    v += a * t + jerk * t * t / 2;
+    a += jerk * t;
+    total += t;
+}
+
+void SlewProfile::changeVelocity(double dv, const SlewLimits &limits) {
+    double s = sign(dv);
+    double size = fabs(dv);
+    double j = limits.jerk, am = limits.acceleration;
+    if (size <= am * am / j) {
+        // The acceleration never reaches the limit
+        double tj = sqrt(size / j);
+        add(tj, s * j);
+        add(tj, -s * j);
+    } else {
+        double tj = am / j;
+        add(tj, s * j);
+        add(size / am - tj, 0.0);
+        add(tj, -s * j);
+    }
+    a = 0.0;
+}
+
+void SlewProfile::plan(double p0, double v0, double a0, const SlewLimits &limits) {
+    numPhases = 0;
+    total = 0.0;
+    p = p0;
+    v = v0;
+    a = a0;
+    const double j = limits.jerk, am = limits.acceleration;
+
+    // Bring the acceleration and then the velocity to 0
+    if (a != 0.0) {
+        add(fabs(a) / j, -sign(a) * j);
+        a = 0.0;
+    }
+    if (v != 0.0) {
+        changeVelocity(-v, limits);
+        v = 0.0;
+    }
+
+    // Then move the remaining distance at the highest velocity that allows. Speeding up to vp and
+    // slowing down again covers vp * ta(vp), where ta is the time to reach vp.
+    double distance = fabs(p);
+    if (distance == 0.0) return;
+    auto accelTime = [&](double vp) {
+        return vp <= am * am / j ? 2.0 * sqrt(vp / j) : vp / am + am / j;
+    };
+    double vp = limits.velocity;
+    if (vp * accelTime(vp) > distance) {
+        vp = pow(distance * sqrt(j) / 2.0, 2.0 / 3.0);
+        if (vp > am * am / j) {
+            double k = am / j;
+            vp = am * (-k + sqrt(k * k + 4.0 * distance / am)) / 2.0;
+        }
+    }
+    double s = -sign(p);
+    changeVelocity(s * vp, limits);
+    add((distance - vp * accelTime(vp)) / vp, 0.0);
+    changeVelocity(-s * vp, limits);
+    v = 0.0;
+}
+
+void SlewProfile::evaluate(double t, double &pos, double &vel, double &acc) const {
+    if (t >= total || numPhases == 0) {
+        pos = vel = acc = 0.0;
+        return;
+    }
+    if (t < 0) t = 0;
+    int i = numPhases - 1;
+    while (i > 0 && phases[i].start > t) i--;
+    const Phase &ph = phases[i];
+    double dt = t - ph.start;
+    pos = ph.p + ph.v * dt + ph.a * dt * dt / 2 + ph.jerk * dt * dt * dt / 6;
+    vel = ph.v + ph.a * dt + ph.jerk * dt * dt / 2;
+    acc = ph.a + ph.jerk * dt;
+}
+
+double SlewProfile::position(double t) const {
+    double pos, vel, acc;
+    evaluate(t, pos, vel, acc);
+    return pos;
+}
+
+Slew::Slew(const SlewLimits *limits) {
+    for (int i = 0; i < NUM_AXES; i++) axisLimits[i] = limits[i];
+}
+
+// Parses "velocity,acceleration,jerk" from the environment variable name, if set
+static bool limitsFromEnv(const char *name, SlewLimits &limits) {
+    const char *s = getenv(name);
+    if (!s) return false;
+    SlewLimits l{};
+    if (sscanf(s, "%lf,%lf,%lf", &l.velocity, &l.acceleration, &l.jerk) != 3 || !(l.velocity > 0)
+        || !(l.acceleration > 0) || !(l.jerk > 0)) {
+        printf("Warning: Ignoring invalid %s: %s\n", name, s);
+    } else {
+        limits = l;
+    }
+    return true;
+}
+
+Slew *Slew::fromEnv() {
+    SlewLimits mount = defaultMount, enclosure = defaultEnclosure, m3 = defaultM3;
+    bool set = getenv("TPK_SLEW") != nullptr;
+    set = limitsFromEnv("TPK_SLEW_MOUNT", mount) || set;
+    set = limitsFromEnv("TPK_SLEW_ENCLOSURE", enclosure) || set;
+    set = limitsFromEnv("TPK_SLEW_M3", m3) || set;
+    if (!set) return nullptr;
+    SlewLimits limits[NUM_AXES] = {mount, mount, enclosure, enclosure, m3, m3};
+    return new Slew(limits);
+}
+
+void Slew::plan(double tai, const double *offsets) {
+    double t = (tai - start) * secondsPerDay;
+    for (int i = 0; i < NUM_AXES; i++) {
+        double p, v, a;
+        profiles[i].evaluate(t, p, v, a);
+        if (std::isnan(offsets[i])) {
+            profiles[i].plan(0.0, 0.0, 0.0, axisLimits[i]);
+        } else {
+            // The azimuths go the short way round when the demands cross 0/360
+            bool azimuth = i == MOUNT_AZ || i == ENCLOSURE_BASE;
+            profiles[i].plan(azimuth ? wrap180(offsets[i]) : offsets[i], v, a, axisLimits[i]);
+        }
+    }
+    start = tai;
+    double longest = 0.0;
+    for (const SlewProfile &profile : profiles) longest = fmax(longest, profile.duration());
+    end = tai + longest / secondsPerDay;
+    ++planned;
+}
+
+double Slew::offset(int axis, double tai) const {
+    return profiles[axis].position((tai - start) * secondsPerDay);
+}
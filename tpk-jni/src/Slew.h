@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+
+// Limits of the motion of an axis (in deg/s, deg/s^2 and deg/s^3)
+typedef struct {
+    double velocity;
+    double acceleration;
+    double jerk;
+} SlewLimits;
+
+// The motion of one axis from a given position, velocity and acceleration to rest at 0, within the
+// velocity, acceleration and jerk limits.
+//
+// The motion is planned as a sequence of phases of constant jerk: first the acceleration is brought
+// to 0 and then the velocity, and then the remaining distance is covered with the usual seven phase
+// S-curve (jerk, constant acceleration, jerk, cruise and the same in reverse), at the highest velocity
+// the distance allows. That is time optimal from rest, which is how every slew starts except one that
+// replaces a slew in progress.
+class SlewProfile {
+public:
+    // Plans the motion from position p0 with velocity v0 and acceleration a0 to rest at 0. v0 and a0
+    // must be such that the velocity stays within the limit while the acceleration is brought to 0,
+    // as they are anywhere on a profile planned here.
+    void plan(double p0, double v0, double a0, const SlewLimits &limits);
+
+    // Gets the position, velocity and acceleration t seconds after the start (0 after the end)
+    void evaluate(double t, double &p, double &v, double &a) const;
+
+    // Returns the position t seconds after the start
+    double position(double t) const;
+
+    // The time to come to rest (s)
+    double duration() const { return total; }
+
+private:
+    // Adds a phase of constant jerk
+    void add(double duration, double jerk);
+
+    // Adds the phases that change the velocity by dv, starting and ending with no acceleration
+    void changeVelocity(double dv, const SlewLimits &limits);
+
+    struct Phase {
+        double start;       // s
+        double jerk;
+        double p, v, a;     // at the start
+    };
+
+    static const int maxPhases = 11;
+    Phase phases[maxPhases];
+    int numPhases = 0;
+    double total = 0.0;
+
+    // The state at the end of the phases added so far
+    double p = 0.0, v = 0.0, a = 0.0;
+};
+
+// Slews the mount, enclosure and M3 demands to new targets instead of letting them step.
+//
+// When new commands are applied, the fast loop plans a profile for each axis that takes the
+// difference between the demands it last published and the new ones (the offset) to 0, and then adds
+// the offsets to the demands it computes until the slew is over. The tracking motion continues
+// underneath, so the limits apply to the slew on top of it. A new slew that starts before the last one
+// is over continues from the offsets, velocities and accelerations of that one.
+class Slew {
+public:
+    enum Axis {
+        MOUNT_AZ, MOUNT_EL, ENCLOSURE_BASE, ENCLOSURE_CAP, M3_ROTATION, M3_TILT, NUM_AXES
+    };
+
+    // Slews with the given limits for each axis
+    explicit Slew(const SlewLimits *limits);
+
+    // Disable copy
+    Slew(Slew const &) = delete;
+
+    Slew &operator=(Slew const &) = delete;
+
+    // Returns a new slew configured by the environment variables TPK_SLEW_MOUNT, TPK_SLEW_ENCLOSURE and
+    // TPK_SLEW_M3 ("velocity,acceleration,jerk" in deg/s, deg/s^2 and deg/s^3), if TPK_SLEW or any of
+    // them is set, or null
+    static Slew *fromEnv();
+
+    // Plans a slew starting at tai (MJD) from the given offsets (deg, NaN to leave an axis at rest).
+    // The mount azimuth and enclosure base offsets are wrapped into (-180, 180] first.
+    // (called by the fast loop only)
+    void plan(double tai, const double *offsets);
+
+    // Returns the offset of an axis at tai (called by the fast loop only)
+    double offset(int axis, double tai) const;
+
+    // The TAI (MJD) at which the last slew ends (can be called from any thread)
+    double endTai() const { return end; }
+
+    // The number of slews planned so far
+    long slews() const { return planned; }
+
+    const SlewLimits &limits(int axis) const { return axisLimits[axis]; }
+
+private:
+    SlewLimits axisLimits[NUM_AXES];
+    SlewProfile profiles[NUM_AXES];
+    double start = 0.0;
+    std::atomic<double> end{0.0};
+    std::atomic<long> planned{0};
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include "SpscRing.h"
+
+// Hands heap allocated snapshots of some state from a producer thread to a real-time consumer thread.
+//
+// The producer builds a complete new snapshot and publishes it. The consumer, at a point of its choosing,
+// takes the latest snapshot and later retires it. Taking and retiring only exchange pointers: the handoff
+// never copies, allocates or frees on the consumer's side. What the consumer does with the snapshot in
+// between is up to it: the fast loop of TpkC copies the site out of it at a tick boundary, since its
+// TimeKeeper and virtual telescopes hold their site by reference. Retired snapshots (and any published
+// snapshot that the consumer never took) are freed by the producer the next time it publishes, or by
+// the destructor.
+//
+// Together with the snapshot in use by the consumer this is a double buffer: the producer always works
+// on memory the consumer cannot see.
+template<typename T>
+class SnapshotHandoff {
+public:
+    // Between two publishes the consumer can take at most two snapshots (the one published before the
+    // previous collect and the one published after it), so a few slots are always enough
+    SnapshotHandoff() : pending(nullptr), retired(8) {}
+
+    ~SnapshotHandoff() {
+        collect();
+        delete pending.exchange(nullptr);
+    }
+
+    // Disable copy
+    SnapshotHandoff(SnapshotHandoff const &) = delete;
+
+    SnapshotHandoff &operator=(SnapshotHandoff const &) = delete;
+
+    // Makes snapshot (allocated with new) available to the consumer, replacing any snapshot it has not
+    // taken yet (producer only)
+    void publish(T *snapshot) {
+        collect();
+        delete pending.exchange(snapshot, std::memory_order_acq_rel);
+    }
+
+    // Returns the latest published snapshot, or nullptr if nothing was published since the last call
+    // (consumer only). The caller owns the snapshot until it passes it to retire().
+    T *take() {
+        if (!pending.load(std::memory_order_relaxed)) return nullptr;
+        return pending.exchange(nullptr, std::memory_order_acq_rel);
+    }
+
+    // Gives a snapshot the consumer no longer uses back to the producer to be freed (consumer only)
+    void retire(T *snapshot) {
+        if (snapshot && !retired.push(snapshot, false)) leaked++;
+    }
+
+    // The number of snapshots that could not be retired because there was no free slot (should be 0)
+    unsigned long leakedSnapshots() const { return leaked.load(); }
+
+private:
+    // Frees the retired snapshots (producer only)
+    void collect() {
+        T *snapshot;
+        while (retired.pop(snapshot)) delete snapshot;
+    }
+
+    std::atomic<T *> pending;
+    SpscRing<T *> retired;
+    std::atomic<unsigned long> leaked{0};
+};
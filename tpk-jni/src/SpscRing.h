@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// A bounded, lock-free, single producer single consumer ring buffer.
+//
+// The producer is normally a real-time scan loop and never blocks: when the ring is full push() either
+// fails or, with dropOldest set, discards the oldest entry to make room. The consumer may lose the race
+// for the oldest entry, in which case pop() simply moves on to the next one.
+//
+// Entries are held as arrays of relaxed atomic words (as in Seqlock) so that a consumer reading an entry
+// the producer is overwriting is well defined; the consumer only keeps the copy if it then succeeds in
+// advancing the tail. All memory is allocated by the constructor. T must be trivially copyable.
+template<typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : cap(capacity > 0 ? capacity : 1), words(cap * numWords), head(0), tail(0) {}
+
+    // Disable copy
+    SpscRing(SpscRing const &) = delete;
+
+    SpscRing &operator=(SpscRing const &) = delete;
+
+    // Adds an entry (producer only). Returns false if an entry was discarded because the ring was full:
+    // the new one, or, if dropOldest is true, the oldest one, to make room for the new one.
+    bool push(const T &value, bool dropOldest) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        bool dropped = false;
+        if (h - t == cap) {
+            if (!dropOldest) return false;
+            // If this fails the consumer has just popped the oldest entry, which made room without a drop
+            dropped = tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel);
+        }
+        write(h % cap, value);
+        head.store(h + 1, std::memory_order_release);
+        return !dropped;
+    }
+
+    // Removes the oldest entry (consumer only). Returns false, leaving value unchanged, if the ring is empty.
+    bool pop(T &value) {
+        size_t t = tail.load(std::memory_order_acquire);
+        for (;;) {
+            if (t == head.load(std::memory_order_acquire)) return false;
+            T copy;
+            read(t % cap, copy);
+            if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                value = copy;
+                return true;
+            }
+            // The producer dropped the entry while we were reading it: t now holds the new tail
+        }
+    }
+
+    // The number of entries in the ring
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        return head.load(std::memory_order_acquire) - t;
+    }
+
+    size_t capacity() const { return cap; }
+
+private:
+#if __GNUC__ >= 5 || defined(__clang__)
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing requires a trivially copyable type");
+#endif
+
+    static const size_t numWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    void write(size_t slot, const T &value) {
+        uint64_t buf[numWords] = {};
+        memcpy(buf, &value, sizeof(T));
+        for (size_t i = 0; i < numWords; i++) {
+            words[slot * numWords + i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+    void read(size_t slot, T &value) const {
+        uint64_t buf[numWords];
+        for (size_t i = 0; i < numWords; i++) {
+            buf[i] = words[slot * numWords + i].load(std::memory_order_relaxed);
+        }
+        memcpy(&value, buf, sizeof(T));
+    }
+
+    const size_t cap;
+    std::vector<std::atomic<uint64_t>> words;
+
+    // head is only written by the producer; tail by the consumer, or by the producer when dropping
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
@@ -2,15 +2,17 @@
 
 #include <ctime>
 #include <cmath>
+#include <cstring>
 
+#include "BaseCap.h"
 #include "FakeSystemClock.h"
+#include "Monotonic.h"
+#include "ParallelFor.h"
+#include "Trajectory.h"
 #include "tpk/UnixClock.h"
 
 #include "csw/csw.h"
 
-// Convert degrees to microarcseconds
-static double deg2Mas(double d) { return d * 60.0 * 60.0 * 1000.0 * 1000.0; }
-
 // Convert degrees to radians
 #define deg2Rad(d) ((d) * M_PI / 180.0)
 
@@ -20,6 +22,17 @@ static double deg2Mas(double d) { return d * 60.0 * 60.0 * 1000.0 * 1000.0; }
 // Convert radians to degrees
 #define rad2Hour(d) (rad2Deg(d) / 15.0)
 
+// TAI-UTC (37 s at the time of writing)
+static const long long taiMinusUtcNs = 37000000000LL;
+
+// The smallest number of points a batch coordinate conversion gives to a thread
+static const size_t minTransformChunk = 256;
+
+// Returns true if refSys is one of the PkRefSys values (a reference system passed in from C or Java)
+static bool isRefSys(int refSys) {
+    return refSys == PK_ICRS || refSys == PK_FK5 || refSys == PK_AZEL;
+}
+
 // CSW component prefix
 const char *prefix = "TCS.PointingKernelAssembly";
 
@@ -27,144 +40,217 @@ const char *prefix = "TCS.PointingKernelAssembly";
 
 class SlowScan : public ScanTask {
 private:
-    tpk::TimeKeeper &time;
-    tpk::Site &site;
+    TpkC *tpkC;
 
     void scan() override {
 
-        // Update the Site object with the current time. If we had a weather
-        // server we would also update the atmospheric conditions here.
-        site.refresh(time.tai());
+        // Update the site with the time of the latest tick and the atmospheric conditions.
+        tpkC->refreshSite();
     }
 
 public:
-    SlowScan(tpk::TimeKeeper &t, tpk::Site &s) :
-            ScanTask("/SlowScan", 6000, 3), time(t), site(s) {};
+    SlowScan(ScanScheduler &scheduler, TpkC *pk) :
+            ScanTask(scheduler, "SlowScan", 6000, 3), tpkC(pk) {};
 };
 
 // The MediumScan class implements the "medium" loop.
 
 class MediumScan : public ScanTask {
 private:
-    tpk::TmtMountVt mount;
-    tpk::TmtMountVt enclosure;
+    TpkC *tpkC;
+    long scans;
 
     void scan() override {
 
-        // Update the pointing model.
-        mount.updatePM();
-
-        // Update the mount SPMs,
-        mount.update();
+        // Update the pointing model and the SPMs of the fast loop's mount and enclosure.
+        tpkC->updateSpms();
 
-        // Update the pointing model.
-        enclosure.updatePM();
-
-        // Update the enclosure SPMs,
-        enclosure.update();
+        // Publish the timing statistics of the loops once a second.
+        if (++scans % 2 == 0) tpkC->requestLoopStats();
     }
 
 public:
-    MediumScan(tpk::TmtMountVt &m, tpk::TmtMountVt &e) :
-            ScanTask("/MediumScan", 500, 2), mount(m), enclosure(e) {};
+    MediumScan(ScanScheduler &scheduler, TpkC *pk) :
+            ScanTask(scheduler, "MediumScan", 500, 2), tpkC(pk), scans(0) {};
 };
 
+// Gets what the virtual telescopes computed on their last track()
+static void trackedPoint(VtSet &v, TrajectoryPoint &p) {
+    p.mountRoll = v.mount.roll();
+    p.mountPitch = v.mount.pitch();
+    p.enclosureRoll = v.enclosure.roll();
+    p.enclosurePitch = v.enclosure.pitch();
+    p.m3Azimuth = v.mount.m3Azimuth();
+    p.m3Elevation = v.mount.m3Elevation();
+    tpk::spherical telpos = v.mount.position();
+    p.ra = telpos.a;
+    p.dec = telpos.b;
+}
+
 // The FastScan class implements the "fast" loop.
 class FastScan : public ScanTask {
 private:
     TpkC *tpkC;
     tpk::TimeKeeper &time;
-    tpk::TmtMountVt &mount;
-    tpk::TmtMountVt &enclosure;
-    tpk::Site &site;
 
 
     void scan() override {
-        // Update the time
+        // Keep the medium loop from updating the virtual telescopes during the tick, and apply any newly
+        // refreshed site and any new target and offset commands
+        std::lock_guard<PiMutex> lock(tpkC->vtLock());
+        tpkC->applySite();
+        tpkC->applyCommands();
+        VtSet &vts = tpkC->trackingVts();
+        tpk::TmtMountVt &mount = vts.mount;
+        tpk::TmtMountVt &enclosure = vts.enclosure;
+
+        // Update the time, once for everything done on this tick
         time.update();
-
-        // Compute the mount and rotator position demands.
-        mount.track(1);
-
-        // Compute the enclosure  position demands.
-        enclosure.track(1);
+        const TickTime &tick = tpkC->newTick();
+
+        // Take the demands from the predicted trajectory if there is one for the current commands,
+        // otherwise compute the mount, rotator and enclosure position demands.
+        TrajectoryPoint demand;
+        if (!tpkC->predictedDemands(tick.tai, demand)) {
+            mount.track(1);
+            enclosure.track(1);
+            trackedPoint(vts, demand);
+        }
 
         // Get the mount az, el and M3 demands in degrees.
-        double tAz = 180.0 - rad2Deg(mount.roll());
-        double tEl = rad2Deg(mount.pitch());
+        double tAz = 180.0 - rad2Deg(demand.mountRoll);
+        double tEl = rad2Deg(demand.mountPitch);
 
         // Get the enclosure az, el demands in degrees.
-        double eAz = 180.0 - rad2Deg(enclosure.roll());
-        double eEl = rad2Deg(enclosure.pitch());
+        double eAz = 180.0 - rad2Deg(demand.enclosureRoll);
+        double eEl = rad2Deg(demand.enclosurePitch);
 
-        double m3R = rad2Deg(mount.m3Azimuth());
-        double m3T = 90.0 - rad2Deg(mount.m3Elevation());
+        double m3R = rad2Deg(demand.m3Azimuth);
+        double m3T = 90.0 - rad2Deg(demand.m3Elevation);
 
 //        CoordPair p;
 //        tpkC->azElToRaDec(tAz, tEl, &p);
 //        double raDeg = p.a;
 //        double decDeg = p.b;
 
-        tpk::spherical telpos = mount.position();
-        double raDeg = rad2Deg(telpos.a);
-        double decDeg = rad2Deg(telpos.b);
+        double raDeg = rad2Deg(demand.ra);
+        double decDeg = rad2Deg(demand.dec);
+        tpkC->setPosition(raDeg, decDeg);
 
         tpkC->newDemands(tAz, tEl, eAz, eEl, m3R, m3T, raDeg, decDeg);
+
+        if (tpkC->isRecording()) {
+            PkTickRecord rec{};
+            rec.tai = tick.tai;
+            rec.utcNs = tick.utc.seconds * 1000000000LL + tick.utc.nanos;
+            rec.monotonicNs = tick.monotonicNs;
+            rec.siderealTime = rad2Hour(tick.siderealTime);
+            rec.mountRoll = demand.mountRoll;
+            rec.mountPitch = demand.mountPitch;
+            rec.enclosureRoll = demand.enclosureRoll;
+            rec.enclosurePitch = demand.enclosurePitch;
+            rec.m3Azimuth = demand.m3Azimuth;
+            rec.m3Elevation = demand.m3Elevation;
+            rec.ra = raDeg;
+            rec.dec = decDeg;
+            rec.targetId = vts.target.id;
+            rec.targetRefSys = vts.target.refSys;
+            rec.targetA = vts.target.a;
+            rec.targetB = vts.target.b;
+            rec.offsetId = vts.offset.id;
+            rec.offsetRefSys = vts.offset.refSys;
+            rec.offsetA = vts.offset.a;
+            rec.offsetB = vts.offset.b;
+            tpkC->recordTick(rec);
+        }
     }
 
 public:
-    FastScan(TpkC *pk, tpk::TimeKeeper &t, tpk::TmtMountVt &m, tpk::TmtMountVt &e, tpk::Site &s) :
-            ScanTask("/FastScan", 10, 1), tpkC(pk), time(t), mount(m), enclosure(e), site(s) {
+    FastScan(ScanScheduler &scheduler, TpkC *pk, tpk::TimeKeeper &t) :
+            ScanTask(scheduler, "FastScan", 10, 1), tpkC(pk), time(t) {
 
     };
 };
 
+// The PredictScan class implements the optional prediction loop, which runs at a lower priority than
+// the others and keeps the predicted trajectory ahead of the fast loop.
+class PredictScan : public ScanTask {
+private:
+    TpkC *tpkC;
+
+    void scan() override {
+        tpkC->predict();
+    }
+
+public:
+    PredictScan(ScanScheduler &scheduler, TpkC *pk) :
+            ScanTask(scheduler, "PredictScan", 100, 4), tpkC(pk) {};
+};
+
+// The clock of the virtual telescopes used for prediction: reads the time being predicted
+class PredictionClock : public tpk::Clock {
+public:
+    double read() override { return tai; }
+
+    double tai = 0.0;
+};
+
+AddedVt::AddedVt(tpk::TimeKeeper &time, tpk::Site &site, tpk::AffineTransform *transf) :
+        vt(time, site, tpk::BentNasmyth(tpk::TcsLib::pi, 0.0), transf, nullptr, tpk::ICRefSys()) {
+}
+
+VtSet::VtSet(tpk::TimeKeeper &time, tpk::Site &site, tpk::AffineTransform *transf, int numAdded) :
+        site(site),
+        mount(time, site, tpk::BentNasmyth(tpk::TcsLib::pi, 0.0), transf, nullptr, tpk::ICRefSys()),
+        enclosure(time, site, tpk::BentNasmyth(tpk::TcsLib::pi, 0.0), transf, nullptr, tpk::ICRefSys()) {
+    added.reserve(static_cast<size_t>(numAdded));
+    for (int i = 0; i < numAdded; i++) added.emplace_back(time, site, transf);
+}
+
 TpkC::TpkC() {
+    rtConfig = RealTimeConfig::fromEnv();
+    virtualTime = getenv("TPK_VIRTUAL_TIME") != nullptr;
+
     // These fields are initialized in init()
+    clock = nullptr;
     time = nullptr;
     site = nullptr;
+    slowSite = nullptr;
+    siteHandoff = nullptr;
     publisher = nullptr;
-    mount = nullptr;
-    enclosure = nullptr;
+    transf = nullptr;
+    slowScan = nullptr;
+    mediumScan = nullptr;
+    fastScan = nullptr;
+    predictScan = nullptr;
+    vts = nullptr;
+    demandPublisher = nullptr;
+    baseCapTable = nullptr;
+    demands = nullptr;
+    shmDemands = nullptr;
+    slew = nullptr;
+    recorder = nullptr;
+    weatherSource = nullptr;
+    manualWeather = nullptr;
+    trajectory = nullptr;
+    predictClock = nullptr;
+    predictSite = nullptr;
+    predictTime = nullptr;
+    predictVts = nullptr;
 }
 
 TpkC::~TpkC() {
-    delete time;
-    delete site;
-    cswEventPublisherClose(publisher);
-    delete mount;
-    delete enclosure;
+    shutdown();
 }
 
-static const double ci = deg2Rad(32.5);
-static const double ciz = deg2Rad(90.0 - 32.5);
-static const double PI2 = M_PI * 2;
-
-
-// From table:
-// cap  =ROUND(DEGREES(ACOS(TAN(RADIANS(el-57.5)) / TAN(RADIANS(32.5)))),1)
-// base =ROUND(DEGREES(ATAN(SIN(RADIANS(cap)/COS(RADIANS(32.5))*(1-COS(RADIANS(cap)))))),1)
-// ???  =ROUND(DEGREES(ACOS(TAN(RADIANS(A2-57.5+1)) / TAN(RADIANS(32.5)))),1)
-
 // Calculates the base and cap values
 void TpkC::calculateBaseAndCap(double azDeg, double elDeg, double &baseDeg, double &capDeg) {
-    double azRad = deg2Rad(azDeg);
-    double elRad = deg2Rad(elDeg);
-
-    if ((elRad > PI2) || (elRad < 0)) {
-        elRad = 0;
-    }
-    if ((azRad > PI2) || (azRad < 0)) {
-        azRad = 0;
-    }
+    BaseCap::calculate(azDeg, elDeg, baseDeg, capDeg);
+}
 
-    // Convert Az, El into base & cap coordinates
-    double capRad = acos(tan(elRad - ciz) / tan(ci));
-    // check for division by zero from altitude angle at 90 degrees
-    double azShift = (elRad == M_PI_2) ? 0.0 : atan(sin(capRad / cos(ci) * (1 - cos(capRad))));
-    double baseRad = ((azRad + azShift) > PI2) ? (azRad + azShift) - PI2 : azRad + azShift;
-    baseDeg = rad2Deg(baseRad);
-    capDeg = rad2Deg(capRad);
+// Calculates the base and cap values for arrays of positions (vectorized where possible)
+void TpkC::calculateBaseAndCap(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg, int n) {
+    if (n > 0) BaseCap::calculateBatch(azDeg, elDeg, baseDeg, capDeg, static_cast<size_t>(n));
 }
 
 // Returns true if the base and cap values for the given az,el pos in deg can be calculated
@@ -175,162 +261,379 @@ bool TpkC::isTargetVisible(double azDeg, double elDeg) {
 }
 
 // Called when there are new demands: All args are in deg
+// The demands are queued for the publisher thread, so this never waits for the event service.
 void TpkC::newDemands(double mcsAzDeg, double mcsElDeg, double ecsAzDeg, double ecsElDeg, double m3RotationDeg,
                       double m3TiltDeg, double raDeg, double decDeg) {
+    DemandSample sample{};
+    sample.time = tick.utc;
+    sample.queuedNs = monotonicNs();
+    // sidereal time in hours
+    sample.siderealTime = rad2Hour(tick.siderealTime);
+
+    // The added virtual telescopes are tracked on every tick, from their own first target on, whether
+    // or not the mount has been given one
+    bool vtsTracking = false;
+    if (vtCount > 0) {
+        sample.numVts = vtCount;
+        trackVts(sample.vts);
+        double t = static_cast<double>(sample.time.seconds) + static_cast<double>(sample.time.nanos) * 1e-9;
+        for (int i = 0; i < vtCount; i++) {
+            const VtDemand &vt = sample.vts[i];
+            if (vt.tracking) vtDemands[i].store(PkVtDemand{t, vt.az, vt.el, vt.ra, vt.dec});
+            vtsTracking = vtsTracking || vt.tracking;
+        }
+    }
+
     // Demand publishing will start only once a new target or offset command has been being received.
     // Note from doc: Mount accepts demands at 100Hz and enclosure accepts demands at 20Hz
-    if (publishDemands) {
-        // at 100Hz
-        publishMcsDemand(mcsAzDeg, mcsElDeg, raDeg, decDeg);
-        if (++publishCounter % 5 == 0) {
-            // at 20Hz
-            publishCounter = 0;
-            double baseDeg, capDeg;
-            calculateBaseAndCap(ecsAzDeg, ecsElDeg, baseDeg, capDeg);
-            if (!std::isnan(baseDeg) && !std::isnan(capDeg)) {
-                publishEcsDemand(baseDeg, capDeg);
-            }
+    if (!publishDemands) {
+        if (vtsTracking) {
+            sample.vtsOnly = true;
+            demandPublisher->post(sample);
         }
-        publishM3Demand(m3RotationDeg, m3TiltDeg);
+        return;
+    }
+
+    // The enclosure demands at 20Hz
+    double baseDeg = NAN, capDeg = NAN;
+    bool ecs = ++publishCounter % 5 == 0;
+    if (ecs) {
+        publishCounter = 0;
+        enclosureDemands(ecsAzDeg, ecsElDeg, baseDeg, capDeg);
+    }
+
+    // Add the slew in progress, if any
+    if (slew) {
+        double d[Slew::NUM_AXES] = {mcsAzDeg, mcsElDeg, baseDeg, capDeg, m3RotationDeg, m3TiltDeg};
+        slewDemands(tick.tai, d, ecsAzDeg, ecsElDeg);
+        mcsAzDeg = d[Slew::MOUNT_AZ];
+        mcsElDeg = d[Slew::MOUNT_EL];
+        baseDeg = d[Slew::ENCLOSURE_BASE];
+        capDeg = d[Slew::ENCLOSURE_CAP];
+        m3RotationDeg = d[Slew::M3_ROTATION];
+        m3TiltDeg = d[Slew::M3_TILT];
+    }
+
+    // at 100Hz
+    sample.mcsAz = mcsAzDeg;
+    sample.mcsEl = mcsElDeg;
+    sample.ra = raDeg;
+    sample.dec = decDeg;
+    sample.m3Rotation = m3RotationDeg;
+    sample.m3Tilt = m3TiltDeg;
+
+    if (ecs && !std::isnan(baseDeg) && !std::isnan(capDeg)) {
+        sample.ecs = true;
+        sample.base = baseDeg;
+        sample.cap = capDeg;
+        lastBase = baseDeg;
+        lastCap = capDeg;
+    }
+    demandPublisher->post(sample);
+
+    PkDemand d;
+    d.time = static_cast<double>(sample.time.seconds) + static_cast<double>(sample.time.nanos) * 1e-9;
+    d.mcsAz = mcsAzDeg;
+    d.mcsEl = mcsElDeg;
+    d.ra = raDeg;
+    d.dec = decDeg;
+    d.siderealTime = sample.siderealTime;
+    d.base = lastBase;
+    d.cap = lastCap;
+    d.m3Rotation = m3RotationDeg;
+    d.m3Tilt = m3TiltDeg;
+    demands->add(d);
+
+    if (shmDemands) {
+        PkShmDemand shm{};
+        shm.timeNs = sample.time.seconds * 1000000000LL + sample.time.nanos;
+        shm.mcsAz = mcsAzDeg;
+        shm.mcsEl = mcsElDeg;
+        shm.ra = raDeg;
+        shm.dec = decDeg;
+        shm.siderealTime = sample.siderealTime;
+        shm.ecs = sample.ecs;
+        shm.base = sample.base;
+        shm.cap = sample.cap;
+        shm.m3Rotation = m3RotationDeg;
+        shm.m3Tilt = m3TiltDeg;
+        shm.monotonicNs = tick.monotonicNs;
+        shmDemands->write(shm);
     }
 }
 
-// Publish a TCS.PointingKernelAssembly.MountDemandPosition event to the CSW event service.
-// All args are in degrees.
-void TpkC::publishMcsDemand(double az, double el, double ra, double dec) {
-    // trackID
-    const char *trackIdAr[] = {"trackid-0"}; // TODO
-    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
-    CswParameter trackIdParam = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+// Tracks the added virtual telescopes one after the other: they are stored together and share the
+// time and site, so a sweep keeps them in the cache, and a tick has too little work to hand to other threads
+void TpkC::trackVts(VtDemand *out) {
+    std::vector<AddedVt> &added = vts->added;
+    for (size_t i = 0; i < added.size(); i++) {
+        AddedVt &a = added[i];
+        VtDemand &d = out[i];
+        d.tracking = a.target.id != 0;
+        if (!d.tracking) continue;
+        a.vt.track(1);
+        d.az = 180.0 - rad2Deg(a.vt.roll());
+        d.el = rad2Deg(a.vt.pitch());
+        tpk::spherical pos = a.vt.position();
+        d.ra = rad2Deg(pos.a);
+        d.dec = rad2Deg(pos.b);
+    }
+}
 
-    // pos
-    CswAltAzCoord posValues[1];
-    posValues[0] = cswMakeAltAzCoord("BASE", lround(deg2Mas(el)), lround(deg2Mas(az)));
-    CswArrayValue arrayValues = {.values = posValues, .numValues = 1};
-    CswParameter coordParam = cswMakeParameter("pos", AltAzCoordKey, arrayValues, csw_unit_NoUnits);
+// Calculates the enclosure base and cap demands, with the lookup table if there is one
+void TpkC::enclosureDemands(double ecsAzDeg, double ecsElDeg, double &baseDeg, double &capDeg) {
+    if (baseCapTable) {
+        baseCapTable->calculate(ecsAzDeg, ecsElDeg, baseDeg, capDeg);
+    } else {
+        calculateBaseAndCap(ecsAzDeg, ecsElDeg, baseDeg, capDeg);
+    }
+}
 
-    // posRaDec
-    CswEqCoord posRaDecValues[1];
-    posRaDecValues[0] = cswMakeEqCoord("BASE", lround(deg2Mas(ra)), lround(deg2Mas(dec)),
-                                       ICRS, "none", 0.0f, 0.0f);
-    CswArrayValue posRaDecArrayValues = {.values = posRaDecValues, .numValues = 1};
-    CswParameter posRaDecCoordParam = cswMakeParameter("posRaDec", EqCoordKey, posRaDecArrayValues, csw_unit_NoUnits);
+// Adds the offsets of the slew in progress to the demands (in Slew::Axis order, NaN for the enclosure
+// on the ticks it is not published). When new commands have been applied, first plans a slew from
+// the demands last published (continuing the one in progress) to the new ones.
+void TpkC::slewDemands(double tai, double *demands, double ecsAzDeg, double ecsElDeg) {
+    if (slewPending) {
+        slewPending = false;
+        double target[Slew::NUM_AXES];
+        for (int i = 0; i < Slew::NUM_AXES; i++) target[i] = demands[i];
+        if (std::isnan(target[Slew::ENCLOSURE_BASE])) {
+            enclosureDemands(ecsAzDeg, ecsElDeg, target[Slew::ENCLOSURE_BASE], target[Slew::ENCLOSURE_CAP]);
+        }
 
-    // time
-    CswUtcTime timeAr[] = {cswUtcTime()};
-    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
-    CswParameter timeParam = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+        // Where each axis would have been on the slew so far, relative to the new demands (NaN for
+        // axes that have not been published yet, and wrapped by plan() for the azimuths)
+        double offsets[Slew::NUM_AXES];
+        for (int i = 0; i < Slew::NUM_AXES; i++) {
+            offsets[i] = slewOutput[i] - slewApplied[i] + slew->offset(i, tai) - target[i];
+        }
+        slew->plan(tai, offsets);
+    }
 
-    // sidereal time in hours
-    double st = rad2Hour(site->st(time->tai()));
-    double siderealTimeAr[] = {st};
-    CswArrayValue siderealTimeValues = {.values = siderealTimeAr, .numValues = 1};
-    CswParameter siderealTimeParam = cswMakeParameter("siderealTime", DoubleKey, siderealTimeValues, csw_unit_hour);
+    for (int i = 0; i < Slew::NUM_AXES; i++) {
+        if (std::isnan(demands[i])) continue;
+        double offset = slew->offset(i, tai);
+        demands[i] += offset;
+        slewOutput[i] = demands[i];
+        slewApplied[i] = offset;
+    }
+}
+
+double TpkC::slewTimeRemaining() {
+    if (!slew || !running) return 0.0;
+    double remaining = (slew->endTai() - lastTickTime().tai) * 86400.0;
+    return remaining > 0.0 ? remaining : 0.0;
+}
 
-    // -- ParamSet
-    CswParameter params[] = {trackIdParam, coordParam, posRaDecCoordParam, timeParam, siderealTimeParam};
-    CswParamSet paramSet = {.params = params, .numParams = 5};
+void TpkC::recordTick(const PkTickRecord &rec) {
+    recorder->record(rec);
+}
 
-    // -- Event --
-    CswEvent event = cswMakeEvent(SystemEvent, prefix, "MountDemandPosition", paramSet);
+void TpkC::recorderStats(RecorderStats *stats) {
+    if (recorder) {
+        recorder->stats(stats);
+    } else {
+        *stats = RecorderStats{};
+    }
+}
 
-    // -- Publish --
-    cswEventPublish(publisher, event);
+bool TpkC::runFor(double seconds) {
+    if (!running || !virtualTime) return false;
+    return scheduler.runTicks(static_cast<long>(llround(seconds * 1000.0)));
+}
 
-    // -- Cleanup --
-    cswFreeEvent(event);
+// In virtual time UTC is derived from the virtual TAI (MJD 40587 is 1970-01-01), so that it is
+// the same in every run
+CswUtcTime TpkC::utcTime() {
+    if (!virtualTime) return cswUtcTime();
+    long long ns = llround((time->tai() - 40587.0) * 86400.0e9) - taiMinusUtcNs;
+    CswUtcTime t{};
+    t.seconds = ns / 1000000000LL;
+    t.nanos = ns % 1000000000LL;
+    return t;
 }
 
-// Publish a TCS.PointingKernelAssembly.EnclosureDemandPosition event to the CSW event service.
-// base and cap are in degrees
-void TpkC::publishEcsDemand(double base, double cap) {
-    // trackID
-    const char *trackIdAr[] = {"trackid-0"}; // TODO
-    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
-    CswParameter trackIdParam = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+// Gives TPK the weather for its refraction calculations, which the site uses from its next refresh().
+// Site::setWeather() is not in every TPK release (see TPK_HAS_SITE_WEATHER in src/CMakeLists.txt);
+// without it the weather is read and reported, but TPK refracts with its own standard atmosphere.
+static void applyWeather(tpk::Site &site, const PkWeather &w) {
+#ifdef TPK_HAS_SITE_WEATHER
+    site.setWeather(w.temperature, w.pressure, w.humidity);
+#else
+    (void) site;
+    (void) w;
+#endif
+}
 
-    // BasePosition
-    double baseAr[] = {base};
-    CswArrayValue baseValues = {.values = baseAr, .numValues = 1};
-    CswParameter baseParam = cswMakeParameter("BasePosition", DoubleKey, baseValues, csw_unit_degree);
+// Only applies weather that changes the refraction by more than about 0.01 arcsec (see
+// WeatherSource::changed()), and then counts it, after the site has been refreshed with it. The site
+// is the slow loop's own, so a copy of it is handed to the fast loop, which switches to it on its next
+// tick, and to the other threads. The medium loop then updates the SPMs with it on its next cycle,
+// and the prediction loop starts predicting again with it, so it is in the demands at most half a
+// second later. Reading the source (which may read a file) never holds up the fast loop.
+void TpkC::refreshSite() {
+    double tai = lastTickTime().tai;
+    PkWeather w{};
+    bool changed = weatherSource->read(tai, w) && (weatherId == 0 || WeatherSource::changed(w, lastWeather));
+    if (changed) {
+        applyWeather(*slowSite, w);
+        lastWeather = w;
+        appliedWeather.store(w);
+    }
+    slowSite->refresh(tai);
+    if (changed) ++weatherId;
 
-    // CapPosition
-    double capAr[] = {cap};
-    CswArrayValue calValues = {.values = capAr, .numValues = 1};
-    CswParameter capParam = cswMakeParameter("CapPosition", DoubleKey, calValues, csw_unit_degree);
+    siteHandoff->publish(new SiteSnapshot(*slowSite, weatherId));
+    std::shared_ptr<const SiteSnapshot> shared = std::make_shared<SiteSnapshot>(*slowSite, weatherId);
+    std::atomic_store(&sharedSite, shared);
+}
 
-    // time
-    CswUtcTime timeAr[] = {cswUtcTime()};
-    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
-    CswParameter timeParam = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+// The copy is made under vtMutex, so the medium loop never updates the SPMs with a site that is
+// being written
+void TpkC::applySite() {
+    SiteSnapshot *snapshot = siteHandoff->take();
+    if (!snapshot) return;
+    *site = snapshot->site;
+    fastWeatherId.store(snapshot->weatherId, std::memory_order_relaxed);
+    siteHandoff->retire(snapshot);
+}
 
+bool TpkC::setWeather(double temperature, double pressure, double humidity) {
+    if (!running || !manualWeather) return false;
+    return manualWeather->set(PkWeather{temperature, pressure, humidity});
+}
 
-    // -- ParamSet
-    CswParameter params[] = {trackIdParam, baseParam, capParam, timeParam};
-    CswParamSet paramSet = {.params = params, .numParams = 4};
+bool TpkC::weather(PkWeather *w) {
+    if (!running || weatherId == 0) return false;
+    *w = appliedWeather.load();
+    return true;
+}
 
-    // -- Event --
-    CswEvent event = cswMakeEvent(SystemEvent, prefix, "EnclosureDemandPosition", paramSet);
+// Reads a pointing model file and builds a TPK pointing model with its terms, which TPK takes in
+// radians. Returns nullptr, after printing why, if the file is not a valid model or TPK does not know
+// one of its terms. PointingModel::addTerm() is not in every TPK release (see
+// TPK_HAS_POINTING_MODEL_TERMS in src/CMakeLists.txt); without it no file can be loaded.
+static std::shared_ptr<tpk::PointingModel> readPointingModel(const char *path) {
+#ifdef TPK_HAS_POINTING_MODEL_TERMS
+    PointingModelFile file;
+    std::string error;
+    if (!file.read(path, error)) {
+        printf("Warning: Ignoring invalid pointing model %s: %s\n", path, error.c_str());
+        return nullptr;
+    }
+    std::shared_ptr<tpk::PointingModel> model = std::make_shared<tpk::PointingModel>();
+    for (const PointingTerm &t : file.terms()) {
+        if (model->addTerm(t.name, t.value * tpk::TcsLib::as2r) < 0) {
+            printf("Warning: Ignoring invalid pointing model %s: unknown term %s\n", path, t.name.c_str());
+            return nullptr;
+        }
+    }
+    printf("Loaded pointing model %s (%s) with %zu terms\n", path, file.caption().c_str(), file.terms().size());
+    return model;
+#else
+    printf("Warning: Ignoring pointing model %s: this TPK cannot build a model from its terms\n", path);
+    return nullptr;
+#endif
+}
 
-    // -- Publish --
-    cswEventPublish(publisher, event);
+int TpkC::loadPointingModel(const char *path) {
+    if (!running) return -1;
+    std::shared_ptr<tpk::PointingModel> model = readPointingModel(path);
+    if (!model) return -1;
+    std::lock_guard<std::mutex> lock(modelMutex);
+    loadedModel = model;
+    return ++loadedModelId;
+}
 
-    // -- Cleanup --
-    cswFreeEvent(event);
+int TpkC::pointingModel() const {
+    return running ? fastModelId.load(std::memory_order_relaxed) : -1;
 }
 
-// Publish a TCS.PointingKernelAssembly.M3DemandPosition event to the CSW event service.
-// rotation and tilt are in degrees
-void TpkC::publishM3Demand(double rotation, double tilt) {
-    // trackID
-    const char *trackIdAr[] = {"trackid-0"}; // TODO
-    CswArrayValue trackIdValues = {.values = trackIdAr, .numValues = 1};
-    CswParameter trackIdParam = cswMakeParameter("trackID", StringKey, trackIdValues, csw_unit_NoUnits);
+// Only the pointer is copied under the lock, so a model being loaded never holds up the loop for longer
+// than that
+bool TpkC::latestPointingModel(int modelId, std::shared_ptr<tpk::PointingModel> &model, int &id) {
+    if (modelId == loadedModelId) return false;
+    std::lock_guard<std::mutex> lock(modelMutex);
+    model = loadedModel;
+    id = loadedModelId;
+    return true;
+}
 
-    // RotationPosition
-    double rotationAr[] = {rotation};
-    CswArrayValue rotationValues = {.values = rotationAr, .numValues = 1};
-    CswParameter rotationParam = cswMakeParameter("RotationPosition", DoubleKey, rotationValues, csw_unit_degree);
+bool TpkC::installPointingModel(VtSet &v) {
+    if (!latestPointingModel(v.modelId, v.model, v.modelId)) return false;
+    v.mount.newPointingModel(*v.model);
+    v.enclosure.newPointingModel(*v.model);
+    for (AddedVt &a : v.added) a.vt.newPointingModel(*v.model);
+    return true;
+}
 
-    // BasePosition
-    double tiltAr[] = {tilt};
-    CswArrayValue calValues = {.values = tiltAr, .numValues = 1};
-    CswParameter tiltParam = cswMakeParameter("TiltPosition", DoubleKey, calValues, csw_unit_degree);
+// Reads the time once for the tick: the sidereal time and UTC of every demand, event and record of the
+// tick are derived from it here rather than wherever they are needed
+const TickTime &TpkC::newTick() {
+    tick.tai = time->tai();
+    tick.siderealTime = site->st(tick.tai);
+    tick.utc = utcTime();
+    tick.monotonicNs = monotonicNs();
+    lastTick.store(tick);
+    return tick;
+}
 
-    // time
-    CswUtcTime timeAr[] = {cswUtcTime()};
-    CswArrayValue timeValues = {.values = timeAr, .numValues = 1};
-    CswParameter timeParam = cswMakeParameter("time", UTCTimeKey, timeValues, csw_unit_NoUnits);
+int TpkC::demandHistory(PkDemand *out, int max) {
+    if (!demands || max <= 0) return 0;
+    return static_cast<int>(demands->latest(out, static_cast<size_t>(max)));
+}
 
+void TpkC::publishStats(PublishStats *stats) {
+    if (demandPublisher) {
+        demandPublisher->stats(stats);
+    } else {
+        *stats = PublishStats{};
+    }
+}
 
-    // -- ParamSet
-    CswParameter params[] = {trackIdParam, rotationParam, tiltParam, timeParam};
-    CswParamSet paramSet = {.params = params, .numParams = 4};
+int TpkC::loopStats(ScanStats *stats, int maxLoops) {
+    if (!fastScan) return 0;
+    ScanTask *loops[] = {slowScan, mediumScan, fastScan};
+    int n = maxLoops < 3 ? maxLoops : 3;
+    for (int i = 0; i < n; i++) loops[i]->stats(&stats[i]);
+    return n;
+}
 
-    // -- Event --
-    CswEvent event = cswMakeEvent(SystemEvent, prefix, "M3DemandPosition", paramSet);
+bool TpkC::configure(const char *key, const char *value) {
+    return rtConfig.set(key, value);
+}
 
-    // -- Publish --
-    cswEventPublish(publisher, event);
+int TpkC::threadPolicies(ThreadPolicy *policies, int maxThreads) {
+    if (!running || maxThreads < 1) return 0;
+    scheduler.policy(&policies[0]);
+    ScanTask *loops[] = {slowScan, mediumScan, fastScan};
+    int n = maxThreads < 4 ? maxThreads : 4;
+    for (int i = 1; i < n; i++) loops[i - 1]->policy(&policies[i]);
+    return n;
+}
 
-    // -- Cleanup --
-    cswFreeEvent(event);
+void TpkC::requestLoopStats() {
+    demandPublisher->requestLoopStats();
 }
 
 void TpkC::init() {
+    if (running) return;
+
     // Construct the TCS. First we need a clock...
     // Assume that the system clock is set to UTC. TAI-UTC is 37 sec at the time of writing.
-    tpk::UnixClock unix_clock(37.0);
-
     // XXX Allan: For testing, you can set the environment variable TPK_USE_FAKE_SYSTEM_CLOCK, which forces the MJD to midnight, Jan 1, 2022,
     // making tests more reproducible.
-    FakeSystemClock fake_clock(37.0);
-    tpk::Clock *clock;
-    if (getenv("TPK_USE_FAKE_SYSTEM_CLOCK")) {
+    // With TPK_VIRTUAL_TIME the clock is stepped by our scheduler instead, one tick at a time.
+    if (virtualTime) {
+        printf("Warning: Using virtual time starting at Jan 1, 2022 (MJD = 59580.5)\n");
+        auto *fakeClock = new FakeSystemClock(37.0, true);
+        scheduler.setVirtualTime([fakeClock](long long tickNs) { fakeClock->advance(tickNs); });
+        clock = fakeClock;
+    } else if (getenv("TPK_USE_FAKE_SYSTEM_CLOCK")) {
         printf("Warning: Using fake system clock starting at Jan 1, 2022 (MJD = 59580.5)\n");
-        clock = &fake_clock;
+        clock = new FakeSystemClock(37.0);
     } else {
-        clock = &unix_clock;
+        clock = new tpk::UnixClock(37.0);
     }
 
     // and a Site...
@@ -344,159 +647,617 @@ void TpkC::init() {
                          0.1611, 0.4475  // Polar motions (arcsec)
     );
 
+    // The slow loop refreshes a site of its own and hands copies of it to the other threads
+    slowSite = new tpk::Site(*site);
+    siteHandoff = new SnapshotHandoff<SiteSnapshot>();
+    fastWeatherId = 0;
+    {
+        std::shared_ptr<const SiteSnapshot> shared = std::make_shared<SiteSnapshot>(*site, 0);
+        std::atomic_store(&sharedSite, shared);
+    }
+
     // Get an object for publishing CSW events
     publisher = cswEventPublisherInit();
 
+    // Use a lookup table for the enclosure base and cap if configured
+    baseCapTable = BaseCapTable::fromEnv();
+    if (baseCapTable) {
+        printf("Using %s base/cap lookup table with %g deg resolution\n",
+               baseCapTable->interpolation() == BaseCapTable::LINEAR ? "linear" : "cubic", baseCapTable->resolution());
+    }
+
+    // and a thread to publish the demands (which builds the demand events once, here)
+    demandPublisher = new DemandPublisher(publisher, prefix, DemandPublisher::policyFromEnv(),
+                                          DemandPublisher::queueSizeFromEnv());
+    const char *loopNames[] = {"SlowScan", "MediumScan", "FastScan"};
+    demandPublisher->setLoopStatsSource(loopNames, 3, [this](ScanStats *stats) {
+        loopStats(stats, LoopStatsEvent::maxLoops);
+    });
+    const char *vtNameList[pkMaxVts];
+    for (int i = 0; i < vtCount; i++) vtNameList[i] = vtNames[i];
+    demandPublisher->setVirtualTelescopes(vtNameList, vtCount);
+    demandPublisher->start();
+
     // and a "time keeper"...
     time = new tpk::TimeKeeper(*clock, *site);
 
-    double st = rad2Hour(site->st(time->tai()));
-    printf("Using Sidereal Time = %g\n", st);
+    newTick();
+    printf("Using Sidereal Time = %g\n", rad2Hour(tick.siderealTime));
 
     // Create a transformation that converts mm to radians for a 450000.0mm	 focal length.
-    tpk::AffineTransform transf(0.0, 0.0, 1.0 / 450000.0, 0.0);
+    transf = new tpk::AffineTransform(0.0, 0.0, 1.0 / 450000.0, 0.0);
 
-    // Create mount and enclosure virtual telescopes. M3 comes automatically with TmtMountVt.
-    mount = new tpk::TmtMountVt(*time, *site, tpk::BentNasmyth(tpk::TcsLib::pi, 0.0), &transf, nullptr,
-                                tpk::ICRefSys());
-    enclosure = new tpk::TmtMountVt(*time, *site, tpk::BentNasmyth(tpk::TcsLib::pi, 0.0), &transf, nullptr,
-                                    tpk::ICRefSys());
-    // Create and install a pointing model. In a real system this would be initialised from a file.
-    tpk::PointingModel model;
-    mount->newPointingModel(model);
-    enclosure->newPointingModel(model);
+    // Create mount and enclosure virtual telescopes, and any added ones. M3 comes automatically with TmtMountVt.
+    vts = new VtSet(*time, *site, transf, vtCount);
 
-    // Make ourselves a real-time process if we have the privilege.
-    ScanTask::makeRealTime();
+    // Create a pointing model, from the file given by TPK_POINTING_MODEL if there is one.
+    loadedModel = std::make_shared<tpk::PointingModel>();
+    loadedModelId = 0;
+    fastModelId = 0;
+    const char *modelPath = getenv("TPK_POINTING_MODEL");
+    std::shared_ptr<tpk::PointingModel> model = modelPath ? readPointingModel(modelPath) : nullptr;
+    if (model) loadedModel = model;
+    vts->model = loadedModel;
+
+    //
+    // Set the mount and enclosure to the same target. This is done before starting the scheduler,
+    // after which only the fast and medium loops touch the virtual telescopes, under vtMutex.
+    //
+    tpk::ICRSTarget target(*site, "10 12 23 11 09 06");
+    setUpVts(*vts, target);
+
+    // The prediction loop, if configured, has virtual telescopes of its own on a clock of its own
+    trajectory = Trajectory::fromEnv();
+    if (trajectory) {
+        printf("Predicting the demands %g s ahead in %g s segments (%s)\n", trajectory->aheadSeconds(),
+               trajectory->segmentSeconds(), trajectory->fit() == Trajectory::CHEBYSHEV ? "chebyshev" : "samples");
+        predictClock = new PredictionClock();
+        predictClock->tai = clock->read();
+        predictSite = new tpk::Site(*site);
+        predictSiteSnapshot = currentSite();
+        predictTime = new tpk::TimeKeeper(*predictClock, *predictSite);
+        predictVts = new VtSet(*predictTime, *predictSite, transf);
+        predictVts->model = vts->model;
+        setUpVts(*predictVts, target);
+        predictSpmTai = 0.0;
+    }
+
+    // Make ourselves a real-time process if configured to and we have the privilege.
+    scheduler.configure(rtConfig);
+    scheduler.makeRealTime();
+
+    // Forget any commands from before a previous shutdown
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        commands.store(PkCommands{});
+        for (int i = 0; i < vtCount; i++) {
+            vtCommands[i].store(PkCommands{});
+            vtDemands[i].store(PkVtDemand{});
+        }
+    }
+    publishCounter = 0;
+    lastBase = lastCap = NAN;
+    demands = new SampleHistory<PkDemand>(demandHistorySize);
+    weatherSource = WeatherSource::fromEnv();
+    manualWeather = dynamic_cast<ManualWeather *>(weatherSource);
+    weatherId = 0;
+    if (!manualWeather) printf("Using the weather from %s\n", weatherSource->description().c_str());
+    slew = Slew::fromEnv();
+    if (slew) {
+        const SlewLimits &m = slew->limits(Slew::MOUNT_AZ);
+        printf("Slewing to new targets (mount limits %g deg/s, %g deg/s^2, %g deg/s^3)\n", m.velocity,
+               m.acceleration, m.jerk);
+    }
+    slewPending = false;
+    for (int i = 0; i < Slew::NUM_AXES; i++) slewOutput[i] = slewApplied[i] = NAN;
+    shmDemands = ShmDemandWriter::fromEnv();
+    recorder = Recorder::fromEnv();
+    if (recorder) {
+        printf("Recording the fast loop to %s\n", recorder->directory());
+        recorder->setBlocking(virtualTime);
+        recorder->start();
+    }
+    if (shmDemands) {
+        printf("Writing demands to shared memory %s (%u slots)\n", shmDemands->name(), shmDemands->capacity());
+    }
 
     // Create the slow, medium and fast threads.
-    SlowScan slow(*time, *site);
-    MediumScan medium(*mount, *enclosure);
-    FastScan fast(this, *time, *mount, *enclosure, *site);
+    slowScan = new SlowScan(scheduler, this);
+    mediumScan = new MediumScan(scheduler, this);
+    fastScan = new FastScan(scheduler, this, *time);
+    if (trajectory) predictScan = new PredictScan(scheduler, this);
 
     // Start the scheduler thread.
-    ScanTask::startScheduler();
+    scheduler.start();
+    running = true;
+
+    // Report the real-time policy the threads actually got
+    ThreadPolicy policies[4];
+    int n = threadPolicies(policies, 4);
+    for (int i = 0; i < n; i++) {
+        const ThreadPolicy &p = policies[i];
+        printf("%s: policy %s, priority %d, cpu %d, memory %s, stack %s\n", p.name, rtPolicyName(p.policy),
+               p.priority, p.cpu, p.memoryLocked ? "locked" : "not locked",
+               p.stackPrefaulted ? "prefaulted" : "not prefaulted");
+    }
+}
+
+void TpkC::shutdown() {
+    if (!running) return;
+    running = false;
+    publishDemands = false;
+
+    // Stop our scheduler, then the scan threads (each finishes its current scan),
+    scheduler.stop();
+    fastScan->stop();
+    mediumScan->stop();
+    slowScan->stop();
+    if (predictScan) predictScan->stop();
+
+    // and the publisher thread, which publishes whatever is still queued (including the loop statistics)
+    demandPublisher->stop();
+    delete demandPublisher;
+    demandPublisher = nullptr;
+
+    // and the recorder, which writes whatever is still queued
+    delete recorder;
+    recorder = nullptr;
+    delete fastScan;
+    delete mediumScan;
+    delete slowScan;
+    delete predictScan;
+    fastScan = nullptr;
+    mediumScan = nullptr;
+    slowScan = nullptr;
+    predictScan = nullptr;
+    cswEventPublisherClose(publisher);
+    publisher = nullptr;
+
+    delete vts;
+    vts = nullptr;
+    delete predictVts;
+    delete predictTime;
+    delete predictClock;
+    delete predictSite;
+    delete trajectory;
+    predictVts = nullptr;
+    predictTime = nullptr;
+    predictClock = nullptr;
+    predictSite = nullptr;
+    predictSiteSnapshot = nullptr;
+    trajectory = nullptr;
+    loadedModel = nullptr;
+    delete transf;
+    delete baseCapTable;
+    delete demands;
+    delete shmDemands;
+    delete slew;
+    delete weatherSource;
+    delete time;
+    delete site;
+    delete slowSite;
+    delete siteHandoff;
+    std::atomic_store(&sharedSite, std::shared_ptr<const SiteSnapshot>());
+    delete clock;
+    transf = nullptr;
+    baseCapTable = nullptr;
+    demands = nullptr;
+    shmDemands = nullptr;
+    slew = nullptr;
+    weatherSource = nullptr;
+    manualWeather = nullptr;
+    time = nullptr;
+    site = nullptr;
+    slowSite = nullptr;
+    siteHandoff = nullptr;
+    clock = nullptr;
+}
+
+// Posts a new target command for the fast loop
+void TpkC::postTarget(Seqlock<PkCommands> &mailbox, PkRefSys refSys, double a, double b) {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    PkCommands c = mailbox.load();
+    c.target = {++lastCommandId, refSys, a, b};
+    mailbox.store(c);
+}
+
+// Posts a new offset command for the fast loop
+void TpkC::postOffset(Seqlock<PkCommands> &mailbox, PkRefSys refSys, double a, double b) {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    PkCommands c = mailbox.load();
+    c.offset = {++lastCommandId, refSys, a, b};
+    mailbox.store(c);
+}
+
+// Applies any new commands. Demand publishing starts once the first target has been applied.
+void TpkC::applyCommands() {
+    unsigned long targetId = vts->target.id;
+    unsigned long offsetId = vts->offset.id;
+    applyCommands(*vts);
+    if (vts->target.id != targetId) {
+        publishDemands = true;
+    }
+    if (vts->target.id != targetId || vts->offset.id != offsetId) {
+        slewPending = true;
+    }
+}
+
+// Applies any commands newer than the ones already applied to v, to the mount and enclosure and to each
+// added virtual telescope
+void TpkC::applyCommands(VtSet &v) {
+    tpk::TmtMountVt *mountAndEnclosure[] = {&v.mount, &v.enclosure};
+    applyCommands(commands.load(), v.site, v.target, v.offset, mountAndEnclosure, 2);
+    for (size_t i = 0; i < v.added.size(); i++) {
+        AddedVt &a = v.added[i];
+        tpk::TmtMountVt *vt = &a.vt;
+        applyCommands(vtCommands[i].load(), v.site, a.target, a.offset, &vt, 1);
+    }
+}
+
+// Applies any commands newer than the ones already applied, in the order in which they were posted
+void TpkC::applyCommands(const PkCommands &c, const tpk::Site &site, PkCommand &target, PkCommand &offset,
+                         tpk::TmtMountVt *const *vt, int n) {
+    bool newTarget = c.target.id != target.id;
+    bool newOffset = c.offset.id != offset.id;
+    if (newOffset && (!newTarget || c.offset.id < c.target.id)) {
+        offset = c.offset;
+        applyOffset(c.offset, vt, n);
+        newOffset = false;
+    }
+    if (newTarget) {
+        target = c.target;
+        applyTarget(c.target, site, vt, n);
+    }
+    if (newOffset) {
+        offset = c.offset;
+        applyOffset(c.offset, vt, n);
+    }
+}
+
+// Updates the pointing model and SPMs of the fast loop's own virtual telescopes in place, so that the
+// fast loop goes on tracking with the objects it has been tracking with, and nothing that track() keeps
+// from tick to tick is lost. Each virtual telescope is updated under vtMutex, which the fast loop holds
+// for its whole tick, so an update never happens during a tick and the fast loop waits for at most one.
+void TpkC::updateSpms() {
+    // Note the weather the fast loop's site has (at least) before updating with it, and get any new
+    // pointing model, which is installed and precomputed by updatePM() below
+    unsigned long w = fastWeatherId.load(std::memory_order_relaxed);
+    std::shared_ptr<tpk::PointingModel> model;
+    int modelId;
+    bool newModel = latestPointingModel(vts->modelId, model, modelId);
+
+    // Update the pointing model and the mount SPMs,
+    tpk::TmtMountVt *vt[] = {&vts->mount, &vts->enclosure};
+    for (tpk::TmtMountVt *v : vt) updateSpms(*v, newModel ? model.get() : nullptr);
+
+    // and the same for the added virtual telescopes.
+    for (AddedVt &a : vts->added) updateSpms(a.vt, newModel ? model.get() : nullptr);
+
+    // The old model is freed here, now that no virtual telescope uses it
+    std::lock_guard<PiMutex> lock(vtMutex);
+    vts->weatherId = w;
+    if (newModel) {
+        vts->model = model;
+        vts->modelId = modelId;
+        fastModelId.store(modelId, std::memory_order_relaxed);
+    }
+}
+
+void TpkC::updateSpms(tpk::TmtMountVt &vt, tpk::PointingModel *model) {
+    std::lock_guard<PiMutex> lock(vtMutex);
+    if (model) vt.newPointingModel(*model);
+    vt.updatePM();
+    vt.update();
+}
+
+// Takes the demands from the predicted trajectory if it was predicted for the commands the fast loop
+// has applied
+bool TpkC::predictedDemands(double tai, TrajectoryPoint &demand) {
+    if (!trajectory) return false;
+    TrajectoryKey key = {vts->target.id, vts->offset.id, vts->weatherId, static_cast<unsigned long>(vts->modelId)};
+    return trajectory->lookup(tai, key, demand);
+}
+
+// Brings the prediction's virtual telescopes up to date with the commands and predicts the demands
+// for them ahead of the current time, stepping the prediction clock through the times the trajectory
+// is fitted at. The pointing model and SPMs are updated as often as the medium loop updates them.
+void TpkC::predict() {
+    // Predict with the site the slow loop last refreshed, taken before the commands, which create
+    // targets with it
+    std::shared_ptr<const SiteSnapshot> s = currentSite();
+    if (s != predictSiteSnapshot) {
+        *predictSite = s->site;
+        predictSiteSnapshot = s;
+    }
+    applyCommands(*predictVts);
+
+    // New weather or a new pointing model invalidates the prediction and forces an update of the SPMs
+    // at the first point
+    unsigned long w = s->weatherId;
+    if (w != predictVts->weatherId) {
+        predictVts->weatherId = w;
+        predictSpmTai = 0.0;
+    }
+    if (installPointingModel(*predictVts)) predictSpmTai = 0.0;
+    TrajectoryKey key = {predictVts->target.id, predictVts->offset.id, predictVts->weatherId,
+                         static_cast<unsigned long>(predictVts->modelId)};
+    trajectory->extend(clock->read(), key, [this](double tai, TrajectoryPoint &p) {
+        predictClock->tai = tai;
+        predictTime->update();
+        if (fabs(tai - predictSpmTai) * 86400.0 >= 0.5) {
+            predictSpmTai = tai;
+            predictVts->mount.updatePM();
+            predictVts->mount.update();
+            predictVts->enclosure.updatePM();
+            predictVts->enclosure.update();
+        }
+        predictVts->mount.track(1);
+        predictVts->enclosure.track(1);
+        trackedPoint(*predictVts, p);
+    });
+}
+
+void TpkC::trajectoryStats(TrajectoryStats *stats) {
+    if (trajectory) {
+        trajectory->stats(stats);
+    } else {
+        *stats = TrajectoryStats{};
+    }
+}
+
+void TpkC::setUpVts(VtSet &v, tpk::Target &target) {
+    // Install the pointing model
+    v.mount.newPointingModel(*v.model);
+    v.enclosure.newPointingModel(*v.model);
 
     // Set the field orientation.
-    mount->setPai(0.0, tpk::ICRefSys());
-    enclosure->setPai(0.0, tpk::ICRefSys());
+    v.mount.setPai(0.0, tpk::ICRefSys());
+    v.enclosure.setPai(0.0, tpk::ICRefSys());
 
-    tpk::ICRSTarget target(*site, "10 12 23 11 09 06");
+    v.mount.newTarget(target);
+    v.enclosure.newTarget(target);
 
-    //
-    // Set the mount and enclosure to the same target
-    //
-    mount->newTarget(target);
-    enclosure->newTarget(target);
+    // The added virtual telescopes start on the same target but are only tracked once given their own
+    for (AddedVt &a : v.added) {
+        a.vt.newPointingModel(*v.model);
+        a.vt.setPai(0.0, tpk::ICRefSys());
+        a.vt.newTarget(target);
+    }
+}
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "EndlessLoop"
-    for (;;) {
-        nanosleep((const struct timespec[]) {{0, 500000L}}, nullptr);
+void TpkC::applyTarget(const PkCommand &cmd, const tpk::Site &site, tpk::TmtMountVt *const *vt, int n) {
+    switch (cmd.refSys) {
+        case PK_ICRS: {
+            tpk::ICRSTarget target(site, cmd.a, cmd.b);
+            for (int i = 0; i < n; i++) vt[i]->newTarget(target);
+            break;
+        }
+        case PK_FK5: {
+            tpk::FK5Target target(site, cmd.a, cmd.b);
+            for (int i = 0; i < n; i++) vt[i]->newTarget(target);
+            break;
+        }
+        case PK_AZEL: {
+            tpk::AzElTarget target(site, cmd.a, cmd.b);
+            for (int i = 0; i < n; i++) vt[i]->newTarget(target);
+            break;
+        }
     }
-#pragma clang diagnostic pop
 }
 
-void TpkC::shutdown() {
-    publishDemands = false;
-    cswEventPublisherClose(publisher);
-    // TODO: Stop event loops?
+void TpkC::applyOffset(const PkCommand &cmd, tpk::TmtMountVt *const *vt, int n) {
+    switch (cmd.refSys) {
+        case PK_ICRS: {
+            auto refSys = tpk::ICRefSys();
+            for (int i = 0; i < n; i++) vt[i]->setOffset(cmd.a, cmd.b, refSys);
+            break;
+        }
+        case PK_FK5: {
+            auto refSys = tpk::FK5RefSys();
+            for (int i = 0; i < n; i++) vt[i]->setOffset(cmd.a, cmd.b, refSys);
+            break;
+        }
+        case PK_AZEL: {
+            auto refSys = tpk::AzElRefSys();
+            for (int i = 0; i < n; i++) vt[i]->setOffset(cmd.a, cmd.b, refSys);
+            break;
+        }
+    }
 }
 
 // Sets a new ICRS target with RA, Dec in deg and returns true if the target is above the horizon
 bool TpkC::newICRSTarget(double ra, double dec) {
-    // check if target is visible
-    CoordPair azEl;
+    if (!running) return false;
+
+    // check if target is visible (not if it could not be converted, which leaves azEl unchanged)
+    CoordPair azEl = {NAN, NAN};
     raDecToAzEl(ra, dec, &azEl);
     if (!isTargetVisible(azEl.a, azEl.b)) {
         return false;
     }
 
-    publishDemands = true;
-    tpk::ICRSTarget target(*site, deg2Rad(ra), deg2Rad(dec));
-    mount->newTarget(target);
-    enclosure->newTarget(target);
+    postTarget(commands, PK_ICRS, deg2Rad(ra), deg2Rad(dec));
     return true;
 }
 
-// Sets a new ICRS target with RA, Dec in deg and returns true if the target is above the horizon
+// Sets a new FK5 target with RA, Dec in deg and returns true if the target is above the horizon
 bool TpkC::newFK5Target(double ra, double dec) {
-    // check if target is visible
-    CoordPair azEl;
+    if (!running) return false;
+
+    // check if target is visible (not if it could not be converted, which leaves azEl unchanged). The
+    // check converts as if the target were ICRS: FK5 (J2000) differs from it by well under an arcsec.
+    CoordPair azEl = {NAN, NAN};
     raDecToAzEl(ra, dec, &azEl);
     if (!isTargetVisible(azEl.a, azEl.b)) {
         return false;
     }
 
-    publishDemands = true;
-    tpk::FK5Target target(*site, deg2Rad(ra), deg2Rad(dec));
-    mount->newTarget(target);
-    enclosure->newTarget(target);
+    postTarget(commands, PK_FK5, deg2Rad(ra), deg2Rad(dec));
     return true;
 }
 
 // Sets a new AzEl target with az, el in deg and returns true if the target is above the horizon
 bool TpkC::newAzElTarget(double az, double el) {
+    if (!running) return false;
     if (!isTargetVisible(az, el)) {
         return false;
     }
 
-    publishDemands = true;
-    tpk::AzElTarget target(*site, deg2Rad(az), deg2Rad(el));
-    mount->newTarget(target);
-    enclosure->newTarget(target);
+    postTarget(commands, PK_AZEL, deg2Rad(az), deg2Rad(el));
     return true;
 }
 
 // Set the offset. raO and decO are expected in arcsec
 void TpkC::setICRSOffset(double raO, double decO) {
-    auto a = raO * tpk::TcsLib::as2r;
-    auto b = decO * tpk::TcsLib::as2r;
-    auto refSys = tpk::ICRefSys();
-    mount->setOffset(a, b, refSys);
-    enclosure->setOffset(a, b, refSys);
+    postOffset(commands, PK_ICRS, raO * tpk::TcsLib::as2r, decO * tpk::TcsLib::as2r);
 }
 
 // Set the offset. raO and decO are expected in arcsec
 void TpkC::setFK5Offset(double raO, double decO) {
-    auto a = raO * tpk::TcsLib::as2r;
-    auto b = decO * tpk::TcsLib::as2r;
-    auto refSys = tpk::FK5RefSys();
-    mount->setOffset(a, b, refSys);
-    enclosure->setOffset(a, b, refSys);
+    postOffset(commands, PK_FK5, raO * tpk::TcsLib::as2r, decO * tpk::TcsLib::as2r);
 }
 
 // Set the offset. azO and elO are expected in arcsec
 void TpkC::setAzElOffset(double azO, double elO) {
-    auto a = azO * tpk::TcsLib::as2r;
-    auto b = elO * tpk::TcsLib::as2r;
-    auto refSys = tpk::AzElRefSys();
-    mount->setOffset(a, b, refSys);
-    enclosure->setOffset(a, b, refSys);
+    postOffset(commands, PK_AZEL, azO * tpk::TcsLib::as2r, elO * tpk::TcsLib::as2r);
+}
+
+int TpkC::addVt(const char *name) {
+    if (running || !name || !*name || strlen(name) >= maxVtName || vtIndex(name) >= 0 || vtCount == pkMaxVts) {
+        return -1;
+    }
+    strcpy(vtNames[vtCount], name);
+    return vtCount++;
+}
+
+int TpkC::vtIndex(const char *name) const {
+    for (int i = 0; i < vtCount; i++) {
+        if (strcmp(vtNames[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Sets a new target for an added virtual telescope (a, b in deg). Unlike the mount's target, it only
+// has to be above the horizon, since the enclosure does not follow it. As for newFK5Target(), an FK5
+// target is checked as if it were ICRS.
+bool TpkC::newVtTarget(int vt, PkRefSys refSys, double a, double b) {
+    if (!running || vt < 0 || vt >= vtCount || !isRefSys(refSys)) return false;
+    double el = b;
+    if (refSys != PK_AZEL) {
+        CoordPair azEl = {NAN, NAN};
+        raDecToAzEl(a, b, &azEl);
+        el = azEl.b;
+    }
+    if (!(el > 0.0)) return false;
+
+    postTarget(vtCommands[vt], refSys, deg2Rad(a), deg2Rad(b));
+    return true;
+}
+
+// Sets the offset of an added virtual telescope (a, b in arcsec)
+bool TpkC::setVtOffset(int vt, PkRefSys refSys, double a, double b) {
+    if (vt < 0 || vt >= vtCount || !isRefSys(refSys)) return false;
+    postOffset(vtCommands[vt], refSys, a * tpk::TcsLib::as2r, b * tpk::TcsLib::as2r);
+    return true;
+}
+
+bool TpkC::vtDemand(int vt, PkVtDemand *demand) {
+    if (vt < 0 || vt >= vtCount) return false;
+    *demand = vtDemands[vt].load();
+    return demand->time != 0.0;
+}
+
+// Saves the mount position computed by the fast loop (in deg)
+void TpkC::setPosition(double raDeg, double decDeg) {
+    CoordPair p = {raDeg, decDeg};
+    position.store(p);
 }
 
+// Returns the mount position computed by the fast loop on its last tick
 void TpkC::currentPosition(CoordPair *raDec) {
-    tpk::spherical telpos = mount->position();
-    raDec->a = rad2Deg(telpos.a);
-    raDec->b = rad2Deg(telpos.b);
+    *raDec = position.load();
 }
 
-// Convert the given az,el coordinates (in deg) to ra,dec (in deg)
+// Convert the given az,el coordinates (in deg) to ra,dec (in deg) at the time of the latest tick
 void TpkC::azElToRaDec(double az, double el, CoordPair *raDec) {
+    std::shared_ptr<const SiteSnapshot> s = currentSite();
+    if (!running || !s) return;
     auto refSys = tpk::ICRefSys();
-    auto pos = refSys.fromAzEl(time->tai(), *site, tpk::spherical(deg2Rad(az), deg2Rad(el)));
+    auto pos = refSys.fromAzEl(lastTickTime().tai, s->site, tpk::spherical(deg2Rad(az), deg2Rad(el)));
     raDec->a = rad2Deg(pos.a);
     raDec->b = rad2Deg(pos.b);
 }
 
-// Convert the given ra,dec coordinates (in deg) to az,el (in deg)
+// Convert the given ra,dec coordinates (in deg) to az,el (in deg) at the time of the latest tick
 void TpkC::raDecToAzEl(double ra, double dec, CoordPair *azEl) {
+    std::shared_ptr<const SiteSnapshot> s = currentSite();
+    if (!running || !s) return;
     auto refSys = tpk::AzElRefSys();
-    auto pos = refSys.fromICRS(time->tai(), *site, tpk::spherical(deg2Rad(ra), deg2Rad(dec)));
+    auto pos = refSys.fromICRS(lastTickTime().tai, s->site, tpk::spherical(deg2Rad(ra), deg2Rad(dec)));
     azEl->a = rad2Deg(pos.a);
     azEl->b = rad2Deg(pos.b);
 }
 
+// Converts a batch of az,el coordinates (in deg) to ra,dec (in deg). The time (of the latest tick), the
+// site and the reference system are the same for the whole batch, so they are set up once and shared by
+// the threads.
+void TpkC::azElToRaDec(const double *az, const double *el, double *ra, double *dec, int n) {
+    if (n <= 0) return;
+    const double tai = lastTickTime().tai;
+    tpk::ICRefSys refSys;
+    std::shared_ptr<const SiteSnapshot> snapshot = currentSite();
+    if (!running || !snapshot) return;
+    const tpk::Site &s = snapshot->site;
+    parallelFor(static_cast<size_t>(n), minTransformChunk, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            auto pos = refSys.fromAzEl(tai, s, tpk::spherical(deg2Rad(az[i]), deg2Rad(el[i])));
+            ra[i] = rad2Deg(pos.a);
+            dec[i] = rad2Deg(pos.b);
+        }
+    });
+}
+
+// Converts a batch of ra,dec coordinates (in deg) to az,el (in deg)
+void TpkC::raDecToAzEl(const double *ra, const double *dec, double *az, double *el, int n) {
+    if (n <= 0) return;
+    const double tai = lastTickTime().tai;
+    tpk::AzElRefSys refSys;
+    std::shared_ptr<const SiteSnapshot> snapshot = currentSite();
+    if (!running || !snapshot) return;
+    const tpk::Site &s = snapshot->site;
+    parallelFor(static_cast<size_t>(n), minTransformChunk, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            auto pos = refSys.fromICRS(tai, s, tpk::spherical(deg2Rad(ra[i]), deg2Rad(dec[i])));
+            az[i] = rad2Deg(pos.a);
+            el[i] = rad2Deg(pos.b);
+        }
+    });
+}
+
+// Calculates the visibility of a batch of ICRS targets. Each target is sampled through the whole window,
+// so a thread is given a few targets rather than a share of the times.
+void TpkC::visibility(const double *ra, const double *dec, int n, double startUtc, double endUtc,
+                      double minElDeg, PkVisibility *visibility) {
+    if (n <= 0) return;
+    tpk::AzElRefSys refSys;
+    std::shared_ptr<const SiteSnapshot> snapshot = currentSite();
+    if (!running || !snapshot) return;
+    const tpk::Site &s = snapshot->site;
+    parallelFor(static_cast<size_t>(n), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const tpk::spherical pos(deg2Rad(ra[i]), deg2Rad(dec[i]));
+            auto azEl = [&](double utc, double &azDeg, double &elDeg) {
+                double tai = 40587.0 + (utc + taiMinusUtcNs / 1.0e9) / 86400.0;
+                auto p = refSys.fromICRS(tai, s, pos);
+                azDeg = rad2Deg(p.a);
+                elDeg = rad2Deg(p.b);
+            };
+            Visibility::calculate(azEl, startUtc, endUtc, minElDeg, Visibility::defaultStepSeconds,
+                                  visibility[i]);
+        }
+    });
+}
+
 
 // --- This provides access from C, to make it easier to access from Java ---
 
@@ -538,13 +1299,104 @@ void tpkc_setAzElOffset(TpkC *self, double raO, double decO) {
     self->setAzElOffset(raO, decO);
 }
 
-//void tpkc_currentPosition(TpkC *self, CoordPair *raDec) {
-//    self->currentPosition(raDec);
-//}
-//
-//void tpkc_azElToRaDec(TpkC *self, double az, double el, CoordPair *raDec) {
-//    self->azElToRaDec(az, el, raDec);
-//}
+void tpkc_calculateBaseAndCap(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg, int n) {
+    TpkC::calculateBaseAndCap(azDeg, elDeg, baseDeg, capDeg, n);
+}
+
+void tpkc_publishStats(TpkC *self, PublishStats *stats) {
+    self->publishStats(stats);
+}
+
+int tpkc_loopStats(TpkC *self, ScanStats *stats, int maxLoops) {
+    return self->loopStats(stats, maxLoops);
+}
+
+void tpkc_azElToRaDecBatch(TpkC *self, const double *az, const double *el, double *ra, double *dec, int n) {
+    self->azElToRaDec(az, el, ra, dec, n);
+}
+
+void tpkc_raDecToAzElBatch(TpkC *self, const double *ra, const double *dec, double *az, double *el, int n) {
+    self->raDecToAzEl(ra, dec, az, el, n);
+}
+
+bool tpkc_configure(TpkC *self, const char *key, const char *value) {
+    return self->configure(key, value);
+}
+
+int tpkc_threadPolicies(TpkC *self, ThreadPolicy *policies, int maxThreads) {
+    return self->threadPolicies(policies, maxThreads);
+}
+
+void tpkc_currentPosition(TpkC *self, CoordPair *raDec) {
+    self->currentPosition(raDec);
+}
+
+void tpkc_azElToRaDec(TpkC *self, double az, double el, CoordPair *raDec) {
+    self->azElToRaDec(az, el, raDec);
+}
+
+void tpkc_raDecToAzEl(TpkC *self, double ra, double dec, CoordPair *azEl) {
+    self->raDecToAzEl(ra, dec, azEl);
+}
+
+int tpkc_demandHistory(TpkC *self, PkDemand *demands, int max) {
+    return self->demandHistory(demands, max);
+}
+
+void tpkc_recorderStats(TpkC *self, RecorderStats *stats) {
+    self->recorderStats(stats);
+}
+
+bool tpkc_runFor(TpkC *self, double seconds) {
+    return self->runFor(seconds);
+}
+
+void tpkc_trajectoryStats(TpkC *self, TrajectoryStats *stats) {
+    self->trajectoryStats(stats);
+}
+
+double tpkc_slewTimeRemaining(TpkC *self) {
+    return self->slewTimeRemaining();
+}
+
+int tpkc_addVt(TpkC *self, const char *name) {
+    return self->addVt(name);
+}
+
+bool tpkc_newVtTarget(TpkC *self, int vt, int refSys, double a, double b) {
+    if (!isRefSys(refSys)) return false;
+    return self->newVtTarget(vt, static_cast<PkRefSys>(refSys), a, b);
+}
+
+bool tpkc_setVtOffset(TpkC *self, int vt, int refSys, double a, double b) {
+    if (!isRefSys(refSys)) return false;
+    return self->setVtOffset(vt, static_cast<PkRefSys>(refSys), a, b);
+}
+
+bool tpkc_vtDemand(TpkC *self, int vt, PkVtDemand *demand) {
+    return self->vtDemand(vt, demand);
+}
+
+void tpkc_visibility(TpkC *self, const double *ra, const double *dec, int n, double startUtc, double endUtc,
+                     double minElDeg, PkVisibility *visibility) {
+    self->visibility(ra, dec, n, startUtc, endUtc, minElDeg, visibility);
+}
+
+bool tpkc_setWeather(TpkC *self, double temperature, double pressure, double humidity) {
+    return self->setWeather(temperature, pressure, humidity);
+}
+
+bool tpkc_weather(TpkC *self, PkWeather *weather) {
+    return self->weather(weather);
+}
+
+int tpkc_loadPointingModel(TpkC *self, const char *path) {
+    return self->loadPointingModel(path);
+}
+
+int tpkc_pointingModel(TpkC *self) {
+    return self->pointingModel();
+}
 
 }
 
@@ -1,9 +1,27 @@
 #pragma once
 
+#include <atomic>
+#include <cmath>
 #include <cstdio>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "tpk/tpk.h"
+#include "BaseCap.h"
+#include "DemandPublisher.h"
+#include "PiMutex.h"
+#include "PointingModelFile.h"
+#include "Recorder.h"
 #include "ScanTask.h"
+#include "SampleHistory.h"
+#include "Seqlock.h"
+#include "ShmDemandRing.h"
+#include "Slew.h"
+#include "SnapshotHandoff.h"
+#include "Trajectory.h"
+#include "Visibility.h"
+#include "Weather.h"
 #include "csw/csw.h"
 
 // Used to store coordinates (az,el or ra,dec) in deg
@@ -12,6 +30,106 @@ typedef struct {
 } CoordPair;
 
 
+// The demands of one tick of the fast loop, as returned by demandHistory(). Only doubles, so that a
+// JVM can read an array of them from a direct buffer at fixed offsets.
+typedef struct {
+    double time;                // UTC, in seconds since 1970
+    double mcsAz, mcsEl;        // deg
+    double ra, dec;             // deg
+    double siderealTime;        // hours
+    double base, cap;           // deg, the latest enclosure demands (published at 20Hz)
+    double m3Rotation, m3Tilt;  // deg
+} PkDemand;
+
+// The latest demands of a virtual telescope added to the mount and enclosure, as returned by vtDemand()
+typedef struct {
+    double time;                // UTC, in seconds since 1970
+    double az, el;              // deg
+    double ra, dec;             // deg
+} PkVtDemand;
+
+// The time of a tick of the fast loop. It is read once at the start of the tick and everything computed
+// or published for the tick uses it, so that all the events of a tick carry the same time.
+typedef struct {
+    double tai;                 // MJD
+    double siderealTime;        // radians
+    CswUtcTime utc;             // the timestamp of the tick's events
+    long long monotonicNs;      // CLOCK_MONOTONIC when the time was read
+} TickTime;
+
+// Reference systems for target and offset commands
+enum PkRefSys {
+    PK_ICRS, PK_FK5, PK_AZEL
+};
+
+// A target or offset command passed from a command thread to the fast loop.
+// id increases with every command posted and is 0 if no command has been posted.
+typedef struct {
+    unsigned long id;
+    PkRefSys refSys;
+    double a, b;   // in radians
+} PkCommand;
+
+// The latest target and offset commands
+typedef struct {
+    PkCommand target;
+    PkCommand offset;
+} PkCommands;
+
+// The scan loops (defined in TpkC.cpp)
+class SlowScan;
+class MediumScan;
+class FastScan;
+class PredictScan;
+class PredictionClock;
+
+// A virtual telescope added to the mount and enclosure (see TpkC::addVt()), with the last target and
+// offset commands applied to it
+struct AddedVt {
+    AddedVt(tpk::TimeKeeper &time, tpk::Site &site, tpk::AffineTransform *transf);
+
+    tpk::TmtMountVt vt;
+    PkCommand target{};
+    PkCommand offset{};
+};
+
+// The mount and enclosure virtual telescopes, with the last target and offset commands applied to
+// them, and any added virtual telescopes. The fast loop tracks with the same set from init() to
+// shutdown(), and the medium loop updates the pointing model and SPMs of those virtual telescopes in
+// place (see TpkC::updateSpms()), so that whatever track() keeps from one tick to the next is never lost.
+struct VtSet {
+    VtSet(tpk::TimeKeeper &time, tpk::Site &site, tpk::AffineTransform *transf, int numAdded = 0);
+
+    // The site the virtual telescopes use, which the targets applied to them are created with
+    tpk::Site &site;
+
+    // The pointing model installed in the virtual telescopes and its number (see
+    // TpkC::loadPointingModel()). The sets share it, so it is freed with the last set that uses it,
+    // and only once none of its virtual telescopes uses it.
+    std::shared_ptr<tpk::PointingModel> model;
+    int modelId = 0;
+
+    tpk::TmtMountVt mount;
+    tpk::TmtMountVt enclosure;
+    PkCommand target{};
+    PkCommand offset{};
+
+    // The weather the SPMs were last updated with (see TpkC::refreshSite())
+    unsigned long weatherId = 0;
+
+    // Kept together, so that the fast loop sweeps through them in order
+    std::vector<AddedVt> added;
+};
+
+// A copy of the site as the slow loop last refreshed it, with the count of the weather applied to it
+// (see TpkC::refreshSite())
+struct SiteSnapshot {
+    SiteSnapshot(const tpk::Site &site, unsigned long weatherId) : site(site), weatherId(weatherId) {}
+
+    tpk::Site site;
+    unsigned long weatherId;
+};
+
 // Used to access a limited set of TPK functions from Scala/Java
 class TpkC {
 public:
@@ -24,21 +142,51 @@ public:
 
     TpkC &operator=(TpkC const &) = delete;
 
-    // Initialize the class (called from the Scala pk assembly code)
+    // Initialize the class and start the scan loops and the demand publisher thread (called from the
+    // Scala pk assembly code). Returns once the threads are running. Does nothing if already running.
     void init();
 
-    // Stops publishing demands
+    // Stops publishing demands, stops and joins all the threads started by init() and frees everything
+    // it created, so that init() can be called again. The target and offset setters must not be called
+    // while this is running.
     void shutdown();
 
+    // Returns true between init() and shutdown()
+    bool isRunning() const { return running; }
+
+    // Returns true if the scan loops run in virtual time (set by the environment variable
+    // TPK_VIRTUAL_TIME): the clock only advances as the loops are run by runFor()
+    bool isVirtualTime() const { return virtualTime; }
+
+    // In virtual time, runs the scan loops for the given number of (virtual) seconds as fast as they
+    // can and returns when done. Returns false if not running in virtual time.
+    bool runFor(double seconds);
+
+    // The current UTC time: from the system clock or, in virtual time, from the virtual clock
+    CswUtcTime utcTime();
+
+    // Sets an item of the real-time configuration of the threads (see RealTimeConfig::set()), which is
+    // initially read from the environment and is applied by the next init(). Returns false if the key
+    // or value is not valid.
+    bool configure(const char *key, const char *value);
+
+    // Gets the real-time policy applied to the scheduler and the slow, medium and fast loop threads (in
+    // that order) and returns the number of threads (at most maxThreads), or 0 if not running
+    int threadPolicies(ThreadPolicy *policies, int maxThreads);
+
     void newDemands(double mcsAzDeg, double mcsElDeg, double eAz, double eEl, double m3RotationDeg, double m3TiltDeg, double raDeg, double decDeg);
 
-    // Sets a new ICRS target with RA, Dec in deg and returns true if the target is above the horizon
+    // Sets a new ICRS target with RA, Dec in deg and returns true if the target is above the horizon, or
+    // returns false if it is not or not running
     bool newICRSTarget(double ra, double dec);
 
-    // Sets a new ICRS target with RA, Dec in deg and returns true if the target is above the horizon
+    // Sets a new FK5 target with RA, Dec in deg and returns true if the target is above the horizon
+    // (checked as if it were ICRS, which differs by well under an arcsec), or returns false if it is not
+    // or not running
     bool newFK5Target(double ra, double dec);
 
-    // Sets a new AzEl target with az, el in deg and returns true if the target is above the horizon
+    // Sets a new AzEl target with az, el in deg and returns true if the target is above the horizon, or
+    // returns false if it is not or not running
     bool newAzElTarget(double ra, double dec);
 
     // Set the offset. raO and decO are expected in arcsec
@@ -50,22 +198,201 @@ public:
     // Set the offset. azO and elO are expected in arcsec
     void setAzElOffset(double azO, double elO);
 
+    // Adds a virtual telescope, such as a guide probe, that tracks a target of its own in the fast loop
+    // alongside the mount and enclosure, and returns its index (0 for the first one added), or -1 if
+    // running, the name is not valid or already used, or pkMaxVts have been added. Its demands are
+    // published as the <name>DemandPosition event. The virtual telescopes added are kept by shutdown().
+    int addVt(const char *name);
+
+    // Returns the index of the added virtual telescope with the given name, or -1 if there is none
+    int vtIndex(const char *name) const;
+
+    // The number of virtual telescopes added
+    int numVts() const { return vtCount; }
+
+    // Sets a new target for an added virtual telescope, with a and b in deg, and returns true if the
+    // target is above the horizon, or returns false if it is not, not running or refSys is not valid
+    bool newVtTarget(int vt, PkRefSys refSys, double a, double b);
+
+    // Sets the offset of an added virtual telescope, with a and b in arcsec, and returns false if vt or
+    // refSys is not valid
+    bool setVtOffset(int vt, PkRefSys refSys, double a, double b);
+
+    // Gets the demands of an added virtual telescope on the last tick and returns true, or returns false
+    // if it has not been given a target or there were no demands
+    bool vtDemand(int vt, PkVtDemand *demand);
+
     // Gets the current CurrentPosition position from the mount as RA, Dec in deg
     void currentPosition(CoordPair* raDec);
 
-    // Convert the given az,el coordinates (in deg) to ra,dec (in deg)
+    // Convert the given az,el coordinates (in deg) to ra,dec (in deg). The conversions and visibility()
+    // leave their outputs unchanged if not running.
     void azElToRaDec(double az, double el, CoordPair* raDec);
 
     // Convert the given ra,dec coordinates (in deg) to az,el (in deg)
     void raDecToAzEl(double ra, double dec, CoordPair *azEl);
 
+    // Convert az[i],el[i] to ra[i],dec[i] for i < n (all in deg), in parallel for large batches
+    void azElToRaDec(const double *az, const double *el, double *ra, double *dec, int n);
+
+    // Convert ra[i],dec[i] to az[i],el[i] for i < n (all in deg), in parallel for large batches
+    void raDecToAzEl(const double *ra, const double *dec, double *az, double *el, int n);
+
+    // Calculates the visibility of the ICRS targets ra[i],dec[i] (deg) for i < n between startUtc and endUtc
+    // (s since 1970) above minElDeg, in parallel over the targets (see Visibility::calculate())
+    void visibility(const double *ra, const double *dec, int n, double startUtc, double endUtc, double minElDeg,
+                    PkVisibility *visibility);
+
     // Calculates base and cap from the az and el coordinates (in deg)
     static void calculateBaseAndCap(double azDeg, double elDeg, double &baseDeg, double &capDeg);
 
+    // Calculates base[i] and cap[i] from az[i] and el[i] (all in deg) for i < n, using SIMD where available
+    static void calculateBaseAndCap(const double *azDeg, const double *elDeg, double *baseDeg, double *capDeg, int n);
+
     // Returns true if the base and cap values for the given az,el pos in deg can be calculated
     static bool isTargetVisible(double azDeg, double elDeg);
 
+    // Gets the statistics of the demand publisher thread
+    void publishStats(PublishStats *stats);
+
+    // Gets the timing statistics of the slow, medium and fast loops (in that order) and returns the number
+    // of loops (at most maxLoops), or 0 if not running
+    int loopStats(ScanStats *stats, int maxLoops);
+
+    // Copies up to max of the latest demands (at most the last demandHistorySize) to demands, oldest
+    // first, and returns the number copied, or 0 if not running. Never blocks the fast loop.
+    int demandHistory(PkDemand *demands, int max);
+
+    // Returns true if the ticks of the fast loop are being recorded (see Recorder::fromEnv())
+    bool isRecording() const { return recorder != nullptr; }
+
+    // Queues the record of a tick of the fast loop for the recorder (called by the fast loop)
+    void recordTick(const PkTickRecord &rec);
+
+    // Returns the time (s) until the current slew to new commands is over (0 if not slewing, see
+    // Slew::fromEnv())
+    double slewTimeRemaining();
+
+    // Gets the statistics of the recorder (all 0 if not recording)
+    void recorderStats(RecorderStats *stats);
+
+    // Asks the publisher thread to publish the PkLoopStats event (called by the medium loop)
+    void requestLoopStats();
+
+    // Copies the site the slow loop last refreshed into the fast loop's, if it has not done so yet
+    // (called by the fast loop at the start of each tick, while holding vtLock())
+    void applySite();
+
+    // Applies any target and offset commands posted since the last call (called by the fast loop at the
+    // start of each tick, before tracking)
+    void applyCommands();
+
+    // Reads the time for a new tick and saves it for the rest of the tick and for other threads
+    // (called by the fast loop after updating the time keeper)
+    const TickTime &newTick();
+
+    // The time of the current tick (only valid in the fast loop)
+    const TickTime &tickTime() const { return tick; }
+
+    // The time of the latest tick of the fast loop (can be called from any thread)
+    TickTime lastTickTime() const { return lastTick.load(); }
+
+    // The virtual telescopes the fast loop tracks with (only valid in the fast loop, while holding vtLock())
+    VtSet &trackingVts() { return *vts; }
+
+    // The lock the fast loop holds for the whole of a tick, and the medium loop while it updates one of
+    // the fast loop's virtual telescopes
+    PiMutex &vtLock() { return vtMutex; }
+
+    // Updates the pointing model and SPMs of the fast loop's virtual telescopes (called by the medium loop)
+    void updateSpms();
+
+    // Saves the mount position computed by the fast loop for currentPosition() (ra, dec in deg)
+    void setPosition(double raDeg, double decDeg);
+
+    // Sets the weather at the site (temperature in deg C, pressure in hPa, relative humidity from 0 to 1)
+    // and returns true, or returns false if the weather comes from another source (see
+    // WeatherSource::fromEnv()), the values are not plausible or not running
+    bool setWeather(double temperature, double pressure, double humidity);
+
+    // Gets the weather last applied to the site and returns true, or returns false if there is none yet
+    bool weather(PkWeather *weather);
+
+    // Applies any new weather to the slow loop's site, refreshes it for the time of the latest tick and
+    // hands a copy of it to the other threads (called by the slow loop)
+    void refreshSite();
+
+    // Loads a pointing model file (see PointingModelFile) and returns its number (1 for the first one
+    // loaded after init()), or -1 if not running or the file is not a valid model. The model is built
+    // by the calling thread and installed by the medium loop in the fast loop's virtual telescopes
+    // between ticks, where it is precomputed with their SPMs, so that loading it never holds up the
+    // fast loop for longer than the update of one virtual telescope.
+    int loadPointingModel(const char *path);
+
+    // Returns the number of the pointing model the fast loop is using (0 for the empty model installed
+    // by init() if TPK_POINTING_MODEL is not set), or -1 if not running
+    int pointingModel() const;
+
+    // Returns true if the demands are predicted ahead of the fast loop (see Trajectory::fromEnv())
+    bool isPredicting() const { return trajectory != nullptr; }
+
+    // Gets the predicted demands at tai for the commands the fast loop is tracking, returning false if
+    // they have not been predicted (called by the fast loop)
+    bool predictedDemands(double tai, TrajectoryPoint &demand);
+
+    // Applies any new commands to the prediction's virtual telescopes and predicts the trajectory ahead
+    // (called by the prediction loop)
+    void predict();
+
+    // Gets the prediction statistics (all 0 if not predicting)
+    void trajectoryStats(TrajectoryStats *stats);
+
 private:
+    // Installs the pointing model, field orientation and the initial target in new virtual telescopes
+    void setUpVts(VtSet &v, tpk::Target &target);
+
+    // Updates the SPMs of one of the fast loop's virtual telescopes under vtMutex, after installing model
+    // if it is not null (called by the medium loop)
+    void updateSpms(tpk::TmtMountVt &vt, tpk::PointingModel *model);
+
+    // Gets the last pointing model loaded and its number, and returns true, or returns false if its
+    // number is modelId
+    bool latestPointingModel(int modelId, std::shared_ptr<tpk::PointingModel> &model, int &id);
+
+    // Installs the last pointing model loaded in the virtual telescopes if they do not have it yet, and
+    // returns true if it did (called by the prediction loop)
+    bool installPointingModel(VtSet &v);
+
+    // Calculates the enclosure demands
+    void enclosureDemands(double ecsAzDeg, double ecsElDeg, double &baseDeg, double &capDeg);
+
+    // Adds the slew in progress to the demands (called by the fast loop)
+    void slewDemands(double tai, double *demands, double ecsAzDeg, double ecsElDeg);
+
+    // Tracks the added virtual telescopes that have a target and gets their demands (called by the fast loop)
+    void trackVts(VtDemand *demands);
+
+    // Posts a new target or offset command to a mailbox read by the fast loop (called from command threads)
+    void postTarget(Seqlock<PkCommands> &mailbox, PkRefSys refSys, double a, double b);
+
+    void postOffset(Seqlock<PkCommands> &mailbox, PkRefSys refSys, double a, double b);
+
+    // Applies the commands posted since the last ones applied to the given virtual telescopes
+    void applyCommands(VtSet &v);
+
+    // Applies the commands in c that are newer than the target and offset commands already applied to
+    // the n virtual telescopes vt, in the order in which they were posted
+    void applyCommands(const PkCommands &c, const tpk::Site &site, PkCommand &target, PkCommand &offset,
+                       tpk::TmtMountVt *const *vt, int n);
+
+    // The site as the slow loop last refreshed it, for the threads other than the scan loops
+    std::shared_ptr<const SiteSnapshot> currentSite() const { return std::atomic_load(&sharedSite); }
+
+    // Applies a target or offset command to the n virtual telescopes vt, which use site
+    void applyTarget(const PkCommand &cmd, const tpk::Site &site, tpk::TmtMountVt *const *vt, int n);
+
+    void applyOffset(const PkCommand &cmd, tpk::TmtMountVt *const *vt, int n);
+
     // Publish CSW events
     void publishMcsDemand(double az, double el, double ra, double dec);
 
@@ -73,11 +400,110 @@ private:
 
     void publishM3Demand(double rotation, double tilt);
 
+    bool running = false;
+    bool virtualTime = false;
+    RealTimeConfig rtConfig;
+    tpk::Clock *clock;
     tpk::TimeKeeper *time;
-    tpk::TmtMountVt *mount;
-    tpk::TmtMountVt *enclosure;
+    tpk::AffineTransform *transf;
+
+    // The last pointing model loaded, for the medium and prediction loops to install, and the number
+    // of the model the fast loop is using
+    std::mutex modelMutex;
+    std::shared_ptr<tpk::PointingModel> loadedModel;
+    std::atomic<int> loadedModelId{0};
+    std::atomic<int> fastModelId{0};
+
+    // The scheduler of the scan loops, which is ours alone, and the scan loops
+    ScanScheduler scheduler;
+    SlowScan *slowScan;
+    MediumScan *mediumScan;
+    FastScan *fastScan;
+    PredictScan *predictScan;
+
+    // The virtual telescopes used by the fast loop, and the lock that keeps the medium loop from updating
+    // them during a tick. The medium loop takes it for one virtual telescope at a time, so the fast loop
+    // waits for at most one update of the SPMs.
+    VtSet *vts;
+    PiMutex vtMutex;
+
+    // No thread reads a site while another writes it. The slow loop applies the weather to a site of its
+    // own (slowSite) and refreshes it, and hands copies of it to the fast loop through siteHandoff and to
+    // the other threads through sharedSite (only accessed with std::atomic_load and std::atomic_store).
+    // The fast loop copies it into the site its time keeper and virtual telescopes use between two
+    // ticks, under vtMutex, and notes the weather it has in fastWeatherId for the medium loop.
     tpk::Site *site;
+    tpk::Site *slowSite;
+    SnapshotHandoff<SiteSnapshot> *siteHandoff;
+    std::shared_ptr<const SiteSnapshot> sharedSite;
+    std::atomic<unsigned long> fastWeatherId{0};
     CswEventServiceContext publisher;
-    bool publishDemands = false;
+
+    // Publishes the demands from its own thread, so that the fast loop never waits for the event service
+    DemandPublisher *demandPublisher;
+
+    // Optional trajectory predicted ahead of the fast loop, by the prediction loop with virtual
+    // telescopes of its own that read the time being predicted, and a site of its own, copied from the
+    // last one it took from sharedSite
+    Trajectory *trajectory;
+    PredictionClock *predictClock;
+    tpk::Site *predictSite;
+    std::shared_ptr<const SiteSnapshot> predictSiteSnapshot;
+    tpk::TimeKeeper *predictTime;
+    VtSet *predictVts;
+    double predictSpmTai = 0.0;
+
+    // Where the weather comes from (manualWeather is the same source if it is set through the API), the
+    // weather last applied to the slow loop's site (slow loop only, with a copy for other threads) and a
+    // count of the weather applied so far, which goes with the copies of the site
+    WeatherSource *weatherSource;
+    ManualWeather *manualWeather;
+    PkWeather lastWeather{};
+    Seqlock<PkWeather> appliedWeather;
+    std::atomic<unsigned long> weatherId{0};
+
+    // Optional recorder of every tick of the fast loop
+    Recorder *recorder;
+
+    // Optional lookup table used for the enclosure demands (see BaseCapTable::fromEnv())
+    BaseCapTable *baseCapTable;
+
+    std::atomic<bool> publishDemands{false};
     int publishCounter = 0;
+
+    // Optional slew to new commands, with the demands last published and the slew offsets added to
+    // them, in Slew::Axis order (used by the fast loop only)
+    Slew *slew;
+    bool slewPending = false;
+    double slewOutput[Slew::NUM_AXES];
+    double slewApplied[Slew::NUM_AXES];
+
+    // The demands of the last demandHistorySize ticks (written by the fast loop)
+    static const size_t demandHistorySize = 1024;
+    SampleHistory<PkDemand> *demands;
+    double lastBase = NAN, lastCap = NAN;
+
+    // Optional shared memory ring the demands are also written to (see ShmDemandWriter::fromEnv())
+    ShmDemandWriter *shmDemands;
+
+    // Mailbox for commands from the command threads: writers are serialized by commandMutex,
+    // the fast loop reads without locking
+    std::mutex commandMutex;
+    unsigned long lastCommandId = 0;
+    Seqlock<PkCommands> commands;
+
+    // The mount position (ra, dec in deg) after the last tick
+    Seqlock<CoordPair> position;
+
+    // The time of the current tick (fast loop only) and a copy for other threads
+    TickTime tick{};
+    Seqlock<TickTime> lastTick;
+
+    // The names of the added virtual telescopes, the mailboxes for their commands (writers serialized by
+    // commandMutex) and their demands on the last tick (written by the fast loop)
+    static const size_t maxVtName = 32;
+    int vtCount = 0;
+    char vtNames[pkMaxVts][maxVtName];
+    Seqlock<PkCommands> vtCommands[pkMaxVts];
+    Seqlock<PkVtDemand> vtDemands[pkMaxVts];
 };
@@ -0,0 +1,256 @@
+#include "Trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const double secondsPerDay = 86400.0;
+static const double twoPi = 2.0 * M_PI;
+static const double arcsecPerRad = 180.0 * 3600.0 / M_PI;
+
+// The fit points per segment: enough that sidereal tracking fits to within a milliarcsecond or so
+static const int samplePoints = TrajectorySegment::maxPoints;
+static const int chebyshevPoints = 12;
+
+// The channels of TrajectoryPoint (in order) that are angles in a 2 pi range rather than bounded
+static const bool isWrapped[TrajectorySegment::channels] = {true, false, true, false, true, false, true, false};
+
+static_assert(sizeof(TrajectoryPoint) == TrajectorySegment::channels * sizeof(double),
+              "TrajectoryPoint must be all channels");
+
+static void toChannels(const TrajectoryPoint &p, double *c) {
+    memcpy(c, &p, sizeof p);
+}
+
+static void fromChannels(const double *c, TrajectoryPoint &p) {
+    memcpy(&p, c, sizeof p);
+}
+
+// Brings an angle into [from, from + 2 pi)
+static double wrap(double a, double from) {
+    double x = fmod(a - from, twoPi);
+    if (x < 0) x += twoPi;
+    return from + x;
+}
+
+// The difference between two angles, in (-pi, pi]
+static double angleDiff(double a, double b) {
+    return remainder(a - b, twoPi);
+}
+
+static double parseSeconds(const char *name, double defaultValue) {
+    const char *s = getenv(name);
+    if (!s) return defaultValue;
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || *end || !(v > 0)) {
+        printf("Warning: Ignoring invalid %s: %s\n", name, s);
+        return defaultValue;
+    }
+    return v;
+}
+
+Trajectory::Trajectory(Fit fit, double segmentSeconds, double aheadSeconds, double toleranceArcsec) :
+        fitKind(fit), length(segmentSeconds), ahead(aheadSeconds), tolerance(toleranceArcsec / arcsecPerRad),
+        points(fit == CHEBYSHEV ? chebyshevPoints : samplePoints) {
+    // Room for every segment up to ahead, the current one and the one the fast loop may still be using
+    capacity = static_cast<size_t>(ceil(ahead / length)) + 2;
+    segments = new Seqlock<TrajectorySegment>[capacity];
+}
+
+Trajectory::~Trajectory() {
+    delete[] segments;
+}
+
+Trajectory *Trajectory::fromEnv() {
+    const char *s = getenv("TPK_PREDICT");
+    if (!s) return nullptr;
+    Fit fit = strcmp(s, "chebyshev") == 0 ? CHEBYSHEV : SAMPLES;
+    if (fit == SAMPLES && strcmp(s, "samples") != 0) {
+        printf("Warning: Unknown TPK_PREDICT %s: using samples\n", s);
+    }
+    return new Trajectory(fit, parseSeconds("TPK_PREDICT_SEGMENT", 1.0), parseSeconds("TPK_PREDICT_AHEAD", 10.0),
+                          parseSeconds("TPK_PREDICT_TOLERANCE", 0.01));
+}
+
+int64_t Trajectory::segmentIndex(double tai) const {
+    return static_cast<int64_t>(floor(tai * secondsPerDay / length));
+}
+
+// Times within a segment are taken relative to its start in MJD, so that the only rounding is that of
+// the MJD itself (about 0.3us, which is up to 0.6 mas at 0.01 rad/s)
+double Trajectory::start(int64_t index) const {
+    return static_cast<double>(index) * length / secondsPerDay;
+}
+
+void Trajectory::extend(double tai, const TrajectoryKey &key, const Compute &compute) {
+    int64_t now = segmentIndex(tai);
+    if (!started || !(key == lastKey) || next < now) {
+        // New commands (or the predictor fell behind): start again from the current segment
+        started = true;
+        lastKey = key;
+        next = now;
+    }
+    int64_t last = segmentIndex(tai + ahead / secondsPerDay);
+    for (; next <= last; next++) {
+        predict(next, key, compute);
+    }
+}
+
+// Computes the fit points and the check points half way between them in time order (the virtual
+// telescopes expect time to go forwards), fits the segment and stores it
+void Trajectory::predict(int64_t index, const TrajectoryKey &key, const Compute &compute) {
+    const int n = points;
+    const double t0 = start(index);
+    double fitTimes[TrajectorySegment::maxPoints];      // s from t0
+    double checkTimes[TrajectorySegment::maxPoints];
+    if (fitKind == CHEBYSHEV) {
+        // The nodes cos(pi (k + 1/2) / n) in increasing order
+        for (int k = 0; k < n; k++) {
+            double u = -cos(M_PI * (k + 0.5) / n);
+            fitTimes[k] = (u + 1.0) * 0.5 * length;
+        }
+    } else {
+        for (int k = 0; k < n; k++) {
+            fitTimes[k] = k * length / (n - 1);
+        }
+    }
+    for (int k = 0; k < n - 1; k++) {
+        checkTimes[k] = 0.5 * (fitTimes[k] + fitTimes[k + 1]);
+    }
+
+    double fitValues[TrajectorySegment::maxPoints][TrajectorySegment::channels];
+    double checkValues[TrajectorySegment::maxPoints][TrajectorySegment::channels];
+    TrajectoryPoint p;
+    for (int k = 0; k < n; k++) {
+        compute(t0 + fitTimes[k] / secondsPerDay, p);
+        toChannels(p, fitValues[k]);
+        if (k < n - 1) {
+            compute(t0 + checkTimes[k] / secondsPerDay, p);
+            toChannels(p, checkValues[k]);
+        }
+    }
+
+    TrajectorySegment segment{};
+    segment.index = index;
+    segment.key = key;
+    segment.points = n;
+    for (int c = 0; c < TrajectorySegment::channels; c++) {
+        // Make the angles continuous over the segment, and remember the range they were given in:
+        // a negative angle means [-pi, pi)
+        segment.wrapFrom[c] = NAN;
+        if (isWrapped[c]) {
+            bool negative = false;
+            for (int k = 0; k < n; k++) {
+                negative = negative || fitValues[k][c] < 0;
+                if (k > 0) fitValues[k][c] = fitValues[k - 1][c] + angleDiff(fitValues[k][c], fitValues[k - 1][c]);
+            }
+            segment.wrapFrom[c] = negative ? -M_PI : 0.0;
+        }
+
+        double *v = segment.values[c];
+        if (fitKind == CHEBYSHEV) {
+            // c_j = 2/n sum_k f(u_k) T_j(u_k), with the nodes in increasing order (u_k = -cos(...)), and
+            // c_0 halved so that f(u) = sum_j c_j T_j(u)
+            for (int j = 0; j < n; j++) {
+                double sum = 0.0;
+                for (int k = 0; k < n; k++) {
+                    sum += fitValues[k][c] * cos(M_PI * j * (n - k - 0.5) / n);
+                }
+                v[j] = 2.0 * sum / n;
+            }
+            v[0] *= 0.5;
+        } else {
+            for (int k = 0; k < n; k++) v[k] = fitValues[k][c];
+        }
+    }
+
+    // Check the fit between the fit points
+    segment.valid = 1;
+    double maxErr = 0.0;
+    for (int k = 0; k < n - 1; k++) {
+        double fitted[TrajectorySegment::channels];
+        evaluate(segment, t0 + checkTimes[k] / secondsPerDay, p);
+        toChannels(p, fitted);
+        for (int c = 0; c < TrajectorySegment::channels; c++) {
+            double err = isWrapped[c] ? fabs(angleDiff(fitted[c], checkValues[k][c]))
+                                      : fabs(fitted[c] - checkValues[k][c]);
+            if (!(err <= tolerance)) segment.valid = 0;
+            if (err > maxErr) maxErr = err;
+        }
+    }
+
+    segments[static_cast<uint64_t>(index) % capacity].store(segment);
+    ++predictedSegments;
+    if (segment.valid) {
+        if (maxErr * arcsecPerRad > maxError.load(std::memory_order_relaxed)) {
+            maxError.store(maxErr * arcsecPerRad, std::memory_order_relaxed);
+        }
+    } else {
+        ++rejected;
+    }
+}
+
+bool Trajectory::lookup(double tai, const TrajectoryKey &key, TrajectoryPoint &point) {
+    int64_t index = segmentIndex(tai);
+    if (current.index != index || !(current.key == key)) {
+        current = segments[static_cast<uint64_t>(index) % capacity].load();
+    }
+    if (current.index != index || !(current.key == key) || !current.valid) {
+        ++computedTicks;
+        return false;
+    }
+    evaluate(current, tai, point);
+    ++predictedTicks;
+    return true;
+}
+
+void Trajectory::evaluate(const TrajectorySegment &segment, double tai, TrajectoryPoint &point) const {
+    const int n = segment.points;
+    double t = (tai - start(segment.index)) * secondsPerDay;
+    double out[TrajectorySegment::channels];
+
+    if (fitKind == CHEBYSHEV) {
+        // Clenshaw's recurrence
+        double u = 2.0 * t / length - 1.0;
+        for (int c = 0; c < TrajectorySegment::channels; c++) {
+            const double *v = segment.values[c];
+            double b1 = 0.0, b2 = 0.0;
+            for (int j = n - 1; j >= 1; j--) {
+                double b0 = 2.0 * u * b1 - b2 + v[j];
+                b2 = b1;
+                b1 = b0;
+            }
+            out[c] = u * b1 - b2 + v[0];
+        }
+    } else {
+        // Cubic Lagrange interpolation between the 4 samples around t
+        double h = length / (n - 1);
+        double x = t / h;
+        int i = std::min(std::max(static_cast<int>(floor(x)), 1), n - 3);
+        double s = x - i;
+        double w0 = -s * (s - 1.0) * (s - 2.0) / 6.0;
+        double w1 = (s + 1.0) * (s - 1.0) * (s - 2.0) / 2.0;
+        double w2 = -(s + 1.0) * s * (s - 2.0) / 2.0;
+        double w3 = (s + 1.0) * s * (s - 1.0) / 6.0;
+        for (int c = 0; c < TrajectorySegment::channels; c++) {
+            const double *v = segment.values[c];
+            out[c] = w0 * v[i - 1] + w1 * v[i] + w2 * v[i + 1] + w3 * v[i + 2];
+        }
+    }
+
+    for (int c = 0; c < TrajectorySegment::channels; c++) {
+        if (isWrapped[c]) out[c] = wrap(out[c], segment.wrapFrom[c]);
+    }
+    fromChannels(out, point);
+}
+
+void Trajectory::stats(TrajectoryStats *s) const {
+    s->segments = predictedSegments;
+    s->rejected = rejected;
+    s->predicted = predictedTicks;
+    s->computed = computedTicks;
+    s->maxErrorArcsec = maxError;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "Seqlock.h"
+
+// What the fast loop computes with the virtual telescopes on a tick (all in rad)
+typedef struct {
+    double mountRoll, mountPitch;
+    double enclosureRoll, enclosurePitch;
+    double m3Azimuth, m3Elevation;
+    double ra, dec;                 // the mount position
+} TrajectoryPoint;
+
+// Identifies the commands a trajectory was predicted for (the ids of the target and offset commands) and
+// the weather and pointing model it was predicted with (see TpkC::refreshSite() and
+// TpkC::loadPointingModel())
+typedef struct {
+    unsigned long targetId, offsetId;
+    unsigned long weatherId;
+    unsigned long modelId;
+} TrajectoryKey;
+
+inline bool operator==(const TrajectoryKey &a, const TrajectoryKey &b) {
+    return a.targetId == b.targetId && a.offsetId == b.offsetId && a.weatherId == b.weatherId &&
+           a.modelId == b.modelId;
+}
+
+// Prediction statistics: segments counts the segments predicted, rejected those that did not fit
+// within the tolerance, predicted the ticks taken from the trajectory and computed those the fast
+// loop had to compute in full
+typedef struct {
+    long segments;
+    long rejected;
+    long predicted;
+    long computed;
+    double maxErrorArcsec;          // the largest fit error of an accepted segment
+} TrajectoryStats;
+
+// One segment of a predicted trajectory: every channel of TrajectoryPoint over one segment length,
+// as samples at equal intervals or as the coefficients of a Chebyshev series
+struct TrajectorySegment {
+    static const int channels = 8;
+    static const int maxPoints = 16;
+
+    int64_t index;                  // covers [index, index + 1) segment lengths of TAI since MJD 0
+    TrajectoryKey key;
+    int32_t valid;                  // 0 if it did not fit within the tolerance
+    int32_t points;
+    double wrapFrom[channels];      // the start of the 2 pi range of an angle channel (NaN for others)
+    double values[channels][maxPoints];
+};
+
+// The demand trajectory predicted ahead of the fast loop.
+//
+// A predictor thread calls extend() with the current time and the commands it has applied: that
+// computes the demands (with the full virtual telescope pipeline, through the compute function) for
+// every segment from the current one to aheadSeconds ahead that has not been computed yet, and fits
+// and stores them in a ring. A new key (a new target or offset) starts again from the current segment.
+//
+// The fast loop calls lookup() on every tick, which evaluates the segment covering the time if it
+// was predicted for the commands the fast loop is tracking, and otherwise returns false so that the
+// fast loop computes the demands itself. The segments are Seqlocks, so neither side ever waits for
+// the other, and the fast loop keeps a copy of the segment it is using so that it only reads the ring
+// once per segment.
+//
+// Each segment is checked against the full computation half way between its fit points. One that
+// is out by more than the tolerance on any channel is stored as invalid, and its ticks are computed
+// in full.
+class Trajectory {
+public:
+    enum Fit {
+        SAMPLES,    // cubic interpolation between samples at equal intervals
+        CHEBYSHEV   // a Chebyshev series fitted at the Chebyshev nodes
+    };
+
+    // Computes the point at the given TAI (MJD)
+    typedef std::function<void(double tai, TrajectoryPoint &point)> Compute;
+
+    Trajectory(Fit fit, double segmentSeconds, double aheadSeconds, double toleranceArcsec);
+
+    ~Trajectory();
+
+    // Disable copy
+    Trajectory(Trajectory const &) = delete;
+
+    Trajectory &operator=(Trajectory const &) = delete;
+
+    // Returns a new trajectory configured by the environment variables TPK_PREDICT ("samples" or
+    // "chebyshev"), TPK_PREDICT_AHEAD (s, default 10), TPK_PREDICT_SEGMENT (s, default 1) and
+    // TPK_PREDICT_TOLERANCE (arcsec, default 0.01), or null if TPK_PREDICT is not set
+    static Trajectory *fromEnv();
+
+    // Predicts the segments up to aheadSeconds after tai for key (called by the predictor thread only)
+    void extend(double tai, const TrajectoryKey &key, const Compute &compute);
+
+    // Predicts one segment (called by the predictor thread only)
+    void predict(int64_t index, const TrajectoryKey &key, const Compute &compute);
+
+    // Evaluates the trajectory at tai for key, returning false if it has not been predicted (called by
+    // the fast loop only)
+    bool lookup(double tai, const TrajectoryKey &key, TrajectoryPoint &point);
+
+    // Returns the index of the segment covering tai
+    int64_t segmentIndex(double tai) const;
+
+    // Returns the TAI (MJD) at which a segment starts
+    double start(int64_t index) const;
+
+    // Gets the statistics so far
+    void stats(TrajectoryStats *stats) const;
+
+    Fit fit() const { return fitKind; }
+
+    double segmentSeconds() const { return length; }
+
+    double aheadSeconds() const { return ahead; }
+
+private:
+    // Evaluates a valid segment at tai
+    void evaluate(const TrajectorySegment &segment, double tai, TrajectoryPoint &point) const;
+
+    Fit fitKind;
+    double length;          // s
+    double ahead;           // s
+    double tolerance;       // rad
+    int points;             // fit points per segment
+
+    size_t capacity;
+    Seqlock<TrajectorySegment> *segments;
+
+    // Only used by the predictor thread
+    bool started = false;
+    TrajectoryKey lastKey{};
+    int64_t next = 0;
+
+    // Only used by the fast loop
+    TrajectorySegment current{};
+
+    std::atomic<long> predictedSegments{0};
+    std::atomic<long> rejected{0};
+    std::atomic<long> predictedTicks{0};
+    std::atomic<long> computedTicks{0};
+    std::atomic<double> maxError{0.0};
+};
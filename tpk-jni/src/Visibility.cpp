@@ -0,0 +1,109 @@
+#include "Visibility.h"
+
+#include <cmath>
+#include "BaseCap.h"
+
+// Times are found to within this (s)
+static const double resolution = 1.0;
+
+namespace {
+    // The state of the target at one time
+    struct Sample {
+        double t;
+        double el;
+        bool up;            // above the elevation limit
+        bool observable;    // and reachable by the enclosure
+    };
+
+    struct Sampler {
+        const Visibility::AzEl &azEl;
+        double minEl;
+
+        Sample at(double t) const {
+            Sample s{};
+            double az, el;
+            azEl(t, az, el);
+            s.t = t;
+            s.el = el;
+            s.up = el >= minEl;
+            if (s.up) {
+                double base, cap;
+                BaseCap::calculate(az, el, base, cap);
+                s.observable = !std::isnan(base) && !std::isnan(cap);
+            }
+            return s;
+        }
+
+        // Returns the time at which what (up or observable) changes between a and b
+        double change(Sample a, Sample b, bool Sample::*what) const {
+            while (b.t - a.t > resolution) {
+                Sample m = at(0.5 * (a.t + b.t));
+                if (m.*what == a.*what) a = m; else b = m;
+            }
+            return 0.5 * (a.t + b.t);
+        }
+
+        // Returns the time of the highest elevation between a and b (golden section search)
+        Sample highest(double a, double b) const {
+            const double g = 0.5 * (sqrt(5.0) - 1.0);
+            Sample c = at(b - g * (b - a)), d = at(a + g * (b - a));
+            while (b - a > resolution) {
+                if (c.el > d.el) {
+                    b = d.t;
+                    d = c;
+                    c = at(b - g * (b - a));
+                } else {
+                    a = c.t;
+                    c = d;
+                    d = at(a + g * (b - a));
+                }
+            }
+            return at(0.5 * (a + b));
+        }
+    };
+}
+
+void Visibility::calculate(const AzEl &azEl, double startUtc, double endUtc, double minElDeg, double stepSeconds,
+                           PkVisibility &v) {
+    v = PkVisibility{};
+    v.rise = v.set = v.transit = NAN;
+    v.maxEl = -90.0;
+    if (!(endUtc > startUtc) || !(stepSeconds > 0)) return;
+
+    Sampler sampler{azEl, minElDeg};
+    Sample before{}, prev = sampler.at(startUtc);
+    bool havePrev2 = false;
+    double intervalStart = prev.observable ? startUtc : NAN;
+    v.maxEl = prev.el;
+
+    auto endInterval = [&](double end) {
+        if (v.numIntervals < pkVisibleIntervals) {
+            v.intervals[v.numIntervals][0] = intervalStart;
+            v.intervals[v.numIntervals][1] = end;
+        }
+        v.numIntervals++;
+    };
+
+    long steps = static_cast<long>(ceil((endUtc - startUtc) / stepSeconds));
+    for (long i = 1; i <= steps; i++) {
+        Sample s = sampler.at(i == steps ? endUtc : startUtc + i * stepSeconds);
+
+        if (!prev.up && s.up && std::isnan(v.rise)) v.rise = sampler.change(prev, s, &Sample::up);
+        if (prev.up && !s.up && std::isnan(v.set)) v.set = sampler.change(prev, s, &Sample::up);
+        if (!prev.observable && s.observable) intervalStart = sampler.change(prev, s, &Sample::observable);
+        if (prev.observable && !s.observable) endInterval(sampler.change(prev, s, &Sample::observable));
+
+        // The transit is the first maximum of the elevation inside the window
+        if (havePrev2 && std::isnan(v.transit) && prev.el >= before.el && prev.el > s.el) {
+            Sample top = sampler.highest(before.t, s.t);
+            v.transit = top.t;
+            v.maxEl = top.el;
+        }
+        if (std::isnan(v.transit) && s.el > v.maxEl) v.maxEl = s.el;
+
+        before = prev;
+        prev = s;
+        havePrev2 = true;
+    }
+    if (prev.observable) endInterval(endUtc);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// The number of enclosure reachable intervals PkVisibility holds
+const int pkVisibleIntervals = 8;
+
+// When a target can be observed in a time window, as returned by TpkC::visibility(). Times are UTC in
+// seconds since 1970, NaN if there is no such event in the window.
+typedef struct {
+    double rise;            // the first time the target rises above the elevation limit
+    double set;             // the first time it sets below the elevation limit
+    double transit;         // the first time it transits (reaches its highest elevation)
+    double maxEl;           // deg, the elevation at that transit, or the highest in the window if none
+    int32_t numIntervals;   // the number of intervals in which it is observable (may be more than stored)
+    int32_t reserved;
+    double intervals[pkVisibleIntervals][2];    // the start and end of the first of those intervals
+} PkVisibility;
+
+// Finds the rise, set and transit times of a target and the intervals in which it is observable: above
+// the elevation limit and reachable by the enclosure (base and cap are not NaN).
+//
+// The position is sampled at a fixed step through the window, and the times at which something
+// changes between two samples are then found to within a second by bisection (or golden section
+// search for the transit). Anything that happens entirely between two samples is missed, so the step
+// should be well under the shortest interval of interest (a minute, by default, for sidereal targets).
+class Visibility {
+public:
+    // Computes the az and el (in deg) of the target at a UTC time (s since 1970)
+    typedef std::function<void(double utc, double &azDeg, double &elDeg)> AzEl;
+
+    static const int defaultStepSeconds = 60;
+
+    // Calculates the visibility of one target between startUtc and endUtc
+    static void calculate(const AzEl &azEl, double startUtc, double endUtc, double minElDeg, double stepSeconds,
+                          PkVisibility &visibility);
+};
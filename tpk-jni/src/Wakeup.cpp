@@ -0,0 +1,82 @@
+//\file Wakeup.cpp
+//\brief Implementation of the Wakeup class
+
+#include "Wakeup.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+// Thin wrappers for the futex system call (there is no glibc wrapper).
+
+static void futexWait(std::atomic<int> *addr, int expected) {
+    (void) syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAIT_PRIVATE,
+                   expected, nullptr, nullptr, 0);
+}
+
+static void futexWake(std::atomic<int> *addr, int count) {
+    (void) syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAKE_PRIVATE,
+                   count, nullptr, nullptr, 0);
+}
+
+Wakeup::Wakeup() : Count(0), Waiters(0) {}
+
+Wakeup::~Wakeup() = default;
+
+/*
+   The waiter registers itself before sleeping and the poster checks 
+   for waiters after incrementing the count. Both are sequentially
+   consistent so either the poster sees the waiter and wakes it, or 
+   the futex sees the new count and does not sleep.
+*/
+void Wakeup::post() {
+    Count.fetch_add(1);
+    if (Waiters.load() > 0) futexWake(&Count, 1);
+}
+
+void Wakeup::wait() {
+    for (;;) {
+        // Try to consume a post without blocking.
+        int c = Count.load();
+        while (c > 0) {
+            if (Count.compare_exchange_weak(c, c - 1)) return;
+        }
+
+        // Sleep until the count changes from zero.
+        Waiters.fetch_add(1);
+        futexWait(&Count, 0);
+        Waiters.fetch_sub(1);
+    }
+}
+
+#else
+
+Wakeup::Wakeup() : Count(0) {
+    pthread_mutex_init(&Mutex, nullptr);
+    pthread_cond_init(&Cond, nullptr);
+}
+
+Wakeup::~Wakeup() {
+    pthread_cond_destroy(&Cond);
+    pthread_mutex_destroy(&Mutex);
+}
+
+void Wakeup::post() {
+    pthread_mutex_lock(&Mutex);
+    Count.fetch_add(1);
+    pthread_cond_signal(&Cond);
+    pthread_mutex_unlock(&Mutex);
+}
+
+void Wakeup::wait() {
+    pthread_mutex_lock(&Mutex);
+    while (Count.load() == 0) pthread_cond_wait(&Cond, &Mutex);
+    Count.fetch_sub(1);
+    pthread_mutex_unlock(&Mutex);
+}
+
+#endif
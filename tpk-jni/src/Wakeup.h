@@ -0,0 +1,59 @@
+//\file Wakeup.h
+//\brief Definition of the Wakeup class.
+
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <atomic>
+
+#ifndef __linux__
+#include <pthread.h>
+#endif
+
+/// Process private counting wakeup
+/**
+   The Wakeup class is a counting semaphore that is private to the
+   process and needs no name, file or allocation. On Linux it waits
+   on a futex and post only makes a system call if a thread is
+   actually waiting; elsewhere it falls back to a mutex and condition
+   variable.
+
+   It replaces the named POSIX semaphores previously used by ScanTask,
+   which were shared through the file system, so that a scan task can
+   only be woken by its own scheduler.
+*/
+class Wakeup {
+public:
+
+    /// Constructor
+    Wakeup();
+
+    /// Destructor
+    ~Wakeup();
+
+    // Disable copy
+    Wakeup(Wakeup const &) = delete;
+
+    Wakeup &operator=(Wakeup const &) = delete;
+
+    /// Increment the count, waking a waiting thread.
+    void post();
+
+    /// Wait for the count to be non-zero and then decrement it.
+    void wait();
+
+private:
+
+    // The number of posts not yet consumed by wait
+    std::atomic<int> Count;
+
+#ifdef __linux__
+    // The number of threads blocked in the futex
+    std::atomic<int> Waiters;
+#else
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+#endif
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "Weather.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Refraction at 45 deg elevation is about 60 arcsec * (P / 1013 hPa) * (283 K / T): it changes by about
+// 0.2 arcsec/K and 0.1 arcsec/hPa at the site, and much less with humidity
+static const double minTemperatureChange = 0.05;
+static const double minPressureChange = 0.1;
+static const double minHumidityChange = 0.01;
+
+// Returns true if the weather is physically plausible
+static bool isValid(const PkWeather &w) {
+    return w.temperature > -60.0 && w.temperature < 60.0 && w.pressure > 400.0 && w.pressure < 1100.0
+           && w.humidity >= 0.0 && w.humidity <= 1.0;
+}
+
+bool WeatherSource::changed(const PkWeather &w, const PkWeather &last) {
+    return fabs(w.temperature - last.temperature) >= minTemperatureChange
+           || fabs(w.pressure - last.pressure) >= minPressureChange
+           || fabs(w.humidity - last.humidity) >= minHumidityChange;
+}
+
+WeatherSource *WeatherSource::fromEnv() {
+    const char *s = getenv("TPK_WEATHER");
+    if (s && strcmp(s, "sim") == 0) return new SimulatedWeather();
+    if (s && *s) return new FileWeather(s);
+    return new ManualWeather();
+}
+
+FileWeather::FileWeather(const char *path) : path(path) {
+}
+
+// Warns once each time the file goes from readable to not
+bool FileWeather::read(double, PkWeather &weather) {
+    FILE *f = fopen(path.c_str(), "r");
+    PkWeather w{};
+    if (f && fscanf(f, "%lf %lf %lf", &w.temperature, &w.pressure, &w.humidity) == 3 && isValid(w)) {
+        last = w;
+        valid = true;
+        warned = false;
+    } else if (!warned) {
+        printf("Warning: Ignoring invalid weather file %s\n", path.c_str());
+        warned = true;
+    }
+    if (f) fclose(f);
+    weather = last;
+    return valid;
+}
+
+bool SimulatedWeather::read(double tai, PkWeather &weather) {
+    // Coldest just before sunrise (about 16:00 UTC in Hawaii)
+    double day = 2.0 * M_PI * (tai - floor(tai));
+    weather.temperature = 2.0 + 3.0 * cos(day - 2.0 * M_PI * (4.0 / 24.0));
+    weather.pressure = 615.0 + 1.0 * cos(2.0 * day) + 2.0 * sin(2.0 * M_PI * tai / 5.0);
+    weather.humidity = 0.2 + 0.1 * sin(day);
+    return true;
+}
+
+bool ManualWeather::set(const PkWeather &weather) {
+    if (!isValid(weather)) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    current.store(weather);
+    isSet = true;
+    return true;
+}
+
+bool ManualWeather::read(double, PkWeather &weather) {
+    if (!isSet) return false;
+    weather = current.load();
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "Seqlock.h"
+
+// The atmospheric conditions at the site that TPK needs for refraction
+typedef struct {
+    double temperature;     // deg C
+    double pressure;        // hPa
+    double humidity;        // relative, 0 to 1
+} PkWeather;
+
+// Where the slow loop gets the weather from (see TpkC::refreshSite())
+class WeatherSource {
+public:
+    virtual ~WeatherSource() = default;
+
+    // Gets the weather at tai (MJD) and returns true, or returns false if there is none (called by the
+    // slow loop only)
+    virtual bool read(double tai, PkWeather &weather) = 0;
+
+    // Describes the source for the log
+    virtual std::string description() const = 0;
+
+    // Returns true if the weather changed enough since last to change the refraction by more than about
+    // 0.01 arcsec at 45 deg elevation
+    static bool changed(const PkWeather &weather, const PkWeather &last);
+
+    // Returns the source selected by the environment variable TPK_WEATHER: "sim" for SimulatedWeather
+    // or the name of a file for FileWeather. If it is not set, returns a ManualWeather, which has no
+    // weather until it is set.
+    static WeatherSource *fromEnv();
+};
+
+// Reads the weather from a text file holding the temperature (deg C), pressure (hPa) and relative
+// humidity (0 to 1), for example written by a script that follows the weather station. The file is read
+// on every call (it is a few bytes and the slow loop reads it every 6 s), and the last valid values are
+// kept while it is missing or cannot be parsed.
+class FileWeather : public WeatherSource {
+public:
+    explicit FileWeather(const char *path);
+
+    bool read(double tai, PkWeather &weather) override;
+
+    std::string description() const override { return "file " + path; }
+
+private:
+    std::string path;
+    bool valid = false;
+    bool warned = false;
+    PkWeather last{};
+};
+
+// Weather that follows a daily cycle around typical night time conditions on Maunakea, with a slow
+// drift in pressure, for tests and simulations. It only depends on the time, so it is the same in every
+// run in virtual time.
+class SimulatedWeather : public WeatherSource {
+public:
+    bool read(double tai, PkWeather &weather) override;
+
+    std::string description() const override { return "simulation"; }
+};
+
+// Weather set through the API (tpkc_setWeather), for example from the CSW weather events
+class ManualWeather : public WeatherSource {
+public:
+    // Sets the weather and returns true, or returns false if it is not plausible (can be called from any thread)
+    bool set(const PkWeather &weather);
+
+    bool read(double tai, PkWeather &weather) override;
+
+    std::string description() const override { return "tpkc_setWeather"; }
+
+private:
+    std::mutex mutex;
+    Seqlock<PkWeather> current;
+    std::atomic<bool> isSet{false};
+};
@@ -0,0 +1,155 @@
+//
+// Tests of the virtual telescopes added to the mount and enclosure, run in virtual time
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <TpkC.h>
+
+// The C entry points, which take the reference system as an int (from Java)
+extern "C" {
+bool tpkc_newVtTarget(TpkC *self, int vt, int refSys, double a, double b);
+bool tpkc_setVtOffset(TpkC *self, int vt, int refSys, double a, double b);
+}
+
+static int testRegistry() {
+    TpkC tpkc;
+    int status = 0;
+    if (tpkc.addVt("GuideProbe1") != 0 || tpkc.addVt("GuideProbe2") != 1) {
+        printf("testRegistry failed: virtual telescopes not added in order\n");
+        status = 1;
+    }
+    if (tpkc.addVt("GuideProbe1") != -1 || tpkc.addVt("") != -1 ||
+        tpkc.addVt("AVirtualTelescopeNameThatIsMuchTooLong") != -1) {
+        printf("testRegistry failed: a duplicate or invalid name was added\n");
+        status = 1;
+    }
+    if (tpkc.vtIndex("GuideProbe2") != 1 || tpkc.vtIndex("Rotator") != -1 || tpkc.numVts() != 2) {
+        printf("testRegistry failed: wrong index or count\n");
+        status = 1;
+    }
+    for (int i = 2; i < pkMaxVts; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Vt%d", i);
+        tpkc.addVt(name);
+    }
+    if (tpkc.numVts() != pkMaxVts || tpkc.addVt("OneTooMany") != -1) {
+        printf("testRegistry failed: %d virtual telescopes added, expected %d\n", tpkc.numVts(), pkMaxVts);
+        status = 1;
+    }
+    return status;
+}
+
+// Each added virtual telescope tracks its own target, without changing the mount demands
+static int testTracking() {
+    TpkC tpkc;
+    int probe = tpkc.addVt("GuideProbe");
+    int rotator = tpkc.addVt("Rotator");
+    tpkc.init();
+    int status = 0;
+
+    tpkc.newAzElTarget(30.0, 60.0);
+    tpkc.runFor(0.5);
+    PkDemand before[1];
+    tpkc.demandHistory(before, 1);
+
+    if (!tpkc.newVtTarget(probe, PK_AZEL, 100.0, 50.0) || tpkc.newVtTarget(rotator, PK_AZEL, 100.0, -5.0) ||
+        tpkc.newVtTarget(2, PK_AZEL, 100.0, 50.0)) {
+        printf("testTracking failed: wrong result for a new target\n");
+        status = 1;
+    }
+    tpkc.runFor(0.5);
+
+    PkVtDemand d{};
+    if (!tpkc.vtDemand(probe, &d) || fabs(d.az - 100.0) > 0.01 || fabs(d.el - 50.0) > 0.01) {
+        printf("testTracking failed: probe demands %f,%f, expected 100,50\n", d.az, d.el);
+        status = 1;
+    }
+    if (tpkc.vtDemand(rotator, &d)) {
+        printf("testTracking failed: rotator has demands without a target\n");
+        status = 1;
+    }
+
+    PkDemand after[1];
+    tpkc.demandHistory(after, 1);
+    if (fabs(after[0].mcsAz - before[0].mcsAz) > 0.01 || fabs(after[0].mcsEl - before[0].mcsEl) > 0.01) {
+        printf("testTracking failed: mount moved from %f,%f to %f,%f\n", before[0].mcsAz, before[0].mcsEl,
+               after[0].mcsAz, after[0].mcsEl);
+        status = 1;
+    }
+
+    // A new target for one leaves the other where it was
+    tpkc.newVtTarget(rotator, PK_AZEL, 200.0, 20.0);
+    tpkc.runFor(0.1);
+    PkVtDemand p{}, r{};
+    tpkc.vtDemand(probe, &p);
+    tpkc.vtDemand(rotator, &r);
+    if (fabs(p.az - 100.0) > 0.01 || fabs(r.az - 200.0) > 0.01 || fabs(r.el - 20.0) > 0.01 || p.time != r.time) {
+        printf("testTracking failed: probe %f,%f, rotator %f,%f at %f/%f\n", p.az, p.el, r.az, r.el, p.time, r.time);
+        status = 1;
+    }
+    tpkc.shutdown();
+
+    // The registry is kept, and the commands are not
+    tpkc.init();
+    tpkc.newAzElTarget(30.0, 60.0);
+    tpkc.runFor(0.1);
+    if (tpkc.numVts() != 2 || tpkc.vtDemand(probe, &d)) {
+        printf("testTracking failed: %d virtual telescopes after init, old target kept\n", tpkc.numVts());
+        status = 1;
+    }
+    tpkc.shutdown();
+    return status;
+}
+
+// An added virtual telescope tracks its target even if the mount has never been given one
+static int testTrackingWithoutMountTarget() {
+    TpkC tpkc;
+    int probe = tpkc.addVt("GuideProbe");
+    tpkc.init();
+    int status = 0;
+
+    tpkc.newVtTarget(probe, PK_AZEL, 100.0, 50.0);
+    tpkc.runFor(0.5);
+    PkVtDemand d{};
+    if (!tpkc.vtDemand(probe, &d) || fabs(d.az - 100.0) > 0.01 || fabs(d.el - 50.0) > 0.01) {
+        printf("testTrackingWithoutMountTarget failed: probe demands %f,%f, expected 100,50\n", d.az, d.el);
+        status = 1;
+    }
+    PkDemand mount[1];
+    if (tpkc.demandHistory(mount, 1) != 0) {
+        printf("testTrackingWithoutMountTarget failed: mount demands without a mount target\n");
+        status = 1;
+    }
+    tpkc.shutdown();
+    return status;
+}
+
+// A reference system that is not one of the PkRefSys values is refused
+static int testInvalidRefSys() {
+    TpkC tpkc;
+    int probe = tpkc.addVt("GuideProbe");
+    tpkc.init();
+    int status = 0;
+    if (tpkc_newVtTarget(&tpkc, probe, 3, 100.0, 50.0) || tpkc_newVtTarget(&tpkc, probe, -1, 100.0, 50.0) ||
+        tpkc_setVtOffset(&tpkc, probe, 7, 1.0, 1.0)) {
+        printf("testInvalidRefSys failed: an invalid reference system was accepted\n");
+        status = 1;
+    }
+    if (!tpkc_newVtTarget(&tpkc, probe, PK_AZEL, 100.0, 50.0) || !tpkc_setVtOffset(&tpkc, probe, PK_AZEL, 1.0, 1.0)) {
+        printf("testInvalidRefSys failed: a valid reference system was refused\n");
+        status = 1;
+    }
+    tpkc.shutdown();
+    return status;
+}
+
+int main() {
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    int status = testRegistry();
+    status |= testTracking();
+    status |= testTrackingWithoutMountTarget();
+    status |= testInvalidRefSys();
+    return status;
+}
@@ -0,0 +1,132 @@
+//
+// Stress tests for the command mailbox used to pass target and offset commands to the fast loop
+//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <TpkC.h>
+
+// Value written by the Seqlock test: all fields are always stored with the same value,
+// so a reader that sees different values has seen a torn write.
+typedef struct {
+    double v[8];
+    long n;
+} Payload;
+
+// Hammers a Seqlock from several writers while a reader checks that it never sees a torn value
+static int testSeqlockNoTornReads() {
+    Seqlock<Payload> seqlock;
+    std::mutex writeMutex;
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 3; w++) {
+        writers.emplace_back([&, w]() {
+            long n = w;
+            while (!done) {
+                Payload p;
+                for (double &v : p.v) v = static_cast<double>(n);
+                p.n = n;
+                std::lock_guard<std::mutex> lock(writeMutex);
+                seqlock.store(p);
+                n += 3;
+            }
+        });
+    }
+
+    int status = 0;
+    long reads = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (std::chrono::steady_clock::now() < end) {
+        Payload p = seqlock.load();
+        reads++;
+        for (double v : p.v) {
+            if (v != static_cast<double>(p.n)) {
+                printf("testSeqlockNoTornReads failed: read %g in a value stored as %ld\n", v, p.n);
+                status = 1;
+                break;
+            }
+        }
+        if (status) break;
+    }
+    done = true;
+    for (auto &t : writers) t.join();
+    printf("testSeqlockNoTornReads: %ld reads\n", reads);
+    return status;
+}
+
+// Calls the target and offset setters from several threads while the fast loop is tracking and
+// checks that the position and demand history it reports are always sane
+static int testSettersWhileTracking(TpkC *tpkc) {
+    std::atomic<bool> done(false);
+    std::atomic<long> commands(0);
+
+    std::vector<std::thread> clients;
+    for (int c = 0; c < 4; c++) {
+        clients.emplace_back([&, c]() {
+            unsigned int seed = c;
+            while (!done) {
+                double a = rand_r(&seed) % 3600 / 10.0;
+                double b = rand_r(&seed) % 500 / 10.0;
+                switch (rand_r(&seed) % 6) {
+                    case 0: tpkc->newICRSTarget(a / 18.0, b); break;
+                    case 1: tpkc->newFK5Target(a / 18.0, b); break;
+                    case 2: tpkc->newAzElTarget(a, 40.0 + b); break;
+                    case 3: tpkc->setICRSOffset(b, -b); break;
+                    case 4: tpkc->setFK5Offset(-b, b); break;
+                    default: tpkc->setAzElOffset(b, b); break;
+                }
+                commands++;
+            }
+        });
+    }
+
+    int status = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (std::chrono::steady_clock::now() < end) {
+        CoordPair raDec;
+        tpkc->currentPosition(&raDec);
+        if (std::isnan(raDec.a) || std::isnan(raDec.b) || raDec.b < -90.0 || raDec.b > 90.0) {
+            printf("testSettersWhileTracking failed: position ra=%g, dec=%g\n", raDec.a, raDec.b);
+            status = 1;
+            break;
+        }
+        PkDemand demands[16];
+        int n = tpkc->demandHistory(demands, 16);
+        for (int i = 0; i < n; i++) {
+            if (demands[i].dec < -90.0 || demands[i].dec > 90.0 || (i > 0 && demands[i].time < demands[i - 1].time)) {
+                printf("testSettersWhileTracking failed: demand %d of %d: time=%f, dec=%g\n", i, n,
+                       demands[i].time, demands[i].dec);
+                status = 1;
+                break;
+            }
+        }
+        if (status) break;
+        usleep(1000);
+    }
+    done = true;
+    for (auto &t : clients) t.join();
+    printf("testSettersWhileTracking: %ld commands\n", commands.load());
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    int status = 0;
+    status |= testSeqlockNoTornReads();
+
+    // Give the scan loops time to start
+    TpkC tpkc;
+    tpkc.init();
+    sleep(1);
+    status |= testSettersWhileTracking(&tpkc);
+    tpkc.shutdown();
+    return status;
+}
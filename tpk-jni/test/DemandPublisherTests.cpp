@@ -0,0 +1,115 @@
+//
+// Tests of the demand publisher thread, with a publish function that stands in for the event service
+// and can be stalled
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <DemandPublisher.h>
+
+static const size_t queueSize = 16;
+
+// The fake event service: while stalled, a publish waits until it is released. The time (in s) of
+// every MountDemandPosition event published is recorded.
+static std::atomic<bool> stalled(false);
+static std::atomic<bool> waiting(false);
+static std::mutex publishedMutex;
+static std::vector<long> publishedTimes;
+
+static int fakePublish(CswEventServiceContext, CswEvent event) {
+    while (stalled) {
+        waiting = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    waiting = false;
+    if (strcmp(event.eventName, "MountDemandPosition") == 0) {
+        // The time is the fourth parameter (see McsDemandEvent)
+        const CswUtcTime *time = static_cast<const CswUtcTime *>(event.paramSet.params[3].values.values);
+        std::lock_guard<std::mutex> lock(publishedMutex);
+        publishedTimes.push_back(static_cast<long>(time->seconds));
+    }
+    return 0;
+}
+
+static DemandSample sampleAt(long seconds) {
+    DemandSample s{};
+    s.time.seconds = seconds;
+    s.ecs = seconds % 5 == 0;
+    return s;
+}
+
+// Stalls the event service while the publisher is publishing the demand of tick 1, queues the demands
+// of ticks 2 to lastTick, then lets the event service recover. Returns the ticks published and the
+// statistics.
+static std::vector<long> stallAndRecover(PublishPolicy policy, long lastTick, PublishStats &stats) {
+    {
+        std::lock_guard<std::mutex> lock(publishedMutex);
+        publishedTimes.clear();
+    }
+    DemandPublisher publisher(nullptr, "TCS.PointingKernelAssembly", policy, queueSize);
+    publisher.setPublishFunction(fakePublish);
+    publisher.start();
+
+    stalled = true;
+    publisher.post(sampleAt(1));
+    while (!waiting) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    for (long t = 2; t <= lastTick; t++) publisher.post(sampleAt(t));
+    stalled = false;
+
+    publisher.stop();
+    publisher.stats(&stats);
+    std::lock_guard<std::mutex> lock(publishedMutex);
+    return publishedTimes;
+}
+
+// After a stall that overflows the queue, coalesce must publish the latest demand, not a stale one
+static int testCoalesceAfterStall() {
+    int status = 0;
+    PublishStats stats{};
+    std::vector<long> times = stallAndRecover(PUBLISH_COALESCE, 100, stats);
+    printf("testCoalesceAfterStall: published %zu demands, the first after the stall from tick %ld, %ld dropped\n",
+           times.size(), times.size() > 1 ? times[1] : -1L, stats.dropped);
+    if (times.size() != 2 || times[0] != 1 || times[1] != 100) {
+        printf("testCoalesceAfterStall failed: expected ticks 1 and 100 to be published\n");
+        status = 1;
+    }
+    if (stats.queued != 100 || stats.published + stats.dropped != stats.queued) {
+        printf("testCoalesceAfterStall failed: %ld queued, %ld published and %ld dropped\n", stats.queued,
+               stats.published, stats.dropped);
+        status = 1;
+    }
+    return status;
+}
+
+// Drop-oldest must publish the demands still queued after the stall, in order, up to the latest one
+static int testDropOldestAfterStall() {
+    int status = 0;
+    PublishStats stats{};
+    std::vector<long> times = stallAndRecover(PUBLISH_DROP_OLDEST, 100, stats);
+    printf("testDropOldestAfterStall: published %zu demands, ticks %ld to %ld after the stall, %ld dropped\n",
+           times.size(), times.size() > 1 ? times[1] : -1L, times.empty() ? -1L : times.back(), stats.dropped);
+    long first = 100 - static_cast<long>(queueSize) + 1;
+    bool inOrder = times.size() == queueSize + 1 && times[0] == 1;
+    for (size_t i = 1; inOrder && i < times.size(); i++) inOrder = times[i] == first + static_cast<long>(i) - 1;
+    if (!inOrder) {
+        printf("testDropOldestAfterStall failed: expected tick 1, then ticks %ld to 100\n", first);
+        status = 1;
+    }
+    if (stats.queued != 100 || stats.published + stats.dropped != stats.queued) {
+        printf("testDropOldestAfterStall failed: %ld queued, %ld published and %ld dropped\n", stats.queued,
+               stats.published, stats.dropped);
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = testCoalesceAfterStall();
+    status |= testDropOldestAfterStall();
+    return status;
+}
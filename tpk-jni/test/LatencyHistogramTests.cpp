@@ -0,0 +1,93 @@
+//
+// Tests the latency histograms and the timing statistics of the scan tasks
+//
+
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include <LatencyHistogram.h>
+#include <ScanTask.h>
+
+// Checks that the percentiles of a known distribution are within the precision of the buckets
+static int testPercentiles() {
+    int status = 0;
+    LatencyHistogram h;
+
+    // 1 us to 100 ms in 1 us steps
+    const long n = 100000;
+    for (long i = 1; i <= n; i++) h.record(i * 1000);
+
+    LatencySummary s{};
+    h.summary(&s);
+    double expected[][2] = {{s.p50Us, 50000.0}, {s.p90Us, 90000.0}, {s.p99Us, 99000.0}, {s.p999Us, 99900.0}};
+    for (auto &e : expected) {
+        if (fabs(e[0] - e[1]) > 0.035 * e[1]) {
+            printf("testPercentiles failed: got %g us, expected %g us\n", e[0], e[1]);
+            status = 1;
+        }
+    }
+    if (s.count != n || s.minUs != 1.0 || s.maxUs != 100000.0 || fabs(s.meanUs - 50000.5) > 1e-6) {
+        printf("testPercentiles failed: count %ld, min %g, mean %g, max %g\n", s.count, s.minUs, s.meanUs, s.maxUs);
+        status = 1;
+    }
+    printf("testPercentiles: p50 %g, p90 %g, p99 %g, p99.9 %g us\n", s.p50Us, s.p90Us, s.p99Us, s.p999Us);
+
+    // Small, negative and huge values
+    LatencyHistogram h2;
+    h2.record(-5);
+    h2.record(3);
+    h2.record(1LL << 50);
+    h2.summary(&s);
+    if (s.count != 3 || s.minUs != 0.0 || h2.percentileNs(0.5) != 3 || h2.percentileNs(1.0) != 1LL << 50) {
+        printf("testPercentiles failed: wrong results for out of range values\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A scan task that takes about 2 ms
+class BusyScan : public ScanTask {
+public:
+    explicit BusyScan(ScanScheduler &scheduler) : ScanTask(scheduler, "BusyScan", 10, 1) {}
+
+    void scan() override {
+        usleep(2000);
+    }
+};
+
+// Runs a 100 Hz scan task for a second and checks its statistics
+static int testScanStats() {
+    int status = 0;
+    ScanScheduler scheduler;
+    BusyScan task(scheduler);
+    scheduler.start();
+    sleep(1);
+    scheduler.stop();
+    task.stop();
+
+    ScanStats s{};
+    task.stats(&s);
+    printf("testScanStats: %s: %ld runs, %ld missed, %ld overruns, wakeup p50 %.1f us, "
+           "execution p50 %.1f us, jitter p99 %.1f us\n",
+           s.name, s.runs, s.missedTicks, s.overruns, s.wakeup.p50Us, s.execution.p50Us, s.jitter.p99Us);
+    if (s.runs < 90 || s.runs > 101) {
+        printf("testScanStats failed: expected about 100 runs\n");
+        status = 1;
+    }
+    if (s.execution.count != s.runs || s.wakeup.count != s.runs || s.jitter.count != s.runs - 1) {
+        printf("testScanStats failed: histogram counts do not match the runs\n");
+        status = 1;
+    }
+    if (s.execution.p50Us < 2000.0 || s.execution.p50Us > 10000.0 || s.overruns > s.runs / 10) {
+        printf("testScanStats failed: execution time should be a little over 2 ms\n");
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = 0;
+    status |= testPercentiles();
+    status |= testScanStats();
+    return status;
+}
@@ -0,0 +1,179 @@
+//
+// Cycles TpkC::init() and shutdown() and checks that every thread is joined and nothing is leaked
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <TpkC.h>
+
+// The number of threads in the process (-1 if unknown)
+static int threadCount() {
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) return -1;
+    int n = 0;
+    while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+// The number of bytes allocated on the heap (-1 if unknown)
+static long heapInUse() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    return static_cast<long>(mallinfo2().uordblks);
+#else
+    return -1;
+#endif
+}
+
+// Runs the kernel for a moment, so that all the loops run, and shuts it down. Returns the time
+// taken by shutdown() in ms.
+static double cycle(TpkC &tpkc) {
+    tpkc.init();
+    tpkc.newICRSTarget(153.1, 11.15);
+    tpkc.setICRSOffset(1.0, 1.0);
+    usleep(600000);
+    auto t0 = std::chrono::steady_clock::now();
+    tpkc.shutdown();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static int testInitShutdownCycles() {
+    const int cycles = 20;
+    // The slowest loop runs every 6 s but does very little; a shutdown should not take much more than a tick
+    const double maxShutdownMs = 500.0;
+    int status = 0;
+    TpkC tpkc;
+
+    // The first cycles may create things that are kept for the life of the process
+    cycle(tpkc);
+    cycle(tpkc);
+    int threads = threadCount();
+    long heap = heapInUse();
+
+    double maxMs = 0;
+    for (int i = 0; i < cycles; i++) {
+        double ms = cycle(tpkc);
+        if (ms > maxMs) maxMs = ms;
+        if (tpkc.isRunning()) {
+            printf("testInitShutdownCycles failed: still running after shutdown\n");
+            status = 1;
+        }
+        int n = threadCount();
+        if (threads >= 0 && n != threads) {
+            printf("testInitShutdownCycles failed: %d threads after shutdown (expected %d)\n", n, threads);
+            status = 1;
+        }
+    }
+
+    long leaked = heap < 0 ? 0 : (heapInUse() - heap) / cycles;
+    printf("testInitShutdownCycles: %d cycles, max shutdown time %.1f ms, heap growth %ld bytes/cycle\n",
+           cycles, maxMs, leaked);
+    if (maxMs > maxShutdownMs) {
+        printf("testInitShutdownCycles failed: shutdown took more than %g ms\n", maxShutdownMs);
+        status = 1;
+    }
+    if (leaked > 1024) {
+        printf("testInitShutdownCycles failed: the heap grows with every cycle\n");
+        status = 1;
+    }
+    return status;
+}
+
+// The number of executions of the kernel's fast loop so far
+static long fastRuns(TpkC &tpkc) {
+    ScanStats stats[3];
+    if (tpkc.loopStats(stats, 3) != 3) return -1;
+    return stats[2].runs;
+}
+
+// Cycles one kernel while a second one is running: shutting down the first must not stop or disturb the
+// loops of the second, or leave any of its threads behind
+static int testCyclesWithSecondKernel() {
+    const int cycles = 5;
+    int status = 0;
+    TpkC other;
+    other.init();
+    other.newICRSTarget(185.0, 11.0);
+    TpkC tpkc;
+    cycle(tpkc);
+    int threads = threadCount();
+
+    for (int i = 0; i < cycles; i++) {
+        cycle(tpkc);
+        long runs = fastRuns(other);
+        usleep(100000);
+        long more = fastRuns(other) - runs;
+        if (!other.isRunning() || more < 5) {
+            printf("testCyclesWithSecondKernel failed: the second kernel's fast loop ran %ld times in the 0.1 s "
+                   "after a shutdown of the first\n", more);
+            status = 1;
+        }
+        int n = threadCount();
+        if (threads >= 0 && n != threads) {
+            printf("testCyclesWithSecondKernel failed: %d threads after shutdown (expected %d)\n", n, threads);
+            status = 1;
+        }
+    }
+
+    ScanStats stats[3];
+    other.loopStats(stats, 3);
+    printf("testCyclesWithSecondKernel: %d cycles, second kernel's fast loop ran %ld times, missed %ld\n", cycles,
+           stats[2].runs, stats[2].missedTicks);
+    other.shutdown();
+    return status;
+}
+
+// Commands, conversions and visibility that arrive before init() or after shutdown() (for example late
+// from the JVM) must be refused or leave their outputs alone, not use the site that shutdown() freed
+static int callsWhenStopped(TpkC &tpkc, const char *when) {
+    int status = 0;
+    if (tpkc.newICRSTarget(185.0, 11.0) || tpkc.newFK5Target(185.0, 11.0) || tpkc.newAzElTarget(180.0, 45.0) ||
+        tpkc.newVtTarget(0, PK_ICRS, 185.0, 11.0)) {
+        printf("testCallsWhenStopped failed: a target was accepted %s\n", when);
+        status = 1;
+    }
+
+    CoordPair p = {-1.0, -2.0}, q = {-1.0, -2.0};
+    tpkc.raDecToAzEl(185.0, 11.0, &p);
+    tpkc.azElToRaDec(180.0, 45.0, &q);
+    double a[2] = {185.0, 186.0}, b[2] = {11.0, 12.0}, c[2] = {-1.0, -1.0}, d[2] = {-1.0, -1.0};
+    tpkc.raDecToAzEl(a, b, c, d, 2);
+    tpkc.azElToRaDec(a, b, c, d, 2);
+    PkVisibility v[2];
+    memset(v, 0x5a, sizeof v);
+    PkVisibility unchanged[2];
+    memcpy(unchanged, v, sizeof v);
+    tpkc.visibility(a, b, 2, 1.6e9, 1.6e9 + 3600.0, 30.0, v);
+    if (p.a != -1.0 || p.b != -2.0 || q.a != -1.0 || q.b != -2.0 || c[0] != -1.0 || d[1] != -1.0 ||
+        memcmp(v, unchanged, sizeof v) != 0) {
+        printf("testCallsWhenStopped failed: a conversion filled in its output %s\n", when);
+        status = 1;
+    }
+    return status;
+}
+
+static int testCallsWhenStopped() {
+    TpkC tpkc;
+    tpkc.addVt("guider");
+    int status = callsWhenStopped(tpkc, "before init()");
+    tpkc.init();
+    tpkc.shutdown();
+    status |= callsWhenStopped(tpkc, "after shutdown()");
+    if (status == 0) printf("testCallsWhenStopped: everything refused before init() and after shutdown()\n");
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    int status = testInitShutdownCycles();
+    status |= testCyclesWithSecondKernel();
+    status |= testCallsWhenStopped();
+    return status;
+}
@@ -0,0 +1,137 @@
+//
+// Tests of reading pointing model files and of loading them while tracking, run in virtual time
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <TpkC.h>
+
+static const char *modelFile = "/tmp/PointingModelTests.dat";
+
+static const char *model =
+        "TMT mount model 2022-01-01\n"
+        "S   T  01  2022 01 01  59580.5  2.0  615.0  0.25\n"
+        "! fitted to 212 stars\n"
+        "     IA       -12.3456     1.2345\n"
+        "     IE        45.678\n"
+        "&    NPAE       1.5        0.5\n"
+        "\n"
+        "     TF         3.0e-1     0.1\n"
+        "END\n";
+
+static void writeFile(const char *contents) {
+    FILE *f = fopen(modelFile, "w");
+    fputs(contents, f);
+    fclose(f);
+}
+
+static int testParse() {
+    PointingModelFile file;
+    std::string error;
+    if (!file.parse(model, error) || file.caption() != "TMT mount model 2022-01-01" || file.terms().size() != 4) {
+        printf("testParse failed: %s, caption '%s', %zu terms\n", error.c_str(), file.caption().c_str(),
+               file.terms().size());
+        return 1;
+    }
+    const PointingTerm &ia = file.terms()[0], &npae = file.terms()[2], &tf = file.terms()[3];
+    if (ia.name != "IA" || ia.value != -12.3456 || npae.name != "NPAE" || npae.value != 1.5 || tf.value != 0.3) {
+        printf("testParse failed: wrong terms\n");
+        return 1;
+    }
+    if (!file.parse("Empty model\nS\nEND\n", error) || !file.terms().empty()) {
+        printf("testParse failed: empty model not accepted\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int testInvalid() {
+    const char *invalid[] = {
+            "Truncated\nS\n     IA  -12.3  1.2\n     IE  45",
+            "Bad value\nS\n     IA  -12.3x  1.2\nEND\n",
+            "Bad name\nS\n     ia  -12.3  1.2\nEND\n",
+            "Repeated\nS\n     IA  -12.3\n     IA  1.0\nEND\n",
+    };
+    int status = 0;
+    for (const char *text : invalid) {
+        PointingModelFile file;
+        std::string error;
+        if (file.parse(text, error) || error.empty()) {
+            printf("testInvalid failed: accepted %s\n", text);
+            status = 1;
+        }
+    }
+    PointingModelFile file;
+    std::string error;
+    if (file.read("/tmp/PointingModelTests.missing", error)) {
+        printf("testInvalid failed: read a missing file\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A model loaded while tracking is used by the fast loop after the next medium loop cycle, without
+// missing a tick, and an invalid one is ignored
+static int testLoad() {
+    writeFile(model);
+    TpkC tpkc;
+    int status = 0;
+    if (tpkc.loadPointingModel(modelFile) != -1) {
+        printf("testLoad failed: loaded before init\n");
+        status = 1;
+    }
+    tpkc.init();
+    tpkc.newICRSTarget(185.0, 11.0);
+    tpkc.runFor(1.0);
+    int n = tpkc.loadPointingModel(modelFile);
+    if (n != 1 || tpkc.pointingModel() != 0) {
+        printf("testLoad failed: loaded model %d, using %d\n", n, tpkc.pointingModel());
+        status = 1;
+    }
+    tpkc.runFor(0.5);
+    if (tpkc.pointingModel() != 1) {
+        printf("testLoad failed: using model %d after a medium loop cycle\n", tpkc.pointingModel());
+        status = 1;
+    }
+
+    writeFile("Truncated\nS\n     IA  -12.3  1.2\n");
+    if (tpkc.loadPointingModel(modelFile) != -1) {
+        printf("testLoad failed: loaded a truncated model\n");
+        status = 1;
+    }
+    writeFile(model);
+    for (int i = 0; i < 10; i++) {
+        n = tpkc.loadPointingModel(modelFile);
+        tpkc.runFor(0.25);
+    }
+    tpkc.runFor(0.5);
+    ScanStats stats[3];
+    tpkc.loopStats(stats, 3);
+    if (n != 11 || tpkc.pointingModel() != 11 || stats[2].missedTicks != 0) {
+        printf("testLoad failed: loaded %d, using %d, %ld ticks missed\n", n, tpkc.pointingModel(),
+               stats[2].missedTicks);
+        status = 1;
+    }
+    tpkc.shutdown();
+
+    // Loaded by init() if configured
+    setenv("TPK_POINTING_MODEL", modelFile, 1);
+    tpkc.init();
+    tpkc.runFor(0.1);
+    if (tpkc.pointingModel() != 0 || tpkc.loadPointingModel(modelFile) != 1) {
+        printf("testLoad failed: model numbers not restarted by init()\n");
+        status = 1;
+    }
+    tpkc.shutdown();
+    unsetenv("TPK_POINTING_MODEL");
+    remove(modelFile);
+    return status;
+}
+
+int main() {
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    int status = testParse();
+    status |= testInvalid();
+    status |= testLoad();
+    return status;
+}
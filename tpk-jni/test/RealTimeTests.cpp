@@ -0,0 +1,98 @@
+//
+// Tests the real-time configuration of the scan threads
+//
+
+#include <cstdio>
+#include <cstring>
+#include <ScanTask.h>
+
+// Checks the parsing of the configuration values
+static int testConfig() {
+    int status = 0;
+    RealTimeConfig c;
+
+    struct {
+        const char *key;
+        const char *value;
+        bool valid;
+    } items[] = {
+            {"policy",         "deadline",                      true},
+            {"policy",         "fifo",                          true},
+            {"policy",         "rr",                            false},
+            {"deadlineBudget", "0.25",                          true},
+            {"deadlineBudget", "2",                             false},
+            {"lockMemory",     "yes",                           true},
+            {"lockMemory",     "maybe",                         false},
+            {"prefaultStack",  "64k",                           true},
+            {"prefaultStack",  "64q",                           false},
+            {"cpuAffinity",    "FastScan=3,Scheduler=3,SlowScan=1", true},
+            {"cpuAffinity",    "FastScan=3,MediumScan",         false},
+            {"cpuAffinity",    "FastScan=-1",                   false},
+            {"unknown",        "1",                             false},
+    };
+    for (auto &item : items) {
+        if (c.set(item.key, item.value) != item.valid) {
+            printf("testConfig failed: %s=%s should be %s\n", item.key, item.value, item.valid ? "valid" : "invalid");
+            status = 1;
+        }
+    }
+
+    // The invalid values must not have changed anything
+    if (c.policy != RT_FIFO || c.deadlineBudget != 0.25 || !c.lockMemory || c.prefaultStack != 64 * 1024
+        || c.numCpus != 3 || c.cpuFor("FastScan") != 3 || c.cpuFor("SlowScan") != 1 || c.cpuFor("MediumScan") != -1) {
+        printf("testConfig failed: wrong configuration after setting\n");
+        status = 1;
+    }
+    return status;
+}
+
+class IdleScan : public ScanTask {
+public:
+    explicit IdleScan(ScanScheduler &scheduler) : ScanTask(scheduler, "IdleScan", 10, 1) {}
+
+    void scan() override {}
+};
+
+// Asks for everything: the task must get what it is allowed to and report it
+static int testFallback() {
+    int status = 0;
+    RealTimeConfig c;
+    c.set("policy", "deadline");
+    c.set("prefaultStack", "64k");
+    c.set("cpuAffinity", "IdleScan=0");
+    ScanScheduler scheduler;
+    scheduler.configure(c);
+
+    ThreadPolicy p{};
+    {
+        IdleScan task(scheduler);
+        task.policy(&p);
+        task.stop();
+    }
+
+    printf("testFallback: %s: policy %s, priority %d, cpu %d, stack %s\n", p.name, rtPolicyName(p.policy),
+           p.priority, p.cpu, p.stackPrefaulted ? "prefaulted" : "not prefaulted");
+    if (strcmp(p.name, "IdleScan") != 0 || !p.stackPrefaulted) {
+        printf("testFallback failed: policy not reported\n");
+        status = 1;
+    }
+#ifdef __linux__
+    // Pinning is always allowed (SCHED_DEADLINE then normally fails and falls back)
+    if (p.cpu != 0) {
+        printf("testFallback failed: not pinned to CPU 0\n");
+        status = 1;
+    }
+#endif
+    if (p.policy == RT_FIFO && p.priority <= 0) {
+        printf("testFallback failed: SCHED_FIFO with no priority\n");
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = 0;
+    status |= testConfig();
+    status |= testFallback();
+    return status;
+}
@@ -0,0 +1,167 @@
+//
+// Tests the recorder of the fast loop ticks and the memory mapped reader of its files
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <RecordReader.h>
+#include <Recorder.h>
+#include <TpkC.h>
+
+static PkTickRecord makeRecord(long n) {
+    PkTickRecord r{};
+    r.tai = 59580.5 + n / 8640000.0;
+    r.monotonicNs = n * 10000000LL;
+    r.mountRoll = static_cast<double>(n);
+    r.mountPitch = -static_cast<double>(n);
+    r.targetId = static_cast<uint64_t>(n / 100);
+    return r;
+}
+
+// The record files in dir, sorted by name (the order they were written in)
+static std::vector<std::string> recordFiles(const std::string &dir) {
+    std::vector<std::string> files;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return files;
+    while (struct dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() > 6 && name.compare(name.size() - 6, 6, ".pkrec") == 0) files.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static void removeDir(const std::string &dir) {
+    for (auto &f : recordFiles(dir)) unlink(f.c_str());
+    rmdir(dir.c_str());
+}
+
+static std::string makeDir() {
+    char dir[] = "/tmp/RecorderTestsXXXXXX";
+    return mkdtemp(dir) ? dir : "";
+}
+
+// Records enough ticks for several files and reads back what was kept
+static int testRotation() {
+    int status = 0;
+    std::string dir = makeDir();
+    const long numRecords = 1000;
+    const long perFile = 300;
+    {
+        Recorder recorder(dir.c_str(), sizeof(PkRecordFileHeader) + perFile * sizeof(PkTickRecord), 3, 64);
+        recorder.start();
+        for (long n = 0; n < numRecords; n++) {
+            recorder.record(makeRecord(n));
+            if (n % 32 == 0) usleep(1000);
+        }
+        recorder.stop();
+        RecorderStats stats{};
+        recorder.stats(&stats);
+        if (stats.recorded != numRecords || stats.written + stats.dropped != numRecords || stats.files != 4) {
+            printf("testRotation failed: recorded %ld, written %ld, dropped %ld, files %ld\n", stats.recorded,
+                   stats.written, stats.dropped, stats.files);
+            status = 1;
+        }
+    }
+
+    // 4 files were written and the oldest removed: the records from the 2nd file on must be there in order
+    auto files = recordFiles(dir);
+    long expected = perFile, read = 0;
+    RecordReader reader;
+    for (auto &f : files) {
+        if (!reader.open(f.c_str())) {
+            status = 1;
+            continue;
+        }
+        for (const PkTickRecord &r : reader) {
+            long n = static_cast<long>(r.mountRoll);
+            if (n < expected || r.mountPitch != -r.mountRoll || r.targetId != static_cast<uint64_t>(n / 100)) {
+                printf("testRotation failed: record %ld in %s after %ld\n", n, f.c_str(), expected);
+                status = 1;
+                break;
+            }
+            expected = n + 1;
+            read++;
+        }
+    }
+    printf("testRotation: %zu files, %ld records read\n", files.size(), read);
+    if (files.size() != 3 || expected != numRecords) {
+        printf("testRotation failed: expected 3 files ending with record %ld\n", numRecords - 1);
+        status = 1;
+    }
+    removeDir(dir);
+    return status;
+}
+
+// The reader must refuse a file that is not a record file
+static int testNotARecordFile() {
+    std::string dir = makeDir();
+    std::string path = dir + "/bad.pkrec";
+    FILE *f = fopen(path.c_str(), "w");
+    for (int i = 0; i < 100; i++) fputs("not a record file\n", f);
+    fclose(f);
+    RecordReader reader;
+    bool opened = reader.open(path.c_str());
+    removeDir(dir);
+    if (opened) {
+        printf("testNotARecordFile failed: opened a text file\n");
+        return 1;
+    }
+    return 0;
+}
+
+// TpkC records every tick of the fast loop, with the target command it is tracking
+static int testTpkC() {
+    int status = 0;
+    std::string dir = makeDir();
+    setenv("TPK_RECORD_DIR", dir.c_str(), 1);
+    TpkC tpkc;
+    tpkc.init();
+    unsetenv("TPK_RECORD_DIR");
+    tpkc.newICRSTarget(185.0, 11.0);
+    sleep(1);
+    tpkc.shutdown();
+
+    auto files = recordFiles(dir);
+    RecordReader reader;
+    size_t numTicks = 0, numWithTarget = 0;
+    double lastTai = 0.0;
+    if (files.size() != 1 || !reader.open(files[0].c_str())) {
+        printf("testTpkC failed: %zu record files\n", files.size());
+        status = 1;
+    } else {
+        numTicks = reader.size();
+        for (const PkTickRecord &r : reader) {
+            if (r.targetId) numWithTarget++;
+            if (r.tai < lastTai || r.dec < -90.0 || r.dec > 90.0) {
+                printf("testTpkC failed: bad record tai=%f, dec=%g\n", r.tai, r.dec);
+                status = 1;
+                break;
+            }
+            lastTai = r.tai;
+        }
+        reader.close();
+    }
+    printf("testTpkC: %zu ticks recorded, %zu with the target\n", numTicks, numWithTarget);
+    if (numTicks < 50 || numWithTarget < 50) {
+        printf("testTpkC failed: too few ticks recorded\n");
+        status = 1;
+    }
+    removeDir(dir);
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    int status = 0;
+    status |= testRotation();
+    status |= testNotARecordFile();
+    status |= testTpkC();
+    return status;
+}
@@ -0,0 +1,98 @@
+//
+// Tests the lock-free history of the latest demands
+//
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <SampleHistory.h>
+
+typedef struct {
+    long n;
+    double check[4];
+} Entry;
+
+static Entry makeEntry(long n) {
+    Entry e;
+    e.n = n;
+    for (double &c : e.check) c = -static_cast<double>(n);
+    return e;
+}
+
+// Checks the values returned before and after the history is full
+static int testLatest() {
+    int status = 0;
+    SampleHistory<Entry> history(4);
+    Entry out[8];
+    if (history.latest(out, 8) != 0) {
+        printf("testLatest failed: an empty history returned values\n");
+        status = 1;
+    }
+    for (long n = 0; n < 3; n++) history.add(makeEntry(n));
+    size_t k = history.latest(out, 8);
+    if (k != 3 || out[0].n != 0 || out[2].n != 2) {
+        printf("testLatest failed: got %zu values before it was full\n", k);
+        status = 1;
+    }
+    for (long n = 3; n < 10; n++) history.add(makeEntry(n));
+    k = history.latest(out, 8);
+    if (k != 4 || out[0].n != 6 || out[3].n != 9) {
+        printf("testLatest failed: got %zu values from %ld once full\n", k, k ? out[0].n : -1);
+        status = 1;
+    }
+    k = history.latest(out, 2);
+    if (k != 2 || out[0].n != 8 || out[1].n != 9) {
+        printf("testLatest failed: did not get the latest 2 values\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A writer races a reader: the reader must always get intact values, in order, ending close to the
+// latest one written
+static int testConcurrent() {
+    const long numEntries = 2000000;
+    SampleHistory<Entry> history(16);
+    std::atomic<bool> done(false);
+    int status = 0;
+
+    std::thread writer([&]() {
+        for (long n = 0; n < numEntries; n++) history.add(makeEntry(n));
+        done = true;
+    });
+
+    long reads = 0, partial = 0;
+    std::vector<Entry> out(16);
+    while (!done) {
+        size_t k = history.latest(out.data(), out.size());
+        for (size_t i = 0; i < k; i++) {
+            const Entry &e = out[i];
+            bool intact = true;
+            for (double c : e.check) intact = intact && c == -static_cast<double>(e.n);
+            if (!intact || (i > 0 && e.n != out[i - 1].n + 1)) {
+                printf("testConcurrent failed: value %zu (%ld) torn or out of order\n", i, e.n);
+                status = 1;
+                break;
+            }
+        }
+        if (k < out.size() && history.added() > out.size()) partial++;
+        reads++;
+    }
+    writer.join();
+
+    size_t k = history.latest(out.data(), out.size());
+    if (k != 16 || out[15].n != numEntries - 1) {
+        printf("testConcurrent failed: wrong values at the end\n");
+        status = 1;
+    }
+    printf("testConcurrent: %ld reads, %ld of them dropped overwritten values\n", reads, partial);
+    return status;
+}
+
+int main() {
+    int status = 0;
+    status |= testLatest();
+    status |= testConcurrent();
+    return status;
+}
@@ -0,0 +1,125 @@
+//
+// Tests of the scan task scheduler, run in real time
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <TpkC.h>
+
+// A scan task that does nothing, every 10 ticks
+class IdleScan : public ScanTask {
+public:
+    explicit IdleScan(ScanScheduler &scheduler) : ScanTask(scheduler, "IdleScan", 10, 1) {}
+
+    void scan() override {}
+};
+
+// A scan task every 10 ticks that takes 25 ms, so it is still running when it is next due
+class StallScan : public ScanTask {
+public:
+    explicit StallScan(ScanScheduler &scheduler) : ScanTask(scheduler, "StallScan", 10, 1) {}
+
+    void scan() override { usleep(25000); }
+};
+
+static long runs(const ScanTask &task) {
+    ScanStats s{};
+    task.stats(&s);
+    return s.runs;
+}
+
+// Two schedulers, each with its own task, run at the same time: each task must only be woken by its own
+// scheduler, and stopping one scheduler must not stop the other
+static int testTwoSchedulers() {
+    int status = 0;
+    ScanScheduler a, b;
+    IdleScan taskA(a), taskB(b);
+    a.start();
+    b.start();
+    usleep(300000);
+    a.stop();
+    long runsA = runs(taskA), runsB = runs(taskB);
+    usleep(300000);
+    b.stop();
+    long moreA = runs(taskA) - runsA, moreB = runs(taskB) - runsB;
+    taskA.stop();
+    taskB.stop();
+
+    printf("testTwoSchedulers: %ld and %ld runs in 0.3 s, then %ld and %ld with the first stopped\n", runsA, runsB,
+           moreA, moreB);
+    if (runsA < 20 || runsA > 32 || runsB < 20 || runsB > 32) {
+        printf("testTwoSchedulers failed: expected about 30 runs of each task\n");
+        status = 1;
+    }
+    if (moreA != 0 || moreB < 20 || moreB > 32) {
+        printf("testTwoSchedulers failed: stopping one scheduler changed the other\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A scan that stalls past its period must count the releases it misses, without holding up another
+// task of the same scheduler
+static int testMissedTicks() {
+    int status = 0;
+    ScanScheduler scheduler;
+    StallScan stalled(scheduler);
+    IdleScan idle(scheduler);
+    scheduler.start();
+    usleep(300000);
+    scheduler.stop();
+    long stalledRuns = runs(stalled), missed = stalled.missedTicks();
+    long idleRuns = runs(idle), idleMissed = idle.missedTicks();
+    stalled.stop();
+    idle.stop();
+
+    printf("testMissedTicks: stalled scan ran %ld times and missed %ld in 0.3 s, idle scan ran %ld times and "
+           "missed %ld\n", stalledRuns, missed, idleRuns, idleMissed);
+    if (missed < 10 || stalledRuns + missed < 20 || stalledRuns + missed > 32) {
+        printf("testMissedTicks failed: expected about 20 of the 30 releases of the stalled scan to be missed\n");
+        status = 1;
+    }
+    if (idleRuns < 20 || idleMissed > 2) {
+        printf("testMissedTicks failed: the stalled scan held up the other task\n");
+        status = 1;
+    }
+    return status;
+}
+
+// Two kernels run at the same time: each must run its own loops at their own rates
+static int testTwoKernels() {
+    int status = 0;
+    TpkC a, b;
+    a.init();
+    b.init();
+    ScanStats before[2][3], after[2][3];
+    a.loopStats(before[0], 3);
+    b.loopStats(before[1], 3);
+    usleep(300000);
+    a.loopStats(after[0], 3);
+    b.loopStats(after[1], 3);
+    a.shutdown();
+    b.shutdown();
+
+    for (int k = 0; k < 2; k++) {
+        long fast = after[k][2].runs - before[k][2].runs;
+        long medium = after[k][1].runs;
+        long slow = after[k][0].runs;
+        printf("testTwoKernels: kernel %d: FastScan ran %ld times in 0.3 s, MediumScan %ld, SlowScan %ld\n", k,
+               fast, medium, slow);
+        if (fast < 20 || fast > 32 || medium < 1 || medium > 2 || slow != 1) {
+            printf("testTwoKernels failed: expected about 30 runs of FastScan and 1 of the others\n");
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    int status = testTwoSchedulers();
+    status |= testMissedTicks();
+    status |= testTwoKernels();
+    return status;
+}
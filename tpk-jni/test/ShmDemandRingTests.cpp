@@ -0,0 +1,190 @@
+//
+// Tests the shared memory demand ring and its C reader API
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <Monotonic.h>
+#include <ShmDemandRing.h>
+#include <TpkC.h>
+
+static std::string ringName(const char *test) {
+    return std::string("tpk-test-") + test + "-" + std::to_string(getpid());
+}
+
+static PkShmDemand makeDemand(uint64_t n) {
+    PkShmDemand d{};
+    d.mcsAz = static_cast<double>(n);
+    d.mcsEl = -static_cast<double>(n);
+    d.m3Tilt = static_cast<double>(n) * 2.0;
+    d.monotonicNs = monotonicNs();
+    return d;
+}
+
+static bool intact(const PkShmDemand &d) {
+    return d.mcsAz == static_cast<double>(d.seq) && d.mcsEl == -d.mcsAz && d.m3Tilt == 2.0 * d.mcsAz;
+}
+
+// Follows a ring from the start to its close, and checks what a reader that falls behind gets
+static int testFollow() {
+    int status = 0;
+    std::string name = ringName("follow");
+    ShmDemandWriter *writer = ShmDemandWriter::create(name.c_str(), 16);
+    PkShmReader *reader = pkshm_open(name.c_str());
+    if (!writer || !reader) {
+        printf("testFollow failed: could not create and open %s\n", name.c_str());
+        return 1;
+    }
+
+    PkShmDemand d{};
+    for (uint64_t n = 0; n < 10; n++) writer->write(makeDemand(n));
+    for (uint64_t n = 0; n < 10; n++) {
+        if (pkshm_next(reader, &d) != 1 || d.seq != n || !intact(d)) {
+            printf("testFollow failed: demand %lu not read\n", static_cast<unsigned long>(n));
+            status = 1;
+        }
+    }
+    if (pkshm_next(reader, &d) != 0) {
+        printf("testFollow failed: read a demand that was not written\n");
+        status = 1;
+    }
+
+    // Fall behind by more than the ring size
+    for (uint64_t n = 10; n < 50; n++) writer->write(makeDemand(n));
+    if (pkshm_next(reader, &d) != 1 || d.seq != 34 || pkshm_lost(reader) != 24) {
+        printf("testFollow failed: got %lu after falling behind, %lu lost\n", static_cast<unsigned long>(d.seq),
+               static_cast<unsigned long>(pkshm_lost(reader)));
+        status = 1;
+    }
+    while (pkshm_next(reader, &d) == 1) {}
+
+    delete writer;
+    if (pkshm_next(reader, &d) != -1) {
+        printf("testFollow failed: closed ring not reported\n");
+        status = 1;
+    }
+    pkshm_close(reader);
+    if (pkshm_open(name.c_str())) {
+        printf("testFollow failed: opened a removed ring\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A writer at full speed races a polling reader: every demand read must be intact and in order.
+// Then the writer writes at 10kHz and the reader reports the latency from write to read.
+static int testConcurrent() {
+    const uint64_t numDemands = 2000000;
+    const int numTimed = 20000;
+    int status = 0;
+    std::string name = ringName("concurrent");
+    ShmDemandWriter *writer = ShmDemandWriter::create(name.c_str(), 1024);
+    PkShmReader *reader = pkshm_open(name.c_str());
+    if (!writer || !reader) {
+        printf("testConcurrent failed: could not create and open %s\n", name.c_str());
+        return 1;
+    }
+
+    std::atomic<bool> timed(false);
+    std::thread writerThread([&]() {
+        for (uint64_t n = 0; n < numDemands; n++) writer->write(makeDemand(n));
+        timed = true;
+        for (uint64_t n = numDemands; n < numDemands + numTimed; n++) {
+            writer->write(makeDemand(n));
+            usleep(100);
+        }
+        delete writer;
+    });
+
+    PkShmDemand d{};
+    uint64_t last = 0, read = 0;
+    std::vector<long long> latencies;
+    latencies.reserve(numTimed);
+    for (;;) {
+        int r = pkshm_next(reader, &d);
+        if (r < 0) break;
+        if (r == 0) continue;
+        if (!intact(d) || (read > 0 && d.seq <= last)) {
+            printf("testConcurrent failed: demand %lu torn or out of order\n", static_cast<unsigned long>(d.seq));
+            status = 1;
+            break;
+        }
+        if (d.seq >= numDemands) latencies.push_back(monotonicNs() - d.monotonicNs);
+        last = d.seq;
+        read++;
+    }
+    writerThread.join();
+    pkshm_close(reader);
+
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    printf("testConcurrent: read %lu, lost %lu, latency median %lld ns, 99%% %lld ns, max %lld ns\n",
+           static_cast<unsigned long>(read), static_cast<unsigned long>(numDemands + numTimed - read),
+           n ? latencies[n / 2] : 0, n ? latencies[n * 99 / 100] : 0, n ? latencies[n - 1] : 0);
+    if (n == 0 || last != numDemands + numTimed - 1) {
+        printf("testConcurrent failed: did not read to the end\n");
+        status = 1;
+    }
+    return status;
+}
+
+// The fast loop writes its demands to the ring named by TPK_SHM_DEMANDS once there is a target
+static int testTpkC() {
+    int status = 0;
+    std::string name = ringName("tpkc");
+    setenv("TPK_SHM_DEMANDS", name.c_str(), 1);
+    TpkC tpkc;
+    tpkc.init();
+    unsetenv("TPK_SHM_DEMANDS");
+    PkShmReader *reader = pkshm_open(name.c_str());
+    if (!reader) {
+        printf("testTpkC failed: could not open %s\n", name.c_str());
+        tpkc.shutdown();
+        return 1;
+    }
+    tpkc.newICRSTarget(185.0, 11.0);
+
+    PkShmDemand d{};
+    int numDemands = 0, numEcs = 0;
+    long long end = monotonicNs() + 1000000000LL;
+    while (monotonicNs() < end) {
+        int r = pkshm_next(reader, &d);
+        if (r == 1) {
+            numDemands++;
+            if (d.ecs) numEcs++;
+            if (d.timeNs <= 0 || d.dec < -90.0 || d.dec > 90.0) {
+                printf("testTpkC failed: bad demand time=%lld, dec=%g\n", static_cast<long long>(d.timeNs), d.dec);
+                status = 1;
+                break;
+            }
+        } else {
+            usleep(100);
+        }
+    }
+    tpkc.shutdown();
+    int r = pkshm_next(reader, &d);
+    while (r == 1) r = pkshm_next(reader, &d);
+    pkshm_close(reader);
+
+    printf("testTpkC: %d demands (%d with base and cap) in 1 s\n", numDemands, numEcs);
+    if (numDemands < 50 || r != -1) {
+        printf("testTpkC failed: too few demands or ring not closed\n");
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    int status = 0;
+    status |= testFollow();
+    status |= testConcurrent();
+    status |= testTpkC();
+    return status;
+}
@@ -0,0 +1,132 @@
+//
+// Tests the slew profiles
+//
+
+#include <cmath>
+#include <cstdio>
+#include <Slew.h>
+
+static const SlewLimits limits = {2.5, 1.0, 2.0};
+
+// Follows a profile at 1ms and checks that it is continuous, within the limits and ends at rest at 0
+static int checkProfile(const char *name, double p0, double v0, double a0) {
+    SlewProfile profile;
+    profile.plan(p0, v0, a0, limits);
+    const double dt = 1e-3, eps = 1e-6;
+    double p, v, a, lastA = a0;
+    profile.evaluate(0.0, p, v, a);
+    if (fabs(p - p0) > eps || fabs(v - v0) > eps || fabs(a - a0) > eps) {
+        printf("checkProfile %s failed: starts at %g %g %g\n", name, p, v, a);
+        return 1;
+    }
+    long steps = static_cast<long>(profile.duration() / dt) + 2;
+    for (long i = 1; i <= steps; i++) {
+        profile.evaluate(i * dt, p, v, a);
+        double jerk = (a - lastA) / dt;
+        lastA = a;
+        if (fabs(v) > limits.velocity + eps || fabs(a) > limits.acceleration + eps || fabs(jerk) > limits.jerk + 1e-3) {
+            printf("checkProfile %s failed: at %g s v %g a %g jerk %g\n", name, i * dt, v, a, jerk);
+            return 1;
+        }
+    }
+    if (p != 0.0 || v != 0.0 || a != 0.0) {
+        printf("checkProfile %s failed: not at rest after %g s\n", name, profile.duration());
+        return 1;
+    }
+
+    // The end must be continuous too
+    profile.evaluate(profile.duration() * (1 - 1e-12), p, v, a);
+    if (fabs(p) > eps || fabs(v) > eps || fabs(a) > eps) {
+        printf("checkProfile %s failed: %g %g %g at the end\n", name, p, v, a);
+        return 1;
+    }
+    return 0;
+}
+
+// Long moves reach the velocity limit, medium ones the acceleration limit and short ones neither
+static int testProfiles() {
+    int status = 0;
+    status |= checkProfile("long", 60.0, 0.0, 0.0);
+    status |= checkProfile("long negative", -170.0, 0.0, 0.0);
+    status |= checkProfile("medium", 1.5, 0.0, 0.0);
+    status |= checkProfile("short", 0.01, 0.0, 0.0);
+    status |= checkProfile("tiny", 1e-6, 0.0, 0.0);
+    status |= checkProfile("none", 0.0, 0.0, 0.0);
+    status |= checkProfile("moving away", 5.0, 2.0, 0.5);
+    status |= checkProfile("overshooting", 0.1, -1.5, -0.9);
+
+    // A long slew takes the time of the S-curve: 60 deg at 2.5 deg/s, with 3 s to speed up and slow down
+    SlewProfile profile;
+    profile.plan(60.0, 0.0, 0.0, limits);
+    double expected = 60.0 / 2.5 + 2.5 / 1.0 + 1.0 / 2.0;
+    if (fabs(profile.duration() - expected) > 1e-9) {
+        printf("testProfiles failed: a 60 deg slew takes %g s (expected %g)\n", profile.duration(), expected);
+        status = 1;
+    }
+    return status;
+}
+
+// A new slew during a slew continues smoothly from it
+static int testReplan() {
+    SlewLimits all[Slew::NUM_AXES];
+    for (SlewLimits &l : all) l = limits;
+    Slew slew(all);
+    const double tai0 = 59580.5, day = 86400.0;
+    double offsets[Slew::NUM_AXES] = {30.0, -10.0, NAN, 5.0, 0.0, 1.0};
+    slew.plan(tai0, offsets);
+    if (slew.offset(Slew::MOUNT_AZ, tai0) != 30.0 || slew.offset(Slew::ENCLOSURE_BASE, tai0) != 0.0) {
+        printf("testReplan failed: the slew does not start from the offsets\n");
+        return 1;
+    }
+
+    // Half way through the new demands are 20 deg further on, which adds to the offset
+    double tai1 = tai0 + 5.0 / day;
+    double before = slew.offset(Slew::MOUNT_AZ, tai1 - 0.01 / day);
+    double at = slew.offset(Slew::MOUNT_AZ, tai1);
+    for (double &o : offsets) o = NAN;
+    offsets[Slew::MOUNT_AZ] = at + 20.0;
+    slew.plan(tai1, offsets);
+    double after = slew.offset(Slew::MOUNT_AZ, tai1 + 0.01 / day);
+    double v1 = (at - before) / 0.01, v2 = (after - (at + 20.0)) / 0.01;
+    if (fabs(v1 - v2) > 0.02) {
+        printf("testReplan failed: the velocity changed from %g to %g\n", v1, v2);
+        return 1;
+    }
+    if (slew.offset(Slew::MOUNT_AZ, slew.endTai() + 0.001 / day) != 0.0 || slew.slews() != 2) {
+        printf("testReplan failed: the slew did not end\n");
+        return 1;
+    }
+    return 0;
+}
+
+// A slew across azimuth 0/360 goes the short way round, not back across the whole circle
+static int testWrap() {
+    SlewLimits all[Slew::NUM_AXES];
+    for (SlewLimits &l : all) l = limits;
+    Slew slew(all), shortSlew(all);
+    const double tai0 = 59580.5;
+    // From 350 to 10 deg and from 5 to 355 deg, and a 20 deg slew on an axis that is not an angle
+    double offsets[Slew::NUM_AXES] = {340.0, 20.0, -350.0, NAN, NAN, NAN};
+    slew.plan(tai0, offsets);
+    double az = slew.offset(Slew::MOUNT_AZ, tai0), base = slew.offset(Slew::ENCLOSURE_BASE, tai0);
+    if (az != -20.0 || base != 10.0 || slew.offset(Slew::MOUNT_EL, tai0) != 20.0) {
+        printf("testWrap failed: the slew starts from offsets %g, %g (az, base), expected -20, 10\n", az, base);
+        return 1;
+    }
+    double shortOffsets[Slew::NUM_AXES] = {-20.0, 20.0, 10.0, NAN, NAN, NAN};
+    shortSlew.plan(tai0, shortOffsets);
+    if (slew.endTai() != shortSlew.endTai()) {
+        printf("testWrap failed: the slew takes %g s, expected %g s\n", (slew.endTai() - tai0) * 86400.0,
+               (shortSlew.endTai() - tai0) * 86400.0);
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    int status = 0;
+    status |= testProfiles();
+    status |= testReplan();
+    status |= testWrap();
+    return status;
+}
@@ -0,0 +1,94 @@
+//
+// Tests the lock-free ring buffer used to queue demands for the publisher thread
+//
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <SpscRing.h>
+
+typedef struct {
+    long n;
+    double check[4];
+} Entry;
+
+static Entry makeEntry(long n) {
+    Entry e;
+    e.n = n;
+    for (double &c : e.check) c = -static_cast<double>(n);
+    return e;
+}
+
+// Checks the behaviour of a full ring with and without dropOldest
+static int testFull() {
+    int status = 0;
+    SpscRing<Entry> ring(4);
+    for (long n = 0; n < 4; n++) ring.push(makeEntry(n), false);
+    if (ring.push(makeEntry(4), false)) {
+        printf("testFull failed: push to a full ring succeeded\n");
+        status = 1;
+    }
+    if (ring.push(makeEntry(5), true) || ring.size() != 4) {
+        printf("testFull failed: push with dropOldest did not report the drop or changed the size\n");
+        status = 1;
+    }
+    long expected[] = {1, 2, 3, 5};
+    for (long n : expected) {
+        Entry e{};
+        if (!ring.pop(e) || e.n != n) {
+            printf("testFull failed: popped %ld (expected %ld)\n", e.n, n);
+            status = 1;
+        }
+    }
+    Entry e = makeEntry(99);
+    if (ring.pop(e) || e.n != 99) {
+        printf("testFull failed: pop from an empty ring succeeded or changed the value\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A producer dropping the oldest entries races a consumer: the consumer must see every entry it gets
+// intact and in order
+static int testConcurrentDropOldest() {
+    const long numEntries = 2000000;
+    SpscRing<Entry> ring(8);
+    std::atomic<bool> done(false);
+    long dropped = 0;
+
+    std::thread producer([&]() {
+        for (long n = 0; n < numEntries; n++) {
+            if (!ring.push(makeEntry(n), true)) dropped++;
+        }
+        done = true;
+    });
+
+    int status = 0;
+    long last = -1, received = 0;
+    Entry e{};
+    while (!done || ring.size() > 0) {
+        if (!ring.pop(e)) continue;
+        received++;
+        if (e.n <= last || e.check[0] != -static_cast<double>(e.n) || e.check[3] != -static_cast<double>(e.n)) {
+            printf("testConcurrentDropOldest failed: got entry %ld after %ld\n", e.n, last);
+            status = 1;
+            break;
+        }
+        last = e.n;
+    }
+    producer.join();
+    printf("testConcurrentDropOldest: received %ld, dropped %ld of %ld\n", received, dropped, numEntries);
+    if (status == 0 && received + dropped != numEntries) {
+        printf("testConcurrentDropOldest failed: %ld entries received or dropped, %ld pushed\n", received + dropped,
+               numEntries);
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = 0;
+    status |= testFull();
+    status |= testConcurrentDropOldest();
+    return status;
+}
@@ -0,0 +1,132 @@
+//
+// Tests the demand trajectory predicted ahead of the fast loop
+//
+
+#include <cmath>
+#include <cstdio>
+#include <Trajectory.h>
+
+static const double startTai = 59580.5;
+static const double arcsecPerRad = 180.0 * 3600.0 / M_PI;
+
+// A smooth trajectory (in seconds from startTai) with a roll that crosses +-pi and an RA that crosses
+// 0, as given by the virtual telescopes
+static void smooth(double tai, TrajectoryPoint &p) {
+    double t = (tai - startTai) * 86400.0;
+    p.mountRoll = remainder(3.1 + 0.01 * t + 1e-5 * t * t, 2 * M_PI);
+    p.mountPitch = 1.0 + 0.2 * sin(7.3e-3 * t);
+    p.enclosureRoll = remainder(p.mountRoll + 1e-3, 2 * M_PI);
+    p.enclosurePitch = p.mountPitch;
+    p.m3Azimuth = remainder(-2.0 + 0.05 * t, 2 * M_PI);
+    p.m3Elevation = 0.5 * cos(1e-2 * t);
+    p.ra = fmod(2 * M_PI - 0.01 + 7.3e-5 * t + 2 * M_PI, 2 * M_PI);
+    p.dec = 0.3 - 1e-6 * t;
+}
+
+static double maxDiffArcsec(const TrajectoryPoint &a, const TrajectoryPoint &b) {
+    const double *x = &a.mountRoll, *y = &b.mountRoll;
+    double maxDiff = 0.0;
+    for (int c = 0; c < 8; c++) {
+        double d = fabs(remainder(x[c] - y[c], 2 * M_PI)) * arcsecPerRad;
+        if (d > maxDiff) maxDiff = d;
+    }
+    return maxDiff;
+}
+
+// Follows a trajectory at 100Hz as the fast loop would, extending it 10 times a second
+static int testFollow(Trajectory::Fit fit, const char *name) {
+    int status = 0;
+    Trajectory trajectory(fit, 1.0, 5.0, 0.01);
+    TrajectoryKey key = {1, 0, 0, 0};
+    long missed = 0;
+    double maxDiff = 0.0;
+    for (int tick = 0; tick < 3000; tick++) {
+        double tai = startTai + tick * 0.01 / 86400.0;
+        if (tick % 10 == 0) trajectory.extend(tai, key, smooth);
+        TrajectoryPoint p, expected;
+        if (!trajectory.lookup(tai, key, p)) {
+            missed++;
+            continue;
+        }
+        smooth(tai, expected);
+        double d = maxDiffArcsec(p, expected);
+        if (d > maxDiff) maxDiff = d;
+
+        // The ranges of the angles are kept
+        if (p.mountRoll < -M_PI || p.mountRoll >= M_PI || p.ra < 0 || p.ra >= 2 * M_PI) {
+            printf("testFollow %s failed: roll %g or RA %g out of range\n", name, p.mountRoll, p.ra);
+            return 1;
+        }
+    }
+
+    TrajectoryStats stats;
+    trajectory.stats(&stats);
+    printf("testFollow %s: %ld segments, max error %g arcsec (fit %g), %ld ticks computed\n", name, stats.segments,
+           maxDiff, stats.maxErrorArcsec, stats.computed);
+    if (missed || stats.rejected || maxDiff > 0.01) {
+        printf("testFollow %s failed: %ld ticks not predicted, %ld segments rejected\n", name, missed, stats.rejected);
+        status = 1;
+    }
+    if (stats.predicted != 3000) {
+        printf("testFollow %s failed: %ld ticks predicted\n", name, stats.predicted);
+        status = 1;
+    }
+    return status;
+}
+
+// The trajectory is not used for other commands until it has been predicted for them
+static int testNewCommands() {
+    int status = 0;
+    Trajectory trajectory(Trajectory::CHEBYSHEV, 1.0, 5.0, 0.01);
+    TrajectoryKey target = {1, 0, 0, 0}, offset = {1, 2, 0, 0};
+    double tai = startTai + 0.5 / 86400.0;
+    TrajectoryPoint p;
+    trajectory.extend(tai, target, smooth);
+    if (!trajectory.lookup(tai, target, p)) {
+        printf("testNewCommands failed: no prediction for the target\n");
+        status = 1;
+    }
+    if (trajectory.lookup(tai, offset, p)) {
+        printf("testNewCommands failed: used the prediction for the target after an offset\n");
+        status = 1;
+    }
+    trajectory.extend(tai, offset, smooth);
+    if (!trajectory.lookup(tai, offset, p) || trajectory.lookup(tai, target, p)) {
+        printf("testNewCommands failed: the prediction was not replaced\n");
+        status = 1;
+    }
+    return status;
+}
+
+// A step in the middle of a segment does not fit: that segment is computed in full
+static void step(double tai, TrajectoryPoint &p) {
+    smooth(tai, p);
+    if ((tai - startTai) * 86400.0 > 1.5) p.mountPitch += 1e-4;
+}
+
+static int testRejected() {
+    int status = 0;
+    Trajectory trajectory(Trajectory::SAMPLES, 1.0, 2.0, 0.01);
+    TrajectoryKey key = {1, 0, 0, 0};
+    TrajectoryPoint p;
+    trajectory.extend(startTai, key, step);
+    bool first = trajectory.lookup(startTai + 0.5 / 86400.0, key, p);
+    bool second = trajectory.lookup(startTai + 1.5 / 86400.0, key, p);
+    bool third = trajectory.lookup(startTai + 2.5 / 86400.0, key, p);
+    TrajectoryStats stats;
+    trajectory.stats(&stats);
+    if (!first || second || !third || stats.rejected != 1) {
+        printf("testRejected failed: segments used %d %d %d, %ld rejected\n", first, second, third, stats.rejected);
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = 0;
+    status |= testFollow(Trajectory::SAMPLES, "samples");
+    status |= testFollow(Trajectory::CHEBYSHEV, "chebyshev");
+    status |= testNewCommands();
+    status |= testRejected();
+    return status;
+}
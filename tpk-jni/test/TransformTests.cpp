@@ -0,0 +1,52 @@
+//
+// Checks that the batch coordinate conversions give the same results as the single point ones
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <TpkC.h>
+
+static int testBatchMatchesSingle(TpkC &tpkc) {
+    const int n = 10000;
+    int status = 0;
+    std::vector<double> ra(n), dec(n), az(n), el(n), ra2(n), dec2(n);
+    unsigned int seed = 1;
+    for (int i = 0; i < n; i++) {
+        ra[i] = rand_r(&seed) * 360.0 / RAND_MAX;
+        dec[i] = rand_r(&seed) * 180.0 / RAND_MAX - 90.0;
+    }
+
+    // Several threads, whatever the number of CPUs
+    setenv("TPK_BATCH_THREADS", "4", 1);
+    tpkc.raDecToAzEl(ra.data(), dec.data(), az.data(), el.data(), n);
+    tpkc.azElToRaDec(az.data(), el.data(), ra2.data(), dec2.data(), n);
+
+    // The time is the same for both (the fake clock is not moving fast enough to matter at 1e-9 deg)
+    int mismatches = 0;
+    for (int i = 0; i < n; i++) {
+        CoordPair azEl, raDec;
+        tpkc.raDecToAzEl(ra[i], dec[i], &azEl);
+        tpkc.azElToRaDec(az[i], el[i], &raDec);
+        if (fabs(azEl.a - az[i]) > 1e-6 || fabs(azEl.b - el[i]) > 1e-6 ||
+            fabs(raDec.a - ra2[i]) > 1e-6 || fabs(raDec.b - dec2[i]) > 1e-6) {
+            if (mismatches++ < 5) {
+                printf("testBatchMatchesSingle failed: point %d: batch %g,%g -> %g,%g, single %g,%g -> %g,%g\n",
+                       i, az[i], el[i], ra2[i], dec2[i], azEl.a, azEl.b, raDec.a, raDec.b);
+            }
+            status = 1;
+        }
+    }
+    printf("testBatchMatchesSingle: %d points, %d mismatches\n", n, mismatches);
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    TpkC tpkc;
+    tpkc.init();
+    int status = testBatchMatchesSingle(tpkc);
+    tpkc.shutdown();
+    return status;
+}
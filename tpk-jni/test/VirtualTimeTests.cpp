@@ -0,0 +1,227 @@
+//
+// Tests running the scan loops in virtual time (TPK_VIRTUAL_TIME)
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <TpkC.h>
+
+static const double runSeconds = 600.0;
+
+// The results of a run
+struct Run {
+    std::vector<PkDemand> demands;
+    ScanStats loops[3];
+    TrajectoryStats prediction;
+    double wallSeconds;
+};
+
+// Tracks a target for runSeconds of virtual time, with an offset half way through
+static Run track() {
+    Run run;
+    TpkC tpkc;
+    tpkc.init();
+    tpkc.newICRSTarget(185.0, 11.0);
+    auto t0 = std::chrono::steady_clock::now();
+    tpkc.runFor(runSeconds / 2);
+    tpkc.setICRSOffset(10.0, -5.0);
+    tpkc.runFor(runSeconds / 2);
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+    run.wallSeconds = t.count();
+
+    run.demands.resize(1024);
+    run.demands.resize(static_cast<size_t>(tpkc.demandHistory(run.demands.data(), 1024)));
+    tpkc.loopStats(run.loops, 3);
+    tpkc.trajectoryStats(&run.prediction);
+    tpkc.shutdown();
+    return run;
+}
+
+// Every loop must run exactly as often as in real time, the clock must advance by exactly 10ms per
+// fast loop tick, and two runs must give the same demands
+static int testReproducible() {
+    int status = 0;
+    Run a = track();
+    Run b = track();
+    printf("testReproducible: %g s of virtual time in %.2f s (%.0f times real time)\n", runSeconds, a.wallSeconds,
+           runSeconds / a.wallSeconds);
+
+    // The scheduler runs ticks 0 to 599999: each loop runs on the first tick and then every period
+    long expectedRuns[] = {100, 1200, 60000};
+    for (int i = 0; i < 3; i++) {
+        if (a.loops[i].runs != expectedRuns[i] || a.loops[i].missedTicks != 0) {
+            printf("testReproducible failed: %s ran %ld times (expected %ld), missed %ld\n", a.loops[i].name,
+                   a.loops[i].runs, expectedRuns[i], a.loops[i].missedTicks);
+            status = 1;
+        }
+    }
+
+    if (a.demands.size() != 1024) {
+        printf("testReproducible failed: %zu demands in the history\n", a.demands.size());
+        return 1;
+    }
+    for (size_t i = 1; i < a.demands.size(); i++) {
+        double dt = a.demands[i].time - a.demands[i - 1].time;
+        if (fabs(dt - 0.01) > 1e-5) {
+            printf("testReproducible failed: %g s between demands %zu and %zu\n", dt, i - 1, i);
+            status = 1;
+            break;
+        }
+    }
+
+    if (b.demands.size() != a.demands.size()
+        || memcmp(a.demands.data(), b.demands.data(), a.demands.size() * sizeof(PkDemand)) != 0) {
+        printf("testReproducible failed: the two runs gave different demands\n");
+        status = 1;
+    }
+    return status;
+}
+
+// The demands taken from the predicted trajectory must be those computed by the fast loop, to within
+// the tolerance
+static int testPrediction() {
+    int status = 0;
+    Run computed = track();
+    setenv("TPK_PREDICT", "chebyshev", 1);
+    Run predicted = track();
+    unsetenv("TPK_PREDICT");
+
+    const TrajectoryStats &s = predicted.prediction;
+    printf("testPrediction: %ld ticks predicted, %ld computed, %ld of %ld segments rejected, max error %g arcsec\n",
+           s.predicted, s.computed, s.rejected, s.segments, s.maxErrorArcsec);
+    if (s.predicted < 55000 || s.rejected > 0) {
+        printf("testPrediction failed: the demands were not predicted\n");
+        status = 1;
+    }
+
+    double maxDiff = 0.0;
+    for (size_t i = 0; i < computed.demands.size() && i < predicted.demands.size(); i++) {
+        const PkDemand &a = computed.demands[i], &b = predicted.demands[i];
+        double d[] = {fmod(fabs(a.mcsAz - b.mcsAz), 360.0), fabs(a.mcsEl - b.mcsEl),
+                      fmod(fabs(a.m3Rotation - b.m3Rotation), 360.0), fabs(a.m3Tilt - b.m3Tilt)};
+        for (double x : d) maxDiff = fmax(maxDiff, fmin(x, 360.0 - x) * 3600.0);
+        if (a.time != b.time) maxDiff = INFINITY;
+    }
+    if (predicted.demands.size() != computed.demands.size() || maxDiff > 0.01) {
+        printf("testPrediction failed: the predicted demands differ by up to %g arcsec\n", maxDiff);
+        status = 1;
+    }
+    return status;
+}
+
+// With TPK_SLEW a new target is reached within the velocity and acceleration limits of the mount
+static int testSlew() {
+    int status = 0;
+    setenv("TPK_SLEW", "1", 1);
+    TpkC tpkc;
+    tpkc.init();
+    tpkc.newAzElTarget(30.0, 60.0);
+    tpkc.runFor(5.0);
+    tpkc.newAzElTarget(120.0, 45.0);
+    tpkc.runFor(5.0);
+    double remaining = tpkc.slewTimeRemaining();
+
+    // The last 1024 demands cover the start of the slew
+    std::vector<PkDemand> d(1024);
+    d.resize(static_cast<size_t>(tpkc.demandHistory(d.data(), 1024)));
+    double maxV = 0.0, maxA = 0.0;
+    for (size_t i = 2; i < d.size(); i++) {
+        double dt = d[i].time - d[i - 1].time;
+        double values[][3] = {{d[i - 2].mcsAz, d[i - 1].mcsAz, d[i].mcsAz},
+                              {d[i - 2].mcsEl, d[i - 1].mcsEl, d[i].mcsEl}};
+        for (auto &x : values) {
+            maxV = fmax(maxV, fabs(x[2] - x[1]) / dt);
+            maxA = fmax(maxA, fabs(x[2] - 2 * x[1] + x[0]) / (dt * dt));
+        }
+    }
+    printf("testSlew: %.1f s to go after 5 s, max velocity %g deg/s, max acceleration %g deg/s^2\n", remaining,
+           maxV, maxA);
+    if (remaining <= 0.0 || maxV > 2.5 + 0.01 || maxA > 1.0 + 0.05) {
+        printf("testSlew failed: the slew was not within the limits\n");
+        status = 1;
+    }
+
+    tpkc.runFor(60.0);
+    if (tpkc.slewTimeRemaining() != 0.0) {
+        printf("testSlew failed: the slew did not end\n");
+        status = 1;
+    }
+    tpkc.shutdown();
+    unsetenv("TPK_SLEW");
+    return status;
+}
+
+// The demands of a tick carry the time of that tick, and its UTC and TAI agree
+static int testTickTime() {
+    int status = 0;
+    TpkC tpkc;
+    tpkc.init();
+    tpkc.newICRSTarget(185.0, 11.0);
+    tpkc.runFor(1.0);
+    TickTime t1 = tpkc.lastTickTime();
+    tpkc.runFor(1.0);
+    TickTime t2 = tpkc.lastTickTime();
+    PkDemand d[1];
+    tpkc.demandHistory(d, 1);
+    tpkc.shutdown();
+
+    double utc = static_cast<double>(t2.utc.seconds) + t2.utc.nanos * 1e-9;
+    double taiUtc = (t2.tai - 40587.0) * 86400.0 - 37.0;
+    if (fabs(d[0].time - utc) > 1e-6 || fabs(taiUtc - utc) > 1e-6 || fabs((t2.tai - t1.tai) * 86400.0 - 1.0) > 1e-6) {
+        printf("testTickTime failed: demand time %.6f, tick UTC %.6f, from TAI %.6f, tick step %.6f s\n", d[0].time,
+               utc, taiUtc, (t2.tai - t1.tai) * 86400.0);
+        status = 1;
+    }
+    return status;
+}
+
+// Two kernels in virtual time: each runFor() must step only its own kernel's clock and loops
+static int testTwoKernels() {
+    int status = 0;
+    TpkC a, b;
+    a.init();
+    b.init();
+    a.newICRSTarget(185.0, 11.0);
+    b.newICRSTarget(185.0, 11.0);
+    a.runFor(2.0);
+    b.runFor(0.5);
+    a.runFor(1.0);
+    TickTime ta = a.lastTickTime(), tb = b.lastTickTime();
+    ScanStats sa[3], sb[3];
+    a.loopStats(sa, 3);
+    b.loopStats(sb, 3);
+
+    // Each kernel has run the same ticks as it would have alone
+    TpkC alone;
+    alone.init();
+    alone.newICRSTarget(185.0, 11.0);
+    alone.runFor(3.0);
+    TickTime t = alone.lastTickTime();
+    alone.shutdown();
+    a.shutdown();
+    b.shutdown();
+
+    double behindA = (t.tai - ta.tai) * 86400.0, behindB = (t.tai - tb.tai) * 86400.0;
+    printf("testTwoKernels: fast loop runs %ld and %ld, clocks %.6f s and %.6f s behind a kernel run alone\n",
+           sa[2].runs, sb[2].runs, behindA, behindB);
+    if (sa[2].runs != 300 || sb[2].runs != 50 || fabs(behindA) > 1e-6 || fabs(behindB - 2.5) > 1e-6) {
+        printf("testTwoKernels failed: expected 300 and 50 runs, and the clocks 0 s and 2.5 s behind\n");
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = 0;
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    status |= testReproducible();
+    status |= testPrediction();
+    status |= testSlew();
+    status |= testTickTime();
+    status |= testTwoKernels();
+    return status;
+}
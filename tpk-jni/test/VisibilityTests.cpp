@@ -0,0 +1,130 @@
+//
+// Tests of the visibility calculator, with targets whose elevation is a known function of time
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <TpkC.h>
+#include <Visibility.h>
+
+static const double day = 86400.0;
+
+// An elevation of 30 + 40 sin(2 pi t / day) deg: it rises above 30 at 0, transits at 70 deg at day/4 and
+// sets again at day/2. The enclosure (base/cap) can reach it from 25 deg.
+static void sinusoid(double utc, double &az, double &el) {
+    az = 120.0;
+    el = 30.0 + 40.0 * sin(2.0 * M_PI * utc / day);
+}
+
+// The time (after 0) at which the sinusoid crosses elDeg going up
+static double crossing(double elDeg) {
+    return asin((elDeg - 30.0) / 40.0) * day / (2.0 * M_PI);
+}
+
+static int check(const char *test, const char *what, double value, double expected, double tolerance) {
+    if (std::isnan(expected) ? !std::isnan(value) : !(fabs(value - expected) <= tolerance)) {
+        printf("%s failed: %s is %.3f, expected %.3f\n", test, what, value, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int testRiseSetTransit() {
+    const char *test = "testRiseSetTransit";
+    PkVisibility v;
+    Visibility::calculate(sinusoid, -day / 8, day, 40.0, Visibility::defaultStepSeconds, v);
+    int status = 0;
+    status |= check(test, "rise", v.rise, crossing(40.0), 1.0);
+    status |= check(test, "set", v.set, day / 2 - crossing(40.0), 1.0);
+    status |= check(test, "transit", v.transit, day / 4, 30.0);
+    status |= check(test, "maxEl", v.maxEl, 70.0, 1e-4);
+    status |= check(test, "numIntervals", v.numIntervals, 1, 0);
+    status |= check(test, "interval start", v.intervals[0][0], crossing(40.0), 1.0);
+    status |= check(test, "interval end", v.intervals[0][1], day / 2 - crossing(40.0), 1.0);
+    return status;
+}
+
+// Below the enclosure's limit the target is up but not observable
+static int testEnclosureLimit() {
+    const char *test = "testEnclosureLimit";
+    PkVisibility v;
+    Visibility::calculate(sinusoid, -day / 8, day / 2, 15.0, Visibility::defaultStepSeconds, v);
+    int status = 0;
+    status |= check(test, "rise", v.rise, crossing(15.0), 1.0);
+    status |= check(test, "numIntervals", v.numIntervals, 1, 0);
+    status |= check(test, "interval start", v.intervals[0][0], crossing(25.0), 1.0);
+    // Still up at the end of the window
+    status |= check(test, "set", v.set, NAN, 0);
+    status |= check(test, "interval end", v.intervals[0][1], day / 2, 0);
+    return status;
+}
+
+// Up at the start and more intervals than are stored
+static int testIntervals() {
+    const char *test = "testIntervals";
+    auto fast = [](double utc, double &az, double &el) {
+        az = 0.0;
+        el = 40.0 + 20.0 * cos(2.0 * M_PI * utc / 3600.0);
+    };
+    PkVisibility v;
+    Visibility::calculate(fast, 0.0, 10 * 3600.0, 45.0, Visibility::defaultStepSeconds, v);
+    int status = 0;
+    status |= check(test, "rise", v.rise, 3600.0 - acos(0.25) * 3600.0 / (2.0 * M_PI), 1.0);
+    status |= check(test, "set", v.set, acos(0.25) * 3600.0 / (2.0 * M_PI), 1.0);
+    status |= check(test, "transit", v.transit, 3600.0, 30.0);
+    status |= check(test, "numIntervals", v.numIntervals, 11, 0);
+    status |= check(test, "first interval start", v.intervals[0][0], 0.0, 0);
+    status |= check(test, "last stored interval end", v.intervals[pkVisibleIntervals - 1][1],
+                    (pkVisibleIntervals - 1) * 3600.0 + acos(0.25) * 3600.0 / (2.0 * M_PI), 1.0);
+
+    Visibility::calculate(fast, 0.0, 10 * 3600.0, 70.0, Visibility::defaultStepSeconds, v);
+    status |= check(test, "never up rise", v.rise, NAN, 0);
+    status |= check(test, "never up numIntervals", v.numIntervals, 0, 0);
+    status |= check(test, "never up maxEl", v.maxEl, 60.0, 1e-4);
+    return status;
+}
+
+// The batch call gives each target the same result as calculating it on its own
+static int testBatch(TpkC &tpkc) {
+    const int n = 64;
+    std::vector<double> ra(n), dec(n);
+    for (int i = 0; i < n; i++) {
+        ra[i] = i * 360.0 / n;
+        dec[i] = -60.0 + i * 90.0 / n;
+    }
+    std::vector<PkVisibility> batch(n), single(n);
+    const double start = 1640995200.0, end = start + day;
+
+    setenv("TPK_BATCH_THREADS", "4", 1);
+    tpkc.visibility(ra.data(), dec.data(), n, start, end, 30.0, batch.data());
+    setenv("TPK_BATCH_THREADS", "1", 1);
+    for (int i = 0; i < n; i++) tpkc.visibility(&ra[i], &dec[i], 1, start, end, 30.0, &single[i]);
+
+    int status = 0;
+    for (int i = 0; i < n; i++) {
+        const PkVisibility &a = batch[i], &b = single[i];
+        bool same = a.numIntervals == b.numIntervals && (a.rise == b.rise || (std::isnan(a.rise) && std::isnan(b.rise)))
+                    && (a.set == b.set || (std::isnan(a.set) && std::isnan(b.set))) && a.maxEl == b.maxEl;
+        if (!same) {
+            printf("testBatch failed: target %d: rise %f/%f, set %f/%f, %d/%d intervals\n", i, a.rise, b.rise,
+                   a.set, b.set, a.numIntervals, b.numIntervals);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int main() {
+    setenv("TPK_USE_FAKE_SYSTEM_CLOCK", "1", 1);
+    int status = testRiseSetTransit();
+    status |= testEnclosureLimit();
+    status |= testIntervals();
+
+    TpkC tpkc;
+    tpkc.init();
+    status |= testBatch(tpkc);
+    tpkc.shutdown();
+    return status;
+}
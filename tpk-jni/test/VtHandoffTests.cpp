@@ -0,0 +1,222 @@
+//
+// Tests of the handoff of snapshots between threads, and of the medium loop's updates of the fast loop's
+// virtual telescopes
+//
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <TpkC.h>
+#include <SnapshotHandoff.h>
+
+// One arcsec in radians
+static const double arcsec = tpk::TcsLib::as2r;
+
+// A clock that the test sets
+class SettableClock : public tpk::Clock {
+public:
+    explicit SettableClock(double mjd) : mjd(mjd) {}
+
+    double read() override { return mjd; }
+
+    double mjd;
+};
+
+// Snapshot type that counts the instances alive
+struct Counted {
+    explicit Counted(long v) : version(v) { alive++; }
+
+    Counted(const Counted &other) : version(other.version) { alive++; }
+
+    ~Counted() { alive--; }
+
+    long version;
+    static std::atomic<long> alive;
+};
+
+std::atomic<long> Counted::alive(0);
+
+// Publishes snapshots as fast as possible while a consumer takes them and checks that it only ever
+// moves to newer ones and that every snapshot is eventually freed
+static int testConcurrentHandoff() {
+    const long n = 1000000;
+    int status = 0;
+    long taken = 0;
+    {
+        SnapshotHandoff<Counted> handoff;
+        std::thread producer([&]() {
+            for (long v = 1; v <= n; v++) handoff.publish(new Counted(v));
+        });
+
+        Counted *current = new Counted(0);
+        while (current->version < n) {
+            Counted *next = handoff.take();
+            if (!next) continue;
+            if (next->version <= current->version) {
+                printf("testConcurrentHandoff failed: took version %ld after %ld\n", next->version, current->version);
+                status = 1;
+            }
+            handoff.retire(current);
+            current = next;
+            taken++;
+        }
+        producer.join();
+        delete current;
+        if (handoff.leakedSnapshots() != 0) {
+            printf("testConcurrentHandoff failed: %lu snapshots could not be retired\n", handoff.leakedSnapshots());
+            status = 1;
+        }
+    }
+    if (Counted::alive != 0) {
+        printf("testConcurrentHandoff failed: %ld snapshots were not freed\n", Counted::alive.load());
+        status = 1;
+    }
+    printf("testConcurrentHandoff: took %ld of %ld snapshots\n", taken, n);
+    return status;
+}
+
+// What the medium loop does to its virtual telescopes
+static void updateSpms(VtSet &v) {
+    v.mount.updatePM();
+    v.mount.update();
+    v.enclosure.updatePM();
+    v.enclosure.update();
+}
+
+// The angle between two (roll, pitch) positions in radians
+static double distance(double roll1, double pitch1, double roll2, double pitch2) {
+    double c = sin(pitch1) * sin(pitch2) + cos(pitch1) * cos(pitch2) * cos(roll1 - roll2);
+    return acos(fmin(1.0, c));
+}
+
+// The distance between the mount demands of two sets of virtual telescopes, and the same for the enclosure
+static void demandDifference(VtSet &v1, VtSet &v2, double &mount, double &enclosure) {
+    v1.mount.track(1);
+    v1.enclosure.track(1);
+    v2.mount.track(1);
+    v2.enclosure.track(1);
+    mount = distance(v1.mount.roll(), v1.mount.pitch(), v2.mount.roll(), v2.mount.pitch());
+    enclosure = distance(v1.enclosure.roll(), v1.enclosure.pitch(), v2.enclosure.roll(), v2.enclosure.pitch());
+}
+
+// Regression test: the SPMs computed by the medium loop must change the demands of the fast loop.
+// (MediumScan used to update private copies of the virtual telescopes, so the fast loop always
+// tracked with the SPMs computed at startup.) The medium loop updates the fast loop's own virtual
+// telescopes in place, as TpkC::updateSpms() does.
+static int testMediumUpdatesReachFastLoop() {
+    int status = 0;
+    SettableClock clock(59580.5);
+    tpk::Site site(clock.read(), 0.56, 37.0, 32.184, -155.4775033, 19.82900194, 4160, 0.1611, 0.4475);
+    tpk::TimeKeeper time(clock, site);
+    tpk::AffineTransform transf(0.0, 0.0, 1.0 / 450000.0, 0.0);
+    tpk::PointingModel model;
+
+    // Set up the virtual telescopes as TpkC::init() does
+    VtSet fast(time, site, &transf);
+    fast.mount.newPointingModel(model);
+    fast.enclosure.newPointingModel(model);
+    fast.mount.setPai(0.0, tpk::ICRefSys());
+    fast.enclosure.setPai(0.0, tpk::ICRefSys());
+    tpk::ICRSTarget target(site, "10 12 23 11 09 06");
+    fast.mount.newTarget(target);
+    fast.enclosure.newTarget(target);
+    time.update();
+    updateSpms(fast);
+    fast.mount.track(1);
+    fast.enclosure.track(1);
+
+    VtSet stale(fast);
+    VtSet reference(fast);
+
+    // A month later the SPMs computed at the start are well out of date. The medium loop updates the
+    // fast loop's virtual telescopes between two ticks.
+    clock.mjd += 30.0;
+    site.refresh(time.tai());
+    time.update();
+    updateSpms(fast);
+
+    // The reference is updated in the same way
+    updateSpms(reference);
+
+    double mount, enclosure;
+    demandDifference(fast, reference, mount, enclosure);
+    printf("testMediumUpdatesReachFastLoop: difference from the updated reference: mount %g, enclosure %g arcsec\n",
+           mount / arcsec, enclosure / arcsec);
+    if (mount > 1e-6 * arcsec || enclosure > 1e-6 * arcsec) {
+        printf("testMediumUpdatesReachFastLoop failed: demands differ from the updated reference\n");
+        status = 1;
+    }
+
+    demandDifference(fast, stale, mount, enclosure);
+    printf("testMediumUpdatesReachFastLoop: difference from stale SPMs: mount %g, enclosure %g arcsec\n",
+           mount / arcsec, enclosure / arcsec);
+    if (mount < 0.1 * arcsec || enclosure < 0.1 * arcsec) {
+        printf("testMediumUpdatesReachFastLoop failed: the medium loop update did not change the demands\n");
+        status = 1;
+    }
+    return status;
+}
+
+// The difference between two angles in deg, in arcsec
+static double arcsecBetween(double a, double b) {
+    return remainder(a - b, 360.0) * 3600.0;
+}
+
+// The mount demands of the kernel must be as smooth across the medium loop's updates of the SPMs (every
+// 50th tick) as between them: the fast loop goes on tracking with the same virtual telescopes, and
+// nothing it kept from the previous ticks is lost. (The fast loop used to switch to copies made by the
+// medium loop, which had not tracked since the previous update.)
+static int testNoStepAcrossSpmUpdate() {
+    int status = 0;
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    TpkC tpkc;
+    tpkc.init();
+    tpkc.newICRSTarget(185.0, 11.0);
+    tpkc.runFor(2.0);
+    tpkc.runFor(10.0);
+    std::vector<PkDemand> d(1024);
+    d.resize(static_cast<size_t>(tpkc.demandHistory(d.data(), 1024)));
+    tpkc.shutdown();
+    unsetenv("TPK_VIRTUAL_TIME");
+
+    // The largest change in the velocity of the demands from one tick to the next, on the ticks just
+    // after an update and on the others
+    double maxAtUpdate = 0.0, maxElsewhere = 0.0;
+    int updates = 0;
+    for (size_t i = 2; i < d.size(); i++) {
+        double az = arcsecBetween(d[i].mcsAz, d[i - 1].mcsAz) - arcsecBetween(d[i - 1].mcsAz, d[i - 2].mcsAz);
+        double el = arcsecBetween(d[i].mcsEl, d[i - 1].mcsEl) - arcsecBetween(d[i - 1].mcsEl, d[i - 2].mcsEl);
+        double step = fmax(fabs(az), fabs(el));
+
+        // The medium loop runs on the same scheduler ticks as the fast loop, every 0.5 s
+        long tick = lround(d[i - 1].time * 100.0);
+        if (tick % 50 == 0) {
+            maxAtUpdate = fmax(maxAtUpdate, step);
+            updates++;
+        } else {
+            maxElsewhere = fmax(maxElsewhere, step);
+        }
+    }
+    printf("testNoStepAcrossSpmUpdate: %zu demands, %d SPM updates, largest step %g arcsec at an update, %g "
+           "elsewhere\n", d.size(), updates, maxAtUpdate, maxElsewhere);
+    if (d.size() != 1024 || updates < 19) {
+        printf("testNoStepAcrossSpmUpdate failed: not enough demands\n");
+        status = 1;
+    }
+    if (maxAtUpdate > 1e-3 || maxElsewhere > 1e-3) {
+        printf("testNoStepAcrossSpmUpdate failed: the demands step when the SPMs are updated\n");
+        status = 1;
+    }
+    return status;
+}
+
+int main() {
+    int status = 0;
+    status |= testConcurrentHandoff();
+    status |= testMediumUpdatesReachFastLoop();
+    status |= testNoStepAcrossSpmUpdate();
+    return status;
+}
@@ -0,0 +1,129 @@
+//
+// Tests of the weather sources and of applying the weather to the site, run in virtual time
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <TpkC.h>
+
+static const char *weatherFile = "/tmp/WeatherTests.txt";
+
+static void writeFile(const char *contents) {
+    FILE *f = fopen(weatherFile, "w");
+    fputs(contents, f);
+    fclose(f);
+}
+
+// The last valid values are kept while the file is missing or cannot be parsed
+static int testFile() {
+    int status = 0;
+    remove(weatherFile);
+    FileWeather source(weatherFile);
+    PkWeather w{};
+    if (source.read(59580.5, w)) {
+        printf("testFile failed: weather read from a missing file\n");
+        status = 1;
+    }
+    writeFile("5.5 615.2 0.25\n");
+    if (!source.read(59580.5, w) || w.temperature != 5.5 || w.pressure != 615.2 || w.humidity != 0.25) {
+        printf("testFile failed: read %f %f %f, expected 5.5 615.2 0.25\n", w.temperature, w.pressure, w.humidity);
+        status = 1;
+    }
+    writeFile("5.5 61520 0.25\n");
+    if (!source.read(59580.5, w) || w.pressure != 615.2) {
+        printf("testFile failed: implausible pressure %f not ignored\n", w.pressure);
+        status = 1;
+    }
+    remove(weatherFile);
+    if (!source.read(59580.5, w) || w.temperature != 5.5) {
+        printf("testFile failed: last weather not kept when the file was removed\n");
+        status = 1;
+    }
+    return status;
+}
+
+static int testChanged() {
+    PkWeather last = {2.0, 615.0, 0.2};
+    PkWeather same = {2.01, 615.05, 0.205};
+    PkWeather warmer = {2.1, 615.0, 0.2};
+    PkWeather higher = {2.0, 615.2, 0.2};
+    PkWeather wetter = {2.0, 615.0, 0.22};
+    if (WeatherSource::changed(same, last) || !WeatherSource::changed(warmer, last) ||
+        !WeatherSource::changed(higher, last) || !WeatherSource::changed(wetter, last)) {
+        printf("testChanged failed: wrong result for a change\n");
+        return 1;
+    }
+    return 0;
+}
+
+// The simulated weather is plausible, the same for the same time and changes slowly
+static int testSimulated() {
+    SimulatedWeather a, b;
+    int status = 0;
+    for (int i = 0; i < 24 * 60; i++) {
+        double tai = 59580.5 + i / (24.0 * 60.0);
+        PkWeather wa{}, wb{}, next{};
+        a.read(tai, wa);
+        b.read(tai, wb);
+        a.read(tai + 6.0 / 86400.0, next);
+        if (wa.temperature != wb.temperature || wa.pressure != wb.pressure || wa.humidity != wb.humidity ||
+            wa.temperature < -10.0 || wa.temperature > 10.0 || fabs(wa.pressure - 615.0) > 5.0 ||
+            wa.humidity < 0.0 || wa.humidity > 1.0 || fabs(next.temperature - wa.temperature) > 0.01) {
+            printf("testSimulated failed at %f: %f %f %f\n", tai, wa.temperature, wa.pressure, wa.humidity);
+            status = 1;
+            break;
+        }
+    }
+    return status;
+}
+
+// Weather set through the API reaches the site on the next slow loop cycle, and the predicted
+// trajectory follows it
+static int testManual() {
+    setenv("TPK_PREDICT", "samples", 1);
+    TpkC tpkc;
+    tpkc.init();
+    int status = 0;
+    PkWeather w{};
+    if (tpkc.weather(&w)) {
+        printf("testManual failed: weather before any was set\n");
+        status = 1;
+    }
+    if (tpkc.setWeather(5.0, 6150.0, 0.3) || !tpkc.setWeather(5.0, 615.0, 0.3)) {
+        printf("testManual failed: wrong result for setting the weather\n");
+        status = 1;
+    }
+    tpkc.newICRSTarget(185.0, 11.0);
+    tpkc.runFor(20.0);
+    if (!tpkc.weather(&w) || w.temperature != 5.0 || w.pressure != 615.0 || w.humidity != 0.3) {
+        printf("testManual failed: weather %f %f %f, expected 5 615 0.3\n", w.temperature, w.pressure, w.humidity);
+        status = 1;
+    }
+
+    // Applied on the slow loop cycle at 24 s, after which every tick is predicted again
+    tpkc.setWeather(-1.0, 612.0, 0.5);
+    tpkc.runFor(7.0);
+    TrajectoryStats before{}, after{};
+    tpkc.trajectoryStats(&before);
+    tpkc.runFor(3.0);
+    tpkc.trajectoryStats(&after);
+    if (!tpkc.weather(&w) || w.temperature != -1.0 || after.computed != before.computed ||
+        after.predicted <= before.predicted) {
+        printf("testManual failed: weather %f, %ld ticks computed after the change\n", w.temperature,
+               after.computed - before.computed);
+        status = 1;
+    }
+    tpkc.shutdown();
+    unsetenv("TPK_PREDICT");
+    return status;
+}
+
+int main() {
+    setenv("TPK_VIRTUAL_TIME", "1", 1);
+    int status = testFile();
+    status |= testChanged();
+    status |= testSimulated();
+    status |= testManual();
+    return status;
+}
@@ -0,0 +1,177 @@
+//
+// Replays record files written by the pointing kernel's recorder (TPK_RECORD_DIR): publishes the
+// recorded MCS, ECS and M3 demands to the CSW event service with the original timing, or faster, or
+// prints the records.
+//
+// Usage: PkReplay [-s speed] [-o] [-p prefix] [-l] file...
+//
+//   -s speed   replay speed: 1 (the default) for the original timing, 10 for 10 times faster, 0 for as
+//              fast as possible
+//   -o         publish the events with the original times (by default the time they are published)
+//   -p prefix  the source prefix of the events (default TCS.PointingKernelAssembly)
+//   -l         only print the records (as CSV), do not publish
+//
+// The files are replayed in the order given. Since they are named by the time they were started,
+// "PkReplay dir/pk-*.pkrec" replays a whole recording.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "BaseCap.h"
+#include "DemandPublisher.h"
+#include "Monotonic.h"
+#include "RecordReader.h"
+
+static const char *defaultPrefix = "TCS.PointingKernelAssembly";
+
+// The size of the publisher's queue (ticks)
+static const long queueSize = 4096;
+
+#define rad2Deg(d) ((d) * 180.0 / M_PI)
+
+static void usage() {
+    printf("Usage: PkReplay [-s speed] [-o] [-p prefix] [-l] file...\n");
+}
+
+// Sleeps until the given CLOCK_MONOTONIC time in ns
+static void sleepUntil(long long ns) {
+    struct timespec t{};
+    t.tv_sec = static_cast<time_t>(ns / 1000000000LL);
+    t.tv_nsec = static_cast<long>(ns % 1000000000LL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr) == EINTR) {}
+}
+
+// Waits while the publisher's queue is full, so that a replay that gets ahead of the event service
+// (as with -s 0) waits for it instead of dropping demands
+static void waitForRoom(const DemandPublisher &demandPublisher) {
+    PublishStats stats{};
+    for (demandPublisher.stats(&stats); stats.depth >= queueSize; demandPublisher.stats(&stats)) {
+        sleepUntil(monotonicNs() + 1000000LL);
+    }
+}
+
+static void printHeader() {
+    printf("tai,utcNs,siderealTime,mountRoll,mountPitch,enclosureRoll,enclosurePitch,m3Azimuth,m3Elevation,"
+           "ra,dec,targetId,targetRefSys,targetA,targetB,offsetId,offsetRefSys,offsetA,offsetB\n");
+}
+
+static void printRecord(const PkTickRecord &r) {
+    printf("%.10f,%lld,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%llu,%d,%.9f,%.9f,%llu,%d,%.9f,%.9f\n",
+           r.tai, static_cast<long long>(r.utcNs), r.siderealTime, r.mountRoll, r.mountPitch, r.enclosureRoll,
+           r.enclosurePitch, r.m3Azimuth, r.m3Elevation, r.ra, r.dec, static_cast<unsigned long long>(r.targetId),
+           r.targetRefSys, r.targetA, r.targetB, static_cast<unsigned long long>(r.offsetId), r.offsetRefSys,
+           r.offsetA, r.offsetB);
+}
+
+// The demands published by the pointing kernel for a tick, computed from its record as in the fast
+// loop. ecs is set on every 5th tick (the enclosure demands are published at 20Hz).
+static DemandSample demandsFor(const PkTickRecord &r, bool ecs, bool originalTime) {
+    DemandSample s{};
+    if (originalTime) {
+        s.time.seconds = r.utcNs / 1000000000LL;
+        s.time.nanos = r.utcNs % 1000000000LL;
+    } else {
+        s.time = cswUtcTime();
+    }
+    s.queuedNs = monotonicNs();
+    s.mcsAz = 180.0 - rad2Deg(r.mountRoll);
+    s.mcsEl = rad2Deg(r.mountPitch);
+    s.ra = r.ra;
+    s.dec = r.dec;
+    s.siderealTime = r.siderealTime;
+    s.m3Rotation = rad2Deg(r.m3Azimuth);
+    s.m3Tilt = 90.0 - rad2Deg(r.m3Elevation);
+    if (ecs) {
+        double base, cap;
+        BaseCap::calculate(180.0 - rad2Deg(r.enclosureRoll), rad2Deg(r.enclosurePitch), base, cap);
+        if (!std::isnan(base) && !std::isnan(cap)) {
+            s.ecs = true;
+            s.base = base;
+            s.cap = cap;
+        }
+    }
+    return s;
+}
+
+int main(int argc, char **argv) {
+    double speed = 1.0;
+    bool originalTime = false, list = false;
+    const char *prefix = defaultPrefix;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:op:lh")) != -1) {
+        switch (opt) {
+            case 's':
+                speed = strtod(optarg, nullptr);
+                if (speed < 0.0) speed = 0.0;
+                break;
+            case 'o':
+                originalTime = true;
+                break;
+            case 'p':
+                prefix = optarg;
+                break;
+            case 'l':
+                list = true;
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+
+    CswEventServiceContext publisher = nullptr;
+    DemandPublisher *demandPublisher = nullptr;
+    if (list) {
+        printHeader();
+    } else {
+        publisher = cswEventPublisherInit();
+        // Nothing is dropped, since the replay waits for room in the queue (see waitForRoom())
+        demandPublisher = new DemandPublisher(publisher, prefix, PUBLISH_DROP_OLDEST, queueSize);
+        demandPublisher->start();
+    }
+
+    // Replay time is measured from the first record of the first file
+    long long startNs = monotonicNs(), firstRecordNs = 0;
+    long ticks = 0;
+    int status = 0;
+    RecordReader reader;
+    for (int i = optind; i < argc; i++) {
+        if (!reader.open(argv[i])) {
+            status = 1;
+            continue;
+        }
+        if (!list) printf("%s: %zu ticks\n", argv[i], reader.size());
+        for (const PkTickRecord &r : reader) {
+            if (list) {
+                printRecord(r);
+                continue;
+            }
+            if (ticks == 0) firstRecordNs = r.monotonicNs;
+            if (speed > 0.0) {
+                sleepUntil(startNs + static_cast<long long>((r.monotonicNs - firstRecordNs) / speed));
+            }
+            waitForRoom(*demandPublisher);
+            demandPublisher->post(demandsFor(r, ticks % 5 == 0, originalTime));
+            ticks++;
+        }
+    }
+
+    if (demandPublisher) {
+        demandPublisher->stop();
+        PublishStats stats{};
+        demandPublisher->stats(&stats);
+        printf("Replayed %ld ticks in %.1f s: published %ld events, %ld ticks dropped\n", ticks,
+               (monotonicNs() - startNs) / 1e9, stats.events, stats.dropped);
+        delete demandPublisher;
+        cswEventPublisherClose(publisher);
+    }
+    return status;
+}